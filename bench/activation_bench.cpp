@@ -0,0 +1,304 @@
+// Session activation: acquiring doesn't activate anything, Start() returns right away while a slow activation runs
+// on the session's own thread, and the state goes Idle -> Activating -> Running. A target that fails a couple of times
+// is retried, one that keeps failing ends up Failed with its error, as does one that fails to start before it's Running,
+// and a capture error while running fails the session until the next Start() brings it back. Also prints the client
+// buffer a few latencies get.
+// scons bench && ./bench/bin/activation_bench [activation ms]
+
+#include "capture_session.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using State = CaptureSession::State;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+constexpr std::chrono::microseconds LATENCY { 30000 };
+const CaptureSessionKey KEY { 1, LoopbackMode::IncludeProcessTree };
+
+const char* StateName(State state) {
+	switch(state) {
+	case State::Idle: return "idle";
+	case State::Activating: return "activating";
+	case State::Running: return "running";
+	case State::Failed: return "failed";
+	case State::Retrying: return "retrying";
+	}
+	return "?";
+}
+
+// Everything a watcher saw, in order
+class Transitions {
+public:
+	explicit Transitions(CaptureSession& session) :
+		session { session },
+		from { session.GetState() },
+		id { session.WatchState([this](State state) {
+			std::lock_guard<std::mutex> lock { mutex };
+			seen.push_back(state);
+		}) }
+	{ }
+
+	~Transitions() {
+		session.CancelWatch(id);
+	}
+
+	std::vector<State> Seen() const {
+		std::lock_guard<std::mutex> lock { mutex };
+		return seen;
+	}
+
+	void Print() const {
+		printf("  %s", StateName(from));
+		for(State state : Seen()) printf(" -> %s", StateName(state));
+		printf("\n");
+	}
+
+private:
+	CaptureSession& session;
+	const State from;
+	mutable std::mutex mutex;
+	std::vector<State> seen;
+	CaptureSession::WatchId id;
+};
+
+bool Lazy(uint32_t activationMicroseconds) {
+	CapturePacing pacing;
+	pacing.activationMicroseconds = activationMicroseconds;
+	std::atomic<uint32_t> activations { 0 };
+	std::atomic<int64_t> clientBuffer { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds buffer, CaptureReceiver* receiver) {
+		activations++;
+		clientBuffer = buffer.count();
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, pacing, 440.0);
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	auto start = Clock::now();
+	std::shared_ptr<CaptureSession> session = registry.Acquire(KEY, LATENCY);
+	const double acquired = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	const uint32_t beforeStart = activations;
+	const bool lazy = beforeStart == 0 && session->GetState() == State::Idle;
+
+	Transitions transitions { *session };
+	start = Clock::now();
+	session->Start();
+	const double started = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	const State right = session->GetState();
+	const State settled = session->WaitUntilSettled(std::chrono::seconds(5));
+	const double running = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	// a second start while it's running does nothing
+	session->Start();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	const uint64_t frames = session->Pipeline().Stats().Read().frames;
+
+	const std::vector<State> expected { State::Activating, State::Running };
+	const bool ok = lazy && right == State::Activating && settled == State::Running && transitions.Seen() == expected &&
+		activations == 1 && started < activationMicroseconds / 4000.0 + 1.0 && frames > 0 &&
+		clientBuffer == CaptureSessionRegistry::ClientBufferFor(LATENCY).count();
+
+	printf("lazy activation, %.0f ms to activate:\n", activationMicroseconds / 1000.0);
+	printf("  Acquire %.2f ms (%u activations), Start returned in %.2f ms, running after %.1f ms, client buffer %.0f ms\n",
+		acquired, beforeStart, started, running, clientBuffer / 1000.0);
+	transitions.Print();
+	printf("  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// fails failures times before it comes up
+bool Retried(uint32_t failures) {
+	std::atomic<uint32_t> attempts { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) {
+		if(attempts++ < failures) throw std::runtime_error("target has no audio session yet");
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, CapturePacing { }, 440.0);
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(KEY, LATENCY);
+	Transitions transitions { *session };
+	const auto start = Clock::now();
+	session->Start();
+	const State settled = session->WaitUntilSettled(std::chrono::seconds(10));
+	const double took = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	const uint32_t maxAttempts = CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS;
+	const bool comesUp = failures < maxAttempts;
+	std::vector<State> expected;
+	for(uint32_t attempt = 0; attempt < std::min(failures + 1, maxAttempts); attempt++) {
+		if(attempt != 0) expected.push_back(State::Retrying);
+		expected.push_back(State::Activating);
+	}
+	expected.push_back(comesUp ? State::Running : State::Failed);
+
+	bool ok = settled == expected.back() && transitions.Seen() == expected && attempts == std::min(failures + 1, maxAttempts);
+	if(!comesUp) ok = ok && session->LastError() == "target has no audio session yet" && session->Source() == nullptr;
+
+	printf("%u failed activations: %s after %u attempts in %.0f ms%s%s\n", failures, StateName(settled), attempts.load(), took,
+		comesUp ? "" : ", error: ", comesUp ? "" : session->LastError().c_str());
+	transitions.Print();
+	printf("  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// A source whose Start() reports an error right away, before the session has it Running, like WASAPI's OnStartCapture
+// beating the session's thread to it
+class FailingStart : public CaptureSource {
+public:
+	explicit FailingStart(CaptureReceiver* receiver) :
+		receiver { receiver }
+	{ }
+
+	void Start() override { receiver->OnCaptureError(0x88890004); }
+	void Stop() override { }
+	CaptureFormat GetFormat() const override { return FORMAT; }
+
+private:
+	CaptureReceiver* receiver;
+};
+
+// a start failure is a failed attempt rather than a session that's Running without capturing
+bool StartFailed(uint32_t failures) {
+	std::atomic<uint32_t> attempts { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) -> std::unique_ptr<CaptureSource> {
+		if(attempts++ < failures) return std::make_unique<FailingStart>(receiver);
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, CapturePacing { }, 440.0);
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(KEY, LATENCY);
+	session->Start();
+	const State settled = session->WaitUntilSettled(std::chrono::seconds(10));
+
+	const bool comesUp = failures < CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS;
+	bool ok = settled == (comesUp ? State::Running : State::Failed) &&
+		attempts == std::min(failures + 1, CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS);
+	if(comesUp) {
+		const uint64_t before = session->Pipeline().Stats().Read().frames;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		ok = ok && session->Pipeline().Stats().Read().frames > before;
+	} else {
+		ok = ok && session->Source() == nullptr && session->LastError() == "capture stopped with error 0x88890004";
+	}
+
+	printf("%u failed starts: %s after %u attempts  %s\n", failures, StateName(settled), attempts.load(), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// the capture stops with an error while running, starting again activates a new source
+bool Restarted() {
+	std::atomic<uint32_t> activations { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) {
+		activations++;
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, CapturePacing { }, 440.0);
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(KEY, LATENCY);
+	session->Start();
+	bool ok = session->WaitUntilSettled(std::chrono::seconds(5)) == State::Running;
+
+	Transitions transitions { *session };
+	// what a source reports when its device went away
+	session->Pipeline().OnCaptureError(0x88890004);
+	ok = ok && session->GetState() == State::Failed && !session->LastError().empty();
+	const std::string error = session->LastError();
+
+	session->Start();
+	ok = session->WaitUntilSettled(std::chrono::seconds(5)) == State::Running && ok;
+	const uint64_t before = session->Pipeline().Stats().Read().frames;
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	const std::vector<State> expected { State::Failed, State::Activating, State::Running };
+	ok = ok && transitions.Seen() == expected && activations == 2 && session->Pipeline().Stats().Read().frames > before;
+
+	printf("capture error while running (%s), restarted:\n", error.c_str());
+	transitions.Print();
+	printf("  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// A source that counts itself gone
+class CountedCapture : public SyntheticCapture {
+public:
+	CountedCapture(CaptureReceiver* receiver, const CapturePacing& pacing, std::atomic<uint32_t>& destroyed) :
+		SyntheticCapture { receiver, FORMAT, pacing, 440.0 },
+		destroyed { destroyed }
+	{ }
+
+	~CountedCapture() { destroyed++; }
+
+private:
+	std::atomic<uint32_t>& destroyed;
+};
+
+// dropping the last user mid activation with no grace period returns right away, the reaper waits for the activation
+// and tears it down
+bool ReleasedWhileActivating() {
+	constexpr uint32_t ACTIVATION_MILLISECONDS = 200;
+	CapturePacing pacing;
+	pacing.activationMicroseconds = ACTIVATION_MILLISECONDS * 1000;
+	std::atomic<uint32_t> destroyed { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) {
+		return std::make_unique<CountedCapture>(receiver, pacing, destroyed);
+	}, SAMPLE_RATE, RING_FRAMES };
+	registry.SetGracePeriod(CaptureSessionRegistry::Clock::duration::zero());
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(KEY, LATENCY);
+	session->Start();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	const bool activating = session->GetState() == State::Activating;
+	const auto start = Clock::now();
+	session.reset();
+	const double took = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	const bool gone = registry.SessionCount() == 0;
+
+	// the activation still finishes and its source goes with the session
+	const auto deadline = Clock::now() + std::chrono::seconds(5);
+	while(destroyed == 0 && Clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	const double tornDown = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	const bool ok = activating && gone && took < ACTIVATION_MILLISECONDS / 4 && destroyed == 1;
+	printf("released while activating, no grace period: returned after %.2f ms, torn down after %.0f ms  %s\n", took, tornDown,
+		ok ? "ok" : "FAIL");
+	return ok;
+}
+
+bool ClientBuffers() {
+	bool ok = true;
+	printf("client buffer for a target latency:\n ");
+	for(int64_t milliseconds : { 5, 15, 30, 100, 500 }) {
+		const std::chrono::microseconds buffer = CaptureSessionRegistry::ClientBufferFor(std::chrono::milliseconds(milliseconds));
+		ok = ok && buffer >= CaptureSessionRegistry::MIN_CLIENT_BUFFER && buffer >= std::chrono::milliseconds(milliseconds * 2);
+		printf(" %lld ms -> %.0f ms", (long long)milliseconds, buffer.count() / 1000.0);
+	}
+	printf("  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const uint32_t activationMilliseconds = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 150;
+
+	bool ok = Lazy(activationMilliseconds * 1000);
+	ok = Retried(2) && ok;
+	ok = Retried(CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS) && ok;
+	ok = StartFailed(1) && ok;
+	ok = StartFailed(CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS) && ok;
+	ok = Restarted() && ok;
+	ok = ReleasedWhileActivating() && ok;
+	ok = ClientBuffers() && ok;
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
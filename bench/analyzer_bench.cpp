@@ -0,0 +1,199 @@
+// CaptureAnalyzer checks and costs: the FFT against a plain DFT, meters and spectrum of a known sine at every SIMD
+// level, the triple buffer handing results across threads without ever tearing one, and what it all costs the
+// capture thread per second of audio.
+// scons bench && ./bench/bin/analyzer_bench [seconds]
+
+#include "capture_analyzer.hpp"
+#include "fft.hpp"
+#include "triple_buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double PI = 3.14159265358979323846;
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t PACKET_FRAMES = 480;
+
+template<typename Function>
+double MeasureMilliseconds(Function&& function) {
+	const auto start = Clock::now();
+	function();
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+bool CheckFft() {
+	bool ok = true;
+	for(size_t size = 4; size <= 4096; size <<= 1) {
+		std::vector<float> input(size);
+		srand(static_cast<unsigned>(size));
+		for(float& sample : input) sample = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+
+		RealFft fft { size };
+		std::vector<float> output(size + 2);
+		fft.Forward(input.data(), output.data());
+
+		double worst = 0.0;
+		for(size_t k = 0; k <= size / 2; k++) {
+			double re = 0.0, im = 0.0;
+			for(size_t n = 0; n < size; n++) {
+				re += input[n] * std::cos(-2.0 * PI * k * n / size);
+				im += input[n] * std::sin(-2.0 * PI * k * n / size);
+			}
+			worst = std::max(worst, std::hypot(output[2 * k] - re, output[2 * k + 1] - im));
+		}
+
+		// float error grows with log2(size) stages over a sum of size terms
+		const bool passed = worst < 1e-5 * size;
+		ok = ok && passed;
+		printf("  fft %5zu  max error vs DFT %.2e  %s\n", size, worst, passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// left and right at different levels, the mid channel is their average
+std::vector<StereoFrame> MakeSine(double frequency, float leftAmplitude, float rightAmplitude, size_t frames) {
+	std::vector<StereoFrame> signal(frames);
+	for(size_t i = 0; i < frames; i++) {
+		const float value = static_cast<float>(std::sin(2.0 * PI * frequency * i / SAMPLE_RATE));
+		signal[i] = StereoFrame { leftAmplitude * value, rightAmplitude * value };
+	}
+	return signal;
+}
+
+void Feed(CaptureAnalyzer& analyzer, const std::vector<StereoFrame>& signal) {
+	for(size_t offset = 0; offset < signal.size(); offset += PACKET_FRAMES) {
+		const size_t count = std::min(PACKET_FRAMES, signal.size() - offset);
+		analyzer.OnFrames(reinterpret_cast<const uint8_t*>(signal.data() + offset), count);
+	}
+}
+
+bool CheckAnalyzer(SimdLevel level) {
+	const size_t fftSize = 2048;
+	const size_t bin = 64;
+	const double frequency = bin * double(SAMPLE_RATE) / fftSize;
+
+	CaptureAnalyzer analyzer { SAMPLE_RATE, fftSize, 512, level };
+	Feed(analyzer, MakeSine(frequency, 0.8f, 0.4f, SAMPLE_RATE));
+	const AnalysisFrame& result = analyzer.Latest();
+
+	const float expectedRms[2] = { 0.8f / std::sqrt(2.0f), 0.4f / std::sqrt(2.0f) };
+	const float expectedPeak[2] = { 0.8f, 0.4f };
+	bool ok = result.sequence > 0;
+	for(int channel = 0; channel < 2; channel++) {
+		ok = ok && std::fabs(result.rms[channel] - expectedRms[channel]) < 1e-3f;
+		ok = ok && std::fabs(result.peak[channel] - expectedPeak[channel]) < 1e-3f;
+	}
+
+	// everything but the bin and its two Hann neighbours should be far down
+	const float magnitude = result.spectrum[bin];
+	float leakage = 0.0f;
+	for(size_t k = 0; k < result.spectrum.size(); k++) {
+		if(k + 1 < bin || k > bin + 1) leakage = std::max(leakage, result.spectrum[k]);
+	}
+	ok = ok && std::fabs(magnitude - 0.6f) < 1e-3f && leakage < 1e-4f;
+
+	printf("  %-6s rms %.4f %.4f  peak %.4f %.4f  bin %zu %.4f (0.6)  leakage %.1e  %s\n", SimdLevelName(level),
+		result.rms[0], result.rms[1], result.peak[0], result.peak[1], bin, magnitude, leakage, ok ? "ok" : "FAIL");
+
+	// silence closes the meters at zero and empties the spectrum once a whole window of it has gone by
+	analyzer.OnFrames(nullptr, fftSize + analyzer.Hop());
+	const AnalysisFrame& silent = analyzer.Latest();
+	const float loudest = *std::max_element(silent.spectrum.begin(), silent.spectrum.end());
+	const bool silentOk = silent.rms[0] == 0.0f && silent.peak[1] == 0.0f && loudest == 0.0f;
+	if(!silentOk) printf("  %-6s silence doesn't read as silence  FAIL\n", SimdLevelName(level));
+	return ok && silentOk;
+}
+
+// the writer fills every element with the sequence number, a torn read shows up as a mix of two
+bool CheckTripleBuffer(double seconds) {
+	TripleBuffer<std::vector<uint64_t>> buffer { size_t(1024) };
+	std::atomic<bool> done { false };
+	uint64_t published = 0;
+
+	std::thread writer([&] {
+		while(!done.load(std::memory_order_relaxed)) {
+			std::vector<uint64_t>& slot = buffer.Back();
+			published++;
+			std::fill(slot.begin(), slot.end(), published);
+			buffer.Publish();
+		}
+	});
+
+	uint64_t reads = 0, updates = 0, torn = 0, backwards = 0, last = 0;
+	const auto end = Clock::now() + std::chrono::duration<double>(seconds);
+	while(Clock::now() < end) {
+		if(buffer.Update()) updates++;
+		const std::vector<uint64_t>& front = buffer.Front();
+		const uint64_t value = front.front();
+		if(std::any_of(front.begin(), front.end(), [&](uint64_t element) { return element != value; })) torn++;
+		if(value < last) backwards++;
+		last = value;
+		reads++;
+	}
+	done = true;
+	writer.join();
+
+	const bool ok = torn == 0 && backwards == 0 && updates > 0;
+	printf("  triple buffer  %llu published, %llu reads, %llu updates, %llu torn, %llu out of order  %s\n",
+		(unsigned long long)published, (unsigned long long)reads, (unsigned long long)updates,
+		(unsigned long long)torn, (unsigned long long)backwards, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+void MeasureCosts(double seconds) {
+	const std::vector<StereoFrame> signal = MakeSine(1000.0, 0.5f, 0.5f, size_t(SAMPLE_RATE * seconds));
+
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) != level) continue;
+
+		// a hop longer than the signal, so this is the meters and the history copy alone
+		CaptureAnalyzer meters { SAMPLE_RATE, 64, signal.size() + 1, level };
+		const double meterMilliseconds = MeasureMilliseconds([&] { Feed(meters, signal); });
+
+		CaptureAnalyzer analyzer { SAMPLE_RATE, 2048, 512, level };
+		const double milliseconds = MeasureMilliseconds([&] { Feed(analyzer, signal); });
+
+		printf("  %-6s meters %.3f ms/s, analyzer (2048 / 512) %.3f ms/s = %.3f%% of real time\n",
+			SimdLevelName(level), meterMilliseconds / seconds, milliseconds / seconds, milliseconds / seconds / 10.0);
+	}
+
+	for(size_t size = CaptureAnalyzer::MIN_FFT_SIZE; size <= CaptureAnalyzer::MAX_FFT_SIZE; size <<= 2) {
+		RealFft fft { size };
+		std::vector<float> input(size), output(size + 2);
+		for(size_t i = 0; i < size; i++) input[i] = signal[i % signal.size()].left;
+
+		const int runs = int(std::max<size_t>(20000000 / size, 10));
+		const double milliseconds = MeasureMilliseconds([&] {
+			for(int run = 0; run < runs; run++) fft.Forward(input.data(), output.data());
+		});
+		printf("  fft %5zu  %8.2f us\n", size, milliseconds * 1000.0 / runs);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 20.0;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	bool ok = CheckFft();
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) ok = CheckAnalyzer(level) && ok;
+	}
+	ok = CheckTripleBuffer(1.0) && ok;
+	MeasureCosts(seconds);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
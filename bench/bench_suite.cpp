@@ -0,0 +1,380 @@
+// Regression suite for the hot paths: short, repeatable measurements of everything the capture and mix threads run
+// per frame, written out as JSON so `scons bench-check` can hold them against bench/baseline.json.
+// Micro benchmarks keep the best of REPEATS runs, which is what moves when the code changes rather than the machine.
+// Every result is a cost (lower is better) with a tolerance of its own, scheduling dependent ones get more slack.
+// scons bench && ./bench/bin/bench_suite [--json results.json] [--filter name_prefix]
+
+#include "broadcast_buffer.hpp"
+#include "capture_analyzer.hpp"
+#include "capture_history.hpp"
+#include "capture_mix.hpp"
+#include "capture_pipeline.hpp"
+#include "channel_mix.hpp"
+#include "insert_chain.hpp"
+#include "resampler.hpp"
+#include "sample_convert.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int REPEATS = 9;
+// relative slack before a result counts as a regression
+constexpr double MICRO_TOLERANCE = 0.3;
+constexpr double SCHEDULED_TOLERANCE = 1.0;
+
+struct Result {
+	std::string name;
+	double value;
+	const char* unit;
+	double tolerance;
+};
+
+class Suite {
+public:
+	explicit Suite(const char* filter) : filter { filter }, prefix { filter != nullptr ? filter : "" } { }
+
+	// the filter is a name prefix, a group runs if any of its names could match
+	bool Selected(const std::string& group) const {
+		return filter == nullptr || group.compare(0, prefix.size(), prefix) == 0 || prefix.compare(0, group.size(), group) == 0;
+	}
+
+	void Add(const std::string& name, double value, const char* unit, double tolerance = MICRO_TOLERANCE) {
+		if(filter != nullptr && name.compare(0, prefix.size(), prefix) != 0) return;
+		printf("  %-40s %10.3f %s\n", name.c_str(), value, unit);
+		results.push_back(Result { name, value, unit, tolerance });
+	}
+
+	bool WriteJson(const char* path) const {
+		FILE* file = fopen(path, "w");
+		if(file == nullptr) return false;
+		fprintf(file, "{\n  \"simd\": \"%s\",\n  \"results\": {\n", SimdLevelName(DetectSimdLevel()));
+		for(size_t i = 0; i < results.size(); i++) {
+			const Result& result = results[i];
+			fprintf(file, "    \"%s\": { \"value\": %.6g, \"unit\": \"%s\", \"tolerance\": %.2f }%s\n", result.name.c_str(),
+				result.value, result.unit, result.tolerance, i + 1 < results.size() ? "," : "");
+		}
+		fprintf(file, "  }\n}\n");
+		return fclose(file) == 0;
+	}
+
+private:
+	const char* filter;
+	const std::string prefix;
+	std::vector<Result> results;
+};
+
+// best of REPEATS, in nanoseconds per unit of work the function reports back
+template<typename Function>
+double BestNanosecondsPer(Function&& function) {
+	double best = 0.0;
+	for(int run = 0; run < REPEATS; run++) {
+		const auto start = Clock::now();
+		const double units = function();
+		const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / units;
+		if(run == 0 || nanoseconds < best) best = nanoseconds;
+	}
+	return best;
+}
+
+std::vector<StereoFrame> MakeSine(uint32_t rate, size_t frames) {
+	std::vector<StereoFrame> signal(frames);
+	for(size_t i = 0; i < frames; i++) {
+		const float value = 0.5f * static_cast<float>(std::sin(2.0 * 3.14159265358979323846 * 1000.0 * i / rate));
+		signal[i] = StereoFrame { value, -value };
+	}
+	return signal;
+}
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+// write a packet, read it back, at the packet sizes capture clients actually deliver
+void RingBuffer(Suite& suite) {
+	constexpr size_t TOTAL_FRAMES = 1 << 22;
+	for(size_t packet : { size_t(32), size_t(480), size_t(1024), size_t(4096) }) {
+		BroadcastBuffer<StereoFrame> ring { 16384 };
+		BroadcastBuffer<StereoFrame>::Reader reader { ring };
+		const std::vector<StereoFrame> input = MakeSine(48000, packet);
+		std::vector<StereoFrame> output(packet);
+
+		suite.Add("ring.write_read." + std::to_string(packet), BestNanosecondsPer([&] {
+			for(size_t done = 0; done < TOTAL_FRAMES; done += packet) {
+				ring.Write(input.data(), packet);
+				reader.Read(output.data(), packet);
+			}
+			return double(TOTAL_FRAMES);
+		}), "ns/frame");
+	}
+}
+
+// per output frame, one second of input per run
+void Resampler(Suite& suite) {
+	const std::pair<uint32_t, uint32_t> rates[] = { { 44100, 48000 }, { 48000, 44100 }, { 96000, 48000 }, { 44056, 48000 } };
+	for(const auto& [input, output] : rates) {
+		const std::vector<StereoFrame> signal = MakeSine(input, input);
+		std::vector<StereoFrame> produced(PolyphaseResampler::CHUNK_FRAMES * 4);
+
+		for(SimdLevel level : AvailableLevels()) {
+			PolyphaseResampler resampler { input, output, level };
+			suite.Add("resampler." + std::to_string(input) + "_" + std::to_string(output) + "." + SimdLevelName(level), BestNanosecondsPer([&] {
+				size_t outputs = 0;
+				for(size_t offset = 0; offset < signal.size(); ) {
+					offset += resampler.Push(signal.data() + offset, std::min<size_t>(480, signal.size() - offset));
+					outputs += resampler.Pull(produced.data(), produced.size());
+				}
+				return double(std::max<size_t>(outputs, 1));
+			}), "ns/frame");
+		}
+	}
+}
+
+// per sample, the integer encodings capture clients negotiate, in packet sized calls
+void Convert(Suite& suite) {
+	constexpr size_t PACKET_SAMPLES = 480 * 2;
+	constexpr size_t PACKETS = 1000;
+	for(SampleEncoding encoding : { SampleEncoding::Int16, SampleEncoding::Int24, SampleEncoding::Int32 }) {
+		std::vector<uint8_t> input(PACKET_SAMPLES * BytesPerSample(encoding));
+		for(size_t i = 0; i < input.size(); i++) input[i] = static_cast<uint8_t>(i * 97);
+		std::vector<float> output(PACKET_SAMPLES);
+
+		for(SimdLevel level : AvailableLevels()) {
+			const SampleConverter convert = SelectConverter(encoding, level);
+			suite.Add(std::string("convert.") + SampleEncodingName(encoding) + "." + SimdLevelName(level), BestNanosecondsPer([&] {
+				for(size_t i = 0; i < PACKETS; i++) convert(input.data(), output.data(), PACKET_SAMPLES);
+				return double(PACKETS * PACKET_SAMPLES);
+			}), "ns/sample");
+		}
+	}
+}
+
+// per frame, 5.1 and 7.1 down to stereo with their ITU matrices
+void Downmix(Suite& suite) {
+	constexpr size_t PACKET_FRAMES = 480;
+	constexpr size_t PACKETS = 1000;
+	for(uint16_t channels : { uint16_t(6), uint16_t(8) }) {
+		std::vector<float> input(PACKET_FRAMES * channels);
+		for(size_t i = 0; i < input.size(); i++) input[i] = static_cast<float>(std::sin(i * 0.01));
+		std::vector<StereoFrame> output(PACKET_FRAMES);
+		const ChannelMatrix matrix = DownmixMatrix(channels, 0);
+
+		for(SimdLevel level : AvailableLevels()) {
+			const ChannelMixer mix = SelectChannelMixer(channels, level);
+			suite.Add("downmix." + std::to_string(channels) + "ch." + SimdLevelName(level), BestNanosecondsPer([&] {
+				for(size_t i = 0; i < PACKETS; i++) mix(input.data(), output.data(), PACKET_FRAMES, matrix);
+				return double(PACKETS * PACKET_FRAMES);
+			}), "ns/frame");
+		}
+	}
+}
+
+// per mixed frame, four captures of a 10 ms packet each summed into one ring, delivering them included
+void MultiMix(Suite& suite) {
+	constexpr uint32_t PACKET_FRAMES = 480;
+	constexpr uint64_t PACKETS = 500;
+	constexpr uint32_t SOURCES = 4;
+	const std::vector<StereoFrame> packet = MakeSine(48000, PACKET_FRAMES);
+	const CaptureFormat format { 48000, 2, 32, SampleType::Float };
+
+	// never started, the sessions only lend their pipelines
+	CaptureSessionRegistry registry { nullptr, 48000, 16384 };
+	registry.SetGracePeriod(CaptureSessionRegistry::Clock::duration::zero());
+	for(SimdLevel level : AvailableLevels()) {
+		CaptureMix mix { 48000, 16384, level };
+		std::vector<std::shared_ptr<CaptureSession>> sessions;
+		for(uint32_t i = 0; i < SOURCES; i++) {
+			sessions.push_back(registry.Acquire(CaptureSessionKey { i, LoopbackMode::IncludeProcessTree }, std::chrono::milliseconds(30)));
+			sessions.back()->Pipeline().Configure(format, 48000);
+			mix.AddSource(sessions.back(), 0.5f);
+		}
+		uint64_t position = 0;
+
+		suite.Add(std::string("multimix.4src.") + SimdLevelName(level), BestNanosecondsPer([&] {
+			size_t mixed = 0;
+			for(uint64_t i = 0; i < PACKETS; i++) {
+				for(const std::shared_ptr<CaptureSession>& session : sessions) {
+					CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), PACKET_FRAMES };
+					captured.position = position;
+					captured.timestamp = position * 10000000 / 48000 + 10000000;
+					captured.timed = true;
+					session->Pipeline().OnPacket(captured);
+				}
+				position += PACKET_FRAMES;
+				mixed += mix.Process(position * 10000000 / 48000 + 10000000);
+			}
+			return double(std::max<size_t>(mixed, 1));
+		}), "ns/frame");
+	}
+}
+
+// OnPacket with nothing attached: what the capture thread pays per frame between the source and the ring
+void CaptureThread(Suite& suite) {
+	constexpr uint32_t PACKET_FRAMES = 480;
+	constexpr uint64_t PACKETS = 2000;
+	for(uint32_t sourceRate : { 48000u, 44100u }) {
+		CapturePipeline pipeline { 16384 };
+		pipeline.Configure(CaptureFormat { sourceRate, 2, 32, SampleType::Float }, 48000);
+		const std::vector<StereoFrame> packet = MakeSine(sourceRate, PACKET_FRAMES);
+		uint64_t position = 0;
+
+		suite.Add(std::string("pipeline.on_packet.") + (sourceRate == 48000 ? "direct" : "resampled"), BestNanosecondsPer([&] {
+			for(uint64_t i = 0; i < PACKETS; i++) {
+				CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), PACKET_FRAMES };
+				captured.position = position;
+				captured.timed = true;
+				pipeline.OnPacket(captured);
+				position += PACKET_FRAMES;
+			}
+			return double(PACKETS * PACKET_FRAMES);
+		}), "ns/frame");
+	}
+}
+
+void Analyzer(Suite& suite) {
+	const std::vector<StereoFrame> signal = MakeSine(48000, 48000);
+	CaptureAnalyzer analyzer { 48000, 2048, 512 };
+	suite.Add("analyzer.2048_512", BestNanosecondsPer([&] {
+		for(size_t offset = 0; offset < signal.size(); offset += 480) {
+			analyzer.OnFrames(reinterpret_cast<const uint8_t*>(signal.data() + offset), 480);
+		}
+		return double(signal.size());
+	}), "ns/frame");
+}
+
+// every insert type on its own, then all of them in a row, in 480 frame packets like the capture thread runs them
+void Inserts(Suite& suite) {
+	constexpr size_t PACKET_FRAMES = 480;
+	const std::vector<StereoFrame> signal = MakeSine(48000, 48000);
+	std::vector<StereoFrame> frames(signal.size());
+	for(SimdLevel level : AvailableLevels()) {
+		for(size_t type = 0; type <= INSERT_TYPES; type++) {
+			InsertChain chain { level };
+			if(type < INSERT_TYPES) {
+				chain.Add(static_cast<InsertType>(type), 0);
+			} else {
+				for(size_t each = 0; each < INSERT_TYPES; each++) chain.Add(static_cast<InsertType>(each), each);
+			}
+			// at 0 dB the gain leaves the audio alone
+			chain.SetParameter(chain.Order().front(), 0, -6.0f);
+			const std::string name = type < INSERT_TYPES ? InsertTypeName(static_cast<InsertType>(type)) : "chain";
+
+			suite.Add("inserts." + name + "." + SimdLevelName(level), BestNanosecondsPer([&] {
+				// fresh audio every run, so the gains don't settle on something the kernels skip
+				frames = signal;
+				for(size_t offset = 0; offset < frames.size(); offset += PACKET_FRAMES) {
+					chain.Process(frames.data() + offset, PACKET_FRAMES, 48000);
+				}
+				return double(frames.size());
+			}), "ns/frame");
+		}
+	}
+}
+
+// Paced capture thread and a mixer pulling 512 frame blocks, like pipeline_bench: how old the audio each mix starts
+// with is, packet timestamp to the moment the mixer reads it. Depends on scheduling, so it gets the wide tolerance.
+void History(Suite& suite) {
+	constexpr size_t PACKET_FRAMES = 480;
+	const std::vector<StereoFrame> signal = MakeSine(48000, 48000 * 10);
+	std::vector<StereoFrame> frames(CaptureHistory::BLOCK_FRAMES);
+	for(bool compress : { false, true }) {
+		CaptureHistory history { 48000, 10.0, compress };
+		uint64_t position = 0;
+		const std::string mode = compress ? "compressed" : "raw";
+
+		suite.Add("history.write." + mode, BestNanosecondsPer([&] {
+			for(size_t offset = 0; offset < signal.size(); offset += PACKET_FRAMES, position += PACKET_FRAMES) {
+				history.Write(position, signal.data() + offset, PACKET_FRAMES);
+			}
+			return double(signal.size());
+		}), "ns/frame");
+		suite.Add("history.read." + mode, BestNanosecondsPer([&] {
+			CaptureHistory::Reader reader { history };
+			reader.SeekTo(history.Begin());
+			size_t read = 0;
+			while(size_t chunk = reader.Read(frames.data(), frames.size())) read += chunk;
+			return double(read);
+		}), "ns/frame");
+	}
+}
+
+void EndToEnd(Suite& suite, double seconds) {
+	for(uint32_t sourceRate : { 48000u, 44100u }) {
+		CapturePipeline pipeline { 4096 };
+		CapturePipeline::Reader reader { pipeline.Ring() };
+		CapturePacing pacing;
+		SyntheticCapture source { &pipeline, CaptureFormat { sourceRate, 2, 32, SampleType::Float }, pacing };
+		pipeline.Configure(source.GetFormat(), 48000);
+
+		constexpr size_t MIX_FRAMES = 512;
+		std::vector<StereoFrame> output(MIX_FRAMES);
+		std::vector<double> ages;
+		const auto mixPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / 48000));
+		const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+
+		source.Start();
+		auto deadline = Clock::now() + std::chrono::microseconds(pacing.periodMicroseconds);
+		while(deadline < end) {
+			std::this_thread::sleep_until(deadline);
+			deadline += mixPeriod;
+
+			const std::optional<uint64_t> captured = pipeline.CaptureTimeAt(reader.Position());
+			if(captured && reader.Lag() > 0) ages.push_back((static_cast<double>(CaptureClockNow()) - static_cast<double>(*captured)) / 10000.0);
+			pipeline.Mix(reader, output.data(), MIX_FRAMES);
+		}
+		source.Stop();
+
+		std::sort(ages.begin(), ages.end());
+		auto percentile = [&](double p) { return ages.empty() ? 0.0 : ages[size_t(p * (ages.size() - 1))]; };
+		const std::string name = std::string("end_to_end.") + (sourceRate == 48000 ? "direct" : "resampled");
+		suite.Add(name + ".age_p50", percentile(0.5), "ms", SCHEDULED_TOLERANCE);
+		suite.Add(name + ".age_p99", percentile(0.99), "ms", SCHEDULED_TOLERANCE);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const char* jsonPath = nullptr;
+	const char* filter = nullptr;
+	for(int i = 1; i + 1 < argc; i += 2) {
+		if(strcmp(argv[i], "--json") == 0) jsonPath = argv[i + 1];
+		else if(strcmp(argv[i], "--filter") == 0) filter = argv[i + 1];
+	}
+
+	Suite suite { filter };
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	if(suite.Selected("ring")) RingBuffer(suite);
+	if(suite.Selected("resampler")) Resampler(suite);
+	if(suite.Selected("convert")) Convert(suite);
+	if(suite.Selected("downmix")) Downmix(suite);
+	if(suite.Selected("multimix")) MultiMix(suite);
+	if(suite.Selected("pipeline")) CaptureThread(suite);
+	if(suite.Selected("analyzer")) Analyzer(suite);
+	if(suite.Selected("inserts")) Inserts(suite);
+	if(suite.Selected("history")) History(suite);
+	if(suite.Selected("end_to_end")) EndToEnd(suite, 3.0);
+
+	if(jsonPath != nullptr && !suite.WriteJson(jsonPath)) {
+		fprintf(stderr, "couldn't write %s\n", jsonPath);
+		return 1;
+	}
+	return 0;
+}
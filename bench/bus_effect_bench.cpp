@@ -0,0 +1,330 @@
+// The bus effect against the AudioStreamPlayer it replaces, per block of godot's mixer. The effect side is
+// AudioEffectWasapiAppCaptureInstance::_process: a jitter buffer mix straight from the ring and one add into the bus.
+// The player side is AudioStreamPlaybackWasapiAppCapture::_mix_resampled plus what godot 4.2 does with a playback
+// around it: AudioStreamPlaybackResampled's cubic interpolation (which runs at 1:1 too) and AudioServer adding the
+// voice into its bus with a volume ramp. Checks that both put the same audio on the bus, the effect without the two
+// frames of delay the interpolation adds, then times a block of each playing and behind the closed silence gate.
+// scons bench && ./bench/bin/bus_effect_bench [seconds]
+
+#include "capture_mix.hpp"
+#include "capture_pipeline.hpp"
+#include "capture_stats.hpp"
+#include "jitter_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+// AudioServer's buffer_size, every bus effect and playback gets blocks of this
+constexpr size_t MIX_FRAMES = 512;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+constexpr float GAIN = 0.5f;
+
+// AudioStreamPlaybackResampled::mix and begin_resample, godot 4.2, at a fixed rate
+class GodotResampled {
+public:
+	static constexpr uint32_t FP_BITS = 16;
+	static constexpr uint64_t FP_LEN = uint64_t(1) << FP_BITS;
+	static constexpr uint64_t FP_MASK = FP_LEN - 1;
+	static constexpr size_t INTERNAL_BUFFER_LEN = 128;
+	static constexpr size_t CUBIC_INTERP_HISTORY = 4;
+
+	template<typename MixInternal>
+	void Begin(MixInternal&& mixInternal) {
+		for(size_t i = 0; i < CUBIC_INTERP_HISTORY; i++) internal[i] = StereoFrame { };
+		mixInternal(internal + CUBIC_INTERP_HISTORY, INTERNAL_BUFFER_LEN);
+		mixOffset = 0;
+	}
+
+	template<typename MixInternal>
+	void Mix(StereoFrame* output, size_t frameCount, double streamRate, double mixRate, MixInternal&& mixInternal) {
+		const uint64_t increment = uint64_t((streamRate / mixRate) * double(FP_LEN));
+		for(size_t i = 0; i < frameCount; i++) {
+			const size_t index = CUBIC_INTERP_HISTORY + size_t(mixOffset >> FP_BITS);
+			const float mu = (mixOffset & FP_MASK) / float(FP_LEN);
+			const float mu2 = mu * mu;
+			output[i].left = Interpolate(internal[index - 3].left, internal[index - 2].left, internal[index - 1].left, internal[index].left, mu, mu2);
+			output[i].right = Interpolate(internal[index - 3].right, internal[index - 2].right, internal[index - 1].right, internal[index].right, mu, mu2);
+
+			mixOffset += increment;
+			while((mixOffset >> FP_BITS) >= INTERNAL_BUFFER_LEN) {
+				for(size_t h = 0; h < CUBIC_INTERP_HISTORY; h++) internal[h] = internal[INTERNAL_BUFFER_LEN + h];
+				mixInternal(internal + CUBIC_INTERP_HISTORY, INTERNAL_BUFFER_LEN);
+				mixOffset -= INTERNAL_BUFFER_LEN << FP_BITS;
+			}
+		}
+	}
+
+private:
+	static float Interpolate(float y0, float y1, float y2, float y3, float mu, float mu2) {
+		const float a0 = 3 * y1 - 3 * y2 + y3 - y0;
+		const float a1 = 2 * y0 - 5 * y1 + 4 * y2 - y3;
+		const float a2 = y2 - y0;
+		const float a3 = 2 * y1;
+		return (a0 * mu * mu2 + a1 * mu2 + a2 * mu + a3) / 2;
+	}
+
+	StereoFrame internal[INTERNAL_BUFFER_LEN + CUBIC_INTERP_HISTORY] { };
+	uint64_t mixOffset = 0;
+};
+
+// AudioServer::_mix_step_for_channel without the attenuation filter, godot 4.2
+void MixVoice(StereoFrame* bus, const StereoFrame* voice, size_t frameCount, float volumeStart, float volumeFinal) {
+	for(size_t i = 0; i < frameCount; i++) {
+		const float lerp = float(i) / frameCount;
+		const float volume = volumeFinal * lerp + (1 - lerp) * volumeStart;
+		bus[i].left += voice[i].left * volume;
+		bus[i].right += voice[i].right * volume;
+	}
+}
+
+// One consumer of the ring, reading through a jitter buffer or a plain reader like the extension does
+struct Consumer {
+	Consumer(CapturePipeline& pipeline, bool jitterBuffer) :
+		pipeline { pipeline }
+	{
+		if(jitterBuffer) {
+			jitter = std::make_unique<JitterBuffer>(pipeline.Ring(), SAMPLE_RATE, SAMPLE_RATE * 30 / 1000);
+			jitter->Start();
+		} else {
+			reader = std::make_unique<CapturePipeline::Reader>(pipeline.Ring());
+		}
+	}
+
+	// What both _mix_resampled and mix_block do before their own part, returns frames mixed and whether it was gated
+	size_t Mix(StereoFrame* output, size_t frameCount, bool& gated) {
+		size_t fill;
+		uint64_t position;
+		size_t mixed;
+		uint64_t dropped;
+		if(jitter) {
+			fill = jitter->Fill();
+			position = jitter->Position();
+			mixed = jitter->MixSilence(output, frameCount, pipeline.SilentUntil(position));
+			gated = mixed != 0;
+			if(!gated) mixed = jitter->Mix(output, frameCount);
+			dropped = jitter->DroppedCount();
+		} else {
+			fill = reader->Lag();
+			position = reader->Position();
+			mixed = pipeline.MixSilence(*reader, output, frameCount);
+			gated = mixed != 0;
+			if(!gated) mixed = pipeline.Mix(*reader, output, frameCount);
+			dropped = reader->DroppedCount();
+		}
+		stats.RecordMix(frameCount, mixed, fill, dropped - lastDropped);
+		if(gated) stats.RecordGatedMix();
+		lastDropped = dropped;
+		return mixed;
+	}
+
+	CapturePipeline& pipeline;
+	std::unique_ptr<CapturePipeline::Reader> reader;
+	std::unique_ptr<JitterBuffer> jitter;
+	MixStats stats;
+	uint64_t lastDropped = 0;
+};
+
+// The effect's _process on one block: the bus passes through with the capture added
+struct EffectPath {
+	EffectPath(CapturePipeline& pipeline, bool jitterBuffer) :
+		consumer { pipeline, jitterBuffer },
+		captured(1024),
+		accumulate { SelectAccumulator() }
+	{ }
+
+	void Process(const StereoFrame* input, StereoFrame* output, size_t frameCount) {
+		memcpy(output, input, frameCount * sizeof(StereoFrame));
+		bool gated = false;
+		const size_t mixed = consumer.Mix(captured.data(), frameCount, gated);
+		if(!gated && mixed > 0) accumulate(captured.data(), output, mixed, GAIN, 0.0f);
+	}
+
+	Consumer consumer;
+	std::vector<StereoFrame> captured;
+	FrameAccumulator accumulate;
+};
+
+// A player on the same bus: the playback fills godot's interpolation buffer, godot interpolates a block out of it and
+// adds that to the bus
+struct PlayerPath {
+	PlayerPath(CapturePipeline& pipeline, bool jitterBuffer) :
+		consumer { pipeline, jitterBuffer },
+		voice(MIX_FRAMES)
+	{ }
+
+	// _start: godot fills its interpolation buffer right away
+	void Start() {
+		resampled.Begin([&](StereoFrame* output, size_t frameCount) { MixResampled(output, frameCount); });
+	}
+
+	void MixResampled(StereoFrame* output, size_t frameCount) {
+		bool gated = false;
+		const size_t mixed = consumer.Mix(output, frameCount, gated);
+		// godot zero fills what a playback didn't deliver
+		std::fill(output + mixed, output + frameCount, StereoFrame { });
+	}
+
+	void Process(StereoFrame* bus, size_t frameCount) {
+		resampled.Mix(voice.data(), frameCount, SAMPLE_RATE, SAMPLE_RATE, [&](StereoFrame* output, size_t count) { MixResampled(output, count); });
+		MixVoice(bus, voice.data(), frameCount, GAIN, GAIN);
+	}
+
+	Consumer consumer;
+	GodotResampled resampled;
+	std::vector<StereoFrame> voice;
+};
+
+struct Source {
+	explicit Source(CapturePipeline& pipeline) :
+		pipeline { pipeline },
+		packet(MIX_FRAMES)
+	{ }
+
+	void Deliver(bool silent) {
+		for(StereoFrame& frame : packet) {
+			const float sample = silent ? 0.0f : 0.5f * static_cast<float>(std::sin(phase));
+			phase += 2.0 * 3.14159265358979323846 * 440.0 / SAMPLE_RATE;
+			frame = StereoFrame { sample, -sample };
+		}
+		CapturePacket captured { };
+		captured.frameCount = MIX_FRAMES;
+		captured.silent = silent;
+		captured.frames = silent ? nullptr : reinterpret_cast<const uint8_t*>(packet.data());
+		pipeline.OnPacket(captured);
+	}
+
+	CapturePipeline& pipeline;
+	std::vector<StereoFrame> packet;
+	double phase = 0.0;
+};
+
+std::vector<StereoFrame> BusNoise(size_t frameCount) {
+	std::mt19937 random { 11 };
+	std::uniform_real_distribution<float> distribution { -0.25f, 0.25f };
+	std::vector<StereoFrame> frames(frameCount);
+	for(StereoFrame& frame : frames) frame = StereoFrame { distribution(random), distribution(random) };
+	return frames;
+}
+
+// With plain readers both paths see the same frames, so the bus has to come out the same, the player's two frames
+// late. The effect's has to be exactly the bus plus the capture at the gain.
+bool CheckSameAudio() {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	EffectPath effect { pipeline, false };
+	PlayerPath player { pipeline, false };
+	CapturePipeline::Reader reference { pipeline.Ring() };
+	Source source { pipeline };
+
+	constexpr size_t BLOCKS = 200;
+	const std::vector<StereoFrame> bus = BusNoise(BLOCKS * MIX_FRAMES);
+	std::vector<StereoFrame> effectBus(bus.size());
+	std::vector<StereoFrame> playerBus = bus;
+	std::vector<StereoFrame> captured(bus.size());
+	// something to fill the player's interpolation buffer from when it starts
+	source.Deliver(false);
+	player.Start();
+	for(size_t block = 0; block < BLOCKS; block++) {
+		source.Deliver(false);
+		const size_t offset = block * MIX_FRAMES;
+		reference.Read(captured.data() + offset, MIX_FRAMES);
+		effect.Process(bus.data() + offset, effectBus.data() + offset, MIX_FRAMES);
+		player.Process(playerBus.data() + offset, MIX_FRAMES);
+	}
+
+	size_t effectWrong = 0;
+	float playerDifference = 0.0f;
+	for(size_t i = 0; i < bus.size(); i++) {
+		const StereoFrame expected { bus[i].left + captured[i].left * GAIN, bus[i].right + captured[i].right * GAIN };
+		if(effectBus[i].left != expected.left || effectBus[i].right != expected.right) effectWrong++;
+		if(i >= 2) {
+			// the player's voice lags by two frames of interpolation history
+			const float left = playerBus[i].left - bus[i].left - (effectBus[i - 2].left - bus[i - 2].left);
+			const float right = playerBus[i].right - bus[i].right - (effectBus[i - 2].right - bus[i - 2].right);
+			playerDifference = std::max(playerDifference, std::max(std::fabs(left), std::fabs(right)));
+		}
+	}
+	const bool ok = effectWrong == 0 && playerDifference < 1e-6f;
+	printf("same audio on the bus: effect %zu frames off bus + capture * gain, player %.2g from the effect two frames later  %s\n",
+		effectWrong, playerDifference, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+struct Timing {
+	double p50 = 0.0;
+	double p99 = 0.0;
+};
+
+// Percentiles rather than a mean, a preempted block says nothing about either path
+Timing Summarize(std::vector<double>& nanoseconds) {
+	std::sort(nanoseconds.begin(), nanoseconds.end());
+	return Timing { nanoseconds[nanoseconds.size() / 2], nanoseconds[nanoseconds.size() * 99 / 100] };
+}
+
+// A block of each at a time against the same capture, the source delivering one block ahead of them
+void TimeBlocks(double seconds, bool jitterBuffer, bool silent) {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	Source source { pipeline };
+	EffectPath effect { pipeline, jitterBuffer };
+	PlayerPath player { pipeline, jitterBuffer };
+	std::vector<StereoFrame> bus = BusNoise(MIX_FRAMES);
+	std::vector<StereoFrame> output(MIX_FRAMES);
+	player.Start();
+
+	// long enough for the jitter buffers to settle and, silent, for the gate to close
+	const size_t warmup = SAMPLE_RATE / MIX_FRAMES;
+	const size_t blocks = std::max<size_t>(static_cast<size_t>(seconds * SAMPLE_RATE / MIX_FRAMES), 100);
+	std::vector<double> effectTimes;
+	std::vector<double> playerTimes;
+	for(size_t block = 0; block < warmup + blocks; block++) {
+		source.Deliver(silent);
+		auto start = Clock::now();
+		effect.Process(bus.data(), output.data(), MIX_FRAMES);
+		const double effectTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		start = Clock::now();
+		player.Process(bus.data(), MIX_FRAMES);
+		const double playerTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		if(block >= warmup) {
+			effectTimes.push_back(effectTime);
+			playerTimes.push_back(playerTime);
+		}
+	}
+
+	const Timing effectTiming = Summarize(effectTimes);
+	const Timing playerTiming = Summarize(playerTimes);
+	const MixStats::Snapshot effectStats = effect.consumer.stats.Read();
+	printf("  %-18s %-22s effect %6.0f / %6.0f ns/block  player %6.0f / %6.0f ns/block  %.1fx, %llu of %llu effect blocks gated\n",
+		jitterBuffer ? "jitter buffer" : "plain reader", silent ? "app silent, gate shut" : "app playing", effectTiming.p50, effectTiming.p99, playerTiming.p50, playerTiming.p99,
+		playerTiming.p50 / effectTiming.p50, (unsigned long long)effectStats.gatedMixes, (unsigned long long)effectStats.mixes);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 10.0;
+
+	const bool ok = CheckSameAudio();
+	printf("a %zu frame block at %u Hz, p50 / p99, %s accumulate kernel (player: godot's interpolation and voice mix, scalar):\n",
+		MIX_FRAMES, SAMPLE_RATE, SimdLevelName(ClampSimdLevel(SimdLevel::Avx)));
+	for(bool jitterBuffer : { true, false }) {
+		TimeBlocks(seconds, jitterBuffer, false);
+		TimeBlocks(seconds, jitterBuffer, true);
+	}
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
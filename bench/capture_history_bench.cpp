@@ -0,0 +1,337 @@
+// Capture history: the block codec round tripping bit for bit (noise, 16 bit audio, silence, odd bit patterns) and
+// what it costs, how much memory a minute of history takes raw and compressed for different material, how long a
+// seek takes at random points of short and long histories, a writer lapping readers that check every frame they get,
+// and a pipeline's history matching what its ring readers saw, direct and resampled.
+// scons bench && ./bench/bin/capture_history_bench [seconds]
+
+#include "capture_history.hpp"
+#include "capture_pipeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t PACKET_FRAMES = 480;
+constexpr double PI = 3.14159265358979323846;
+
+enum class Material {
+	Music16,
+	MusicFloat,
+	Speech,
+	Silence,
+};
+
+const char* MaterialName(Material material) {
+	switch(material) {
+	case Material::Music16: return "music, 16 bit source";
+	case Material::MusicFloat: return "music, float source";
+	case Material::Speech: return "speech with pauses";
+	case Material::Silence: return "silence";
+	}
+	return "?";
+}
+
+// Something music-like: a few detuned partials with an envelope and a little noise, optionally quantized to 16 bit
+// the way a game's int16 assets come out of the mixer at unity gain
+class Generator {
+public:
+	explicit Generator(Material material) :
+		material { material },
+		random { 17 },
+		noise { -0.02f, 0.02f },
+		frame { 0 }
+	{ }
+
+	void Fill(StereoFrame* frames, size_t frameCount) {
+		for(size_t i = 0; i < frameCount; i++, frame++) {
+			const double t = double(frame) / SAMPLE_RATE;
+			double left = 0.0;
+			double right = 0.0;
+			if(material != Material::Silence) {
+				const double envelope = 0.5 + 0.5 * std::sin(2.0 * PI * 0.5 * t);
+				for(int partial = 1; partial <= 4; partial++) {
+					left += 0.15 / partial * std::sin(2.0 * PI * 220.0 * partial * t);
+					right += 0.15 / partial * std::sin(2.0 * PI * 220.7 * partial * t);
+				}
+				left = left * envelope + noise(random);
+				right = right * envelope + noise(random);
+				// talk for a second and a half, pause for a second
+				if(material == Material::Speech && std::fmod(t, 2.5) > 1.5) left = right = 0.0;
+			}
+			if(material == Material::Music16 || material == Material::Speech) {
+				left = std::round(left * 32767.0) / 32768.0;
+				right = std::round(right * 32767.0) / 32768.0;
+			}
+			frames[i] = StereoFrame { static_cast<float>(left), static_cast<float>(right) };
+		}
+	}
+
+private:
+	const Material material;
+	std::mt19937 random;
+	std::uniform_real_distribution<float> noise;
+	uint64_t frame;
+};
+
+bool RoundTrips(const std::vector<StereoFrame>& frames, size_t& bytes) {
+	std::vector<uint8_t> encoded(MaxEncodedHistoryBytes(frames.size()));
+	bytes = EncodeHistoryBlock(frames.data(), frames.size(), encoded.data());
+	std::vector<StereoFrame> decoded(frames.size());
+	return DecodeHistoryBlock(encoded.data(), bytes, decoded.data(), decoded.size()) &&
+		memcmp(decoded.data(), frames.data(), frames.size() * sizeof(StereoFrame)) == 0 &&
+		!DecodeHistoryBlock(encoded.data(), bytes - 1, decoded.data(), decoded.size());
+}
+
+bool CheckCodec() {
+	bool ok = true;
+	constexpr size_t FRAMES = CaptureHistory::BLOCK_FRAMES;
+	printf("codec, one block each:\n");
+
+	std::vector<std::pair<const char*, std::vector<StereoFrame>>> cases;
+	for(Material material : { Material::Music16, Material::MusicFloat, Material::Silence }) {
+		std::vector<StereoFrame> frames(FRAMES);
+		Generator { material }.Fill(frames.data(), frames.size());
+		cases.emplace_back(MaterialName(material), std::move(frames));
+	}
+	{
+		// every bit pattern that's awkward for floats: -0, denormals, infinities, NaNs, random bits
+		std::mt19937 random { 5 };
+		std::vector<StereoFrame> frames(FRAMES);
+		const uint32_t specials[] = { 0x80000000u, 0x00000001u, 0x007FFFFFu, 0x7F800000u, 0xFF800000u, 0x7FC00001u, 0xFFFFFFFFu };
+		for(size_t i = 0; i < frames.size(); i++) {
+			const uint32_t left = i % 3 == 0 ? specials[i % 7] : random();
+			const uint32_t right = i % 5 == 0 ? specials[(i / 5) % 7] : random();
+			memcpy(&frames[i].left, &left, sizeof(left));
+			memcpy(&frames[i].right, &right, sizeof(right));
+		}
+		cases.emplace_back("odd bit patterns", std::move(frames));
+	}
+
+	for(const auto& [name, frames] : cases) {
+		size_t bytes = 0;
+		const bool exact = RoundTrips(frames, bytes);
+
+		std::vector<uint8_t> encoded(MaxEncodedHistoryBytes(frames.size()));
+		std::vector<StereoFrame> decoded(frames.size());
+		double encodeTime = 1e30;
+		double decodeTime = 1e30;
+		for(int round = 0; round < 20; round++) {
+			auto start = Clock::now();
+			const size_t written = EncodeHistoryBlock(frames.data(), frames.size(), encoded.data());
+			encodeTime = std::min(encodeTime, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames.size());
+			start = Clock::now();
+			DecodeHistoryBlock(encoded.data(), written, decoded.data(), decoded.size());
+			decodeTime = std::min(decodeTime, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames.size());
+		}
+
+		ok = ok && exact;
+		printf("  %-22s %5.2f bytes/frame (%.2fx), encode %.2f ns/frame, decode %.2f ns/frame  %s\n", name,
+			double(bytes) / frames.size(), 8.0 * frames.size() / bytes, encodeTime, decodeTime, exact ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// Ten seconds of material, played over and over
+std::vector<StereoFrame> Material10s(Material material) {
+	std::vector<StereoFrame> frames(SAMPLE_RATE * 10);
+	Generator { material }.Fill(frames.data(), frames.size());
+	return frames;
+}
+
+void Feed(CaptureHistory& history, const std::vector<StereoFrame>& material, uint64_t& position, double seconds) {
+	const uint64_t end = position + static_cast<uint64_t>(seconds * SAMPLE_RATE);
+	while(position < end) {
+		history.Write(position, material.data() + position % material.size(), PACKET_FRAMES);
+		position += PACKET_FRAMES;
+	}
+}
+
+// A minute's history full of each material, raw and compressed
+void ReportMemory() {
+	printf("memory for a minute of history at %u Hz (allocated up front, in use by what it holds, held):\n", SAMPLE_RATE);
+	for(Material material : { Material::Music16, Material::MusicFloat, Material::Speech, Material::Silence }) {
+		const std::vector<StereoFrame> frames = Material10s(material);
+		for(bool compress : { false, true }) {
+			CaptureHistory history { SAMPLE_RATE, 60.0, compress };
+			uint64_t position = 0;
+			const auto start = Clock::now();
+			// twice over, so it's full and has been wrapping for a while
+			Feed(history, frames, position, 120.0);
+			const double writeTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / position;
+
+			const CaptureHistory::Stats stats = history.GetStats();
+			const double held = double(history.End() - history.Begin()) / SAMPLE_RATE;
+			printf("  %-22s %-10s %6.1f MiB  %6.1f MiB  %5.1f s  %.2f ns/frame to write\n", MaterialName(material), compress ? "compressed" : "raw",
+				history.MemoryBytes() / 1048576.0, stats.storedBytes / 1048576.0, held, writeTime);
+		}
+	}
+}
+
+// Seeking anywhere and reading a mix's worth, like a playback's first mix after a seek
+bool ReportSeeks() {
+	bool ok = true;
+	printf("seek and read 512 frames at random positions (usec p50 / p99 / max):\n");
+	const struct {
+		double seconds;
+		bool compress;
+	} windows[] = { { 30.0, false }, { 300.0, false }, { 30.0, true }, { 300.0, true } };
+	const std::vector<StereoFrame> music = Material10s(Material::Music16);
+	for(const auto& window : windows) {
+		CaptureHistory history { SAMPLE_RATE, window.seconds, window.compress };
+		uint64_t position = 0;
+		Feed(history, music, position, window.seconds + 1.0);
+
+		CaptureHistory::Reader reader { history };
+		std::mt19937_64 random { 3 };
+		std::vector<double> times;
+		std::vector<StereoFrame> output(512);
+		bool allRead = true;
+		for(int seek = 0; seek < 2000; seek++) {
+			const uint64_t target = history.Begin() + random() % (history.End() - history.Begin() - output.size());
+			const auto start = Clock::now();
+			reader.SeekTo(target);
+			const size_t read = reader.Read(output.data(), output.size());
+			times.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+			allRead = allRead && read == output.size();
+		}
+		std::sort(times.begin(), times.end());
+		ok = ok && allRead;
+		printf("  %5.0f s %-10s  %6.2f / %6.2f / %6.2f  %s\n", window.seconds, window.compress ? "compressed" : "raw",
+			times[times.size() / 2], times[times.size() * 99 / 100], times.back(), allRead ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+StereoFrame Marker(uint64_t position) {
+	const float value = static_cast<float>(position & 0xFFFFFF) / 16777216.0f;
+	return StereoFrame { value, -value };
+}
+
+// A writer going flat out over a short history while readers keep seeking to its oldest frames: every frame they get
+// has to be the one for its position, whatever the writer overwrote meanwhile
+bool CheckLapping(double seconds) {
+	bool ok = true;
+	for(bool compress : { false, true }) {
+		CaptureHistory history { SAMPLE_RATE, 0.5, compress };
+		std::atomic<bool> done { false };
+		std::thread writer([&] {
+			std::vector<StereoFrame> packet(PACKET_FRAMES);
+			uint64_t position = 0;
+			while(!done) {
+				for(size_t i = 0; i < packet.size(); i++) packet[i] = Marker(position + i);
+				history.Write(position, packet.data(), packet.size());
+				position += packet.size();
+			}
+		});
+
+		std::atomic<uint64_t> mismatches { 0 };
+		std::atomic<uint64_t> frames { 0 };
+		std::atomic<uint64_t> dropped { 0 };
+		std::vector<std::thread> readers;
+		for(int r = 0; r < 2; r++) {
+			readers.emplace_back([&] {
+				CaptureHistory::Reader reader { history };
+				std::vector<StereoFrame> output(2048);
+				while(!done) {
+					reader.SeekTo(history.Begin());
+					for(int i = 0; i < 8; i++) {
+						const uint64_t start = reader.Position();
+						const uint64_t droppedBefore = reader.DroppedCount();
+						const size_t read = reader.Read(output.data(), output.size());
+						// a skip ahead happens before anything is copied
+						const uint64_t first = start + (reader.DroppedCount() - droppedBefore);
+						for(size_t j = 0; j < read; j++) {
+							const StereoFrame expected = Marker(first + j);
+							if(output[j].left != expected.left || output[j].right != expected.right) mismatches++;
+						}
+						frames += read;
+					}
+				}
+				dropped += reader.DroppedCount();
+			});
+		}
+
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		done = true;
+		writer.join();
+		for(std::thread& reader : readers) reader.join();
+
+		const bool passed = mismatches == 0 && frames > 0;
+		ok = ok && passed;
+		printf("readers lapped by the writer, %s: %llu frames read, %llu skipped, %llu wrong  %s\n", compress ? "compressed" : "raw",
+			(unsigned long long)frames.load(), (unsigned long long)dropped.load(), (unsigned long long)mismatches.load(), passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// What a pipeline's ring readers saw, frame for frame, is what its history has at the same positions. Including a
+// stretch of flagged silence and, resampled, the filter ringing out into it.
+bool CheckPipeline() {
+	bool ok = true;
+	printf("pipeline history against its ring:\n");
+	for(uint32_t sourceRate : { SAMPLE_RATE, 44100u }) {
+		CapturePipeline pipeline { 16384 };
+		pipeline.Configure(CaptureFormat { sourceRate, 2, 32, SampleType::Float }, SAMPLE_RATE);
+		CaptureHistory history { SAMPLE_RATE, 10.0, true };
+		CaptureHistory other { SAMPLE_RATE, 1.0, false };
+		const bool attached = pipeline.AttachHistory(&history) && !pipeline.AttachHistory(&other);
+
+		CapturePipeline::Reader ring { pipeline.Ring() };
+		const uint64_t from = ring.Position();
+		std::vector<StereoFrame> seen;
+		std::vector<StereoFrame> packet(PACKET_FRAMES);
+		std::vector<StereoFrame> chunk(16384);
+		Generator generator { Material::MusicFloat };
+		const size_t packets = sourceRate * 4 / PACKET_FRAMES;
+		for(size_t i = 0; i < packets; i++) {
+			generator.Fill(packet.data(), packet.size());
+			CapturePacket captured { };
+			captured.frameCount = PACKET_FRAMES;
+			captured.silent = i > packets / 2 && i < packets * 3 / 4;
+			captured.frames = captured.silent ? nullptr : reinterpret_cast<const uint8_t*>(packet.data());
+			pipeline.OnPacket(captured);
+			const size_t read = ring.Read(chunk.data(), chunk.size());
+			seen.insert(seen.end(), chunk.begin(), chunk.begin() + read);
+		}
+		pipeline.DetachHistory(&history);
+
+		CaptureHistory::Reader reader { history };
+		reader.SeekTo(from);
+		std::vector<StereoFrame> kept(seen.size());
+		const size_t read = reader.Read(kept.data(), kept.size());
+		// the newest block isn't readable yet
+		const bool passed = attached && read + CaptureHistory::BLOCK_FRAMES > seen.size() &&
+			memcmp(kept.data(), seen.data(), read * sizeof(StereoFrame)) == 0 && reader.DroppedCount() == 0;
+		ok = ok && passed;
+		printf("  %u -> %u Hz: %zu frames through the ring, the history has the first %zu of them bit for bit, %llu blocks silent  %s\n",
+			sourceRate, SAMPLE_RATE, seen.size(), read, (unsigned long long)history.GetStats().silentBlocks, passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+	bool ok = CheckCodec();
+	ReportMemory();
+	ok = ReportSeeks() && ok;
+	ok = CheckLapping(seconds) && ok;
+	ok = CheckPipeline() && ok;
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+// Multichannel downmix: every mixing kernel against the scalar reference for each channel count, the ITU matrices for
+// the usual layouts, a pipeline fed int16 5.1 against the reference conversion and downmix (direct and resampled),
+// a matrix swapped in while it runs, and what mixing costs per frame at each SIMD level.
+// scons bench && ./bench/bin/channel_mix_bench [seconds]
+
+#include "capture_pipeline.hpp"
+#include "channel_mix.hpp"
+#include "sample_convert.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+std::vector<float> RandomSamples(size_t count, uint32_t seed) {
+	std::mt19937 random { seed };
+	std::uniform_real_distribution<float> distribution { -1.0f, 1.0f };
+	std::vector<float> samples(count);
+	for(float& sample : samples) sample = distribution(random);
+	return samples;
+}
+
+ChannelMatrix RandomMatrix(uint16_t channels, uint32_t seed) {
+	const std::vector<float> gains = RandomSamples(channels * 2, seed);
+	ChannelMatrix matrix;
+	matrix.channels = channels;
+	for(uint16_t channel = 0; channel < channels; channel++) matrix.Set(channel, gains[channel * 2], gains[channel * 2 + 1]);
+	return matrix;
+}
+
+// The vector kernels add the products up in a different order than the reference, up to 18 of them at most full scale
+// each can differ by a few rounding steps of their sum
+bool Close(const StereoFrame& a, const StereoFrame& b) {
+	return std::fabs(a.left - b.left) <= 1e-5f && std::fabs(a.right - b.right) <= 1e-5f;
+}
+
+bool CheckAgainstReference() {
+	bool ok = true;
+	for(uint16_t channels : { 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 18 }) {
+		const ChannelMixer reference = SelectChannelMixer(channels, SimdLevel::Scalar);
+		const ChannelMatrix matrix = RandomMatrix(channels, channels);
+		size_t mismatches = 0;
+		size_t cases = 0;
+		for(SimdLevel level : AvailableLevels()) {
+			const ChannelMixer kernel = SelectChannelMixer(channels, level);
+			for(size_t count : { 0, 1, 2, 3, 4, 5, 7, 9, 1000, 1023 }) {
+				for(size_t offset : { 0, 1 }) {
+					const std::vector<float> input = RandomSamples((count + offset) * channels, uint32_t(count + offset));
+					const float* frames = input.data() + offset;
+					std::vector<StereoFrame> expected(count + 1, StereoFrame { 7.0f, 7.0f });
+					std::vector<StereoFrame> actual(count + 1, StereoFrame { 7.0f, 7.0f });
+					reference(frames, expected.data(), count, matrix);
+					kernel(frames, actual.data(), count, matrix);
+					bool same = actual[count].left == 7.0f && actual[count].right == 7.0f;
+					for(size_t i = 0; i < count; i++) same = same && Close(expected[i], actual[i]);
+					if(!same) mismatches++;
+					cases++;
+				}
+			}
+		}
+		ok = ok && mismatches == 0;
+		printf("  %2u channels  %zu kernels, lengths and alignments, %zu differ from the reference  %s\n", channels, cases, mismatches,
+			mismatches == 0 ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+bool CheckMatrices() {
+	const float h = 0.70710678f;
+	bool ok = DownmixMatrix(2, 0).IsPassthrough();
+
+	// 5.1: FL FR FC LFE BL BR
+	const ChannelMatrix surround = DownmixMatrix(6, 0);
+	const float left[] = { 1.0f, 0.0f, h, 0.0f, h, 0.0f };
+	const float right[] = { 0.0f, 1.0f, h, 0.0f, 0.0f, h };
+	for(uint16_t channel = 0; channel < 6; channel++) {
+		ok = ok && surround.Left(channel) == left[channel] && surround.Right(channel) == right[channel];
+	}
+
+	// mono is all center
+	const ChannelMatrix mono = DownmixMatrix(1, 0);
+	ok = ok && mono.Left(0) == 1.0f && mono.Right(0) == 1.0f;
+
+	// 7.1 with its sides, from an explicit mask
+	const uint32_t sevenOne = DefaultChannelMask(8);
+	const ChannelMatrix wide = DownmixMatrix(8, sevenOne);
+	ok = ok && wide.Left(6) == h && wide.Right(6) == 0.0f && wide.Left(7) == 0.0f && wide.Right(7) == h && wide.Left(3) == 0.0f;
+
+	// more channels than the mask has speakers for: the rest is dropped
+	const ChannelMatrix extra = DownmixMatrix(3, DefaultChannelMask(2));
+	ok = ok && extra.Left(2) == 0.0f && extra.Right(2) == 0.0f;
+
+	printf("  ITU matrices for mono, stereo, 5.1 and 7.1  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// 5.1 int16 through the pipeline has to come out of the ring the way the reference conversion and downmix make it,
+// the taps too; then a matrix that only keeps the center, swapped in between packets
+bool CheckPipeline() {
+	class Collect : public CaptureTap {
+	public:
+		void OnFrames(const uint8_t* frames, uint64_t frameCount) override {
+			const StereoFrame* stereo = reinterpret_cast<const StereoFrame*>(frames);
+			for(uint64_t i = 0; i < frameCount; i++) seen.push_back(frames != nullptr ? stereo[i] : StereoFrame { 0.0f, 0.0f });
+		}
+		std::vector<StereoFrame> seen;
+	};
+
+	constexpr uint16_t CHANNELS = 6;
+	constexpr uint32_t PACKET_FRAMES = 441;
+	const SampleConverter convert = SelectConverter(SampleEncoding::Int16, SimdLevel::Scalar);
+	const ChannelMixer mix = SelectChannelMixer(CHANNELS, SimdLevel::Scalar);
+
+	ChannelMatrix centerOnly;
+	centerOnly.channels = CHANNELS;
+	centerOnly.Set(2, 1.0f, 1.0f);
+
+	bool ok = true;
+	for(uint32_t sourceRate : { 48000u, 44100u }) {
+		CapturePipeline surround { 16384 };
+		CapturePipeline stereo { 16384 };
+		surround.Configure(CaptureFormat { sourceRate, CHANNELS, 16, SampleType::Int }, 48000);
+		stereo.Configure(CaptureFormat { sourceRate, 2, 32, SampleType::Float }, 48000);
+		CapturePipeline::Reader surroundReader { surround.Ring() };
+		CapturePipeline::Reader stereoReader { stereo.Ring() };
+		Collect tap;
+		surround.AttachTap(&tap);
+
+		std::mt19937 random { sourceRate };
+		std::vector<int16_t> packet(PACKET_FRAMES * CHANNELS);
+		std::vector<float> samples(packet.size());
+		std::vector<StereoFrame> expected(PACKET_FRAMES);
+		std::vector<StereoFrame> surroundOutput(16384), stereoOutput(16384);
+		size_t compared = 0, differing = 0, tapDiffering = 0;
+		ChannelMatrix matrix = surround.GetChannelMatrix();
+
+		for(uint32_t packetIndex = 0; packetIndex < 100; packetIndex++) {
+			if(packetIndex == 50) {
+				ok = surround.SetChannelMatrix(centerOnly) && !surround.SetChannelMatrix(DownmixMatrix(2, 0)) && ok;
+				matrix = centerOnly;
+			}
+			for(int16_t& sample : packet) sample = static_cast<int16_t>(random());
+			convert(reinterpret_cast<const uint8_t*>(packet.data()), samples.data(), samples.size());
+			mix(samples.data(), expected.data(), PACKET_FRAMES, matrix);
+
+			// the same stereo as float into a plain pipeline, so both rings went through the same resampling
+			CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), PACKET_FRAMES };
+			captured.position = uint64_t(packetIndex) * PACKET_FRAMES;
+			captured.timed = true;
+			surround.OnPacket(captured);
+			captured.frames = reinterpret_cast<const uint8_t*>(expected.data());
+			stereo.OnPacket(captured);
+
+			for(uint32_t i = 0; i < PACKET_FRAMES; i++) {
+				if(!Close(tap.seen[tap.seen.size() - PACKET_FRAMES + i], expected[i])) tapDiffering++;
+			}
+
+			const size_t read = surroundReader.Read(surroundOutput.data(), surroundOutput.size());
+			const size_t stereoRead = stereoReader.Read(stereoOutput.data(), stereoOutput.size());
+			if(read != stereoRead) differing++;
+			for(size_t i = 0; i < std::min(read, stereoRead); i++) {
+				if(!Close(surroundOutput[i], stereoOutput[i])) differing++;
+			}
+			compared += read;
+		}
+		surround.DetachTap(&tap);
+
+		const bool passed = differing == 0 && tapDiffering == 0 && compared > 0 && surround.RejectedFrames() == 0;
+		ok = ok && passed;
+		printf("  pipeline 5.1 int16 %5u Hz  %zu frames, %zu differ from the reference downmix, taps %zu  %s\n", sourceRate, compared,
+			differing, tapDiffering, passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+void MeasureThroughput(double seconds) {
+	constexpr size_t FRAMES = 4096;
+	for(uint16_t channels : { 1, 2, 6, 8, 12 }) {
+		const std::vector<float> input = RandomSamples(FRAMES * channels, 1);
+		const ChannelMatrix matrix = channels == 2 ? RandomMatrix(2, 1) : DownmixMatrix(channels, 0);
+		std::vector<StereoFrame> output(FRAMES);
+		for(SimdLevel level : AvailableLevels()) {
+			const ChannelMixer kernel = SelectChannelMixer(channels, level);
+			uint64_t mixed = 0;
+			const auto start = Clock::now();
+			const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+			while(Clock::now() < end) {
+				for(int i = 0; i < 16; i++) kernel(input.data(), output.data(), FRAMES, matrix);
+				mixed += 16 * FRAMES;
+			}
+			const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			printf("  %2u channels %-6s %7.3f ns/frame  %.4f ms per second of 48kHz\n", channels, SimdLevelName(level), nanoseconds / mixed,
+				nanoseconds / mixed * 48000 / 1e6);
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 0.3;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	bool ok = CheckAgainstReference();
+	ok = CheckMatrices() && ok;
+	ok = CheckPipeline() && ok;
+	MeasureThroughput(seconds);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+# Holds bench_suite's JSON against a baseline, exits 1 if anything got slower than its tolerance allows.
+# python bench/compare_bench.py bench/baseline.json bench/bin/bench_results.json [--update]
+#
+# --update replaces the baseline with the results, after a deliberate change or on a new reference machine.
+# Numbers are only comparable on the same machine (and SIMD level): the baseline checked in is a starting point,
+# regenerate it with --update on whatever machine runs the check.
+import json
+import shutil
+import sys
+
+
+def main(argv):
+    args = [arg for arg in argv[1:] if not arg.startswith("--")]
+    if len(args) != 2:
+        print("usage: compare_bench.py baseline.json results.json [--update]")
+        return 2
+    baseline_path, results_path = args
+
+    with open(results_path) as file:
+        results = json.load(file)
+
+    if "--update" in argv:
+        shutil.copyfile(results_path, baseline_path)
+        print("baseline %s updated, %d results" % (baseline_path, len(results["results"])))
+        return 0
+
+    with open(baseline_path) as file:
+        baseline = json.load(file)
+
+    if baseline.get("simd") != results.get("simd"):
+        print("warning: baseline ran with %s kernels, these results with %s" % (baseline.get("simd"), results.get("simd")))
+
+    regressions = 0
+    for name, base in sorted(baseline["results"].items()):
+        result = results["results"].get(name)
+        if result is None:
+            print("  %-40s missing" % name)
+            regressions += 1
+            continue
+
+        limit = base["value"] * (1.0 + base["tolerance"])
+        change = result["value"] / base["value"] - 1.0 if base["value"] > 0 else 0.0
+        status = "REGRESSED" if result["value"] > limit else "ok"
+        if status != "ok":
+            regressions += 1
+        print("  %-40s %10.3f -> %10.3f %-8s %+6.1f%%  %s" % (name, base["value"], result["value"], base["unit"], change * 100.0, status))
+
+    for name in sorted(set(results["results"]) - set(baseline["results"])):
+        print("  %-40s new, not in the baseline" % name)
+
+    if regressions:
+        print("%d regression(s) against %s" % (regressions, baseline_path))
+        return 1
+    print("no regressions against %s" % baseline_path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
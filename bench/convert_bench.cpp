@@ -0,0 +1,212 @@
+// Sample format conversion: every kernel against the scalar reference (bit exact, odd lengths and misaligned
+// buffers included), the full scale edges, a pipeline fed int packets against one fed the same samples as float, and
+// what each encoding costs per sample at each SIMD level.
+// scons bench && ./bench/bin/convert_bench [seconds]
+
+#include "capture_pipeline.hpp"
+#include "sample_convert.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const SampleEncoding ENCODINGS[] = { SampleEncoding::Int16, SampleEncoding::Int24, SampleEncoding::Int32, SampleEncoding::Float32 };
+
+CaptureFormat FormatOf(SampleEncoding encoding, uint32_t sampleRate) {
+	const uint16_t bits = static_cast<uint16_t>(BytesPerSample(encoding) * 8);
+	return CaptureFormat { sampleRate, 2, bits, encoding == SampleEncoding::Float32 ? SampleType::Float : SampleType::Int };
+}
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+// random bytes are valid samples for every integer encoding, floats get random values in [-1, 1]
+std::vector<uint8_t> RandomSamples(SampleEncoding encoding, size_t sampleCount, uint32_t seed) {
+	std::mt19937 random { seed };
+	std::vector<uint8_t> bytes(sampleCount * BytesPerSample(encoding) + 16);
+	if(encoding == SampleEncoding::Float32) {
+		std::uniform_real_distribution<float> distribution { -1.0f, 1.0f };
+		for(size_t i = 0; i < sampleCount; i++) {
+			const float value = distribution(random);
+			memcpy(bytes.data() + i * 4, &value, sizeof(value));
+		}
+	} else {
+		for(uint8_t& byte : bytes) byte = static_cast<uint8_t>(random());
+	}
+	return bytes;
+}
+
+bool CheckAgainstReference() {
+	bool ok = true;
+	for(SampleEncoding encoding : ENCODINGS) {
+		const SampleConverter reference = SelectConverter(encoding, SimdLevel::Scalar);
+		for(SimdLevel level : AvailableLevels()) {
+			const SampleConverter kernel = SelectConverter(encoding, level);
+			size_t mismatches = 0;
+			size_t cases = 0;
+			for(size_t count : { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1000, 4099 }) {
+				for(size_t offset : { 0, 1, 3 }) {
+					const std::vector<uint8_t> input = RandomSamples(encoding, count + offset, uint32_t(count * 7 + offset));
+					const uint8_t* samples = input.data() + offset;
+					// one past the end is a canary, nobody may write it
+					std::vector<float> expected(count + 1, 7.0f);
+					std::vector<float> actual(count + 2, 7.0f);
+					reference(samples, expected.data(), count);
+					kernel(samples, actual.data() + 1, count);
+					if(memcmp(expected.data(), actual.data() + 1, (count + 1) * sizeof(float)) != 0) mismatches++;
+					cases++;
+				}
+			}
+			ok = ok && mismatches == 0;
+			printf("  %-7s %-6s %zu lengths and alignments, %zu differ from the reference  %s\n", SampleEncodingName(encoding),
+				SimdLevelName(level), cases, mismatches, mismatches == 0 ? "ok" : "FAIL");
+		}
+	}
+	return ok;
+}
+
+// the most negative value is exactly -1, the most positive one step short of 1
+bool CheckFullScale() {
+	const uint8_t int16[] = { 0x00, 0x80, 0xFF, 0x7F, 0x00, 0x00, 0xFF, 0xFF };
+	const uint8_t int24[] = { 0x00, 0x00, 0x80, 0xFF, 0xFF, 0x7F, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF };
+	const uint8_t int32[] = { 0x00, 0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF, 0x7F, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF };
+	struct Case {
+		SampleEncoding encoding;
+		const uint8_t* input;
+		float expected[4];
+	} cases[] = {
+		{ SampleEncoding::Int16, int16, { -1.0f, 32767.0f / 32768.0f, 0.0f, -1.0f / 32768.0f } },
+		{ SampleEncoding::Int24, int24, { -1.0f, 8388607.0f / 8388608.0f, 0.0f, -1.0f / 8388608.0f } },
+		{ SampleEncoding::Int32, int32, { -1.0f, 1.0f, 0.0f, -1.0f / 2147483648.0f } },
+	};
+
+	bool ok = true;
+	for(const Case& test : cases) {
+		for(SimdLevel level : AvailableLevels()) {
+			float output[4];
+			SelectConverter(test.encoding, level)(test.input, output, 4);
+			// int32's largest value rounds up to 1.0 in a float, like it does everywhere else
+			ok = ok && memcmp(output, test.expected, sizeof(output)) == 0;
+		}
+	}
+	printf("  full scale edges  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// The same samples through an int pipeline and a float one have to come out of the ring identical, direct and
+// through the resampler, and taps have to see float either way
+bool CheckPipeline() {
+	class Collect : public CaptureTap {
+	public:
+		void OnFrames(const uint8_t* frames, uint64_t frameCount) override {
+			const StereoFrame* stereo = reinterpret_cast<const StereoFrame*>(frames);
+			for(uint64_t i = 0; i < frameCount; i++) seen.push_back(frames != nullptr ? stereo[i] : StereoFrame { 0.0f, 0.0f });
+		}
+		std::vector<StereoFrame> seen;
+	};
+
+	bool ok = true;
+	for(SampleEncoding encoding : { SampleEncoding::Int16, SampleEncoding::Int24, SampleEncoding::Int32 }) {
+		for(uint32_t sourceRate : { 48000u, 44100u }) {
+			CapturePipeline ints { 16384 };
+			CapturePipeline floats { 16384 };
+			ints.Configure(FormatOf(encoding, sourceRate), 48000);
+			floats.Configure(FormatOf(SampleEncoding::Float32, sourceRate), 48000);
+			CapturePipeline::Reader intReader { ints.Ring() };
+			CapturePipeline::Reader floatReader { floats.Ring() };
+			Collect tap;
+			ints.AttachTap(&tap);
+
+			constexpr uint32_t PACKET_FRAMES = 441;
+			const SampleConverter reference = SelectConverter(encoding, SimdLevel::Scalar);
+			std::vector<float> asFloat(PACKET_FRAMES * 2);
+			std::vector<StereoFrame> intOutput(16384), floatOutput(16384);
+			size_t compared = 0, differing = 0, tapDiffering = 0;
+
+			for(uint32_t packetIndex = 0; packetIndex < 100; packetIndex++) {
+				const std::vector<uint8_t> samples = RandomSamples(encoding, PACKET_FRAMES * 2, packetIndex);
+				reference(samples.data(), asFloat.data(), asFloat.size());
+
+				CapturePacket packet { samples.data(), PACKET_FRAMES };
+				packet.position = uint64_t(packetIndex) * PACKET_FRAMES;
+				packet.timed = true;
+				packet.silent = packetIndex % 10 == 9;
+				if(packet.silent) packet.frames = nullptr;
+				ints.OnPacket(packet);
+				packet.frames = packet.silent ? nullptr : reinterpret_cast<const uint8_t*>(asFloat.data());
+				floats.OnPacket(packet);
+
+				for(uint32_t i = 0; i < PACKET_FRAMES && !packet.silent; i++) {
+					const StereoFrame& seen = tap.seen[tap.seen.size() - PACKET_FRAMES + i];
+					if(seen.left != asFloat[i * 2] || seen.right != asFloat[i * 2 + 1]) tapDiffering++;
+				}
+
+				const size_t read = intReader.Read(intOutput.data(), intOutput.size());
+				const size_t floatRead = floatReader.Read(floatOutput.data(), floatOutput.size());
+				if(read != floatRead) differing++;
+				for(size_t i = 0; i < std::min(read, floatRead); i++) {
+					if(memcmp(&intOutput[i], &floatOutput[i], sizeof(StereoFrame)) != 0) differing++;
+				}
+				compared += read;
+			}
+			ints.DetachTap(&tap);
+
+			const bool passed = differing == 0 && tapDiffering == 0 && compared > 0 && ints.RejectedFrames() == 0;
+			ok = ok && passed;
+			printf("  pipeline %-6s %5u Hz  %zu frames, %zu differ from float input, taps %zu  %s\n", SampleEncodingName(encoding),
+				sourceRate, compared, differing, tapDiffering, passed ? "ok" : "FAIL");
+		}
+	}
+	return ok;
+}
+
+void MeasureThroughput(double seconds) {
+	constexpr size_t SAMPLES = 1 << 16;
+	for(SampleEncoding encoding : ENCODINGS) {
+		const std::vector<uint8_t> input = RandomSamples(encoding, SAMPLES, 1);
+		std::vector<float> output(SAMPLES);
+		for(SimdLevel level : AvailableLevels()) {
+			const SampleConverter kernel = SelectConverter(encoding, level);
+			uint64_t converted = 0;
+			const auto start = Clock::now();
+			const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+			while(Clock::now() < end) {
+				for(int i = 0; i < 16; i++) kernel(input.data(), output.data(), SAMPLES);
+				converted += 16 * SAMPLES;
+			}
+			const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			printf("  %-7s %-6s %7.3f ns/sample  %7.2f Msamples/s  %.4f ms per second of 48kHz stereo\n", SampleEncodingName(encoding),
+				SimdLevelName(level), nanoseconds / converted, converted / nanoseconds * 1000.0, nanoseconds / converted * 96000 / 1e6);
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	bool ok = CheckAgainstReference();
+	ok = CheckFullScale() && ok;
+	ok = CheckPipeline() && ok;
+	MeasureThroughput(seconds);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,396 @@
+// Insert chain: the gain ramp, biquad and energy kernels against the scalar reference and what they cost per level,
+// each processor doing what it says on a tone (gain, high pass response, compressor reduction, the limiter's ceiling,
+// loudness converging and holding through a pause), parameter changes and edits from another thread while a
+// "capture thread" runs the chain flat out, the queue overflowing with nothing draining it, and a pipeline handing its
+// taps and ring the processed audio. Then every processor's time per frame as the chain itself recorded it.
+// scons bench && ./bench/bin/insert_chain_bench [seconds]
+
+#include "capture_pipeline.hpp"
+#include "insert_chain.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t PACKET_FRAMES = 480;
+constexpr double PI = 3.14159265358979323846;
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+std::vector<StereoFrame> Tone(double frequency, float amplitude, size_t frames, double phase = 0.0) {
+	std::vector<StereoFrame> tone(frames);
+	for(size_t i = 0; i < frames; i++) {
+		const float sample = amplitude * static_cast<float>(std::sin(phase + 2.0 * PI * frequency * i / SAMPLE_RATE));
+		tone[i] = StereoFrame { sample, sample };
+	}
+	return tone;
+}
+
+std::vector<StereoFrame> Noise(size_t frames, uint32_t seed) {
+	std::mt19937 random { seed };
+	std::uniform_real_distribution<float> distribution { -0.5f, 0.5f };
+	std::vector<StereoFrame> noise(frames);
+	for(StereoFrame& frame : noise) frame = StereoFrame { distribution(random), distribution(random) };
+	return noise;
+}
+
+// Runs frames through the chain a packet at a time, like a capture thread would
+void Run(InsertChain& chain, std::vector<StereoFrame>& frames) {
+	for(size_t i = 0; i < frames.size(); i += PACKET_FRAMES) {
+		chain.Process(frames.data() + i, std::min(PACKET_FRAMES, frames.size() - i), SAMPLE_RATE);
+	}
+}
+
+float Peak(const std::vector<StereoFrame>& frames, size_t from, size_t to) {
+	float peak = 0.0f;
+	for(size_t i = from; i < to; i++) peak = std::max({ peak, std::fabs(frames[i].left), std::fabs(frames[i].right) });
+	return peak;
+}
+
+double Decibels(double gain) {
+	return 20.0 * std::log10(std::max(gain, 1e-12));
+}
+
+template<typename Function>
+double NanosecondsPerFrame(size_t frames, Function&& function) {
+	double best = 1e30;
+	for(int round = 0; round < 5; round++) {
+		const auto start = Clock::now();
+		for(int repeat = 0; repeat < 20; repeat++) function();
+		best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (20.0 * frames));
+	}
+	return best;
+}
+
+bool CheckKernels() {
+	bool ok = true;
+	const std::vector<StereoFrame> input = Noise(4099, 3);
+	BiquadCoefficients coefficients;
+	coefficients.b0 = 0.9f;
+	coefficients.b1 = -1.8f;
+	coefficients.b2 = 0.9f;
+	coefficients.a1 = -1.79f;
+	coefficients.a2 = 0.81f;
+
+	std::vector<StereoFrame> rampReference = input;
+	SelectGainRamp(SimdLevel::Scalar)(rampReference.data(), rampReference.size(), 0.25f, 0.0003f);
+	std::vector<StereoFrame> biquadReference = input;
+	BiquadState referenceState;
+	SelectBiquad(SimdLevel::Scalar)(biquadReference.data(), biquadReference.size(), coefficients, referenceState);
+	const float energyReference = SelectEnergy(SimdLevel::Scalar)(input.data(), input.size());
+
+	printf("kernels against the scalar reference, ns/frame:\n");
+	for(SimdLevel level : AvailableLevels()) {
+		std::vector<StereoFrame> ramped = input;
+		SelectGainRamp(level)(ramped.data(), ramped.size(), 0.25f, 0.0003f);
+		std::vector<StereoFrame> filtered = input;
+		BiquadState state;
+		SelectBiquad(level)(filtered.data(), filtered.size(), coefficients, state);
+		const float energy = SelectEnergy(level)(input.data(), input.size());
+
+		const bool rampExact = memcmp(ramped.data(), rampReference.data(), input.size() * sizeof(StereoFrame)) == 0;
+		const bool biquadExact = memcmp(filtered.data(), biquadReference.data(), input.size() * sizeof(StereoFrame)) == 0 &&
+			memcmp(&state, &referenceState, sizeof(state)) == 0;
+		const bool energyClose = std::fabs(energy - energyReference) <= energyReference * 1e-5f;
+
+		std::vector<StereoFrame> scratch = input;
+		const double rampTime = NanosecondsPerFrame(scratch.size(), [&] { SelectGainRamp(level)(scratch.data(), scratch.size(), 1.0f, 0.0f); });
+		BiquadState timedState;
+		const double biquadTime = NanosecondsPerFrame(scratch.size(), [&] { SelectBiquad(level)(scratch.data(), scratch.size(), coefficients, timedState); });
+		volatile float sink = 0.0f;
+		const double energyTime = NanosecondsPerFrame(scratch.size(), [&] { sink = sink + SelectEnergy(level)(scratch.data(), scratch.size()); });
+
+		const bool levelOk = rampExact && biquadExact && energyClose;
+		ok = ok && levelOk;
+		printf("  %-6s gain ramp %.3f%s, biquad %.3f%s, energy %.3f%s  %s\n", SimdLevelName(level), rampTime, rampExact ? "" : " (differs)",
+			biquadTime, biquadExact ? "" : " (differs)", energyTime, energyClose ? "" : " (off)", levelOk ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+bool CheckProcessors() {
+	bool ok = true;
+	printf("processors on a tone:\n");
+
+	{
+		InsertChain chain;
+		const InsertChain::InsertId gain = chain.Add(InsertType::Gain, 0);
+		chain.SetParameter(gain, 0, -6.0f);
+		std::vector<StereoFrame> frames = Tone(1000.0, 0.5f, SAMPLE_RATE / 2);
+		Run(chain, frames);
+		const double change = Decibels(Peak(frames, SAMPLE_RATE / 4, frames.size()) / 0.5);
+		const bool passed = std::fabs(change + 6.0) < 0.05;
+		ok = ok && passed;
+		printf("  gain -6 dB: %+.2f dB  %s\n", change, passed ? "ok" : "FAIL");
+	}
+
+	{
+		double low = 0.0;
+		double high = 0.0;
+		for(double frequency : { 20.0, 1000.0 }) {
+			InsertChain tone;
+			tone.Add(InsertType::HighPass, 0);
+			std::vector<StereoFrame> frames = Tone(frequency, 0.5f, SAMPLE_RATE);
+			Run(tone, frames);
+			(frequency < 100.0 ? low : high) = Decibels(Peak(frames, SAMPLE_RATE / 2, frames.size()) / 0.5);
+		}
+		const bool passed = low < -20.0 && std::fabs(high) < 0.1;
+		ok = ok && passed;
+		printf("  high pass at 80 Hz: 20 Hz %+.1f dB, 1 kHz %+.2f dB  %s\n", low, high, passed ? "ok" : "FAIL");
+	}
+
+	{
+		InsertChain chain;
+		const InsertChain::InsertId compressor = chain.Add(InsertType::Compressor, 0);
+		chain.SetParameter(compressor, 0, -20.0f);
+		chain.SetParameter(compressor, 1, 4.0f);
+		chain.SetParameter(compressor, 2, 1.0f);
+		// a tone peaking at -8 dBFS is 12 dB over, 3/4 of that comes off
+		const float amplitude = static_cast<float>(std::pow(10.0, -8.0 / 20.0));
+		std::vector<StereoFrame> frames = Tone(1000.0, amplitude, SAMPLE_RATE * 2);
+		Run(chain, frames);
+		const double reduction = Decibels(Peak(frames, SAMPLE_RATE, frames.size()) / amplitude);
+		const bool passed = std::fabs(reduction + 9.0) < 1.0;
+		ok = ok && passed;
+		printf("  compressor -20 dB 4:1, tone at -8 dBFS: %+.2f dB (-9 expected)  %s\n", reduction, passed ? "ok" : "FAIL");
+	}
+
+	{
+		InsertChain chain;
+		const InsertChain::InsertId limiter = chain.Add(InsertType::Limiter, 0);
+		chain.SetParameter(limiter, 0, -3.0f);
+		std::vector<StereoFrame> frames = Noise(SAMPLE_RATE, 11);
+		for(StereoFrame& frame : frames) frame = StereoFrame { frame.left * 3.0f, frame.right * 3.0f };
+		Run(chain, frames);
+		const float ceiling = static_cast<float>(std::pow(10.0, -3.0 / 20.0));
+		const float peak = Peak(frames, 0, frames.size());
+		const bool passed = peak <= ceiling * 1.000001f && peak > ceiling * 0.99f;
+		ok = ok && passed;
+		printf("  limiter at -3 dB on noise peaking at +3.5 dBFS: peak %.2f dBFS  %s\n", Decibels(peak), passed ? "ok" : "FAIL");
+	}
+
+	{
+		InsertChain chain;
+		const InsertChain::InsertId loudness = chain.Add(InsertType::Loudness, 0);
+		chain.SetParameter(loudness, 0, -20.0f);
+		// about -31 LUFS, 11 dB short
+		const float amplitude = 0.03f;
+		std::vector<StereoFrame> frames = Tone(1000.0, amplitude, SAMPLE_RATE * 12);
+		Run(chain, frames);
+		const double settled = Decibels(Peak(frames, frames.size() - SAMPLE_RATE, frames.size()) / amplitude);
+		// -0.691 + 10 log10 of both channels' mean square, K weighting is within a fraction of a dB at 1 kHz
+		const float outputPeak = Peak(frames, frames.size() - SAMPLE_RATE, frames.size());
+		const double lufs = -0.691 + 10.0 * std::log10(outputPeak * outputPeak);
+
+		// a pause doesn't get boosted, and the tone comes back at the level it left at
+		std::vector<StereoFrame> pause(SAMPLE_RATE * 5);
+		Run(chain, pause);
+		std::vector<StereoFrame> back = Tone(1000.0, amplitude, SAMPLE_RATE / 5);
+		Run(chain, back);
+		const double resumed = Decibels(Peak(back, 0, back.size()) / amplitude);
+
+		const bool passed = std::fabs(lufs + 20.0) < 1.0 && std::fabs(resumed - settled) < 0.5 && Peak(pause, 0, pause.size()) == 0.0f;
+		ok = ok && passed;
+		printf("  loudness to -20 LUFS from about -31: %+.1f dB after 12 s (%.1f LUFS), %+.1f dB after a 5 s pause  %s\n",
+			settled, lufs, resumed, passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// Main thread edits and sets parameters as fast as it can while another thread runs the chain flat out
+bool CheckConcurrentControl(double seconds) {
+	InsertChain chain;
+	const InsertChain::InsertId gain = chain.Add(InsertType::Gain, 0);
+	std::atomic<bool> done { false };
+	std::atomic<uint64_t> blocks { 0 };
+	std::thread capture([&] {
+		std::vector<StereoFrame> frames = Noise(PACKET_FRAMES, 5);
+		while(!done) {
+			chain.Process(frames.data(), frames.size(), SAMPLE_RATE);
+			// keep it from blowing up or dying out under random gains
+			for(StereoFrame& frame : frames) frame = StereoFrame { std::clamp(frame.left, -1.0f, 1.0f), std::clamp(frame.right, -1.0f, 1.0f) };
+			blocks++;
+		}
+	});
+
+	std::mt19937 random { 9 };
+	std::uniform_real_distribution<float> decibels { -40.0f, 6.0f };
+	uint64_t changes = 0;
+	uint64_t edits = 0;
+	const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	while(Clock::now() < end) {
+		for(int i = 0; i < 100; i++) {
+			chain.SetParameter(gain, 0, decibels(random));
+			changes++;
+		}
+		const InsertChain::InsertId added = chain.Add(static_cast<InsertType>(edits % INSERT_TYPES), edits % 3);
+		chain.Move(added, 0);
+		chain.SetBypassed(added, edits % 2 == 0);
+		chain.Remove(added);
+		edits++;
+	}
+	chain.SetParameter(gain, 0, -12.0f);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	done = true;
+	capture.join();
+
+	// the last value is what the capture thread ended up with
+	std::vector<StereoFrame> frames = Tone(1000.0, 0.5f, SAMPLE_RATE / 2);
+	Run(chain, frames);
+	const double level = Decibels(Peak(frames, SAMPLE_RATE / 4, frames.size()) / 0.5);
+	const bool ok = std::fabs(level + 12.0) < 0.05 && blocks > 0 && chain.Order().size() == 1;
+	printf("control from another thread: %llu parameter changes and %llu add/move/remove rounds over %llu blocks, %llu overflows,"
+		" ends at %+.2f dB  %s\n", (unsigned long long)changes, (unsigned long long)edits, (unsigned long long)blocks.load(),
+		(unsigned long long)chain.Overflows(), level, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// Nothing drains the queue (no capture running), it fills up, and the next block still gets the latest values
+bool CheckOverflow() {
+	InsertChain chain;
+	const InsertChain::InsertId gain = chain.Add(InsertType::Gain, 0);
+	const InsertChain::InsertId limiter = chain.Add(InsertType::Limiter, 1);
+	for(int i = 0; i < 1000; i++) {
+		chain.SetParameter(gain, 0, -30.0f + i * 0.01f);
+		chain.SetParameter(limiter, 0, -20.0f);
+	}
+	chain.SetParameter(gain, 0, 6.0f);
+	chain.SetParameter(limiter, 0, -6.0f);
+
+	std::vector<StereoFrame> frames = Tone(1000.0, 0.25f, SAMPLE_RATE / 2);
+	Run(chain, frames);
+	// +6 dB takes the tone to about -6 dBFS, right at the limiter's ceiling
+	const double level = Decibels(Peak(frames, SAMPLE_RATE / 4, frames.size()));
+	const bool ok = chain.Overflows() > 0 && std::fabs(level + 6.0) < 0.1;
+	printf("queue overflow: %llu commands didn't fit, the chain still ends up at %.2f dBFS  %s\n", (unsigned long long)chain.Overflows(),
+		level, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+class PeakTap : public CaptureTap {
+public:
+	void OnFrames(const uint8_t* frames, uint64_t frameCount) override {
+		const StereoFrame* stereo = reinterpret_cast<const StereoFrame*>(frames);
+		for(uint64_t i = 0; i < frameCount; i++) peak = std::max(peak, std::fabs(stereo[i].left));
+	}
+
+	float peak = 0.0f;
+};
+
+// The taps and the ring get the processed frames, on the direct, converting and resampling paths
+bool CheckPipeline() {
+	bool ok = true;
+	printf("pipeline with a -6 dB gain insert attached:\n");
+	const struct {
+		const char* name;
+		CaptureFormat format;
+		uint32_t outputRate;
+	} cases[] = {
+		{ "float, as is", CaptureFormat { SAMPLE_RATE, 2, 32, SampleType::Float }, SAMPLE_RATE },
+		{ "int16", CaptureFormat { SAMPLE_RATE, 2, 16, SampleType::Int }, SAMPLE_RATE },
+		{ "float, resampled", CaptureFormat { SAMPLE_RATE, 2, 32, SampleType::Float }, 44100 },
+	};
+	for(const auto& test : cases) {
+		CapturePipeline pipeline { 16384 };
+		pipeline.Configure(test.format, test.outputRate);
+		CapturePipeline::Reader reader { pipeline.Ring() };
+		PeakTap tap;
+		pipeline.AttachTap(&tap);
+
+		InsertChain chain;
+		const InsertChain::InsertId gain = chain.Add(InsertType::Gain, 0);
+		chain.SetParameter(gain, 0, -6.0f);
+		const bool attached = pipeline.AttachInserts(&chain);
+		InsertChain other;
+		const bool refused = !pipeline.AttachInserts(&other);
+
+		const std::vector<StereoFrame> tone = Tone(1000.0, 0.5f, SAMPLE_RATE / 2);
+		std::vector<int16_t> pcm(tone.size() * 2);
+		for(size_t i = 0; i < tone.size(); i++) {
+			pcm[i * 2] = static_cast<int16_t>(tone[i].left * 32767.0f);
+			pcm[i * 2 + 1] = static_cast<int16_t>(tone[i].right * 32767.0f);
+		}
+		const uint8_t* bytes = test.format.bitsPerSample == 16 ? reinterpret_cast<const uint8_t*>(pcm.data()) : reinterpret_cast<const uint8_t*>(tone.data());
+		for(size_t i = 0; i < tone.size(); i += PACKET_FRAMES) {
+			CapturePacket packet;
+			packet.frames = bytes + i * test.format.BytesPerFrame();
+			packet.frameCount = PACKET_FRAMES;
+			pipeline.OnPacket(packet);
+		}
+
+		std::vector<StereoFrame> output(8192);
+		const size_t read = reader.Read(output.data(), output.size());
+		const double ring = Decibels(Peak(output, read / 2, read) / 0.5);
+		const double tapped = Decibels(tap.peak / 0.5);
+
+		pipeline.DetachInserts(&chain);
+		pipeline.DetachTap(&tap);
+		// set before the first block, so there's no ramp and the tap's peak is already down too
+		const bool passed = attached && refused && std::fabs(ring + 6.0) < 0.1 && std::fabs(tapped + 6.0) < 0.1;
+		ok = ok && passed;
+		printf("  %-17s ring %+.2f dB, taps %+.2f dB  %s\n", test.name, ring, tapped, passed ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// Every processor alone and then all of them in a row, timed by the chain itself
+void ReportTiming(double seconds) {
+	const size_t frames = static_cast<size_t>(seconds * SAMPLE_RATE);
+	const std::vector<StereoFrame> music = Noise(frames, 13);
+
+	printf("time per frame as the chain records it, %zu frame blocks (block p50 / p99 in usec):\n", PACKET_FRAMES);
+	for(SimdLevel level : AvailableLevels()) {
+		printf("  %s\n", SimdLevelName(level));
+		InsertChain chain { level };
+		std::vector<InsertChain::InsertId> ids;
+		for(size_t type = 0; type < INSERT_TYPES; type++) ids.push_back(chain.Add(static_cast<InsertType>(type), type));
+
+		std::vector<StereoFrame> block = music;
+		const auto start = Clock::now();
+		Run(chain, block);
+		const double total = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+
+		double sum = 0.0;
+		for(InsertChain::InsertId id : ids) {
+			const InsertTiming::Snapshot timing = *chain.Timing(id);
+			sum += timing.NanosecondsPerFrame();
+			printf("    %-11s %6.2f ns/frame  %5.2f / %5.2f\n", InsertTypeName(*chain.TypeOf(id)), timing.NanosecondsPerFrame(),
+				timing.blockNanoseconds.Percentile(0.5) / 1000.0, timing.blockNanoseconds.Percentile(0.99) / 1000.0);
+		}
+		printf("    whole chain %6.2f ns/frame (%.2f in the inserts), %.3f%% of a core at 48 kHz\n", total, sum, total * SAMPLE_RATE / 1e7);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+	bool ok = CheckKernels();
+	ok = CheckProcessors() && ok;
+	ok = CheckConcurrentControl(seconds) && ok;
+	ok = CheckOverflow() && ok;
+	ok = CheckPipeline() && ok;
+	ReportTiming(seconds * 5.0);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
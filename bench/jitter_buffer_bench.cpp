@@ -0,0 +1,171 @@
+// Steady state latency and cost of holding a reader at a target latency while the capture clock runs skewed
+// against the mixer's, plain Reader versus JitterBuffer.
+//
+// Runs on a simulated clock: the capture delivers packets at its (skewed) rate with random delivery jitter and the
+// mixer pulls blocks at exactly the nominal rate, events in timestamp order on one thread. Minutes of audio take a
+// fraction of a second and every run is reproducible. Only the Mix calls themselves are timed on the real clock.
+// scons bench && ./bench/bin/jitter_buffer_bench [seconds] [target_ms] [jitter_ms]
+
+#include "capture_pipeline.hpp"
+#include "jitter_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+constexpr uint32_t PACKET_FRAMES = 480;
+constexpr size_t MIX_FRAMES = 512;
+
+struct Result {
+	double meanLatency;
+	double minLatency;
+	double maxLatency;
+	uint64_t underrunFrames;
+	uint64_t droppedFrames;
+	uint64_t resyncs;
+	double correctionPpm;
+	double correctionSpreadPpm;
+	double mixMicroseconds;
+};
+
+// adaptive = false is what the stream did before: start target frames behind the live edge and read whatever's there
+Result Simulate(double skewPpm, bool adaptive, double seconds, uint32_t target, double jitterSeconds) {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(CaptureFormat { SAMPLE_RATE, 2, 32, SampleType::Float }, SAMPLE_RATE);
+
+	std::unique_ptr<CapturePipeline::Reader> reader;
+	std::unique_ptr<JitterBuffer> jitter;
+	if(adaptive) {
+		jitter = std::make_unique<JitterBuffer>(pipeline.Ring(), SAMPLE_RATE, target);
+		jitter->Start();
+	} else {
+		reader = std::make_unique<CapturePipeline::Reader>(pipeline.Ring());
+	}
+	bool readerStarted = false;
+
+	std::vector<StereoFrame> packet(PACKET_FRAMES);
+	std::vector<StereoFrame> output(MIX_FRAMES);
+	double phase = 0.0;
+
+	// the capture runs at SAMPLE_RATE * (1 + skew) as measured by the mixer's clock
+	const double packetPeriod = PACKET_FRAMES / (SAMPLE_RATE * (1.0 + skewPpm * 1e-6));
+	const double mixPeriod = double(MIX_FRAMES) / SAMPLE_RATE;
+	uint32_t rng = 1;
+	auto jitterSample = [&] {
+		rng = rng * 1664525u + 1013904223u;
+		return jitterSeconds * (rng >> 8) / double(1 << 24);
+	};
+
+	uint64_t packetIndex = 0;
+	double nextPacket = jitterSample();
+	double nextMix = mixPeriod;
+	uint64_t underrunFrames = 0;
+	double latencySum = 0.0;
+	double minLatency = 1e30;
+	double maxLatency = 0.0;
+	uint64_t latencySamples = 0;
+	double correctionSum = 0.0;
+	double minCorrection = 1.0;
+	double maxCorrection = -1.0;
+	double mixMicroseconds = 0.0;
+	uint64_t mixes = 0;
+
+	while(nextMix < seconds) {
+		if(nextPacket <= nextMix) {
+			for(StereoFrame& frame : packet) {
+				const float value = 0.25f * static_cast<float>(std::sin(phase));
+				frame = StereoFrame { value, value };
+				phase += 2.0 * 3.14159265358979323846 * 440.0 / SAMPLE_RATE;
+			}
+			pipeline.OnPacket(CapturePacket { reinterpret_cast<const uint8_t*>(packet.data()), PACKET_FRAMES });
+
+			// delivery jitter delays a packet but never reorders them
+			packetIndex++;
+			nextPacket = std::max(nextPacket, packetIndex * packetPeriod + jitterSample());
+			continue;
+		}
+
+		if(!adaptive && !readerStarted) {
+			reader->SeekToLive(target);
+			readerStarted = true;
+		}
+
+		const auto start = Clock::now();
+		const size_t mixed = adaptive ? jitter->Mix(output.data(), MIX_FRAMES) : reader->Read(output.data(), MIX_FRAMES);
+		mixMicroseconds += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		mixes++;
+
+		if(!adaptive) underrunFrames += MIX_FRAMES - mixed;
+
+		// only the second half counts as steady state
+		if(nextMix > seconds / 2) {
+			const double latency = adaptive ? jitter->Latency() : double(reader->Lag());
+			latencySum += latency;
+			minLatency = std::min(minLatency, latency);
+			maxLatency = std::max(maxLatency, latency);
+			latencySamples++;
+
+			if(adaptive) {
+				const double correction = jitter->Correction();
+				correctionSum += correction;
+				minCorrection = std::min(minCorrection, correction);
+				maxCorrection = std::max(maxCorrection, correction);
+			}
+		}
+
+		nextMix += mixPeriod;
+	}
+
+	Result result { };
+	result.meanLatency = latencySamples ? latencySum / latencySamples : 0.0;
+	result.minLatency = latencySamples ? minLatency : 0.0;
+	result.maxLatency = maxLatency;
+	result.underrunFrames = adaptive ? jitter->UnderrunFrames() : underrunFrames;
+	result.droppedFrames = adaptive ? jitter->DroppedCount() : reader->DroppedCount();
+	result.resyncs = adaptive ? jitter->Resyncs() : 0;
+	result.correctionPpm = adaptive && latencySamples ? correctionSum / latencySamples * 1e6 : 0.0;
+	result.correctionSpreadPpm = adaptive && latencySamples ? (maxCorrection - minCorrection) * 1e6 : 0.0;
+	result.mixMicroseconds = mixes ? mixMicroseconds / mixes : 0.0;
+	return result;
+}
+
+double Milliseconds(double frames) {
+	return frames * 1000.0 / SAMPLE_RATE;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 600.0;
+	const double targetMilliseconds = argc > 2 ? atof(argv[2]) : 30.0;
+	const double jitterMilliseconds = argc > 3 ? atof(argv[3]) : 4.0;
+	const uint32_t target = static_cast<uint32_t>(targetMilliseconds * SAMPLE_RATE / 1000.0);
+
+	printf("%.0f simulated seconds, target %.1f ms, packets %u frames with up to %.1f ms jitter, mixes %zu frames\n\n",
+		seconds, targetMilliseconds, PACKET_FRAMES, jitterMilliseconds, MIX_FRAMES);
+	printf("%8s  %-8s  %24s  %10s  %10s  %7s  %22s  %8s\n",
+		"skew", "mode", "latency ms (min/mean/max)", "underrun", "overrun", "resyncs", "correction (mean/span)", "mix us");
+
+	for(double skew : { 0.0, 50.0, -50.0, 200.0, -200.0, 1000.0, -1000.0 }) {
+		for(bool adaptive : { false, true }) {
+			const Result result = Simulate(skew, adaptive, seconds, target, jitterMilliseconds / 1000.0);
+			printf("%+6.0f ppm  %-8s  %7.2f / %6.2f / %7.2f  %10llu  %10llu  %7llu  %+8.1f / %6.1f ppm  %8.2f\n",
+				skew, adaptive ? "adaptive" : "fixed",
+				Milliseconds(result.minLatency), Milliseconds(result.meanLatency), Milliseconds(result.maxLatency),
+				(unsigned long long)result.underrunFrames, (unsigned long long)result.droppedFrames,
+				(unsigned long long)result.resyncs, result.correctionPpm, result.correctionSpreadPpm, result.mixMicroseconds);
+		}
+	}
+
+	return 0;
+}
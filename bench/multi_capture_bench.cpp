@@ -0,0 +1,315 @@
+// Several captures mixed into one ring: the accumulate kernels against the scalar reference, three sources that start
+// at different times, deliver in different packet sizes and at different delays lined up by their timestamps, one of
+// them stalling and coming back, gain and mute changes, then a real time run on synthetic sources and what a mixing
+// pass costs per frame for more and more sources.
+// scons bench && ./bench/bin/multi_capture_bench [seconds]
+
+#include "capture_mix.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+// somewhere well away from 0 on the capture clock
+constexpr uint64_t EPOCH = 10000000000ull;
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+std::vector<StereoFrame> RandomFrames(size_t count, uint32_t seed) {
+	std::mt19937 random { seed };
+	std::uniform_real_distribution<float> distribution { -1.0f, 1.0f };
+	std::vector<StereoFrame> frames(count);
+	for(StereoFrame& frame : frames) frame = StereoFrame { distribution(random), distribution(random) };
+	return frames;
+}
+
+// A session that's never started, so it has no source and the bench delivers into its pipeline by hand
+std::shared_ptr<CaptureSession> ManualSession(uint32_t id) {
+	static CaptureSessionRegistry registry { nullptr, SAMPLE_RATE, RING_FRAMES };
+	// the next test's sessions reuse the ids
+	registry.SetGracePeriod(CaptureSessionRegistry::Clock::duration::zero());
+	std::shared_ptr<CaptureSession> session = registry.Acquire(CaptureSessionKey { id, LoopbackMode::IncludeProcessTree }, std::chrono::milliseconds(30));
+	session->Pipeline().Configure(FORMAT, SAMPLE_RATE);
+	return session;
+}
+
+uint64_t TimeOf(uint64_t frame) {
+	return EPOCH + frame * 10000000 / SAMPLE_RATE;
+}
+
+bool CheckAgainstReference() {
+	bool ok = true;
+	const FrameAccumulator reference = SelectAccumulator(SimdLevel::Scalar);
+	for(SimdLevel level : AvailableLevels()) {
+		const FrameAccumulator kernel = SelectAccumulator(level);
+		size_t mismatches = 0;
+		size_t cases = 0;
+		for(size_t count : { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 17, 255, 256 }) {
+			for(float step : { 0.0f, 1.0f / 256, -0.75f / 100 }) {
+				const std::vector<StereoFrame> input = RandomFrames(count + 1, uint32_t(count));
+				std::vector<StereoFrame> expected = RandomFrames(count + 1, uint32_t(count + 1000));
+				std::vector<StereoFrame> actual = expected;
+				// one past the end is a canary
+				reference(input.data(), expected.data(), count, 0.8f, step);
+				kernel(input.data(), actual.data(), count, 0.8f, step);
+				if(memcmp(expected.data(), actual.data(), expected.size() * sizeof(StereoFrame)) != 0) mismatches++;
+				cases++;
+			}
+		}
+		ok = ok && mismatches == 0;
+		printf("  accumulate %-6s %zu lengths and ramps, %zu differ from the reference  %s\n", SimdLevelName(level), cases, mismatches,
+			mismatches == 0 ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// One source as the bench drives it: it started capturing at a global frame, delivers packets of its own size, and
+// each one only some delay after its last frame was captured
+struct Feed {
+	std::shared_ptr<CaptureSession> session;
+	uint64_t startFrame;
+	uint32_t packetFrames;
+	uint64_t delayTicks;
+	float impulse;
+	uint64_t next;
+	bool paused;
+};
+
+// Impulses at the same capture time from every source have to land on the same mix frame. Between them a source
+// stalls (the others carry on without it) and comes back, and gains and mutes change.
+bool CheckAlignment() {
+	constexpr uint64_t FRAMES = 120000;
+	// when every source has a click, and what the mix should make of them
+	const uint64_t CLICKS[] = { 24000, 48000, 84000, 108000 };
+	// the third one stalls in between, the first gets half gain and the second is muted for the last one
+	const float EXPECTED[] = { 0.7f, 0.3f, 0.7f, 0.45f };
+	constexpr uint64_t STALL_FROM = 36000, STALL_UNTIL = 60000, GAIN_FROM = 96000;
+
+	Feed feeds[] = {
+		{ ManualSession(1), 0, 480, 20000, 0.1f, 0, false },
+		{ ManualSession(2), 3000, 441, 70000, 0.2f, 3000, false },
+		{ ManualSession(3), 7001, 512, 30000, 0.4f, 7001, false },
+	};
+
+	CaptureMix mix { SAMPLE_RATE, RING_FRAMES };
+	for(Feed& feed : feeds) mix.AddSource(feed.session);
+	CaptureMix::Reader reader { mix.Ring() };
+
+	std::vector<StereoFrame> packet(512);
+	std::vector<StereoFrame> output;
+	std::vector<StereoFrame> read(RING_FRAMES);
+	std::vector<uint64_t> clickTimes;
+	bool stalledSeen = false;
+
+	// one step a millisecond, on a clock the packets' timestamps run on as well
+	for(uint64_t now = TimeOf(0); now < TimeOf(FRAMES); now += 10000) {
+		for(Feed& feed : feeds) {
+			feed.paused = feed.impulse == 0.4f && now >= TimeOf(STALL_FROM) && now < TimeOf(STALL_UNTIL);
+			while(feed.next + feed.packetFrames <= FRAMES && TimeOf(feed.next + feed.packetFrames) + feed.delayTicks <= now) {
+				const uint64_t first = feed.next;
+				feed.next += feed.packetFrames;
+				// a stalled target delivers nothing at all, its device position jumps when it's back
+				if(feed.paused) continue;
+
+				for(uint32_t i = 0; i < feed.packetFrames; i++) {
+					const uint64_t frame = first + i;
+					const bool click = std::find(std::begin(CLICKS), std::end(CLICKS), frame) != std::end(CLICKS);
+					packet[i] = click ? StereoFrame { feed.impulse, feed.impulse } : StereoFrame { 0.0f, 0.0f };
+				}
+				CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), feed.packetFrames };
+				captured.position = first - feed.startFrame;
+				captured.timestamp = TimeOf(first);
+				captured.timed = true;
+				feed.session->Pipeline().OnPacket(captured);
+			}
+		}
+
+		if(now >= TimeOf(GAIN_FROM) && mix.GetGain(0) == 1.0f) {
+			mix.SetGain(0, 0.5f);
+			mix.SetMuted(1, true);
+		}
+
+		mix.Process(now);
+		if(now >= TimeOf(STALL_FROM + 6000) && now < TimeOf(STALL_UNTIL)) stalledSeen = stalledSeen || (!mix.IsLive(2) && mix.IsLive(0));
+
+		const uint64_t position = reader.Position();
+		const size_t count = reader.Read(read.data(), read.size());
+		for(size_t i = 0; i < count; i++) {
+			if(read[i].left != 0.0f) clickTimes.push_back(mix.CaptureTimeAt(position + i).value_or(0));
+		}
+		output.insert(output.end(), read.begin(), read.begin() + count);
+	}
+
+	std::vector<float> clicks;
+	for(const StereoFrame& frame : output) {
+		if(frame.left != 0.0f || frame.right != 0.0f) clicks.push_back(frame.left);
+	}
+
+	bool ok = clicks.size() == std::size(CLICKS);
+	for(size_t i = 0; ok && i < clicks.size(); i++) {
+		ok = std::fabs(clicks[i] - EXPECTED[i]) < 1e-6f;
+		// where the mix says it was captured, to the frame
+		ok = ok && std::llabs(static_cast<int64_t>(clickTimes[i]) - static_cast<int64_t>(TimeOf(CLICKS[i]))) <= 10000000 / SAMPLE_RATE + 1;
+	}
+	ok = ok && stalledSeen && mix.IsLive(2) && mix.Realignments() == 0;
+	// everything but the slowest source's delay and the last partial packets
+	ok = ok && output.size() > FRAMES - 2 * SAMPLE_RATE / 10;
+
+	printf("  3 sources, %zu frames mixed, clicks", output.size());
+	for(float click : clicks) printf(" %.2f", click);
+	printf(" (want 0.70 0.30 0.70 0.45), stall seen %s, realignments %llu  %s\n", stalledSeen ? "yes" : "no",
+		static_cast<unsigned long long>(mix.Realignments()), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// A source whose timestamps jump away from its ring positions (its clock was reset, say) gets moved back in line
+bool CheckRealignment() {
+	auto first = ManualSession(1);
+	auto second = ManualSession(2);
+	CaptureMix mix { SAMPLE_RATE, RING_FRAMES };
+	mix.AddSource(first);
+	mix.AddSource(second);
+
+	std::vector<StereoFrame> packet(480, StereoFrame { 0.0f, 0.0f });
+	uint64_t skew = 0;
+	for(uint64_t index = 0; index < 200; index++) {
+		const uint64_t frame = index * 480;
+		if(index == 100) skew = 10000000 / 100; // 10 ms
+		for(auto& [session, offset] : { std::make_pair(first, uint64_t(0)), std::make_pair(second, skew) }) {
+			CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), 480 };
+			captured.position = frame;
+			captured.timestamp = TimeOf(frame) + offset;
+			captured.timed = true;
+			session->Pipeline().OnPacket(captured);
+		}
+		mix.Process(TimeOf(frame + 480));
+	}
+
+	const bool ok = mix.Realignments() == 1 && mix.IsLive(0) && mix.IsLive(1);
+	printf("  a source's timestamps jumping 10 ms, realignments %llu  %s\n", static_cast<unsigned long long>(mix.Realignments()),
+		ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// Synthetic sources on their own threads with jitter, mixed by the mixing thread, read back in real time by a
+// consumer like the godot mixer: it shouldn't run dry once it prefilled
+bool RunRealTime(double seconds) {
+	constexpr size_t SOURCES = 3;
+	constexpr size_t MIX_FRAMES = 512;
+	std::vector<std::shared_ptr<CaptureSession>> sessions;
+	std::vector<std::unique_ptr<SyntheticCapture>> captures;
+	for(uint32_t i = 0; i < SOURCES; i++) {
+		sessions.push_back(ManualSession(i));
+		CapturePacing pacing;
+		pacing.jitterMicroseconds = 1500;
+		pacing.seed = i + 1;
+		pacing.periodMicroseconds = 10000 - i * 1000;
+		captures.push_back(std::make_unique<SyntheticCapture>(&sessions.back()->Pipeline(), FORMAT, pacing, 220.0 * (i + 1), 0.2f));
+	}
+
+	CaptureMix mix { SAMPLE_RATE, RING_FRAMES };
+	for(auto& session : sessions) mix.AddSource(session);
+	for(auto& capture : captures) capture->Start();
+	mix.Start();
+
+	CaptureMix::Reader reader { mix.Ring() };
+	while(reader.Lag() < SAMPLE_RATE / 25) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::vector<StereoFrame> output(MIX_FRAMES);
+	size_t underruns = 0;
+	uint64_t mixed = 0;
+	const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / SAMPLE_RATE));
+	auto deadline = Clock::now();
+	const auto end = deadline + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	while(Clock::now() < end) {
+		const size_t read = reader.Read(output.data(), MIX_FRAMES);
+		if(read < MIX_FRAMES) underruns++;
+		mixed += read;
+		deadline += period;
+		std::this_thread::sleep_until(deadline);
+	}
+
+	mix.Stop();
+	for(auto& capture : captures) capture->Stop();
+
+	bool live = true;
+	for(size_t i = 0; i < SOURCES; i++) live = live && mix.IsLive(i);
+	const bool ok = underruns == 0 && live && reader.DroppedCount() == 0;
+	printf("  real time, %zu jittery sources %.1f s, %llu frames read, %zu underruns, realignments %llu  %s\n", SOURCES, seconds,
+		static_cast<unsigned long long>(mixed), underruns, static_cast<unsigned long long>(mix.Realignments()), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// What one mixing pass costs per output frame, 10 ms of every source at a time
+void MeasureThroughput(double seconds) {
+	constexpr uint32_t PACKET_FRAMES = 480;
+	const std::vector<StereoFrame> packet = RandomFrames(PACKET_FRAMES, 1);
+	for(size_t sourceCount : { 1, 2, 4, 8 }) {
+		for(SimdLevel level : AvailableLevels()) {
+			std::vector<std::shared_ptr<CaptureSession>> sessions;
+			CaptureMix mix { SAMPLE_RATE, RING_FRAMES, level };
+			for(uint32_t i = 0; i < sourceCount; i++) {
+				sessions.push_back(ManualSession(i));
+				mix.AddSource(sessions.back(), 0.5f);
+			}
+
+			uint64_t frame = 0;
+			uint64_t mixed = 0;
+			Clock::duration spent { 0 };
+			const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+			while(Clock::now() < end) {
+				for(auto& session : sessions) {
+					CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), PACKET_FRAMES };
+					captured.position = frame;
+					captured.timestamp = TimeOf(frame);
+					captured.timed = true;
+					session->Pipeline().OnPacket(captured);
+				}
+				frame += PACKET_FRAMES;
+				const auto start = Clock::now();
+				mixed += mix.Process(TimeOf(frame));
+				spent += Clock::now() - start;
+			}
+			const double nanoseconds = std::chrono::duration<double, std::nano>(spent).count();
+			printf("  %zu sources %-6s %7.3f ns/frame  %.4f ms per second of 48kHz\n", sourceCount, SimdLevelName(level),
+				nanoseconds / std::max<uint64_t>(mixed, 1), nanoseconds / std::max<uint64_t>(mixed, 1) * 48000 / 1e6);
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	bool ok = CheckAgainstReference();
+	ok = CheckAlignment() && ok;
+	ok = CheckRealignment() && ok;
+	ok = RunRealTime(seconds) && ok;
+	MeasureThroughput(seconds / 8);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
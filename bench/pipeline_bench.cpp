@@ -0,0 +1,135 @@
+// Drives CapturePipeline with a paced synthetic (or replayed WAV) capture thread and a simulated mixer thread,
+// so the capture -> ring -> mixer path can be profiled under reproducible timing without Windows.
+// silent_every / drop_every flag every Nth packet silent / lose every Nth packet, to exercise the timeline handling.
+// scons bench && ./bench/bin/pipeline_bench [seconds] [period_us] [jitter_us] [replay.wav or ""] [mix_rate] [silent_every] [drop_every]
+
+#include "capture_pipeline.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t MIX_FRAMES = 512;
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 5.0;
+
+	CapturePacing pacing;
+	pacing.periodMicroseconds = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 10000;
+	pacing.jitterMicroseconds = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 2000;
+	pacing.silentEvery = argc > 6 ? static_cast<uint32_t>(atoi(argv[6])) : 0;
+	pacing.dropEvery = argc > 7 ? static_cast<uint32_t>(atoi(argv[7])) : 0;
+
+	CapturePipeline pipeline { 4096 };
+	CapturePipeline::Reader reader { pipeline.Ring() };
+
+	std::unique_ptr<PacedCaptureSource> source;
+	try {
+		if(argc > 4 && argv[4][0] != '\0') {
+			source = std::make_unique<ReplayCapture>(&pipeline, argv[4], pacing);
+		} else {
+			source = std::make_unique<SyntheticCapture>(&pipeline, CaptureFormat { 48000, 2, 32, SampleType::Float }, pacing);
+		}
+	} catch(const std::exception& ex) {
+		fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+
+	const CaptureFormat format = source->GetFormat();
+	const uint32_t mixRate = argc > 5 ? static_cast<uint32_t>(atoi(argv[5])) : format.sampleRate;
+	pipeline.Configure(format, mixRate);
+
+	std::vector<StereoFrame> output(MIX_FRAMES);
+	std::vector<double> mixMicroseconds;
+	// how long ago what each mix started with was captured, from the pipeline's timestamps
+	std::vector<double> captureAgeMilliseconds;
+	uint64_t requested = 0;
+	uint64_t delivered = 0;
+	uint64_t shortMixes = 0;
+	MixStats mixStats;
+
+	const auto mixPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / mixRate));
+	const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+
+	source->Start();
+
+	// give the capture side one packet of head start, like the real mixer would after _start
+	auto deadline = Clock::now() + std::chrono::microseconds(pacing.periodMicroseconds);
+	while(deadline < end) {
+		std::this_thread::sleep_until(deadline);
+		deadline += mixPeriod;
+
+		const size_t fill = reader.Lag();
+		const uint64_t droppedBefore = reader.DroppedCount();
+		const std::optional<uint64_t> captured = pipeline.CaptureTimeAt(reader.Position());
+		if(captured && fill > 0) {
+			const uint64_t now = CaptureClockNow();
+			captureAgeMilliseconds.push_back((static_cast<double>(now) - static_cast<double>(*captured)) / 10000.0);
+			mixStats.RecordCaptureLatency(now > *captured ? (now - *captured) / 10 : 0);
+		}
+
+		const auto mixStart = Clock::now();
+		const size_t mixed = pipeline.Mix(reader, output.data(), MIX_FRAMES);
+		mixMicroseconds.push_back(std::chrono::duration<double, std::micro>(Clock::now() - mixStart).count());
+		mixStats.RecordMix(MIX_FRAMES, mixed, fill, reader.DroppedCount() - droppedBefore);
+
+		requested += MIX_FRAMES;
+		delivered += mixed;
+		if(mixed < MIX_FRAMES) shortMixes++;
+	}
+
+	source->Stop();
+
+	std::sort(mixMicroseconds.begin(), mixMicroseconds.end());
+	auto percentile = [&](double p) { return mixMicroseconds.empty() ? 0.0 : mixMicroseconds[size_t(p * (mixMicroseconds.size() - 1))]; };
+	std::sort(captureAgeMilliseconds.begin(), captureAgeMilliseconds.end());
+	auto agePercentile = [&](double p) { return captureAgeMilliseconds.empty() ? 0.0 : captureAgeMilliseconds[size_t(p * (captureAgeMilliseconds.size() - 1))]; };
+
+	printf("format      %u Hz, %u ch, %u bit %s -> %u Hz%s\n", format.sampleRate, format.channels, format.bitsPerSample,
+		format.sampleType == SampleType::Float ? "float" : "int", mixRate, pipeline.IsResampling() ? " (resampled)" : "");
+	printf("pacing      period=%uus jitter=%uus packet=%u frames\n", pacing.periodMicroseconds, pacing.jitterMicroseconds, source->PacketFrames());
+	printf("packets     %llu (%llu lost)\n", (unsigned long long)source->PacketsDelivered(), (unsigned long long)source->PacketsDropped());
+	printf("mixes       %zu (%llu short)\n", mixMicroseconds.size(), (unsigned long long)shortMixes);
+	printf("underrun    %llu of %llu frames\n", (unsigned long long)(requested - delivered), (unsigned long long)requested);
+	printf("overrun     %llu frames\n", (unsigned long long)reader.DroppedCount());
+	printf("rejected    %llu frames\n", (unsigned long long)pipeline.RejectedFrames());
+	printf("mix cost    p50=%.2fus p99=%.2fus max=%.2fus\n", percentile(0.5), percentile(0.99), percentile(1.0));
+
+	// what the extension reports through get_stats() and the Performance monitors
+	const CaptureStats::Snapshot capture = pipeline.Stats().Read();
+	const MixStats::Snapshot mix = mixStats.Read();
+	printf("wakeups     %llu, %.2f packets/wakeup, %.1f frames/packet, p50=%lluus p99=%lluus max=%lluus\n",
+		(unsigned long long)capture.wakeups, capture.packetsPerWakeup.Mean(), capture.framesPerPacket.Mean(),
+		(unsigned long long)capture.wakeupMicroseconds.Percentile(0.5), (unsigned long long)capture.wakeupMicroseconds.Percentile(0.99),
+		(unsigned long long)capture.wakeupMicroseconds.max);
+	printf("fill        p5=%llu p50=%llu p99=%llu frames, %llu underruns, %llu overruns\n",
+		(unsigned long long)mix.fillFrames.Percentile(0.05), (unsigned long long)mix.fillFrames.Percentile(0.5),
+		(unsigned long long)mix.fillFrames.Percentile(0.99), (unsigned long long)mix.underruns, (unsigned long long)mix.overruns);
+
+	// with the gaps filled the ring holds exactly what the source produced, lost packets included
+	const uint64_t produced = (source->PacketsDelivered() + source->PacketsDropped()) * source->PacketFrames();
+	const double expected = static_cast<double>(produced) * mixRate / format.sampleRate;
+	printf("timeline    %llu silent frames, %llu discontinuities, %llu frames filled, %llu dropped as overlap\n",
+		(unsigned long long)capture.silentFrames, (unsigned long long)capture.discontinuities,
+		(unsigned long long)capture.gapFrames, (unsigned long long)capture.overlapFrames);
+	printf("            %llu frames in the ring for %.0f produced (%+.0f)\n", (unsigned long long)pipeline.Ring().WriteCursor(),
+		expected, static_cast<double>(pipeline.Ring().WriteCursor()) - expected);
+	printf("capture age p50=%.2fms p99=%.2fms max=%.2fms\n", agePercentile(0.5), agePercentile(0.99), agePercentile(1.0));
+	printf("            histogram p50=%.2fms p99=%.2fms max=%.2fms\n", mix.captureLatencyMicroseconds.Percentile(0.5) / 1000.0,
+		mix.captureLatencyMicroseconds.Percentile(0.99) / 1000.0, mix.captureLatencyMicroseconds.max / 1000.0);
+
+	return 0;
+}
@@ -0,0 +1,216 @@
+// ProcessRegistry against a fake process table: correctness checks for the index and its incremental updates,
+// then the cost of refreshing and looking things up, next to the linear window scan the stream used to do.
+// The old scan also made two syscalls (OpenProcess, GetProcessImageFileNameA) per window, which the fake can't
+// charge for, so its numbers here are a lower bound.
+// scons bench && ./bench/bin/process_registry_bench [processes]
+
+#include "process_registry.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+class FakeProcessTable : public ProcessEnumerator {
+public:
+	void EnumerateProcesses(std::vector<ProcessInfo>& out) override {
+		std::lock_guard<std::mutex> lock { mutex };
+		out.insert(out.end(), processes.begin(), processes.end());
+	}
+
+	void EnumerateWindows(std::vector<WindowInfo>& out) override {
+		std::lock_guard<std::mutex> lock { mutex };
+		out.insert(out.end(), windows.begin(), windows.end());
+	}
+
+	void Start(uint32_t processId, uint32_t parentProcessId, const std::string& exeName, const std::string& title = { }) {
+		std::lock_guard<std::mutex> lock { mutex };
+		processes.push_back(ProcessInfo { processId, parentProcessId, exeName });
+		if(!title.empty()) windows.push_back(WindowInfo { processId, title });
+	}
+
+	void Exit(uint32_t processId) {
+		std::lock_guard<std::mutex> lock { mutex };
+		for(size_t i = 0; i < processes.size(); i++) {
+			if(processes[i].processId == processId) {
+				processes.erase(processes.begin() + i);
+				break;
+			}
+		}
+		CloseWindowsLocked(processId);
+	}
+
+	void CloseWindows(uint32_t processId) {
+		std::lock_guard<std::mutex> lock { mutex };
+		CloseWindowsLocked(processId);
+	}
+
+	// what findWindowByExeName did: walk every window, resolve its owner's exe name into a fresh string, compare
+	std::optional<uint32_t> LinearFind(const std::string& exeName) {
+		std::lock_guard<std::mutex> lock { mutex };
+		for(const WindowInfo& window : windows) {
+			std::string name;
+			for(const ProcessInfo& process : processes) {
+				if(process.processId == window.processId) {
+					name = process.exeName;
+					break;
+				}
+			}
+			if(name == exeName) return window.processId;
+		}
+		return std::nullopt;
+	}
+
+	std::vector<ProcessInfo> processes;
+	std::vector<WindowInfo> windows;
+
+private:
+	void CloseWindowsLocked(uint32_t processId) {
+		for(size_t i = 0; i < windows.size();) {
+			if(windows[i].processId == processId) {
+				windows.erase(windows.begin() + i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	std::mutex mutex;
+};
+
+int failures = 0;
+
+void Check(bool condition, const char* what) {
+	if(!condition) {
+		printf("FAIL  %s\n", what);
+		failures++;
+	}
+}
+
+void CorrectnessChecks() {
+	auto table = std::make_unique<FakeProcessTable>();
+	FakeProcessTable& fake = *table;
+	fake.Start(4, 0, "System");
+	fake.Start(100, 4, "explorer.exe", "Desktop");
+	// spotify's tree: the root owns the window, helpers hang off it
+	fake.Start(200, 100, "Spotify.exe", "Spotify Premium");
+	fake.Start(201, 200, "Spotify.exe");
+	fake.Start(202, 200, "Spotify.exe");
+	fake.Start(150, 100, "Spotify.exe"); // lower PID but no window and not... well, a root, but windowless
+
+	ProcessRegistry registry { std::move(table), std::chrono::hours(1) };
+
+	Check(registry.ProcessCount() == 6, "initial build sees every process");
+	Check(registry.Find(ProcessQuery::ByExeName("spotify.exe")) == 200u, "exe lookup is case insensitive and prefers the window owner");
+	Check(registry.Find(ProcessQuery::ByWindowTitle("Spotify Premium")) == 200u, "title lookup");
+	Check(registry.Find(ProcessQuery::ById(201)) == 201u, "pid lookup");
+	Check(!registry.Find(ProcessQuery::ById(999)), "missing pid");
+	Check(registry.Refresh() == 0, "refresh without changes changes nothing");
+
+	fake.CloseWindows(200);
+	registry.Refresh();
+	Check(registry.Find(ProcessQuery::ByExeName("Spotify.exe")) == 150u, "without windows the lowest root wins");
+	Check(!registry.Find(ProcessQuery::ByWindowTitle("Spotify Premium")), "closed window's title is gone");
+
+	fake.Exit(150);
+	registry.Refresh();
+	Check(registry.Find(ProcessQuery::ByExeName("Spotify.exe")) == 200u, "then the root of the remaining tree");
+
+	fake.Exit(200);
+	fake.Exit(201);
+	fake.Exit(202);
+	registry.Refresh();
+	Check(!registry.Find(ProcessQuery::ByExeName("Spotify.exe")), "exited tree is gone");
+
+	// PID reused by something else between two refreshes
+	fake.Exit(100);
+	fake.Start(100, 4, "notepad.exe", "Untitled - Notepad");
+	registry.Refresh();
+	Check(!registry.Find(ProcessQuery::ByExeName("explorer.exe")), "reused pid drops the old name");
+	Check(registry.Find(ProcessQuery::ByExeName("notepad.exe")) == 100u, "reused pid indexes the new name");
+	Check(!registry.Find(ProcessQuery::ByWindowTitle("Desktop")), "reused pid drops the old titles");
+
+	std::atomic<uint32_t> appeared { 0 };
+	std::atomic<uint32_t> cancelled { 0 };
+	registry.WaitFor(ProcessQuery::ByExeName("game.exe"), [&](uint32_t processId) { appeared = processId; });
+	const ProcessRegistry::WaitId cancelId = registry.WaitFor(ProcessQuery::ByExeName("game.exe"), [&](uint32_t processId) { cancelled = processId; });
+	registry.CancelWait(cancelId);
+	registry.Refresh();
+	Check(appeared == 0, "wait doesn't fire early");
+
+	fake.Start(300, 4, "game.exe", "Game");
+	registry.Refresh();
+	Check(appeared == 300, "wait fires when the process appears");
+	Check(cancelled == 0, "cancelled wait doesn't fire");
+
+	uint32_t immediate = 0;
+	registry.WaitFor(ProcessQuery::ByWindowTitle("Game"), [&](uint32_t processId) { immediate = processId; });
+	Check(immediate == 300, "wait on something already running fires right away");
+}
+
+template<typename Function>
+double NanosecondsPer(size_t iterations, Function&& function) {
+	const auto start = Clock::now();
+	for(size_t i = 0; i < iterations; i++) function(i);
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+}
+
+void Benchmarks(uint32_t processCount) {
+	auto table = std::make_unique<FakeProcessTable>();
+	FakeProcessTable& fake = *table;
+	// a window for roughly every tenth process, like a desktop
+	for(uint32_t i = 0; i < processCount; i++) {
+		const uint32_t processId = 1000 + i * 4;
+		const std::string name = "process" + std::to_string(i % (processCount / 3 + 1)) + ".exe";
+		fake.Start(processId, 4, name, i % 10 == 0 ? "Window " + std::to_string(i) : std::string { });
+	}
+	const uint32_t lastWindowed = 1000 + ((processCount - 1) / 10 * 10) * 4;
+	const std::string lastName = "process" + std::to_string(((processCount - 1) / 10 * 10) % (processCount / 3 + 1)) + ".exe";
+
+	const auto buildStart = Clock::now();
+	ProcessRegistry registry { std::move(table), std::chrono::hours(1) };
+	const double buildMicroseconds = std::chrono::duration<double, std::micro>(Clock::now() - buildStart).count();
+
+	printf("%u processes, %zu windows\n", processCount, fake.windows.size());
+	printf("  initial build                 %10.1f us\n", buildMicroseconds);
+	printf("  refresh, nothing changed      %10.1f us\n", NanosecondsPer(20, [&](size_t) { registry.Refresh(); }) / 1000.0);
+
+	uint32_t nextProcessId = 1000 + processCount * 4;
+	const size_t churn = processCount / 100 + 1;
+	printf("  refresh, %4zu started/exited  %10.1f us\n", churn, NanosecondsPer(20, [&](size_t round) {
+		for(size_t i = 0; i < churn; i++) {
+			fake.Exit(1000 + uint32_t((round * churn + i) % processCount) * 4);
+			fake.Start(nextProcessId, 4, "churn.exe");
+			nextProcessId += 4;
+		}
+		registry.Refresh();
+	}) / 1000.0);
+
+	volatile uint32_t sink = 0;
+	printf("  linear scan by exe name       %10.1f ns\n", NanosecondsPer(2000, [&](size_t) { sink = fake.LinearFind(lastName).value_or(0); }));
+	printf("  indexed lookup by exe name    %10.1f ns\n", NanosecondsPer(200000, [&](size_t) { sink = registry.Find(ProcessQuery::ByExeName(lastName)).value_or(0); }));
+	printf("  indexed lookup by title       %10.1f ns\n", NanosecondsPer(200000, [&](size_t) { sink = registry.Find(ProcessQuery::ByWindowTitle("Window 0")).value_or(0); }));
+	printf("  indexed lookup by pid         %10.1f ns\n", NanosecondsPer(200000, [&](size_t) { sink = registry.Find(ProcessQuery::ById(lastWindowed)).value_or(0); }));
+	(void)sink;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const uint32_t processCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 400;
+
+	CorrectnessChecks();
+	printf("correctness: %s\n\n", failures == 0 ? "ok" : "FAILED");
+
+	Benchmarks(processCount);
+	Benchmarks(processCount * 10);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// The native side of AudioStreamWasapiAppCapture's pull API (get_frames_available / get_buffer / read_buffer):
+// what draining the ring costs per frame at different call sizes, down to one frame per call the way a script
+// looping over single frames would, and a live run with a paced producer that checks a puller sees every frame
+// exactly once while a playback reader keeps going untouched.
+// A script call adds its own overhead on top of the one frame numbers here, game/pull_bench.gd measures that part.
+// scons bench && ./bench/bin/pull_bench [seconds]
+
+#include "capture_pipeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr uint32_t PACKET_FRAMES = 480;
+constexpr size_t RING_FRAMES = 16384;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+
+StereoFrame MakeFrame(uint64_t sequence) {
+	return StereoFrame { static_cast<float>(sequence & 0xFFFFFF), static_cast<float>(sequence >> 24) };
+}
+
+uint64_t FrameSequence(const StereoFrame& frame) {
+	return static_cast<uint64_t>(frame.left) | (static_cast<uint64_t>(frame.right) << 24);
+}
+
+void Deliver(CapturePipeline& pipeline, std::vector<StereoFrame>& packet, uint64_t position) {
+	for(size_t i = 0; i < packet.size(); i++) packet[i] = MakeFrame(position + i);
+
+	CapturePacket captured { reinterpret_cast<const uint8_t*>(packet.data()), static_cast<uint32_t>(packet.size()) };
+	captured.position = position;
+	captured.timed = true;
+	pipeline.OnPacket(captured);
+}
+
+// what the stream's get_buffer does per call, kept out of line like a bound method would be
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+size_t Pull(CapturePipeline& pipeline, CapturePipeline::Reader& reader, StereoFrame* output, size_t frames) {
+	frames = std::min(frames, reader.Lag());
+	return frames == 0 ? 0 : pipeline.Mix(reader, output, frames);
+}
+
+void MeasureCallSizes(double seconds) {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	CapturePipeline::Reader reader { pipeline.Ring() };
+	std::vector<StereoFrame> packet(PACKET_FRAMES);
+	std::vector<StereoFrame> output(4096);
+
+	const uint64_t total = uint64_t(SAMPLE_RATE * seconds);
+	for(size_t callFrames : { size_t(1), size_t(16), size_t(256), size_t(1024), size_t(4096) }) {
+		uint64_t position = 0;
+		uint64_t pulled = 0;
+		uint64_t calls = 0;
+		Clock::duration spent { };
+
+		// fill half the ring, drain it, repeat: only the draining is timed
+		while(position < total) {
+			for(size_t filled = 0; filled < RING_FRAMES / 2; filled += PACKET_FRAMES) {
+				Deliver(pipeline, packet, position);
+				position += PACKET_FRAMES;
+			}
+			const auto start = Clock::now();
+			size_t read;
+			while((read = Pull(pipeline, reader, output.data(), callFrames)) > 0) {
+				pulled += read;
+				calls++;
+			}
+			spent += Clock::now() - start;
+		}
+
+		const double nanoseconds = std::chrono::duration<double, std::nano>(spent).count();
+		printf("  %4zu frames per call  %8.2f ns/frame  %8.1f ns/call  %7.4f ms per second of audio\n",
+			callFrames, nanoseconds / pulled, nanoseconds / calls, nanoseconds / 1e6 / (pulled / double(SAMPLE_RATE)));
+	}
+}
+
+// producer at real time, a playback reader and a puller polling like _process at 60 Hz
+bool LiveRun(double seconds) {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	CapturePipeline::Reader playback { pipeline.Ring() };
+	CapturePipeline::Reader puller { pipeline.Ring() };
+	std::atomic<bool> done { false };
+
+	std::thread producer([&] {
+		std::vector<StereoFrame> packet(PACKET_FRAMES);
+		const auto start = Clock::now();
+		const uint64_t packets = uint64_t(seconds * SAMPLE_RATE / PACKET_FRAMES);
+		for(uint64_t i = 0; i < packets; i++) {
+			std::this_thread::sleep_until(start + std::chrono::microseconds(i * PACKET_FRAMES * 1000000 / SAMPLE_RATE));
+			Deliver(pipeline, packet, i * PACKET_FRAMES);
+		}
+		done = true;
+	});
+
+	std::thread mixer([&] {
+		std::vector<StereoFrame> block(512);
+		while(!done) {
+			pipeline.Mix(playback, block.data(), block.size());
+			std::this_thread::sleep_for(std::chrono::microseconds(512 * 1000000 / SAMPLE_RATE));
+		}
+	});
+
+	std::vector<StereoFrame> output(RING_FRAMES);
+	uint64_t expected = 0;
+	uint64_t mismatches = 0;
+	auto check = [&](size_t read) {
+		for(size_t i = 0; i < read; i++) {
+			if(FrameSequence(output[i]) != expected) mismatches++;
+			expected = FrameSequence(output[i]) + 1;
+		}
+	};
+	while(!done) {
+		std::this_thread::sleep_for(std::chrono::microseconds(16667));
+		check(Pull(pipeline, puller, output.data(), output.size()));
+	}
+	producer.join();
+	mixer.join();
+	check(Pull(pipeline, puller, output.data(), output.size()));
+
+	const bool ok = mismatches == 0 && puller.DroppedCount() == 0 && expected == pipeline.Ring().WriteCursor();
+	printf("  live %.0f s: pulled %llu of %llu frames, %llu out of sequence, %llu dropped, playback dropped %llu  %s\n",
+		seconds, (unsigned long long)expected, (unsigned long long)pipeline.Ring().WriteCursor(),
+		(unsigned long long)mismatches, (unsigned long long)puller.DroppedCount(),
+		(unsigned long long)playback.DroppedCount(), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 20.0;
+
+	printf("draining %.0f s of audio:\n", seconds);
+	MeasureCallSizes(seconds);
+	const bool ok = LiveRun(std::min(seconds, 5.0));
+	return ok ? 0 : 1;
+}
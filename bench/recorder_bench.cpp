@@ -0,0 +1,173 @@
+// CaptureRecorder behind a CapturePipeline, the way a session records: first a short round trip (lost packets,
+// silent packets, read back with LoadWav and compared sample for sample), then a long recording pushed through at a
+// multiple of real time to see whether the writer keeps up and what the capture thread pays per packet.
+// Recordings past 4 GiB (about 3 hours) come out as RF64, the header is checked either way.
+// scons bench && ./bench/bin/recorder_bench [hours] [speedup] [path]
+
+#include "capture_pipeline.hpp"
+#include "capture_recorder.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr uint32_t PACKET_FRAMES = 480;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+
+// every sample says which frame it is, so anything shifted, lost or doubled shows up
+void FillRamp(std::vector<StereoFrame>& packet, uint64_t position) {
+	for(size_t i = 0; i < packet.size(); i++) {
+		const float value = static_cast<float>((position + i) % 1000000) / 1000000.0f;
+		packet[i] = StereoFrame { value, -value };
+	}
+}
+
+bool RoundTrip(const std::string& path) {
+	CapturePipeline pipeline { 4096 };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	std::vector<StereoFrame> packet(PACKET_FRAMES);
+	const uint32_t packets = 400;
+
+	{
+		// enough blocks for all of it, this pushes much faster than real time
+		CaptureRecorder recorder { path, FORMAT, 64 * 1024, 32 };
+		pipeline.AttachTap(&recorder);
+		for(uint32_t i = 0; i < packets; i++) {
+			const uint64_t position = uint64_t(i) * PACKET_FRAMES;
+			// every 7th packet lost, every 5th silent
+			if(i % 7 == 3) continue;
+			FillRamp(packet, position);
+
+			CapturePacket captured { };
+			captured.frameCount = PACKET_FRAMES;
+			captured.position = position;
+			captured.timestamp = position * 10000000 / SAMPLE_RATE;
+			captured.silent = i % 5 == 1;
+			captured.frames = captured.silent ? nullptr : reinterpret_cast<const uint8_t*>(packet.data());
+			captured.timed = true;
+			pipeline.OnPacket(captured);
+		}
+		pipeline.DetachTap(&recorder);
+		if(!recorder.Finish()) {
+			printf("round trip: finishing failed\n");
+			return false;
+		}
+	}
+
+	const ReplayCapture::WavData wav = ReplayCapture::LoadWav(path);
+	const size_t frames = wav.frames.size() / FORMAT.BytesPerFrame();
+	// the lost packet at the end isn't followed by anything, so it can't be filled in
+	const size_t expected = size_t(packets) * PACKET_FRAMES - (packets % 7 == 4 ? PACKET_FRAMES : 0);
+	if(frames != expected) {
+		printf("round trip: %zu frames, expected %zu\n", frames, expected);
+		return false;
+	}
+
+	const StereoFrame* samples = reinterpret_cast<const StereoFrame*>(wav.frames.data());
+	for(size_t i = 0; i < frames; i++) {
+		const uint32_t index = static_cast<uint32_t>(i / PACKET_FRAMES);
+		const bool zero = index % 7 == 3 || index % 5 == 1;
+		const float value = zero ? 0.0f : static_cast<float>(i % 1000000) / 1000000.0f;
+		if(samples[i].left != value || samples[i].right != -value) {
+			printf("round trip: frame %zu is %f, expected %f\n", i, samples[i].left, value);
+			return false;
+		}
+	}
+	return true;
+}
+
+// sizes from the header, however big the file is
+bool CheckHeader(const std::string& path, uint64_t expectedFrames) {
+	std::ifstream file(path, std::ios::binary);
+	uint8_t header[CaptureRecorder::HEADER_BYTES];
+	if(!file.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+
+	auto read = [&](size_t offset, size_t bytes) {
+		uint64_t value = 0;
+		for(size_t i = 0; i < bytes; i++) value |= uint64_t(header[offset + i]) << (8 * i);
+		return value;
+	};
+
+	const bool rf64 = memcmp(header, "RF64", 4) == 0;
+	const uint64_t dataBytes = rf64 ? read(28, 8) : read(CaptureRecorder::HEADER_BYTES - 4, 4);
+	printf("header      %s, %llu frames in the data chunk\n", rf64 ? "RF64" : "RIFF", (unsigned long long)(dataBytes / FORMAT.BytesPerFrame()));
+	return dataBytes == expectedFrames * FORMAT.BytesPerFrame();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double hours = argc > 1 ? atof(argv[1]) : 0.5;
+	const double speedup = argc > 2 ? atof(argv[2]) : 100.0;
+	const std::string path = argc > 3 ? argv[3] : "recorder_bench.wav";
+
+	const bool roundTrip = RoundTrip(path);
+	printf("round trip: %s\n\n", roundTrip ? "ok" : "FAILED");
+
+	CapturePipeline pipeline { 4096 };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	std::vector<StereoFrame> packet(PACKET_FRAMES);
+	FillRamp(packet, 0);
+
+	const uint64_t totalPackets = static_cast<uint64_t>(hours * 3600.0 * SAMPLE_RATE / PACKET_FRAMES);
+	const auto packetPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(PACKET_FRAMES) / SAMPLE_RATE / speedup));
+	std::vector<double> packetMicroseconds;
+	packetMicroseconds.reserve(static_cast<size_t>(std::min<uint64_t>(totalPackets, 100000000)));
+
+	CaptureRecorder recorder { path, FORMAT };
+	pipeline.AttachTap(&recorder);
+
+	const auto start = Clock::now();
+	auto deadline = start;
+	for(uint64_t i = 0; i < totalPackets; i++) {
+		deadline += packetPeriod;
+		std::this_thread::sleep_until(deadline);
+
+		CapturePacket captured { };
+		captured.frames = reinterpret_cast<const uint8_t*>(packet.data());
+		captured.frameCount = PACKET_FRAMES;
+		captured.position = i * PACKET_FRAMES;
+		captured.timed = true;
+
+		const auto packetStart = Clock::now();
+		pipeline.OnPacket(captured);
+		packetMicroseconds.push_back(std::chrono::duration<double, std::micro>(Clock::now() - packetStart).count());
+	}
+
+	pipeline.DetachTap(&recorder);
+	const auto finishStart = Clock::now();
+	const bool finished = recorder.Finish();
+	const auto end = Clock::now();
+
+	const CaptureRecorder::Stats stats = recorder.GetStats();
+	const double seconds = std::chrono::duration<double>(end - start).count();
+
+	std::sort(packetMicroseconds.begin(), packetMicroseconds.end());
+	auto percentile = [&](double p) { return packetMicroseconds.empty() ? 0.0 : packetMicroseconds[size_t(p * (packetMicroseconds.size() - 1))]; };
+
+	printf("recorded    %.2f hours of %u Hz float stereo at %.0fx real time in %.1f s\n", hours, SAMPLE_RATE, speedup, seconds);
+	printf("written     %.1f MiB, %.1f MiB/s (needed %.1f MiB/s), finish took %.1f ms\n", stats.bytesWritten / 1048576.0,
+		stats.bytesWritten / 1048576.0 / seconds, SAMPLE_RATE * FORMAT.BytesPerFrame() * speedup / 1048576.0,
+		std::chrono::duration<double, std::milli>(end - finishStart).count());
+	printf("dropped     %llu blocks, %llu frames%s\n", (unsigned long long)stats.droppedBlocks, (unsigned long long)stats.droppedFrames,
+		stats.failed || !finished ? ", WRITE FAILED" : "");
+	printf("per packet  p50=%.2fus p99=%.2fus max=%.2fus on the capture thread\n", percentile(0.5), percentile(0.99), percentile(1.0));
+
+	const bool header = CheckHeader(path, stats.framesWritten);
+	printf("header:     %s\n", header ? "ok" : "FAILED");
+	std::remove(path.c_str());
+
+	return roundTrip && header && finished ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// CPU cost of getting captured audio to godot's mix rate, in milliseconds of CPU per second of audio.
+//
+// "double" is what the stream used to do: capture at a fixed 48k (so the OS resamples from the endpoint's native
+// rate first) and then let AudioStreamPlaybackResampled's cubic interpolator go from 48k to the mix rate. The OS
+// converter can't be run here, a linear interpolator stands in for it, which can only flatter the old path.
+// "single" is the polyphase resampler going native -> mix rate once, plus godot's cubic pass at exactly 1:1.
+// scons bench && ./bench/bin/resampler_bench [seconds]
+
+#include "audio_types.hpp"
+#include "resampler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t PACKET_FRAMES = 480;
+
+std::vector<StereoFrame> MakeInput(uint32_t rate, double seconds) {
+	std::vector<StereoFrame> input(size_t(rate * seconds));
+	for(size_t i = 0; i < input.size(); i++) {
+		const float value = 0.5f * static_cast<float>(std::sin(2.0 * 3.14159265358979323846 * 1000.0 * i / rate));
+		input[i] = StereoFrame { value, -value };
+	}
+	return input;
+}
+
+// AudioStreamPlaybackResampled::mix, 16 bit fixed point position and 4 point cubic interpolation
+size_t GodotCubic(const std::vector<StereoFrame>& input, uint32_t inputRate, uint32_t outputRate, std::vector<StereoFrame>& output) {
+	constexpr int FP_BITS = 16;
+	constexpr uint64_t FP_MASK = (1 << FP_BITS) - 1;
+	const uint64_t increment = uint64_t(double(inputRate) / outputRate * double(1 << FP_BITS));
+
+	size_t count = 0;
+	for(uint64_t offset = 0; (offset >> FP_BITS) + 3 < input.size() && count < output.size(); offset += increment) {
+		const size_t index = size_t(offset >> FP_BITS);
+		const float mu = (offset & FP_MASK) / float(1 << FP_BITS);
+		const float mu2 = mu * mu;
+		const StereoFrame& y0 = input[index];
+		const StereoFrame& y1 = input[index + 1];
+		const StereoFrame& y2 = input[index + 2];
+		const StereoFrame& y3 = input[index + 3];
+
+		auto cubic = [&](float a, float b, float c, float d) {
+			const float a0 = 3 * b - 3 * c + d - a;
+			const float a1 = 2 * a - 5 * b + 4 * c - d;
+			const float a2 = c - a;
+			const float a3 = 2 * b;
+			return (a0 * mu * mu2 + a1 * mu2 + a2 * mu + a3) / 2;
+		};
+		output[count++] = StereoFrame { cubic(y0.left, y1.left, y2.left, y3.left), cubic(y0.right, y1.right, y2.right, y3.right) };
+	}
+	return count;
+}
+
+// stand-in for the OS converter in the old path
+size_t Linear(const std::vector<StereoFrame>& input, uint32_t inputRate, uint32_t outputRate, std::vector<StereoFrame>& output) {
+	const double step = double(inputRate) / outputRate;
+	size_t count = 0;
+	for(double position = 0.0; size_t(position) + 1 < input.size() && count < output.size(); position += step) {
+		const size_t index = size_t(position);
+		const float t = float(position - index);
+		output[count++] = StereoFrame {
+			input[index].left + t * (input[index + 1].left - input[index].left),
+			input[index].right + t * (input[index + 1].right - input[index].right),
+		};
+	}
+	return count;
+}
+
+size_t Polyphase(const std::vector<StereoFrame>& input, PolyphaseResampler& resampler, std::vector<StereoFrame>& output) {
+	size_t produced = 0;
+	for(size_t offset = 0; offset < input.size(); offset += PACKET_FRAMES) {
+		size_t remaining = std::min(PACKET_FRAMES, input.size() - offset);
+		const StereoFrame* packet = input.data() + offset;
+		while(remaining > 0) {
+			const size_t pushed = resampler.Push(packet, remaining);
+			packet += pushed;
+			remaining -= pushed;
+			produced += resampler.Pull(output.data() + produced, output.size() - produced);
+		}
+	}
+	return produced;
+}
+
+template<typename Function>
+double MeasureMilliseconds(Function&& function) {
+	const auto start = Clock::now();
+	function();
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void RunScenario(uint32_t nativeRate, uint32_t mixRate, double seconds) {
+	const std::vector<StereoFrame> input = MakeInput(nativeRate, seconds);
+	std::vector<StereoFrame> intermediate(size_t(48000 * seconds) + 64);
+	std::vector<StereoFrame> output(size_t(mixRate * seconds) + 64);
+
+	printf("%6u -> %6u\n", nativeRate, mixRate);
+
+	// old: OS to 48k, then godot cubic 48k -> mix rate
+	{
+		size_t produced = 0;
+		const double milliseconds = MeasureMilliseconds([&] {
+			if(nativeRate == 48000) {
+				produced = GodotCubic(input, 48000, mixRate, output);
+			} else {
+				intermediate.resize(Linear(input, nativeRate, 48000, intermediate));
+				produced = GodotCubic(intermediate, 48000, mixRate, output);
+			}
+		});
+		printf("  double (os + cubic)     %7.3f ms/s  (%zu frames)\n", milliseconds / seconds, produced);
+	}
+
+	// new: polyphase native -> mix rate once, godot cubic at 1:1
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) != level) continue;
+
+		PolyphaseResampler resampler { nativeRate, mixRate, level };
+		size_t produced = 0;
+		double cubicMilliseconds = 0.0;
+		const double milliseconds = MeasureMilliseconds([&] {
+			produced = nativeRate == mixRate ? input.size() : Polyphase(input, resampler, output);
+		});
+		const std::vector<StereoFrame> resampled = nativeRate == mixRate ? input : std::vector<StereoFrame>(output.begin(), output.begin() + produced);
+		std::vector<StereoFrame> unity(produced);
+		cubicMilliseconds = MeasureMilliseconds([&] { GodotCubic(resampled, mixRate, mixRate, unity); });
+
+		printf("  single (%-6s %s)  %7.3f ms/s  (+%.3f ms/s godot 1:1 pass, %zu frames)\n",
+			SimdLevelName(level), resampler.IsExact() ? "exact" : "interp",
+			milliseconds / seconds, cubicMilliseconds / seconds, produced);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 20.0;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	RunScenario(44100, 48000, seconds);
+	RunScenario(48000, 44100, seconds);
+	RunScenario(96000, 48000, seconds);
+	RunScenario(48000, 96000, seconds);
+	RunScenario(44100, 44100, seconds);
+	RunScenario(88200, 48000, seconds);
+	// no small rational ratio, takes the interpolated path
+	RunScenario(44056, 48000, seconds);
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+// Live retargeting: a session playing one synthetic target is moved to another through the registry while a mixer
+// keeps reading it in real time. Checks the switch is gapless (no underruns, no reader reset, no sample jump bigger
+// than the tones themselves make) and ends up on the new tone, and reports how long activation and the whole switch
+// took. Then the two fallbacks: a new source taking over from one that stopped delivering, and retargeting a session
+// that was never started, which only moves its key.
+// scons bench && ./bench/bin/retarget_bench [activation ms]
+
+#include "capture_session.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+constexpr size_t MIX_FRAMES = 512;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+constexpr std::chrono::microseconds LATENCY { 30000 };
+
+// the "process id" picks the tone, so what comes out tells which source wrote it
+double Frequency(uint32_t processId) {
+	return 220.0 * processId;
+}
+
+// Mixes in real time from its own reader after a short prefill, keeps everything it got
+class Mixer {
+public:
+	Mixer(CapturePipeline& pipeline, double seconds) :
+		pipeline { pipeline },
+		reader { pipeline.Ring() },
+		output(size_t(seconds * SAMPLE_RATE) + MIX_FRAMES),
+		done { false },
+		underruns { 0 }
+	{ }
+
+	void Start() {
+		thread = std::thread([this] {
+			while(reader.Lag() < SAMPLE_RATE / 20 && !done) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			auto deadline = Clock::now();
+			const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / SAMPLE_RATE));
+			while(!done && mixed + MIX_FRAMES <= output.size()) {
+				const size_t read = pipeline.Mix(reader, output.data() + mixed, MIX_FRAMES);
+				if(read < MIX_FRAMES) underruns++;
+				mixed += read;
+				deadline += period;
+				std::this_thread::sleep_until(deadline);
+			}
+		});
+	}
+
+	void Stop() {
+		done = true;
+		thread.join();
+	}
+
+	// the biggest jump between neighbouring samples, a click shows up here
+	float MaxStep(size_t from, size_t to) const {
+		float step = 0.0f;
+		for(size_t i = std::max<size_t>(from, 1); i < to; i++) step = std::max(step, std::fabs(output[i].left - output[i - 1].left));
+		return step;
+	}
+
+	double ZeroCrossingFrequency(size_t from, size_t to) const {
+		size_t crossings = 0;
+		for(size_t i = from + 1; i < to; i++) {
+			if((output[i - 1].left < 0.0f) != (output[i].left < 0.0f)) crossings++;
+		}
+		return crossings * 0.5 * SAMPLE_RATE / double(to - from);
+	}
+
+	size_t Mixed() const { return mixed; }
+	uint64_t Underruns() const { return underruns; }
+	uint64_t Dropped() const { return reader.DroppedCount(); }
+
+private:
+	CapturePipeline& pipeline;
+	CapturePipeline::Reader reader;
+	std::vector<StereoFrame> output;
+	std::atomic<size_t> mixed { 0 };
+	std::atomic<bool> done;
+	uint64_t underruns;
+	std::thread thread;
+};
+
+void PrintSwitchStats(const CaptureStats::Snapshot& stats) {
+	printf("  activation %.1f ms, switch %.1f ms (start of the switch to the new source owning the ring)\n",
+		stats.switchActivationMicroseconds.max / 1000.0, stats.switchMicroseconds.max / 1000.0);
+}
+
+bool Gapless(uint32_t activationMicroseconds) {
+	CapturePacing pacing;
+	pacing.activationMicroseconds = activationMicroseconds;
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) {
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, pacing, Frequency(key.processId), 0.5f);
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(CaptureSessionKey { 1, LoopbackMode::IncludeProcessTree }, LATENCY);
+	session->Start();
+	if(session->WaitUntilSettled(std::chrono::seconds(5)) != CaptureSession::State::Running) {
+		printf("gapless switch: the first source didn't come up (%s)  FAIL\n", session->LastError().c_str());
+		return false;
+	}
+	CapturePipeline& pipeline = session->Pipeline();
+	const CaptureSource* first = session->Source();
+
+	Mixer mixer { pipeline, 4.0 };
+	mixer.Start();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	const size_t switchedAt = mixer.Mixed();
+	const auto start = Clock::now();
+	const CaptureSessionRegistry::RetargetResult result = registry.Retarget(*session, CaptureSessionKey { 2, LoopbackMode::IncludeProcessTree });
+	const double blocked = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	// the registry destroys the old source once it's faded out
+	while(pipeline.Stats().Read().switches == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::this_thread::sleep_for(std::chrono::seconds(2));
+	mixer.Stop();
+
+	const CaptureStats::Snapshot stats = pipeline.Stats().Read();
+	const size_t end = mixer.Mixed();
+	// the louder of the two tones moves at most this much per sample, sqrt(2) for both at full gain mid fade
+	const float tone = 0.5f * static_cast<float>(2.0 * 3.14159265358979323846 * Frequency(2) / SAMPLE_RATE) * std::sqrt(2.0f);
+	const float step = mixer.MaxStep(switchedAt, end);
+	const double before = mixer.ZeroCrossingFrequency(SAMPLE_RATE / 10, switchedAt);
+	const double after = mixer.ZeroCrossingFrequency(end - SAMPLE_RATE, end);
+
+	const bool ok = result == CaptureSessionRegistry::RetargetResult::Switching && session->Key().processId == 2 &&
+		session->Source() != first && stats.switches == 1 && stats.abruptSwitches == 0 && mixer.Underruns() == 0 &&
+		mixer.Dropped() == 0 && step <= tone * 1.05f && std::fabs(before - Frequency(1)) < 5.0 && std::fabs(after - Frequency(2)) < 5.0;
+
+	printf("gapless switch, %.0f ms activation:\n", activationMicroseconds / 1000.0);
+	printf("  Retarget blocked the caller %.1f ms, the old target kept playing meanwhile\n", blocked);
+	PrintSwitchStats(stats);
+	printf("  %.0f Hz -> %.0f Hz, max step %.4f (tones alone %.4f), %llu underruns, %llu dropped  %s\n", before, after, step, tone,
+		(unsigned long long)mixer.Underruns(), (unsigned long long)mixer.Dropped(), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// the old source dies before the new one is up: it takes over without waiting for a fade that never comes
+bool Takeover() {
+	CapturePipeline pipeline { RING_FRAMES };
+	CapturePacing pacing;
+	auto old = std::make_unique<SyntheticCapture>(&pipeline, FORMAT, pacing, Frequency(1));
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	old->Start();
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	old->Stop();
+
+	const uint64_t written = pipeline.Ring().WriteCursor();
+	CaptureReceiver* receiver = pipeline.BeginSwitch();
+	const bool refused = pipeline.BeginSwitch() == nullptr;
+	SyntheticCapture replacement { receiver, FORMAT, pacing, Frequency(2) };
+	replacement.Start();
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	replacement.Stop();
+	old.reset();
+
+	const CaptureStats::Snapshot stats = pipeline.Stats().Read();
+	const bool ok = refused && pipeline.SwitchSettled() && stats.switches == 1 && stats.abruptSwitches == 1 &&
+		pipeline.Ring().WriteCursor() > written + SAMPLE_RATE / 5;
+	printf("takeover from a stopped source:\n");
+	PrintSwitchStats(stats);
+	printf("  %llu frames written after the switch  %s\n", (unsigned long long)(pipeline.Ring().WriteCursor() - written), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// nothing activated yet: the session just moves to the new key and activates that when it's started
+bool NotStarted() {
+	std::atomic<uint32_t> activations { 0 };
+	CaptureSessionRegistry registry { [&](const CaptureSessionKey& key, std::chrono::microseconds, CaptureReceiver* receiver) {
+		activations++;
+		return std::make_unique<SyntheticCapture>(receiver, FORMAT, CapturePacing { }, Frequency(key.processId));
+	}, SAMPLE_RATE, RING_FRAMES };
+
+	std::shared_ptr<CaptureSession> session = registry.Acquire(CaptureSessionKey { 1, LoopbackMode::IncludeProcessTree }, LATENCY);
+	std::shared_ptr<CaptureSession> other = registry.Acquire(CaptureSessionKey { 3, LoopbackMode::IncludeProcessTree }, LATENCY);
+	const CaptureSessionKey second { 2, LoopbackMode::IncludeProcessTree };
+	const CaptureSessionKey third { 3, LoopbackMode::IncludeProcessTree };
+
+	bool ok = registry.Retarget(*session, third) == CaptureSessionRegistry::RetargetResult::TargetInUse;
+	ok = registry.Retarget(*session, session->Key()) == CaptureSessionRegistry::RetargetResult::Unchanged && ok;
+	{
+		std::shared_ptr<CaptureSession> shared = registry.Acquire(session->Key(), LATENCY);
+		ok = registry.Retarget(*session, second) == CaptureSessionRegistry::RetargetResult::Shared && ok;
+	}
+	ok = registry.Retarget(*session, second) == CaptureSessionRegistry::RetargetResult::Rekeyed && ok;
+	ok = ok && activations == 0;
+
+	session->Start();
+	ok = session->WaitUntilSettled(std::chrono::seconds(5)) == CaptureSession::State::Running && ok;
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	const CaptureStats::Snapshot stats = session->Pipeline().Stats().Read();
+	ok = ok && stats.switches == 0 && stats.frames > 0 && session->Key().processId == 2 && activations == 1;
+
+	// and the old key is free again
+	std::shared_ptr<CaptureSession> reacquired = registry.Acquire(CaptureSessionKey { 1, LoopbackMode::IncludeProcessTree }, LATENCY);
+	ok = ok && reacquired.get() != session.get() && registry.SessionCount() == 3;
+
+	printf("retarget before starting, and the refusals:  %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const uint32_t activationMilliseconds = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 50;
+
+	bool ok = Gapless(activationMilliseconds * 1000);
+	ok = Takeover() && ok;
+	ok = NotStarted() && ok;
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
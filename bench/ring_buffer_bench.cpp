@@ -0,0 +1,292 @@
+// Stress tests, throughput and memory traffic benchmarks for CircularBuffer and BroadcastBuffer.
+// Runs anywhere with a C++17 compiler and threads.
+// scons bench && ./bench/bin/ring_buffer_bench
+
+#include "audio_types.hpp"
+#include "broadcast_buffer.hpp"
+#include "ring_buffer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Every frame carries its own sequence number so the consumer can check ordering and count losses
+StereoFrame MakeFrame(uint64_t sequence) {
+	return StereoFrame { static_cast<float>(sequence & 0xFFFFFF), static_cast<float>(sequence >> 24) };
+}
+
+uint64_t FrameSequence(const StereoFrame& frame) {
+	return static_cast<uint64_t>(frame.left) | (static_cast<uint64_t>(frame.right) << 24);
+}
+
+// Producer pushes packets of varying size as fast as it can, consumer pulls mixer sized blocks and checks that
+// sequence numbers only ever go up and that anything missing was reported as dropped.
+bool StressTest(OverrunPolicy policy, uint64_t totalFrames) {
+	CircularBuffer<StereoFrame> ring { 4096, policy };
+	std::atomic<bool> producerDone { false };
+
+	std::thread producer([&] {
+		std::vector<StereoFrame> packet(1024);
+		uint64_t sequence = 0;
+		uint32_t rng = 12345;
+		while(sequence < totalFrames) {
+			rng = rng * 1664525 + 1013904223;
+			const size_t size = 1 + (rng >> 22); // 1..1024 frames
+			for(size_t i = 0; i < size; i++) packet[i] = MakeFrame(sequence + i);
+
+			const size_t written = ring.Write(packet.data(), size);
+			// with DropNewest whatever didn't fit is gone for good, the sequence just moves on
+			sequence += policy == OverrunPolicy::DropNewest ? size : written;
+		}
+		producerDone = true;
+	});
+
+	std::vector<StereoFrame> block(128);
+	uint64_t received = 0;
+	uint64_t expected = 0;
+	uint64_t gaps = 0;
+	bool ok = true;
+
+	while(!producerDone) {
+		const size_t read = ring.Read(block.data(), block.size());
+		for(size_t i = 0; i < read; i++) {
+			const uint64_t sequence = FrameSequence(block[i]);
+			if(sequence < expected) {
+				fprintf(stderr, "  out of order: got %llu, expected >= %llu\n", (unsigned long long)sequence, (unsigned long long)expected);
+				ok = false;
+				break;
+			}
+			if(sequence != expected) gaps += sequence - expected;
+			expected = sequence + 1;
+		}
+		received += read;
+		if(!ok) break;
+		if(read == 0) std::this_thread::yield();
+	}
+
+	producer.join();
+
+	// drain what's left, it must still be in order
+	size_t read;
+	while(ok && (read = ring.Read(block.data(), block.size())) > 0) {
+		for(size_t i = 0; i < read; i++) {
+			const uint64_t sequence = FrameSequence(block[i]);
+			if(sequence < expected) ok = false;
+			if(sequence != expected) gaps += sequence - expected;
+			expected = sequence + 1;
+		}
+		received += read;
+	}
+
+	const uint64_t dropped = ring.DroppedCount();
+	if(ok && received + dropped < totalFrames) {
+		fprintf(stderr, "  lost frames that were never reported: received %llu + dropped %llu < %llu\n",
+			(unsigned long long)received, (unsigned long long)dropped, (unsigned long long)totalFrames);
+		ok = false;
+	}
+
+	printf("stress %-11s frames=%llu received=%llu dropped=%llu gaps=%llu %s\n",
+		policy == OverrunPolicy::DropOldest ? "drop_oldest" : "drop_newest",
+		(unsigned long long)totalFrames, (unsigned long long)received, (unsigned long long)dropped,
+		(unsigned long long)gaps, ok ? "OK" : "FAILED");
+	return ok;
+}
+
+// Producer paced to stay under the ring size, consumer drains continuously. Reports frames per second through the ring.
+void ThroughputBenchmark(size_t packetFrames, uint64_t totalFrames) {
+	CircularBuffer<StereoFrame> ring { 16384, OverrunPolicy::DropNewest };
+	std::vector<StereoFrame> packet(packetFrames, StereoFrame { 0.25f, -0.25f });
+
+	const auto start = Clock::now();
+
+	std::thread producer([&] {
+		uint64_t written = 0;
+		while(written < totalFrames) {
+			if(ring.Writable() < packetFrames) {
+				std::this_thread::yield();
+				continue;
+			}
+			written += ring.Write(packet.data(), packetFrames);
+		}
+	});
+
+	std::vector<StereoFrame> block(512);
+	uint64_t read = 0;
+	while(read < totalFrames) {
+		const size_t count = ring.Read(block.data(), block.size());
+		if(count == 0) std::this_thread::yield();
+		read += count;
+	}
+
+	producer.join();
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	printf("throughput packet=%-5zu %8.1f Mframes/s %8.1f MB/s\n",
+		packetFrames, read / seconds / 1e6, read * sizeof(StereoFrame) / seconds / 1e6);
+}
+
+// One producer, several readers on their own threads, one of them far too slow to keep up. Every reader has to see
+// its own consistent, ordered stream with losses accounted for, and the producer's write time must not depend on how
+// many readers there are or how slow they are.
+bool FanOutStressTest(size_t readerCount, uint64_t totalFrames) {
+	BroadcastBuffer<StereoFrame> ring { 4096 };
+	std::atomic<bool> producerDone { false };
+
+	struct ReaderState {
+		std::unique_ptr<BroadcastBuffer<StereoFrame>::Reader> reader;
+		uint64_t received = 0;
+		bool ok = true;
+	};
+	std::vector<ReaderState> readers(readerCount);
+	for(ReaderState& state : readers) state.reader = std::make_unique<BroadcastBuffer<StereoFrame>::Reader>(ring);
+
+	std::vector<std::thread> threads;
+	for(size_t index = 0; index < readerCount; index++) {
+		threads.emplace_back([&, index] {
+			ReaderState& state = readers[index];
+			std::vector<StereoFrame> block(128);
+			uint64_t expected = 0;
+
+			auto consume = [&] {
+				const size_t read = state.reader->Read(block.data(), block.size());
+				for(size_t i = 0; i < read; i++) {
+					const uint64_t sequence = FrameSequence(block[i]);
+					if(sequence < expected) state.ok = false;
+					expected = sequence + 1;
+				}
+				state.received += read;
+				return read;
+			};
+
+			while(!producerDone && state.ok) {
+				if(consume() == 0) std::this_thread::yield();
+				// the last reader is a stalled listener
+				if(index == readerCount - 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			while(state.ok && consume() > 0) { }
+		});
+	}
+
+	std::vector<StereoFrame> packet(480);
+	double worstWriteMicroseconds = 0.0;
+	for(uint64_t sequence = 0; sequence < totalFrames; sequence += packet.size()) {
+		for(size_t i = 0; i < packet.size(); i++) packet[i] = MakeFrame(sequence + i);
+
+		const auto start = Clock::now();
+		ring.Write(packet.data(), packet.size());
+		const double microseconds = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		if(microseconds > worstWriteMicroseconds) worstWriteMicroseconds = microseconds;
+	}
+	producerDone = true;
+	for(std::thread& thread : threads) thread.join();
+
+	const uint64_t written = ring.WriteCursor();
+	bool ok = true;
+	for(size_t index = 0; index < readerCount; index++) {
+		const ReaderState& state = readers[index];
+		const bool accounted = state.received + state.reader->DroppedCount() >= written;
+		ok &= state.ok && accounted;
+		printf("fanout reader %zu/%zu received=%llu dropped=%llu %s\n", index + 1, readerCount,
+			(unsigned long long)state.received, (unsigned long long)state.reader->DroppedCount(),
+			state.ok && accounted ? "OK" : "FAILED");
+	}
+	printf("fanout %zu readers, worst producer write %.2fus, buffer %zu bytes\n",
+		readerCount, worstWriteMicroseconds, ring.Capacity() * sizeof(StereoFrame));
+	return ok;
+}
+
+// Bytes moved through memory per delivered frame, read and write sides both counted
+struct TrafficCounter {
+	uint64_t bytes = 0;
+
+	void Copy(size_t count, size_t sourceSize, size_t destinationSize) {
+		bytes += count * (sourceSize + destinationSize);
+	}
+};
+
+void ConvertInt16(const int16_t* source, StereoFrame* destination, size_t frames) {
+	for(size_t i = 0; i < frames; i++) {
+		destination[i] = StereoFrame { source[2 * i] * (1.0f / 32768.0f), source[2 * i + 1] * (1.0f / 32768.0f) };
+	}
+}
+
+// One thread playing both sides, so the numbers only reflect the copies and not scheduling.
+// "staged" is what the stream used to do: convert a packet into scratch memory, Write() it, Read() into a pcm staging
+// buffer and copy that out to the mixer. "direct" converts into a ReserveWrite span and copies a PeekRead span out.
+void TrafficBenchmark(bool direct, uint64_t totalFrames) {
+	constexpr size_t packetFrames = 480;
+	constexpr size_t mixFrames = 512;
+
+	CircularBuffer<StereoFrame> ring { 4096, OverrunPolicy::DropNewest };
+	std::vector<int16_t> packet(packetFrames * 2, 1234);
+	std::vector<StereoFrame> scratch(packetFrames);
+	std::vector<StereoFrame> pcm(mixFrames);
+	std::vector<StereoFrame> output(mixFrames);
+	TrafficCounter traffic;
+
+	const auto start = Clock::now();
+
+	uint64_t delivered = 0;
+	while(delivered < totalFrames) {
+		if(direct) {
+			const RingSpan<StereoFrame> span = ring.ReserveWrite(packetFrames);
+			ConvertInt16(packet.data(), span.first, span.firstCount);
+			ConvertInt16(packet.data() + 2 * span.firstCount, span.second, span.secondCount);
+			ring.CommitWrite(span.Size());
+			traffic.Copy(span.Size(), 2 * sizeof(int16_t), sizeof(StereoFrame));
+
+			while(ring.Readable() >= mixFrames) {
+				const RingSpan<const StereoFrame> view = ring.PeekRead(mixFrames);
+				view.CopyTo(output.data());
+				delivered += ring.ConsumeRead(view.Size());
+				traffic.Copy(view.Size(), sizeof(StereoFrame), sizeof(StereoFrame));
+			}
+		} else {
+			ConvertInt16(packet.data(), scratch.data(), packetFrames);
+			traffic.Copy(packetFrames, 2 * sizeof(int16_t), sizeof(StereoFrame));
+			const size_t written = ring.Write(scratch.data(), packetFrames);
+			traffic.Copy(written, sizeof(StereoFrame), sizeof(StereoFrame));
+
+			while(ring.Readable() >= mixFrames) {
+				const size_t read = ring.Read(pcm.data(), mixFrames);
+				traffic.Copy(read, sizeof(StereoFrame), sizeof(StereoFrame));
+				memcpy(output.data(), pcm.data(), read * sizeof(StereoFrame));
+				traffic.Copy(read, sizeof(StereoFrame), sizeof(StereoFrame));
+				delivered += read;
+			}
+		}
+	}
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	printf("traffic %-6s %6.1f bytes/frame %8.1f Mframes/s\n",
+		direct ? "direct" : "staged", double(traffic.bytes) / delivered, delivered / seconds / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const uint64_t frames = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000000ull;
+
+	bool ok = true;
+	ok &= StressTest(OverrunPolicy::DropOldest, frames);
+	ok &= StressTest(OverrunPolicy::DropNewest, frames);
+	ok &= FanOutStressTest(1, frames);
+	ok &= FanOutStressTest(4, frames);
+
+	for(size_t packetFrames : { 32, 128, 480, 1024, 4096 }) {
+		ThroughputBenchmark(packetFrames, frames);
+	}
+
+	TrafficBenchmark(false, frames);
+	TrafficBenchmark(true, frames);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,411 @@
+// Capture across a process boundary: the shared ring's protocol within one process (packets, flags and silence
+// coming through unchanged, records wrapping around the end, a reader too slow to keep up), then a forked producer
+// running a synthetic source in real time, how fast packets get across when nobody paces them, and what the reader
+// does when its producer crashes or never comes up.
+// scons bench && ./bench/bin/shared_ring_bench [seconds]
+
+#include "capture_pipeline.hpp"
+#include "shared_capture_ring.hpp"
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Ring = SharedCaptureRing;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr size_t RING_FRAMES = 16384;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+constexpr size_t RING_BYTES = 1 << 20;
+
+std::string UniqueName(const char* what) {
+	static int counter = 0;
+	return std::string("wacr-bench-") + what + "-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+}
+
+// What the reader delivered, copied out so it can be compared after the fact
+class RecordingReceiver : public CaptureReceiver {
+public:
+	struct Delivered {
+		uint32_t frameCount;
+		uint64_t position;
+		uint64_t timestamp;
+		bool silent;
+		bool discontinuity;
+		bool timed;
+		float first;
+		float last;
+	};
+
+	void OnPacket(const CapturePacket& packet) override {
+		const float* samples = reinterpret_cast<const float*>(packet.frames);
+		std::lock_guard<std::mutex> lock { mutex };
+		delivered.push_back({ packet.frameCount, packet.position, packet.timestamp, packet.silent, packet.discontinuity, packet.timed,
+			samples ? samples[0] : 0.0f, samples ? samples[size_t(packet.frameCount) * 2 - 1] : 0.0f });
+	}
+
+	void OnWakeup(uint32_t, uint32_t) override { wakeups++; }
+	void OnCaptureError(uint32_t code) override { lastError = code; }
+
+	size_t Count() {
+		std::lock_guard<std::mutex> lock { mutex };
+		return delivered.size();
+	}
+
+	std::mutex mutex;
+	std::vector<Delivered> delivered;
+	std::atomic<uint64_t> wakeups { 0 };
+	std::atomic<uint32_t> lastError { 0 };
+};
+
+// Frames counted and touched, nothing kept
+class CountingReceiver : public CaptureReceiver {
+public:
+	void OnPacket(const CapturePacket& packet) override {
+		const float* samples = reinterpret_cast<const float*>(packet.frames);
+		if(samples) sum += samples[0] + samples[size_t(packet.frameCount) * 2 - 1];
+		frames.fetch_add(packet.frameCount, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> frames { 0 };
+	float sum = 0.0f;
+};
+
+std::vector<float> PacketSamples(uint32_t frameCount, uint32_t seed) {
+	std::vector<float> samples(size_t(frameCount) * 2);
+	for(size_t i = 0; i < samples.size(); i++) samples[i] = float(seed) + float(i) / float(samples.size());
+	return samples;
+}
+
+bool WaitFor(const std::function<bool()>& condition, std::chrono::milliseconds timeout) {
+	const auto deadline = Clock::now() + timeout;
+	while(!condition()) {
+		if(Clock::now() > deadline) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+// Writer and reader in one process: every field arrives as written, in order, across many wraps of a small ring
+bool CheckProtocol() {
+	constexpr size_t SMALL_RING = 64 * 1024;
+	SharedMemory memory = SharedMemory::Create(UniqueName("protocol"), Ring::MemoryBytes(SMALL_RING));
+	RecordingReceiver receiver;
+	SharedRingCapture capture { memory, SMALL_RING, &receiver, [] { return true; } };
+	SharedRingWriter writer { memory };
+	writer.Publish(FORMAT);
+	capture.WaitForProducer(std::chrono::milliseconds(100));
+	capture.Start();
+
+	// sizes that don't divide the ring, so records keep landing in different places before the wrap
+	const uint32_t sizes[] = { 480, 441, 1024, 7, 333, 2000 };
+	struct Sent {
+		uint32_t frameCount;
+		uint64_t position;
+		bool silent;
+		bool discontinuity;
+		std::vector<float> samples;
+	};
+	std::vector<Sent> sent;
+	uint64_t position = 0;
+	for(uint32_t i = 0; i < 600; i++) {
+		Sent packet { sizes[i % 6], position, i % 11 == 5, i % 13 == 7, PacketSamples(sizes[i % 6], i) };
+		position += packet.frameCount;
+
+		CapturePacket captured { packet.silent ? nullptr : reinterpret_cast<const uint8_t*>(packet.samples.data()), packet.frameCount };
+		captured.position = packet.position;
+		captured.timestamp = packet.position * 10000000 / SAMPLE_RATE;
+		captured.timed = true;
+		captured.silent = packet.silent;
+		captured.discontinuity = packet.discontinuity;
+		// never more than the ring holds in flight, this part isn't about overflow
+		WaitFor([&] { return receiver.Count() + 2 >= sent.size(); }, std::chrono::milliseconds(1000));
+		writer.OnPacket(captured);
+		sent.push_back(std::move(packet));
+		writer.OnWakeup(1, 100);
+	}
+	WaitFor([&] { return receiver.Count() == sent.size(); }, std::chrono::milliseconds(1000));
+	capture.Stop();
+
+	size_t mismatches = 0;
+	for(size_t i = 0; i < sent.size() && i < receiver.delivered.size(); i++) {
+		const Sent& a = sent[i];
+		const RecordingReceiver::Delivered& b = receiver.delivered[i];
+		const bool same = a.frameCount == b.frameCount && a.position == b.position && b.timestamp == a.position * 10000000 / SAMPLE_RATE &&
+			a.silent == b.silent && a.discontinuity == b.discontinuity && b.timed &&
+			(a.silent || (a.samples.front() == b.first && a.samples.back() == b.last));
+		if(!same) mismatches++;
+	}
+	const bool ok = receiver.delivered.size() == sent.size() && mismatches == 0 && writer.DroppedPackets() == 0 && receiver.wakeups > 0;
+	printf("  %zu packets through a 64 KiB ring, %zu delivered, %zu mismatched, %llu wakeups  %s\n", sent.size(), receiver.delivered.size(),
+		mismatches, static_cast<unsigned long long>(receiver.wakeups.load()), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// The reader doesn't take anything for a while: packets that don't fit are dropped, the next one that does is flagged,
+// and a pipeline behind the reader fills the hole so its timeline still matches what the source produced
+bool CheckOverflow() {
+	constexpr size_t SMALL_RING = 64 * 1024;
+	constexpr uint32_t PACKET_FRAMES = 480;
+	SharedMemory memory = SharedMemory::Create(UniqueName("overflow"), Ring::MemoryBytes(SMALL_RING));
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, SAMPLE_RATE);
+	SharedRingCapture capture { memory, SMALL_RING, &pipeline, [] { return true; } };
+	SharedRingWriter writer { memory };
+	writer.Publish(FORMAT);
+	capture.WaitForProducer(std::chrono::milliseconds(100));
+
+	const std::vector<float> samples = PacketSamples(PACKET_FRAMES, 1);
+	uint64_t position = 0;
+	auto send = [&](uint32_t count) {
+		for(uint32_t i = 0; i < count; i++) {
+			CapturePacket captured { reinterpret_cast<const uint8_t*>(samples.data()), PACKET_FRAMES };
+			captured.position = position;
+			captured.timestamp = position * 10000000 / SAMPLE_RATE;
+			captured.timed = true;
+			writer.OnPacket(captured);
+			position += PACKET_FRAMES;
+		}
+		writer.OnWakeup(count, 0);
+	};
+
+	// the reader isn't started yet, about 16 of these fit
+	send(40);
+	const uint64_t dropped = writer.DroppedPackets();
+	capture.Start();
+	WaitFor([&] { return pipeline.Ring().WriteCursor() >= 16 * PACKET_FRAMES; }, std::chrono::milliseconds(1000));
+	send(4);
+	WaitFor([&] { return pipeline.Ring().WriteCursor() >= position; }, std::chrono::milliseconds(1000));
+	capture.Stop();
+
+	const CaptureStats::Snapshot stats = pipeline.Stats().Read();
+	const bool ok = dropped > 0 && stats.discontinuities == 1 && stats.gapFrames == dropped * PACKET_FRAMES && pipeline.Ring().WriteCursor() == position;
+	printf("  reader stalled: %llu of 44 packets dropped, %llu discontinuity, %llu frames filled, %llu of %llu frames in the ring  %s\n",
+		static_cast<unsigned long long>(dropped), static_cast<unsigned long long>(stats.discontinuities),
+		static_cast<unsigned long long>(stats.gapFrames), static_cast<unsigned long long>(pipeline.Ring().WriteCursor()),
+		static_cast<unsigned long long>(position), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// Runs in the forked child: a synthetic source writing into the shared memory by name, until told to quit
+[[noreturn]] void RunProducer(const std::string& name, const CapturePacing& pacing) {
+	int status = 0;
+	try {
+		SharedMemory memory = SharedMemory::Open(name);
+		SharedRingWriter writer { memory };
+		SyntheticCapture source { &writer, FORMAT, pacing };
+		writer.Publish(source.GetFormat());
+
+		Ring::Command command = Ring::Idle;
+		while(command != Ring::Quit) {
+			const Ring::Command next = writer.WaitForCommand(command, std::chrono::milliseconds(100));
+			if(next == Ring::Start && command != Ring::Start) source.Start();
+			command = next;
+		}
+		source.Stop();
+	} catch(const std::exception& error) {
+		fprintf(stderr, "producer: %s\n", error.what());
+		status = 1;
+	}
+	_exit(status);
+}
+
+bool ChildAlive(pid_t child) {
+	return waitpid(child, nullptr, WNOHANG) == 0;
+}
+
+// A forked producer paced like WASAPI, read into a pipeline and pulled in real time like the godot mixer does
+bool RunRealTime(double seconds) {
+	constexpr size_t MIX_FRAMES = 512;
+	const std::string name = UniqueName("realtime");
+	SharedMemory memory = SharedMemory::Create(name, Ring::MemoryBytes(RING_BYTES));
+	CapturePipeline pipeline { RING_FRAMES };
+	SharedRingCapture capture { memory, RING_BYTES, &pipeline, [] { return true; } };
+
+	CapturePacing pacing;
+	pacing.jitterMicroseconds = 1500;
+	const pid_t child = fork();
+	if(child == 0) RunProducer(name, pacing);
+
+	bool ok = true;
+	try {
+		capture.WaitForProducer(std::chrono::milliseconds(2000));
+	} catch(const std::exception& error) {
+		printf("  %s  FAIL\n", error.what());
+		kill(child, SIGKILL);
+		waitpid(child, nullptr, 0);
+		return false;
+	}
+	pipeline.Configure(capture.GetFormat(), SAMPLE_RATE);
+	CapturePipeline::Reader reader { pipeline.Ring() };
+	capture.Start();
+
+	// prefill like a playback's target latency would
+	WaitFor([&] { return reader.Lag() >= SAMPLE_RATE / 25; }, std::chrono::milliseconds(1000));
+
+	std::vector<StereoFrame> output(MIX_FRAMES);
+	size_t underruns = 0;
+	const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / SAMPLE_RATE));
+	auto deadline = Clock::now();
+	const auto end = deadline + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	while(Clock::now() < end) {
+		if(pipeline.Mix(reader, output.data(), MIX_FRAMES) < MIX_FRAMES) underruns++;
+		deadline += period;
+		std::this_thread::sleep_until(deadline);
+	}
+
+	capture.Stop();
+	int status = -1;
+	const bool exited = WaitFor([&] { return waitpid(child, &status, WNOHANG) == child; }, std::chrono::milliseconds(1000));
+	if(!exited) {
+		kill(child, SIGKILL);
+		waitpid(child, nullptr, 0);
+	}
+
+	const CaptureStats::Snapshot stats = pipeline.Stats().Read();
+	const AtomicHistogram<64>::Snapshot latency = capture.WakeupLatency();
+	ok = underruns == 0 && capture.DroppedPackets() == 0 && stats.discontinuities == 0 && stats.wakeups > 0 && exited && status == 0;
+	printf("  forked producer %.1f s: %llu packets, %llu wakeups, %zu underruns, %llu dropped, producer quit %s\n", seconds,
+		static_cast<unsigned long long>(stats.packets), static_cast<unsigned long long>(stats.wakeups), underruns,
+		static_cast<unsigned long long>(capture.DroppedPackets()), exited && status == 0 ? "cleanly" : "NOT cleanly");
+	printf("  wakeup across the boundary p50=%lluus p99=%lluus max=%lluus  %s\n", static_cast<unsigned long long>(latency.Percentile(0.5)),
+		static_cast<unsigned long long>(latency.Percentile(0.99)), static_cast<unsigned long long>(latency.max), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// The forked producer writes as fast as the reader makes room, waiting on its cursor rather than dropping
+void MeasureThroughput(double seconds) {
+	for(uint32_t packetFrames : { 64u, 480u, 4096u }) {
+		const std::string name = UniqueName("throughput");
+		SharedMemory memory = SharedMemory::Create(name, Ring::MemoryBytes(RING_BYTES));
+		CountingReceiver receiver;
+		SharedRingCapture capture { memory, RING_BYTES, &receiver, [] { return true; } };
+
+		const pid_t child = fork();
+		if(child == 0) {
+			SharedMemory shared = SharedMemory::Open(name);
+			SharedRingWriter writer { shared };
+			writer.Publish(FORMAT);
+			while(writer.WaitForCommand(Ring::Idle, std::chrono::milliseconds(100)) == Ring::Idle) { }
+
+			const Ring::Header& header = *static_cast<const Ring::Header*>(shared.Data());
+			const std::vector<float> samples = PacketSamples(packetFrames, 1);
+			const size_t recordBytes = sizeof(Ring::Record) * 2 + samples.size() * sizeof(float);
+			uint64_t position = 0;
+			while(header.command.load(std::memory_order_relaxed) != Ring::Quit) {
+				for(int i = 0; i < 4; i++) {
+					while(header.writeCursor.load(std::memory_order_relaxed) - header.readCursor.load(std::memory_order_acquire) + recordBytes * 2 > RING_BYTES) {
+						if(header.command.load(std::memory_order_relaxed) == Ring::Quit) _exit(0);
+					}
+					CapturePacket captured { reinterpret_cast<const uint8_t*>(samples.data()), packetFrames };
+					captured.position = position;
+					writer.OnPacket(captured);
+					position += packetFrames;
+				}
+				writer.OnWakeup(4, 0);
+			}
+			_exit(0);
+		}
+
+		capture.WaitForProducer(std::chrono::milliseconds(2000));
+		capture.Start();
+		const auto start = Clock::now();
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		const uint64_t frames = receiver.frames.load();
+		const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		capture.Stop();
+		waitpid(child, nullptr, 0);
+
+		const double bytes = double(frames) * FORMAT.BytesPerFrame();
+		printf("  %4u frames per packet  %8.3f GB/s  %6.2f ns/frame  %6.0fx real time  %.0f packets/s\n", packetFrames, bytes / elapsed / 1e9,
+			elapsed * 1e9 / std::max<double>(double(frames), 1), double(frames) / elapsed / SAMPLE_RATE, double(frames) / packetFrames / elapsed);
+	}
+}
+
+// The producer dies mid-capture: the reader has to notice and report it, not wait forever
+bool CheckProducerCrash() {
+	const std::string name = UniqueName("crash");
+	SharedMemory memory = SharedMemory::Create(name, Ring::MemoryBytes(RING_BYTES));
+	RecordingReceiver receiver;
+	pid_t child = 0;
+	SharedRingCapture capture { memory, RING_BYTES, &receiver, [&] { return ChildAlive(child); } };
+
+	child = fork();
+	if(child == 0) RunProducer(name, CapturePacing { });
+
+	capture.WaitForProducer(std::chrono::milliseconds(2000));
+	capture.Start();
+	WaitFor([&] { return receiver.Count() >= 10; }, std::chrono::milliseconds(1000));
+	kill(child, SIGKILL);
+	const auto killed = Clock::now();
+	const bool noticed = WaitFor([&] { return receiver.lastError.load() == SharedRingCapture::ERROR_PRODUCER_LOST; }, std::chrono::milliseconds(2000));
+	const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - killed).count();
+	capture.Stop();
+	waitpid(child, nullptr, WNOHANG);
+
+	printf("  producer killed after %zu packets, reader reported it after %.0f ms  %s\n", receiver.Count(), milliseconds, noticed ? "ok" : "FAIL");
+	return noticed;
+}
+
+// The producer never gets its source up, like an activation that never completes: waiting for it gives up
+bool CheckProducerHang() {
+	const std::string name = UniqueName("hang");
+	SharedMemory memory = SharedMemory::Create(name, Ring::MemoryBytes(RING_BYTES));
+	RecordingReceiver receiver;
+	pid_t child = 0;
+	SharedRingCapture capture { memory, RING_BYTES, &receiver, [&] { return ChildAlive(child); } };
+
+	child = fork();
+	if(child == 0) {
+		pause();
+		_exit(0);
+	}
+
+	const auto start = Clock::now();
+	bool threw = false;
+	try {
+		capture.WaitForProducer(std::chrono::milliseconds(300));
+	} catch(const std::exception&) {
+		threw = true;
+	}
+	const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	kill(child, SIGKILL);
+	waitpid(child, nullptr, 0);
+
+	const bool ok = threw && milliseconds < 500;
+	printf("  producer hung activating, gave up after %.0f ms  %s\n", milliseconds, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 3.0;
+
+	bool ok = CheckProtocol();
+	ok = CheckOverflow() && ok;
+	ok = RunRealTime(seconds) && ok;
+	ok = CheckProducerCrash() && ok;
+	ok = CheckProducerHang() && ok;
+	MeasureThroughput(seconds / 6);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
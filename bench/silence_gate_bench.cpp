@@ -0,0 +1,373 @@
+// The silence gate: the peak kernels against the scalar reference, the gate's hysteresis on levels around both
+// thresholds, a pipeline and jitter buffer on a simulated clock with and without the gate (the same output until it
+// closes, no underruns while the source idles and the tone coming back on time), then what idle and active streams
+// cost in real time, with the process' CPU time as the measure.
+// scons bench && ./bench/bin/silence_gate_bench [seconds] [streams]
+
+#include "capture_pipeline.hpp"
+#include "jitter_buffer.hpp"
+#include "silence_gate.hpp"
+#include "synthetic_capture.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+// godot's default mix rate, so the pipeline resamples like it usually does
+constexpr uint32_t MIX_RATE = 44100;
+constexpr size_t RING_FRAMES = 16384;
+constexpr uint32_t PACKET_FRAMES = 480;
+constexpr size_t MIX_FRAMES = 512;
+const CaptureFormat FORMAT { SAMPLE_RATE, 2, 32, SampleType::Float };
+// somewhere well away from 0 on the capture clock
+constexpr uint64_t EPOCH = 10000000000ull;
+
+std::vector<SimdLevel> AvailableLevels() {
+	std::vector<SimdLevel> levels;
+	for(SimdLevel level : { SimdLevel::Scalar, SimdLevel::Baseline, SimdLevel::Avx }) {
+		if(ClampSimdLevel(level) == level) levels.push_back(level);
+	}
+	return levels;
+}
+
+double ProcessCpuSeconds() {
+	timespec now { };
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+bool CheckPeak() {
+	bool ok = true;
+	const PeakFunction reference = SelectPeak(SimdLevel::Scalar);
+	std::mt19937 random { 7 };
+	std::uniform_real_distribution<float> distribution { -0.5f, 0.5f };
+	for(SimdLevel level : AvailableLevels()) {
+		const PeakFunction kernel = SelectPeak(level);
+		size_t mismatches = 0;
+		size_t cases = 0;
+		for(size_t count : { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1000, 1023 }) {
+			// the loudest sample everywhere from the first to the last, negative and positive
+			for(size_t loudest = 0; loudest < std::max<size_t>(count, 1); loudest += std::max<size_t>(count / 7, 1)) {
+				std::vector<float> samples(count);
+				for(float& sample : samples) sample = distribution(random);
+				if(count != 0) samples[loudest] = loudest % 2 == 0 ? -0.9f : 0.9f;
+				if(kernel(samples.data(), count) != reference(samples.data(), count)) mismatches++;
+				cases++;
+			}
+		}
+		ok = ok && mismatches == 0;
+		printf("  peak %-6s %zu lengths and positions, %zu differ from the reference  %s\n", SimdLevelName(level), cases, mismatches,
+			mismatches == 0 ? "ok" : "FAIL");
+	}
+	return ok;
+}
+
+// Feeds chunk after chunk of one level into a gate, keeping the ring position
+struct GateDriver {
+	SilenceGate& gate;
+	uint64_t position;
+	std::vector<StereoFrame> chunk;
+
+	void Feed(float level, uint32_t milliseconds, bool flagged = false) {
+		for(uint64_t frames = uint64_t(SAMPLE_RATE) * milliseconds / 1000; frames > 0;) {
+			const size_t count = static_cast<size_t>(std::min<uint64_t>(frames, PACKET_FRAMES));
+			// alternating sign, the peak is the level either way
+			for(size_t i = 0; i < count; i++) chunk[i] = StereoFrame { i % 2 == 0 ? level : -level, level * 0.5f };
+			gate.Feed(flagged ? nullptr : chunk.data(), count, position);
+			position += count;
+			frames -= count;
+		}
+	}
+};
+
+bool CheckHysteresis() {
+	SilenceGate gate;
+	gate.Configure(SAMPLE_RATE);
+	GateDriver driver { gate, 0, std::vector<StereoFrame>(PACKET_FRAMES) };
+	const uint64_t holdFrames = uint64_t(SAMPLE_RATE) * SilenceGate::HOLD_MILLISECONDS / 1000;
+	// -70, -63 (between the thresholds) and -54 dBFS
+	const float quiet = 0.0003f, between = 0.0007f, audible = 0.002f;
+
+	driver.Feed(0.5f, 1000);
+	const uint64_t quietFrom = driver.position;
+	driver.Feed(quiet, SilenceGate::HOLD_MILLISECONDS - 10);
+	const bool heldOpen = !gate.IsClosed();
+	driver.Feed(quiet, 20);
+	const bool closedAfterHold = gate.IsClosed();
+	// closes at the first packet once the hold is over, and everything from there on is silent
+	const uint64_t closedAt = quietFrom + (holdFrames + PACKET_FRAMES - 1) / PACKET_FRAMES * PACKET_FRAMES;
+	const bool closedAtHold = gate.SilentUntil(closedAt) == SilenceGate::NEVER && gate.SilentUntil(closedAt - 1) == closedAt - 1;
+
+	driver.Feed(between, 1000);
+	const bool stayedClosed = gate.IsClosed();
+	const uint64_t openedAt = driver.position;
+	driver.Feed(audible, 10);
+	const bool opened = !gate.IsClosed() && gate.SilentUntil(closedAt) == openedAt && gate.SilentUntil(openedAt) == openedAt;
+
+	driver.Feed(between, 1000);
+	const bool stayedOpen = !gate.IsClosed();
+	driver.Feed(0.0f, SilenceGate::HOLD_MILLISECONDS + 20, true);
+	const bool flaggedCloses = gate.IsClosed();
+
+	gate.SetEnabled(false);
+	driver.Feed(0.0f, 10, true);
+	const bool disabledOpens = !gate.IsClosed();
+
+	const bool ok = heldOpen && closedAfterHold && closedAtHold && stayedClosed && opened && stayedOpen && flaggedCloses && disabledOpens &&
+		gate.Closes() == 2;
+	printf("  hysteresis: held %d, closed %d at the hold %d, -63 dB kept it closed %d, -54 dB opened it %d, -63 dB kept it open %d, "
+		"flagged silence closed it %d, disabling opened it %d  %s\n", heldOpen, closedAfterHold, closedAtHold, stayedClosed, opened, stayedOpen,
+		flaggedCloses, disabledOpens, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// What the capture delivers at a source frame: a tone, then digital silence, then packets flagged silent, then the
+// tone again
+constexpr uint64_t SILENT_FROM = 1 * SAMPLE_RATE;
+constexpr uint64_t FLAGGED_FROM = 3 * SAMPLE_RATE;
+constexpr uint64_t TONE_AGAIN = 4 * SAMPLE_RATE;
+constexpr uint64_t SOURCE_END = 5 * SAMPLE_RATE;
+
+struct SimulatedRun {
+	std::vector<StereoFrame> output;
+	uint64_t wakeups;
+	uint64_t silentWakeups;
+	uint64_t gatedMixes;
+	uint64_t underrunFrames;
+	uint64_t mixes;
+};
+
+// A source waking up like WASAPI does, idling when the pipeline asks it to, and a playback mixing like
+// AudioStreamPlaybackWasapiAppCapture::_mix_resampled, events in time order on one thread
+SimulatedRun Simulate(bool gateEnabled) {
+	CapturePipeline pipeline { RING_FRAMES };
+	pipeline.Configure(FORMAT, MIX_RATE);
+	pipeline.SetSilenceGateEnabled(gateEnabled);
+	JitterBuffer jitter { pipeline.Ring(), MIX_RATE, MIX_RATE * 30 / 1000 };
+	jitter.Start();
+
+	SimulatedRun run { };
+	std::vector<StereoFrame> packet(PACKET_FRAMES);
+	std::vector<StereoFrame> block(MIX_FRAMES);
+	const uint64_t packetTicks = uint64_t(PACKET_FRAMES) * 10000000 / SAMPLE_RATE;
+	const double mixTicks = double(MIX_FRAMES) * 10000000 / MIX_RATE;
+
+	uint64_t delivered = 0;
+	uint64_t nextWakeup = EPOCH + packetTicks;
+	double nextMix = EPOCH + packetTicks;
+	double phase = 0.0;
+	while(delivered < SOURCE_END) {
+		if(nextWakeup <= nextMix) {
+			// everything captured until now, as many packets as piled up
+			uint32_t packets = 0;
+			while(delivered < SOURCE_END && EPOCH + (delivered + PACKET_FRAMES) * 10000000 / SAMPLE_RATE <= nextWakeup) {
+				CapturePacket captured { };
+				captured.frameCount = PACKET_FRAMES;
+				captured.position = delivered;
+				captured.timestamp = EPOCH + delivered * 10000000 / SAMPLE_RATE;
+				captured.timed = true;
+				const bool tone = delivered < SILENT_FROM || delivered >= TONE_AGAIN;
+				for(uint32_t i = 0; i < PACKET_FRAMES; i++) {
+					const float sample = tone ? 0.5f * static_cast<float>(std::sin(phase)) : 0.0f;
+					phase += 2.0 * 3.14159265358979323846 * 440.0 / SAMPLE_RATE;
+					packet[i] = StereoFrame { sample, sample };
+				}
+				captured.silent = delivered >= FLAGGED_FROM && delivered < TONE_AGAIN;
+				captured.frames = captured.silent ? nullptr : reinterpret_cast<const uint8_t*>(packet.data());
+				pipeline.OnPacket(captured);
+				delivered += PACKET_FRAMES;
+				packets++;
+			}
+			pipeline.OnWakeup(packets, 0);
+			run.wakeups++;
+			if(delivered > SILENT_FROM && delivered <= TONE_AGAIN) run.silentWakeups++;
+
+			const uint64_t idle = std::chrono::duration_cast<std::chrono::microseconds>(pipeline.IdleWakeupInterval()).count() * 10;
+			nextWakeup += std::max(packetTicks, idle / packetTicks * packetTicks);
+		} else {
+			const uint64_t underrunsBefore = jitter.UnderrunFrames();
+			size_t mixed = jitter.MixSilence(block.data(), MIX_FRAMES, pipeline.SilentUntil(jitter.Position()));
+			if(mixed != 0) {
+				run.gatedMixes++;
+			} else {
+				mixed = jitter.Mix(block.data(), MIX_FRAMES);
+			}
+			std::fill(block.begin() + mixed, block.end(), StereoFrame { 0.0f, 0.0f });
+			run.output.insert(run.output.end(), block.begin(), block.end());
+			run.underrunFrames += jitter.UnderrunFrames() - underrunsBefore;
+			run.mixes++;
+			nextMix += mixTicks;
+		}
+	}
+	return run;
+}
+
+size_t FirstAudible(const std::vector<StereoFrame>& output, size_t from) {
+	for(size_t i = from; i < output.size(); i++) {
+		if(std::fabs(output[i].left) > 0.05f) return i;
+	}
+	return output.size();
+}
+
+bool CheckPipeline() {
+	const SimulatedRun gated = Simulate(true);
+	const SimulatedRun reference = Simulate(false);
+
+	// untouched until the gate closes, a hold after the tone stopped plus the latency
+	const size_t untilClose = static_cast<size_t>((SILENT_FROM + SAMPLE_RATE * SilenceGate::HOLD_MILLISECONDS / 1000) * MIX_RATE / SAMPLE_RATE);
+	bool same = gated.output.size() == reference.output.size();
+	for(size_t i = 0; same && i < untilClose; i++) {
+		same = gated.output[i].left == reference.output[i].left && gated.output[i].right == reference.output[i].right;
+	}
+
+	// the tone comes back as late as where in an idle interval it started, give or take
+	const size_t searchFrom = static_cast<size_t>((FLAGGED_FROM + TONE_AGAIN) / 2 * MIX_RATE / SAMPLE_RATE);
+	const size_t gatedOnset = FirstAudible(gated.output, searchFrom);
+	const size_t referenceOnset = FirstAudible(reference.output, searchFrom);
+	const double onsetMilliseconds = (static_cast<double>(gatedOnset) - static_cast<double>(referenceOnset)) * 1000.0 / MIX_RATE;
+	const bool onTime = gatedOnset < gated.output.size() && std::fabs(onsetMilliseconds) <= 15.0;
+
+	// the whole silence but the hold and a mix either side of it
+	const double silentMixes = double(TONE_AGAIN - SILENT_FROM - SAMPLE_RATE * SilenceGate::HOLD_MILLISECONDS / 1000) * MIX_RATE / SAMPLE_RATE / MIX_FRAMES;
+	const bool gatedEnough = gated.gatedMixes + 2 >= static_cast<uint64_t>(silentMixes) && reference.gatedMixes == 0;
+	const bool fewerWakeups = gated.silentWakeups * 3 < reference.silentWakeups * 2;
+
+	const bool ok = same && onTime && gatedEnough && fewerWakeups && gated.underrunFrames == 0 && reference.underrunFrames == 0;
+	printf("  simulated, 1 s tone, 2 s zeros, 1 s flagged silence, 1 s tone:\n");
+	printf("    gate on:  %llu of %llu mixes gated, %llu underrun frames, %llu wakeups while silent\n",
+		static_cast<unsigned long long>(gated.gatedMixes), static_cast<unsigned long long>(gated.mixes), static_cast<unsigned long long>(gated.underrunFrames),
+		static_cast<unsigned long long>(gated.silentWakeups));
+	printf("    gate off: %llu of %llu mixes gated, %llu underrun frames, %llu wakeups while silent\n",
+		static_cast<unsigned long long>(reference.gatedMixes), static_cast<unsigned long long>(reference.mixes),
+		static_cast<unsigned long long>(reference.underrunFrames), static_cast<unsigned long long>(reference.silentWakeups));
+	printf("    identical until the gate closed %d, tone back %+.1f ms from without the gate  %s\n", same, onsetMilliseconds, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+
+struct Scenario {
+	const char* name;
+	float amplitude;
+	// the source flags its packets silent instead of delivering zeros
+	bool flagged;
+	bool gate;
+};
+
+struct Stream {
+	CapturePipeline pipeline { RING_FRAMES };
+	std::unique_ptr<JitterBuffer> jitter;
+	std::unique_ptr<SyntheticCapture> capture;
+	uint64_t wakeups = 0;
+	uint64_t underrunFrames = 0;
+	uint64_t gatedMixes = 0;
+};
+
+// streams captures at the source's pace, mixed by this thread at the mixer's like godot would, for a while to let
+// the gates close and then for seconds measured
+void MeasureStreams(double seconds, size_t streamCount) {
+	const Scenario scenarios[] = {
+		{ "tone, gate on", 0.2f, false, true },
+		{ "zeros, gate off", 0.0f, false, false },
+		{ "zeros, gate on", 0.0f, false, true },
+		{ "flagged silent, gate off", 0.0f, true, false },
+		{ "flagged silent, gate on", 0.0f, true, true },
+	};
+
+	printf("  %zu streams %.1f s each, %u Hz captured and mixed at %u Hz through jitter buffers (the synthetic sources' own cost is in every row):\n",
+		streamCount, seconds, SAMPLE_RATE, MIX_RATE);
+	for(const Scenario& scenario : scenarios) {
+		std::vector<std::unique_ptr<Stream>> streams;
+		for(size_t i = 0; i < streamCount; i++) {
+			auto stream = std::make_unique<Stream>();
+			stream->pipeline.Configure(FORMAT, MIX_RATE);
+			stream->pipeline.SetSilenceGateEnabled(scenario.gate);
+			stream->jitter = std::make_unique<JitterBuffer>(stream->pipeline.Ring(), MIX_RATE, MIX_RATE * 30 / 1000);
+			stream->jitter->Start();
+
+			CapturePacing pacing;
+			pacing.jitterMicroseconds = 1000;
+			pacing.seed = static_cast<uint32_t>(i + 1);
+			pacing.silentEvery = scenario.flagged ? 1 : 0;
+			stream->capture = std::make_unique<SyntheticCapture>(&stream->pipeline, FORMAT, pacing, 220.0 + 20.0 * i, scenario.amplitude);
+			streams.push_back(std::move(stream));
+		}
+		for(auto& stream : streams) stream->capture->Start();
+
+		std::vector<StereoFrame> block(MIX_FRAMES);
+		const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(double(MIX_FRAMES) / MIX_RATE));
+		auto deadline = Clock::now();
+		const auto measureFrom = deadline + std::chrono::milliseconds(500);
+		const auto end = measureFrom + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+		bool measuring = false;
+		double cpuFrom = 0.0;
+		uint64_t mixes = 0;
+		while(deadline < end) {
+			if(!measuring && Clock::now() >= measureFrom) {
+				measuring = true;
+				cpuFrom = ProcessCpuSeconds();
+				for(auto& stream : streams) {
+					stream->wakeups = stream->pipeline.Stats().Read().wakeups;
+					stream->underrunFrames = stream->jitter->UnderrunFrames();
+				}
+			}
+
+			for(auto& stream : streams) {
+				JitterBuffer& jitter = *stream->jitter;
+				if(jitter.MixSilence(block.data(), MIX_FRAMES, stream->pipeline.SilentUntil(jitter.Position())) != 0) {
+					if(measuring) stream->gatedMixes++;
+				} else {
+					jitter.Mix(block.data(), MIX_FRAMES);
+				}
+			}
+			if(measuring) mixes++;
+
+			deadline += period;
+			std::this_thread::sleep_until(deadline);
+		}
+		const double cpu = ProcessCpuSeconds() - cpuFrom;
+
+		uint64_t wakeups = 0;
+		uint64_t underrunFrames = 0;
+		uint64_t gatedMixes = 0;
+		for(auto& stream : streams) {
+			wakeups += stream->pipeline.Stats().Read().wakeups - stream->wakeups;
+			underrunFrames += stream->jitter->UnderrunFrames() - stream->underrunFrames;
+			gatedMixes += stream->gatedMixes;
+		}
+		for(auto& stream : streams) stream->capture->Stop();
+
+		printf("    %-26s %6.2f%% of a core  %5.1f wakeups/s per stream  %5.1f%% of mixes gated  %llu underrun frames\n", scenario.name,
+			cpu / seconds * 100.0, wakeups / seconds / streamCount, mixes != 0 ? 100.0 * gatedMixes / (mixes * streamCount) : 0.0,
+			static_cast<unsigned long long>(underrunFrames));
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+	const double seconds = argc > 1 ? atof(argv[1]) : 3.0;
+	const size_t streams = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 16;
+
+	printf("kernel available: %s\n", SimdLevelName(DetectSimdLevel()));
+
+	bool ok = CheckPeak();
+	ok = CheckHysteresis() && ok;
+	ok = CheckPipeline() && ok;
+	MeasureStreams(seconds, streams);
+
+	printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#ifndef AUDIO_TYPES_HPP
+#define AUDIO_TYPES_HPP
+
+// Platform-neutral audio types shared between the capture side and the godot side.
+// Nothing in here may include windows.h or godot-cpp, so the buffering code can be built on its own.
+
+// Same layout as godot::AudioFrame, so the mixer can hand its output buffer straight to the ring
+struct StereoFrame {
+	float left;
+	float right;
+};
+
+static_assert(sizeof(StereoFrame) == 2 * sizeof(float), "StereoFrame must be two packed floats");
+
+#endif // AUDIO_TYPES_HPP
@@ -0,0 +1,200 @@
+#include "audioeffect_wasapi_app_capture.h"
+
+#include <godot_cpp/classes/audio_frame.hpp>
+#include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+AudioEffectWasapiAppCapture::AudioEffectWasapiAppCapture()
+    : volume_db(0.0), gain(1.0f) {
+}
+
+AudioEffectWasapiAppCapture::~AudioEffectWasapiAppCapture() {
+}
+
+Ref<AudioEffectInstance> AudioEffectWasapiAppCapture::_instantiate() {
+    Ref<AudioEffectWasapiAppCaptureInstance> instance;
+    instance.instantiate();
+    instance->start(Ref<AudioEffectWasapiAppCapture>(this));
+    return instance;
+}
+
+void AudioEffectWasapiAppCapture::set_stream(const Ref<AudioStreamWasapiAppCapture> &stream) {
+    this->stream = stream;
+}
+
+Ref<AudioStreamWasapiAppCapture> AudioEffectWasapiAppCapture::get_stream() const {
+    return stream;
+}
+
+void AudioEffectWasapiAppCapture::set_volume_db(double volume_db) {
+    this->volume_db = volume_db;
+    gain.store(static_cast<float>(Math::db_to_linear(volume_db)), std::memory_order_relaxed);
+}
+
+double AudioEffectWasapiAppCapture::get_volume_db() const {
+    return volume_db;
+}
+
+void AudioEffectWasapiAppCapture::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_stream", "stream"), &AudioEffectWasapiAppCapture::set_stream);
+    ClassDB::bind_method(D_METHOD("get_stream"), &AudioEffectWasapiAppCapture::get_stream);
+    ClassDB::bind_method(D_METHOD("set_volume_db", "volume_db"), &AudioEffectWasapiAppCapture::set_volume_db);
+    ClassDB::bind_method(D_METHOD("get_volume_db"), &AudioEffectWasapiAppCapture::get_volume_db);
+
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "stream", PROPERTY_HINT_RESOURCE_TYPE, "AudioStreamWasapiAppCapture"), "set_stream", "get_stream");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "volume_db", PROPERTY_HINT_RANGE, "-80,24,0.01,suffix:dB"), "set_volume_db", "get_volume_db");
+}
+
+AudioEffectWasapiAppCaptureInstance::AudioEffectWasapiAppCaptureInstance()
+    : captured(BLOCK_FRAMES), accumulate(SelectAccumulator()), gain(1.0f), last_dropped(0), mix_position(0), capture_latency_usec(-1) {
+}
+
+AudioEffectWasapiAppCaptureInstance::~AudioEffectWasapiAppCaptureInstance() {
+}
+
+void AudioEffectWasapiAppCaptureInstance::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("get_latency"), &AudioEffectWasapiAppCaptureInstance::get_latency);
+    ClassDB::bind_method(D_METHOD("get_stats"), &AudioEffectWasapiAppCaptureInstance::get_stats);
+    ClassDB::bind_method(D_METHOD("get_capture_time_usec"), &AudioEffectWasapiAppCaptureInstance::get_capture_time_usec);
+    ClassDB::bind_method(D_METHOD("get_capture_latency"), &AudioEffectWasapiAppCaptureInstance::get_capture_latency);
+    ClassDB::bind_method(D_METHOD("get_total_latency"), &AudioEffectWasapiAppCaptureInstance::get_total_latency);
+
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "capture_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_capture_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "total_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_total_latency");
+}
+
+void AudioEffectWasapiAppCaptureInstance::start(const Ref<AudioEffectWasapiAppCapture> &owner) {
+    effect = owner;
+    gain = owner->gain.load(std::memory_order_relaxed);
+    audioStream = owner->stream;
+    // don't capture into the editor's buses, a scene being edited isn't playing
+    if(audioStream.is_null() || Engine::get_singleton()->is_editor_hint()) return;
+
+    // a target that isn't running has been reported, the bus just goes through then
+    session = audioStream->acquire_session();
+    if(!session) return;
+
+    // the capture is converted to the mix rate already, the bus runs at it, so there's nothing to resample
+    CapturePipeline &pipeline = session->Pipeline();
+    if(audioStream->is_jitter_buffer_enabled()) {
+        const uint32_t target = static_cast<uint32_t>(audioStream->get_target_latency() * pipeline.OutputRate());
+        jitter = std::make_unique<JitterBuffer>(pipeline.Ring(), pipeline.OutputRate(), target);
+        jitter->Start();
+        last_dropped = jitter->DroppedCount();
+    } else {
+        // starts at the live edge
+        reader = std::make_unique<CapturePipeline::Reader>(pipeline.Ring());
+        last_dropped = reader->DroppedCount();
+    }
+}
+
+bool AudioEffectWasapiAppCaptureInstance::_process_silence() const {
+    return true;
+}
+
+void AudioEffectWasapiAppCaptureInstance::_process(const void *src_buffer, AudioFrame *dst_buffer, int32_t frame_count) {
+    const AudioFrame *source = static_cast<const AudioFrame*>(src_buffer);
+    if(source != dst_buffer) memcpy(dst_buffer, source, frame_count * sizeof(AudioFrame));
+    if(!session || frame_count <= 0) return;
+
+    static_assert(sizeof(AudioFrame) == sizeof(StereoFrame), "AudioFrame layout changed");
+    StereoFrame *output = reinterpret_cast<StereoFrame*>(dst_buffer);
+    const float target_gain = effect->gain.load(std::memory_order_relaxed);
+    for(size_t offset = 0; offset < static_cast<size_t>(frame_count); offset += BLOCK_FRAMES) {
+        mix_block(output + offset, std::min(BLOCK_FRAMES, static_cast<size_t>(frame_count) - offset), target_gain);
+    }
+}
+
+void AudioEffectWasapiAppCaptureInstance::mix_block(StereoFrame *output, size_t frames, float target_gain) {
+    size_t fill;
+    uint64_t position;
+    size_t mixed;
+    uint64_t dropped;
+    bool gated;
+    CapturePipeline &pipeline = session->Pipeline();
+    // Behind a closed silence gate there's nothing to read, and adding zeros to the bus changes nothing
+    if(jitter) {
+        fill = jitter->Fill();
+        position = jitter->Position();
+        mixed = jitter->MixSilence(captured.data(), frames, pipeline.SilentUntil(position));
+        gated = mixed != 0;
+        if(!gated) mixed = jitter->Mix(captured.data(), frames);
+        dropped = jitter->DroppedCount();
+    } else {
+        fill = reader->Lag();
+        position = reader->Position();
+        mixed = pipeline.MixSilence(*reader, captured.data(), frames);
+        gated = mixed != 0;
+        if(!gated) mixed = pipeline.Mix(*reader, captured.data(), frames);
+        dropped = reader->DroppedCount();
+    }
+    mix_position.store(position, std::memory_order_relaxed);
+
+    // An underrun leaves the rest of the bus as it was
+    if(!gated && mixed > 0) {
+        accumulate(captured.data(), output, mixed, gain, (target_gain - gain) / static_cast<float>(mixed));
+    }
+    gain = target_gain;
+
+    // Relaxed atomics only, like a playback's mix
+    stats.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    AudioStreamWasapiAppCapture::mix_totals.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    if(gated) {
+        stats.RecordGatedMix();
+        AudioStreamWasapiAppCapture::mix_totals.RecordGatedMix();
+    }
+    last_dropped = dropped;
+
+    if(fill > 0) {
+        const int64_t latency = AudioStreamWasapiAppCapture::record_capture_latency(stats, pipeline.CaptureTimeAt(position));
+        if(latency >= 0) capture_latency_usec.store(latency, std::memory_order_relaxed);
+    }
+}
+
+Dictionary AudioEffectWasapiAppCaptureInstance::get_stats() const {
+    Dictionary result;
+    if(session) {
+        AudioStreamWasapiAppCapture::add_capture_stats(result, session->Pipeline().Stats().Read());
+        result["rejected_frames"] = session->Pipeline().RejectedFrames();
+        result["silence_gated"] = session->Pipeline().Gate().IsClosed();
+        result["silence_gate_closes"] = session->Pipeline().Gate().Closes();
+    }
+    AudioStreamWasapiAppCapture::add_mix_stats(result, stats.Read());
+    result["latency"] = get_latency();
+    if(jitter) {
+        result["rate_correction_ppm"] = jitter->Correction() * 1e6;
+    }
+    return result;
+}
+
+int64_t AudioEffectWasapiAppCaptureInstance::get_capture_time_usec() const {
+    if(!session) return -1;
+
+    const std::optional<uint64_t> captured_at = session->Pipeline().CaptureTimeAt(mix_position.load(std::memory_order_relaxed));
+    return captured_at ? static_cast<int64_t>(*captured_at / 10) : -1;
+}
+
+double AudioEffectWasapiAppCaptureInstance::get_capture_latency() const {
+    const int64_t latency = capture_latency_usec.load(std::memory_order_relaxed);
+    return latency < 0 ? -1.0 : latency / 1e6;
+}
+
+double AudioEffectWasapiAppCaptureInstance::get_total_latency() const {
+    const double capture = get_capture_latency();
+    return capture < 0 ? -1.0 : capture + AudioServer::get_singleton()->get_output_latency();
+}
+
+double AudioEffectWasapiAppCaptureInstance::get_latency() const {
+    if(!session) return 0.0;
+
+    const double rate = session->Pipeline().OutputRate();
+    if(jitter) return jitter->Latency() / rate;
+    if(reader) return reader->Lag() / rate;
+    return 0.0;
+}
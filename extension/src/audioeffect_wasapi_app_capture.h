@@ -0,0 +1,108 @@
+#ifndef AUDIOEFFECT_WASAPI_APP_CAPTURE_H
+#define AUDIOEFFECT_WASAPI_APP_CAPTURE_H
+
+#include "audiostream_wasapi_app_capture.h"
+
+#include <godot_cpp/classes/audio_effect.hpp>
+#include <godot_cpp/classes/audio_effect_instance.hpp>
+
+#include "capture_mix.hpp"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Adds a capture straight onto the bus it's on, without an AudioStreamPlayer: no playback, no
+ * AudioStreamPlaybackResampled pass and no voice of its own in the mixer, just a read from the capture's buffer and
+ * an add into the bus, with volume_db, in the bus's effect pass. What to capture and how (target, jitter buffer,
+ * target_latency, inserts, history...) comes from stream, which shares its capture with any player using it.
+ *
+ * Every bus the effect is on reads the capture on its own. In the editor it passes the bus through untouched.
+ */
+class AudioEffectWasapiAppCapture : public AudioEffect {
+    GDCLASS(AudioEffectWasapiAppCapture, AudioEffect)
+    friend class AudioEffectWasapiAppCaptureInstance;
+
+public:
+    AudioEffectWasapiAppCapture();
+    ~AudioEffectWasapiAppCapture();
+
+    // The capture is acquired here, when the effect is added to a bus or the bus layout is loaded. A target that
+    // isn't running then isn't mixed until the effect is added again.
+    Ref<AudioEffectInstance> _instantiate() override;
+
+    // Picked up by instances created from then on
+    void set_stream(const Ref<AudioStreamWasapiAppCapture> &stream);
+    Ref<AudioStreamWasapiAppCapture> get_stream() const;
+
+    // Of the captured audio added to the bus, ramped over one block when it changes
+    void set_volume_db(double volume_db);
+    double get_volume_db() const;
+
+protected:
+    static void _bind_methods();
+
+private:
+    Ref<AudioStreamWasapiAppCapture> stream;
+    double volume_db;
+    // volume_db as a linear gain, for the audio thread
+    std::atomic<float> gain;
+};
+
+class AudioEffectWasapiAppCaptureInstance : public AudioEffectInstance {
+    GDCLASS(AudioEffectWasapiAppCaptureInstance, AudioEffectInstance)
+    friend class AudioEffectWasapiAppCapture;
+
+private:
+    // Most frames read per pass, longer blocks take several
+    static constexpr size_t BLOCK_FRAMES = 1024;
+
+    Ref<AudioEffectWasapiAppCapture> effect;
+    // Keeps the stream our session hands back its inserts and history to alive
+    Ref<AudioStreamWasapiAppCapture> audioStream;
+    std::shared_ptr<CaptureSession> session; // Null in the editor or when the target wasn't running
+    // Our own cursor into the session's buffer, like a playback's. Declared after session so they go first.
+    std::unique_ptr<CapturePipeline::Reader> reader;
+    std::unique_ptr<JitterBuffer> jitter;
+    std::vector<StereoFrame> captured;
+    FrameAccumulator accumulate;
+    float gain; // Where the last ramp ended, audio thread only
+
+    MixStats stats; // Recorded by _process on the audio thread
+    uint64_t last_dropped;
+    std::atomic<uint64_t> mix_position;
+    std::atomic<int64_t> capture_latency_usec;
+
+    // Main thread, from _instantiate
+    void start(const Ref<AudioEffectWasapiAppCapture> &owner);
+    // Audio thread, one BLOCK_FRAMES or less
+    void mix_block(StereoFrame *output, size_t frames, float target_gain);
+
+public:
+    AudioEffectWasapiAppCaptureInstance();
+    ~AudioEffectWasapiAppCaptureInstance();
+
+    // dst is src with the capture added, nothing here locks or allocates
+    void _process(const void *src_buffer, AudioFrame *dst_buffer, int32_t frame_count) override;
+    // The bus may well be silent while the app isn't
+    bool _process_silence() const override;
+
+    // Like AudioStreamPlaybackWasapiAppCapture's: seconds between the capture's live edge and what we last mixed,
+    // when that was captured, and from the target rendering it to our last pass (plus the output latency)
+    double get_latency() const;
+    int64_t get_capture_time_usec() const;
+    double get_capture_latency() const;
+    double get_total_latency() const;
+
+    // This instance's passes and its session's capture
+    Dictionary get_stats() const;
+
+protected:
+    static void _bind_methods();
+};
+
+#endif // AUDIOEFFECT_WASAPI_APP_CAPTURE_H
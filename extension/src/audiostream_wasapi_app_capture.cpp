@@ -2,71 +2,818 @@
 
 #include <godot_cpp/classes/audio_frame.hpp>
 #include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/core/object.hpp>
+#include <godot_cpp/classes/performance.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/variant/callable_method_pointer.hpp>
 #include <godot_cpp/core/memory.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
 
-#include <Psapi.h>
-#include <TlHelp32.h>
+#include "helper_capture.hpp"
+#include "win32_process_enumerator.hpp"
+
 #include <Audioclient.h>
 #include <audioclientactivationparams.h>
 #include <mmdeviceapi.h>
 #include <wrl/implements.h>
 
+#include <cstring>
+
 enum {
-    // TODO: get this from wasapi
-    MIX_RATE=48000,
-    // A buffer of about 93ms (at 44100 mix rate)
-    PCM_BUFFER_SIZE = 4096,
-    // TODO Document this (see core implementations). Note that 4096=2^13
-    MIX_FRAC_BITS = 13
+    // A buffer of about 340ms of stereo frames (at 48000 mix rate), must stay a power of two.
+    // Bounds the target latency to a bit under half that, see JitterBuffer::MaxTargetLatency
+    PCM_BUFFER_SIZE = 16384
 };
 
-// TODO: these misc methods should be in some class...
-std::string getWindowExeName(HWND window) {
-	DWORD processId;
-	GetWindowThreadProcessId(window, &processId);
-	if(processId == GetCurrentProcessId()) return "";
+// How often the process registry looks for processes that started or exited
+static const std::chrono::milliseconds PROCESS_POLL_INTERVAL { 1000 };
 
-	HANDLE processHandle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, processId);
-	if(processHandle == nullptr) return "";
+// How long a session nobody uses anymore stays activated, in seconds
+static const char *SESSION_GRACE_PERIOD_SETTING = "audio/wasapi_app_capture/session_grace_period";
+static const double SESSION_GRACE_PERIOD_DEFAULT = 5.0;
 
-	char exeName[MAX_PATH];
-	DWORD exeNameLength = GetProcessImageFileNameA(processHandle, exeName, MAX_PATH);
-	CloseHandle(processHandle);
+// Run WASAPI in capture_helper.exe instead of in the game, read once at startup
+static const char *OUT_OF_PROCESS_SETTING = "audio/wasapi_app_capture/capture_out_of_process";
+// How long one activation attempt (or a helper coming up) gets before it counts as failed, and how long
+// start_recording() and start_analysis() wait for a session that's still activating
+static const std::chrono::milliseconds ACTIVATION_TIMEOUT { 5000 };
 
-	if(exeNameLength == 0) return "";
+// ~43 ms windows, 94 results a second at 48 kHz
+static const int ANALYSIS_FFT_SIZE_DEFAULT = 2048;
+static const int ANALYSIS_HOP_DEFAULT = 512;
 
-	char* lastSlash = strrchr(exeName, '\\');
-	if(lastSlash == nullptr) return "";
+static const char *MONITOR_NAMES[] = {
+    "WASAPIAppCapture/Underruns",
+    "WASAPIAppCapture/Overrun Frames",
+    "WASAPIAppCapture/Fill p50 (ms)",
+    "WASAPIAppCapture/Wakeup p99 (usec)",
+    "WASAPIAppCapture/Packets per Wakeup",
+    "WASAPIAppCapture/Frames per Packet",
+    "WASAPIAppCapture/Capture Errors",
+    "WASAPIAppCapture/Sessions",
+    "WASAPIAppCapture/Total Latency p50 (ms)",
+};
 
-	return std::string(lastSlash + 1);
+static double frames_to_msec(uint64_t frames) {
+    return frames * 1000.0 / AudioServer::get_singleton()->get_mix_rate();
 }
 
-bool checkWindowValid(HWND window) {
-	return window != nullptr &&
-		IsWindowVisible(window) &&
-		!(GetWindowLongPtr(window, GWL_STYLE) & WS_CHILD) &&
-		!(GetWindowLongPtr(window, GWL_EXSTYLE) & WS_EX_TOOLWINDOW);
+void AudioStreamWasapiAppCapture::add_capture_stats(Dictionary &stats, const CaptureStats::Snapshot &capture) {
+    stats["wakeups"] = capture.wakeups;
+    stats["packets"] = capture.packets;
+    stats["frames"] = capture.frames;
+    stats["packets_per_wakeup"] = capture.packetsPerWakeup.Mean();
+    stats["packets_per_wakeup_max"] = capture.packetsPerWakeup.max;
+    stats["frames_per_packet"] = capture.framesPerPacket.Mean();
+    stats["frames_per_packet_max"] = capture.framesPerPacket.max;
+    stats["wakeup_usec_p50"] = capture.wakeupMicroseconds.Percentile(0.5);
+    stats["wakeup_usec_p99"] = capture.wakeupMicroseconds.Percentile(0.99);
+    stats["wakeup_usec_max"] = capture.wakeupMicroseconds.max;
+    stats["capture_errors"] = capture.errors;
+    stats["last_capture_error"] = capture.lastError;
+    stats["silent_frames"] = capture.silentFrames;
+    stats["discontinuities"] = capture.discontinuities;
+    stats["gap_frames"] = capture.gapFrames;
+    stats["overlap_frames"] = capture.overlapFrames;
+    stats["switches"] = capture.switches;
+    stats["abrupt_switches"] = capture.abruptSwitches;
+    stats["switch_activation_usec_p50"] = capture.switchActivationMicroseconds.Percentile(0.5);
+    stats["switch_usec_p50"] = capture.switchMicroseconds.Percentile(0.5);
+    stats["switch_usec_max"] = capture.switchMicroseconds.max;
 }
 
-HWND findWindowByExeName(std::string targetExeName) {
-	HWND window = FindWindowExA(GetDesktopWindow(), nullptr, nullptr, nullptr);
+void AudioStreamWasapiAppCapture::add_mix_stats(Dictionary &stats, const MixStats::Snapshot &mix) {
+    stats["mixes"] = mix.mixes;
+    stats["underruns"] = mix.underruns;
+    stats["underrun_frames"] = mix.underrunFrames;
+    stats["overruns"] = mix.overruns;
+    stats["overrun_frames"] = mix.overrunFrames;
+    stats["gated_mixes"] = mix.gatedMixes;
+    stats["fill_msec_p5"] = frames_to_msec(mix.fillFrames.Percentile(0.05));
+    stats["fill_msec_p50"] = frames_to_msec(mix.fillFrames.Percentile(0.5));
+    stats["fill_msec_p99"] = frames_to_msec(mix.fillFrames.Percentile(0.99));
+
+    // Godot's output latency is one number for the whole device, so the totals are the capture side's shifted by it
+    const double output = AudioServer::get_singleton()->get_output_latency() * 1000.0;
+    const double p50 = mix.captureLatencyMicroseconds.Percentile(0.5) / 1000.0;
+    const double p99 = mix.captureLatencyMicroseconds.Percentile(0.99) / 1000.0;
+    const double max = mix.captureLatencyMicroseconds.max / 1000.0;
+    stats["capture_latency_msec_p50"] = p50;
+    stats["capture_latency_msec_p99"] = p99;
+    stats["capture_latency_msec_max"] = max;
+    stats["output_latency_msec"] = output;
+    stats["total_latency_msec_p50"] = p50 + output;
+    stats["total_latency_msec_p99"] = p99 + output;
+    stats["total_latency_msec_max"] = max + output;
+}
 
-	while(window != nullptr) {
-		if(checkWindowValid(window) && getWindowExeName(window) == targetExeName) return window;
-		window = FindWindowExA(GetDesktopWindow(), window, nullptr, nullptr);
-	}
+int64_t AudioStreamWasapiAppCapture::record_capture_latency(MixStats &stats, const std::optional<uint64_t> &captured) {
+    if(!captured) return -1;
 
-	return 0;
+    // The timestamp can run a little ahead of our clock when the resampler still holds the frame's input
+    const uint64_t now = CaptureClockNow();
+    const uint64_t microseconds = now > *captured ? (now - *captured) / 10 : 0;
+    stats.RecordCaptureLatency(microseconds);
+    mix_totals.RecordCaptureLatency(microseconds);
+    return static_cast<int64_t>(microseconds);
 }
 
+CaptureSessionRegistry *AudioStreamWasapiAppCapture::sessions = nullptr;
+ProcessRegistry *AudioStreamWasapiAppCapture::processes = nullptr;
+MixStats AudioStreamWasapiAppCapture::mix_totals;
+bool AudioStreamWasapiAppCapture::capture_out_of_process = false;
+// Keeps the multithreaded apartment up, so the sessions' own threads can activate without initializing COM themselves
+static CO_MTA_USAGE_COOKIE mta_usage = nullptr;
+
 AudioStreamWasapiAppCapture::AudioStreamWasapiAppCapture()
-    : mix_rate(MIX_RATE), audioBuffer { PCM_BUFFER_SIZE } {
-    auto hwnd = findWindowByExeName("Spotify.exe");
-    DWORD pid;
-    GetWindowThreadProcessId(hwnd, &pid);
+    : meter_sequence(0), spectrum_sequence(0), analysis_fft_size(ANALYSIS_FFT_SIZE_DEFAULT), analysis_hop(ANALYSIS_HOP_DEFAULT),
+      target_app_name("Spotify.exe"), target_process_id(0), target_wait(0),
+      include_process_tree(true), jitter_buffer_enabled(true), target_latency(0.03), history_seconds(0.0), history_compression(false) {
+    // Capture at whatever rate the source renders at and convert once, straight to what godot mixes at.
+    // Godot's own resampler then runs at exactly 1:1 and leaves the samples alone.
+    mix_rate = static_cast<int>(AudioServer::get_singleton()->get_mix_rate());
+}
+
+AudioStreamWasapiAppCapture::~AudioStreamWasapiAppCapture() {
+    stop_recording();
+    stop_analysis();
+    stop_pull();
+    prewarm_session.reset();
+
+    // a callback already on its way only holds our instance id, emit_target_appeared drops it
+    if(target_wait != 0 && processes) {
+        processes->CancelWait(target_wait);
+    }
+}
+
+static void define_setting(ProjectSettings *settings, const char *name, const Variant &initial, Variant::Type type, PropertyHint hint, const String &hint_string) {
+    if(!settings->has_setting(name)) {
+        settings->set_setting(name, initial);
+    }
+    settings->set_initial_value(name, initial);
+
+    Dictionary info;
+    info["name"] = name;
+    info["type"] = type;
+    info["hint"] = hint;
+    info["hint_string"] = hint_string;
+    settings->add_property_info(info);
+}
+
+void AudioStreamWasapiAppCapture::initialize_sessions() {
+    ProjectSettings *settings = ProjectSettings::get_singleton();
+    define_setting(settings, SESSION_GRACE_PERIOD_SETTING, SESSION_GRACE_PERIOD_DEFAULT, Variant::FLOAT, PROPERTY_HINT_RANGE, "0,60,0.1,suffix:s");
+    define_setting(settings, OUT_OF_PROCESS_SETTING, false, Variant::BOOL, PROPERTY_HINT_NONE, "");
+
+    // builds the index right here, lookups after that don't touch the OS at all
+    processes = new ProcessRegistry(std::make_unique<Win32ProcessEnumerator>(), PROCESS_POLL_INTERVAL);
+
+    CaptureSessionRegistry::SourceFactory factory;
+    capture_out_of_process = settings->get_setting(OUT_OF_PROCESS_SETTING);
+    if(capture_out_of_process) {
+        // nothing of WASAPI's or the work queues' is loaded into the game at all
+        factory = [helper = HelperCapture::DefaultHelperPath()](const CaptureSessionKey &key, std::chrono::microseconds client_buffer,
+                CaptureReceiver *receiver) {
+            return std::make_unique<HelperCapture>(receiver, key.processId, key.mode, client_buffer, helper, ACTIVATION_TIMEOUT);
+        };
+    } else {
+        RtwqStartup();
+        CoIncrementMTAUsage(&mta_usage);
+        factory = [](const CaptureSessionKey &key, std::chrono::microseconds client_buffer, CaptureReceiver *receiver) {
+            return std::make_unique<WASAPICapture>(receiver, key.processId, key.mode, client_buffer, ACTIVATION_TIMEOUT);
+        };
+    }
+
+    const uint32_t output_rate = static_cast<uint32_t>(AudioServer::get_singleton()->get_mix_rate());
+    sessions = new CaptureSessionRegistry(std::move(factory), output_rate, PCM_BUFFER_SIZE);
+
+    const double grace_period = settings->get_setting(SESSION_GRACE_PERIOD_SETTING);
+    sessions->SetGracePeriod(std::chrono::duration_cast<CaptureSessionRegistry::Clock::duration>(
+        std::chrono::duration<double>(grace_period)));
+
+    Performance *performance = Performance::get_singleton();
+    for(int monitor = 0; monitor < MONITOR_MAX; monitor++) {
+        Array arguments;
+        arguments.push_back(monitor);
+        performance->add_custom_monitor(MONITOR_NAMES[monitor], callable_mp_static(&AudioStreamWasapiAppCapture::get_monitor), arguments);
+    }
+}
+
+void AudioStreamWasapiAppCapture::uninitialize_sessions() {
+    Performance *performance = Performance::get_singleton();
+    for(int monitor = 0; monitor < MONITOR_MAX; monitor++) {
+        if(performance->has_custom_monitor(MONITOR_NAMES[monitor])) {
+            performance->remove_custom_monitor(MONITOR_NAMES[monitor]);
+        }
+    }
+
+    // stops whatever is still warm
+    delete sessions;
+    sessions = nullptr;
+
+    delete processes;
+    processes = nullptr;
+
+    if(!capture_out_of_process) {
+        RtwqShutdown();
+        if(mta_usage != nullptr) CoDecrementMTAUsage(mta_usage);
+        mta_usage = nullptr;
+    }
+}
+
+std::optional<CaptureSessionKey> AudioStreamWasapiAppCapture::find_session_key() const {
+    return find_session_key(get_target_query(), include_process_tree);
+}
+
+std::optional<CaptureSessionKey> AudioStreamWasapiAppCapture::find_session_key(const ProcessQuery &query, bool include_process_tree) {
+    std::optional<uint32_t> process_id = processes->Find(query);
+    if(!process_id) {
+        // may have started since the last poll
+        processes->Refresh();
+        process_id = processes->Find(query);
+    }
+    if(!process_id) return std::nullopt;
+    return CaptureSessionKey { *process_id, include_process_tree ? LoopbackMode::IncludeProcessTree : LoopbackMode::ExcludeProcessTree };
+}
+
+std::shared_ptr<CaptureSession> AudioStreamWasapiAppCapture::acquire_session() const {
+    ERR_FAIL_NULL_V(sessions, nullptr);
+    ERR_FAIL_NULL_V(processes, nullptr);
+
+    const std::optional<CaptureSessionKey> key = find_session_key();
+    ERR_FAIL_COND_V_MSG(!key, nullptr, "Capture target " + get_target_description() + " isn't running.");
+
+    // everything of ours shares one user of the session, so nothing but other streams can keep us from retargeting it
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(!session || !(session->Key() == *key)) {
+        // the chain only ever runs on one capture thread, it moves over to the new target's capture. Playbacks still
+        // on the old one carry on without it until their next start.
+        // The history is of the old capture's positions, the new one gets a new one
+        if(session) {
+            session->Pipeline().DetachInserts(&inserts);
+            if(history) session->Pipeline().DetachHistory(history.get());
+        }
+        std::shared_ptr<CaptureSession> user = sessions->Acquire(*key, session_latency(target_latency));
+
+        // the session's thread (or a capture thread) calls this with the registry locked, hop over to the main thread
+        const uint64_t instance_id = get_instance_id();
+        const CaptureSession::WatchId watch = user->WatchState([instance_id](CaptureSession::State state) {
+            callable_mp_static(&AudioStreamWasapiAppCapture::emit_session_state).call_deferred(instance_id, static_cast<int>(state));
+        });
+        // dropping the last of our handles stops watching and takes our inserts and history back, then gives back
+        // the user
+        InsertChain *chain = &inserts;
+        std::shared_ptr<CaptureHistory> *kept = &history;
+        session = std::shared_ptr<CaptureSession>(user.get(), [user, watch, chain, kept](CaptureSession *watched) mutable {
+            watched->CancelWatch(watch);
+            watched->Pipeline().DetachInserts(chain);
+            if(*kept) watched->Pipeline().DetachHistory(kept->get());
+            user.reset();
+        });
+        current_session = session;
+        if(!inserts.Empty()) attach_inserts(*session);
+        history.reset();
+        if(history_seconds > 0.0) attach_history(*session);
+        // a stream that never set one leaves whatever another stream on the same capture set alone, otherwise it's
+        // applied once the capture is running and its channels are known
+        if(!channel_matrix.is_empty() && session->GetState() == CaptureSession::State::Running) apply_channel_matrix(*session);
+    }
+
+    // activates on the session's thread, session_state_changed says how that went
+    session->Start();
+    return session;
+}
+
+std::shared_ptr<CaptureSession> AudioStreamWasapiAppCapture::acquire_running_session() const {
+    std::shared_ptr<CaptureSession> session = acquire_session();
+    if(!session) return nullptr;
+
+    // blocks for as long as the capture takes to come up, only for what needs its format right away
+    const CaptureSession::State state = session->WaitUntilSettled(ACTIVATION_TIMEOUT);
+    if(state == CaptureSession::State::Failed) {
+        ERR_FAIL_V_MSG(nullptr, "Failed to start capturing " + get_target_description() + ": " + String(session->LastError().c_str()));
+    }
+    ERR_FAIL_COND_V_MSG(state != CaptureSession::State::Running, nullptr, "Capture of " + get_target_description() + " is still starting.");
+    return session;
+}
+
+std::chrono::microseconds AudioStreamWasapiAppCapture::session_latency(double seconds) {
+    return std::chrono::microseconds(static_cast<int64_t>(seconds * 1000000.0));
+}
+
+Error AudioStreamWasapiAppCapture::prewarm() {
+    std::shared_ptr<CaptureSession> session = acquire_session();
+    ERR_FAIL_COND_V(!session, ERR_CANT_OPEN);
+    prewarm_session = std::move(session);
+    return OK;
+}
+
+AudioStreamWasapiAppCapture::SessionState AudioStreamWasapiAppCapture::get_session_state() const {
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    return session ? static_cast<SessionState>(session->GetState()) : SESSION_IDLE;
+}
+
+String AudioStreamWasapiAppCapture::get_session_error() const {
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    return session ? String(session->LastError().c_str()) : String();
+}
+
+void AudioStreamWasapiAppCapture::emit_session_state(uint64_t instance_id, int state) {
+    AudioStreamWasapiAppCapture *stream = Object::cast_to<AudioStreamWasapiAppCapture>(ObjectDB::get_instance(instance_id));
+    if(stream == nullptr) return;
+
+    if(state == SESSION_RUNNING && !stream->channel_matrix.is_empty()) {
+        // activating configured the pipeline with the default downmix
+        std::shared_ptr<CaptureSession> session = stream->current_session.lock();
+        if(session && session->GetState() == CaptureSession::State::Running) stream->apply_channel_matrix(*session);
+    }
+    stream->emit_signal("session_state_changed", state);
+}
+
+void AudioStreamWasapiAppCapture::apply_channel_matrix(CaptureSession &session) const {
+    CapturePipeline &pipeline = session.Pipeline();
+    const CaptureFormat format = pipeline.GetFormat();
+    if(channel_matrix.is_empty()) {
+        pipeline.SetChannelMatrix(DownmixMatrix(format.channels, format.channelMask));
+        return;
+    }
+
+    ERR_FAIL_COND_MSG(channel_matrix.size() != format.channels * 2, "channel_matrix needs a left and a right gain for each of the " +
+        itos(format.channels) + " channels " + get_target_description() + " delivers, it has " + itos(channel_matrix.size()) + " values.");
+    ChannelMatrix matrix;
+    matrix.channels = format.channels;
+    for(uint16_t channel = 0; channel < format.channels; channel++) {
+        matrix.Set(channel, channel_matrix[channel * 2], channel_matrix[channel * 2 + 1]);
+    }
+    pipeline.SetChannelMatrix(matrix);
+}
+
+void AudioStreamWasapiAppCapture::attach_inserts(CaptureSession &session) const {
+    CapturePipeline &pipeline = session.Pipeline();
+    if(inserts.Empty()) {
+        pipeline.DetachInserts(&inserts);
+        return;
+    }
+    if(!pipeline.AttachInserts(&inserts)) {
+        WARN_PRINT("Another stream capturing " + get_target_description() + " already has inserts, ours aren't used.");
+    }
+}
+
+void AudioStreamWasapiAppCapture::attach_history(CaptureSession &session) const {
+    CapturePipeline &pipeline = session.Pipeline();
+    if(history) {
+        pipeline.DetachHistory(history.get());
+        history.reset();
+    }
+    if(history_seconds <= 0.0) return;
+
+    // allocates all of it up front, the capture thread only ever copies into it
+    history = std::make_shared<CaptureHistory>(pipeline.OutputRate(), history_seconds, history_compression);
+    if(!pipeline.AttachHistory(history.get())) {
+        history.reset();
+        WARN_PRINT("Another stream capturing " + get_target_description() + " already keeps a history, ours isn't kept.");
+    }
+}
+
+void AudioStreamWasapiAppCapture::retarget_session() {
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(!session || !sessions || !processes) return;
+
+    // not running (yet, or it's half typed in the inspector): keep capturing what we have
+    const std::optional<CaptureSessionKey> key = find_session_key();
+    if(!key) return;
+
+    CaptureSessionRegistry::RetargetResult result;
+    try {
+        result = sessions->Retarget(*session, *key);
+    } catch(const std::exception &ex) {
+        ERR_FAIL_MSG("Failed to switch capture to " + get_target_description() + ": " + ex.what());
+    }
+
+    switch(result) {
+        case CaptureSessionRegistry::RetargetResult::Shared:
+        case CaptureSessionRegistry::RetargetResult::TargetInUse:
+            WARN_PRINT("Capture is shared with other streams, playbacks switch to " + get_target_description() + " on their next start.");
+            break;
+        case CaptureSessionRegistry::RetargetResult::Busy:
+            WARN_PRINT("Still starting or switching to the previous target, playbacks switch to " + get_target_description() + " on their next start.");
+            break;
+        case CaptureSessionRegistry::RetargetResult::Rekeyed:
+            // it had failed, something of ours still wants the audio so give the new target a go right away
+            session->Start();
+            break;
+        default:
+            break;
+    }
+}
+
+Error AudioStreamWasapiAppCapture::start_recording(const String &path) {
+    ERR_FAIL_COND_V_MSG(recorder, ERR_ALREADY_IN_USE, "Already recording to " + String(recorder->Path().c_str()) + ".");
+
+    std::shared_ptr<CaptureSession> session = acquire_running_session();
+    ERR_FAIL_COND_V(!session, ERR_CANT_OPEN);
+
+    const String file_path = ProjectSettings::get_singleton()->globalize_path(path);
+    try {
+        recorder = std::make_unique<CaptureRecorder>(file_path.utf8().get_data(), session->Pipeline().TapFormat());
+    } catch(const std::exception &ex) {
+        ERR_FAIL_V_MSG(ERR_FILE_CANT_WRITE, "Failed to start recording to " + file_path + ": " + ex.what());
+    }
+
+    if(!session->Pipeline().AttachTap(recorder.get())) {
+        recorder->Finish();
+        recorder.reset();
+        ERR_FAIL_V_MSG(ERR_BUSY, "Too many recorders and analyzers on " + get_target_description() + " already.");
+    }
+    recording_session = std::move(session);
+    return OK;
+}
+
+Error AudioStreamWasapiAppCapture::stop_recording() {
+    if(!recorder) return OK;
+
+    // waits for the capture thread to let go, then for the writer to drain
+    recording_session->Pipeline().DetachTap(recorder.get());
+    const bool finished = recorder->Finish();
+    const std::string file_path = recorder->Path();
+    recorder.reset();
+    recording_session.reset();
+
+    ERR_FAIL_COND_V_MSG(!finished, ERR_FILE_CANT_WRITE, String("Recording to ") + file_path.c_str() + " is incomplete, writing it failed.");
+    return OK;
+}
+
+bool AudioStreamWasapiAppCapture::is_recording() const {
+    return recorder != nullptr;
+}
+
+Dictionary AudioStreamWasapiAppCapture::get_recording_stats() const {
+    Dictionary result;
+    if(!recorder) return result;
+
+    const CaptureRecorder::Stats stats = recorder->GetStats();
+    result["path"] = String(recorder->Path().c_str());
+    result["frames_written"] = stats.framesWritten;
+    result["seconds_written"] = static_cast<double>(stats.framesWritten) / recorder->Format().sampleRate;
+    result["bytes_written"] = stats.bytesWritten;
+    result["dropped_blocks"] = stats.droppedBlocks;
+    result["dropped_frames"] = stats.droppedFrames;
+    result["failed"] = stats.failed;
+    return result;
+}
+
+Error AudioStreamWasapiAppCapture::start_analysis() {
+    ERR_FAIL_COND_V_MSG(analyzer, ERR_ALREADY_IN_USE, "Already analyzing.");
+
+    std::shared_ptr<CaptureSession> session = acquire_running_session();
+    ERR_FAIL_COND_V(!session, ERR_CANT_OPEN);
+
+    try {
+        analyzer = std::make_unique<CaptureAnalyzer>(session->Pipeline().TapFormat().sampleRate, analysis_fft_size, analysis_hop);
+    } catch(const std::exception &ex) {
+        ERR_FAIL_V_MSG(ERR_INVALID_PARAMETER, String("Failed to start analysis: ") + ex.what());
+    }
+
+    if(!session->Pipeline().AttachTap(analyzer.get())) {
+        analyzer.reset();
+        ERR_FAIL_V_MSG(ERR_BUSY, "Too many recorders and analyzers on " + get_target_description() + " already.");
+    }
+    analysis_session = std::move(session);
+
+    meter.resize(4);
+    meter.fill(0.0f);
+    spectrum.resize(analyzer->Bins());
+    spectrum.fill(0.0f);
+    meter_sequence = 0;
+    spectrum_sequence = 0;
+    return OK;
+}
+
+void AudioStreamWasapiAppCapture::stop_analysis() {
+    if(!analyzer) return;
+
+    analysis_session->Pipeline().DetachTap(analyzer.get());
+    analyzer.reset();
+    analysis_session.reset();
+}
+
+bool AudioStreamWasapiAppCapture::is_analyzing() const {
+    return analyzer != nullptr;
+}
+
+PackedFloat32Array AudioStreamWasapiAppCapture::get_meter() {
+    if(!analyzer) return PackedFloat32Array();
+
+    const AnalysisFrame &latest = analyzer->Latest();
+    if(latest.sequence != meter_sequence) {
+        float *values = meter.ptrw();
+        values[0] = latest.rms[0];
+        values[1] = latest.rms[1];
+        values[2] = latest.peak[0];
+        values[3] = latest.peak[1];
+        meter_sequence = latest.sequence;
+    }
+    return meter;
+}
+
+PackedFloat32Array AudioStreamWasapiAppCapture::get_spectrum() {
+    if(!analyzer) return PackedFloat32Array();
+
+    const AnalysisFrame &latest = analyzer->Latest();
+    if(latest.sequence != spectrum_sequence) {
+        memcpy(spectrum.ptrw(), latest.spectrum.data(), latest.spectrum.size() * sizeof(float));
+        spectrum_sequence = latest.sequence;
+    }
+    return spectrum;
+}
+
+double AudioStreamWasapiAppCapture::get_spectrum_bin_hz() const {
+    return analyzer ? analyzer->BinHz() : 0.0;
+}
+
+void AudioStreamWasapiAppCapture::set_analysis_fft_size(int size) {
+    ERR_FAIL_COND_MSG(size < int(CaptureAnalyzer::MIN_FFT_SIZE) || size > int(CaptureAnalyzer::MAX_FFT_SIZE) || (size & (size - 1)) != 0,
+        "FFT size must be a power of two between 64 and 16384.");
+    analysis_fft_size = size;
+}
+
+int AudioStreamWasapiAppCapture::get_analysis_fft_size() const {
+    return analysis_fft_size;
+}
+
+void AudioStreamWasapiAppCapture::set_analysis_hop(int frames) {
+    ERR_FAIL_COND(frames < 1);
+    analysis_hop = frames;
+}
+
+int AudioStreamWasapiAppCapture::get_analysis_hop() const {
+    return analysis_hop;
+}
+
+Error AudioStreamWasapiAppCapture::start_pull() {
+    ERR_FAIL_COND_V_MSG(pull_reader, ERR_ALREADY_IN_USE, "Already pulling.");
+
+    std::shared_ptr<CaptureSession> session = acquire_session();
+    ERR_FAIL_COND_V(!session, ERR_CANT_OPEN);
+
+    pull_reader = std::make_unique<CapturePipeline::Reader>(session->Pipeline().Ring());
+    pull_session = std::move(session);
+    return OK;
+}
+
+void AudioStreamWasapiAppCapture::stop_pull() {
+    // reader first, it points into the session's ring
+    pull_reader.reset();
+    pull_session.reset();
+    pull_frames = PackedVector2Array();
+}
+
+bool AudioStreamWasapiAppCapture::is_pulling() const {
+    return pull_reader != nullptr;
+}
+
+int AudioStreamWasapiAppCapture::get_frames_available() const {
+    return pull_reader ? static_cast<int>(pull_reader->Lag()) : 0;
+}
+
+PackedVector2Array AudioStreamWasapiAppCapture::get_buffer(int frames) {
+    PackedVector2Array result;
+    ERR_FAIL_COND_V_MSG(!pull_reader, result, "Not pulling, call start_pull() first.");
+    ERR_FAIL_COND_V(frames < 0, result);
+
+    static_assert(sizeof(Vector2) == sizeof(StereoFrame), "Vector2 isn't two floats, real_t=double builds need a conversion here");
+    result.resize(MIN(frames, get_frames_available()));
+    if(result.is_empty()) return result;
+
+    // a lapped reader can come back short
+    const size_t read = pull_session->Pipeline().Mix(*pull_reader, reinterpret_cast<StereoFrame*>(result.ptrw()), result.size());
+    if(read < static_cast<size_t>(result.size())) result.resize(read);
+    return result;
+}
+
+PackedVector2Array AudioStreamWasapiAppCapture::read_buffer(int frames) {
+    ERR_FAIL_COND_V_MSG(!pull_reader, PackedVector2Array(), "Not pulling, call start_pull() first.");
+    ERR_FAIL_COND_V(frames <= 0, PackedVector2Array());
+    if(get_frames_available() < frames) return PackedVector2Array();
+
+    // only allocates when the size changes or the caller still holds the last result (copy on write)
+    if(pull_frames.size() != frames) pull_frames.resize(frames);
+    StereoFrame *output = reinterpret_cast<StereoFrame*>(pull_frames.ptrw());
+    size_t read = pull_session->Pipeline().Mix(*pull_reader, output, frames);
+    // lapped in between, the reader skipped ahead past the torn part and has plenty to read from there
+    if(read < static_cast<size_t>(frames)) {
+        read += pull_session->Pipeline().Mix(*pull_reader, output + read, frames - read);
+        memset(output + read, 0, (frames - read) * sizeof(StereoFrame));
+    }
+    return pull_frames;
+}
+
+void AudioStreamWasapiAppCapture::clear_buffer() {
+    if(pull_reader) pull_reader->SeekToLive();
+}
+
+int64_t AudioStreamWasapiAppCapture::get_discarded_frames() const {
+    return pull_reader ? static_cast<int64_t>(pull_reader->DroppedCount()) : 0;
+}
+
+int AudioStreamWasapiAppCapture::add_insert(InsertType type, int position) {
+    ERR_FAIL_INDEX_V(static_cast<int>(type), static_cast<int>(INSERT_TYPES), -1);
+    const InsertChain::InsertId id = inserts.Add(static_cast<::InsertType>(type), position < 0 ? InsertChain::MAX_INSERTS : position);
+    ERR_FAIL_COND_V_MSG(id == 0, -1, "Already " + itos(InsertChain::MAX_INSERTS) + " inserts, that's as many as there can be.");
+
+    // the capture picks it up at its next packet, or once one starts
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session) attach_inserts(*session);
+    return static_cast<int>(id);
+}
+
+void AudioStreamWasapiAppCapture::remove_insert(int id) {
+    // waits for the capture thread to be done with it, a packet's worth at most
+    ERR_FAIL_COND_MSG(!inserts.Remove(id), "No insert " + itos(id) + ".");
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session) attach_inserts(*session);
+}
+
+void AudioStreamWasapiAppCapture::move_insert(int id, int position) {
+    ERR_FAIL_COND_MSG(!inserts.Move(id, position < 0 ? InsertChain::MAX_INSERTS : position), "No insert " + itos(id) + ".");
+}
+
+void AudioStreamWasapiAppCapture::clear_inserts() {
+    inserts.Clear();
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session) attach_inserts(*session);
+}
+
+PackedInt32Array AudioStreamWasapiAppCapture::get_inserts() const {
+    PackedInt32Array result;
+    for(InsertChain::InsertId id : inserts.Order()) result.push_back(static_cast<int32_t>(id));
+    return result;
+}
+
+AudioStreamWasapiAppCapture::InsertType AudioStreamWasapiAppCapture::get_insert_type(int id) const {
+    const std::optional<::InsertType> type = inserts.TypeOf(id);
+    ERR_FAIL_COND_V_MSG(!type, INSERT_GAIN, "No insert " + itos(id) + ".");
+    return static_cast<InsertType>(*type);
+}
+
+void AudioStreamWasapiAppCapture::set_insert_parameter(int id, const String &name, double value) {
+    const std::optional<::InsertType> type = inserts.TypeOf(id);
+    ERR_FAIL_COND_MSG(!type, "No insert " + itos(id) + ".");
+    const std::optional<size_t> parameter = FindInsertParameter(*type, name.utf8().get_data());
+    ERR_FAIL_COND_MSG(!parameter, String(InsertTypeName(*type)) + " inserts have no parameter " + name + ".");
+    inserts.SetParameter(id, *parameter, static_cast<float>(value));
+}
+
+double AudioStreamWasapiAppCapture::get_insert_parameter(int id, const String &name) const {
+    const std::optional<::InsertType> type = inserts.TypeOf(id);
+    ERR_FAIL_COND_V_MSG(!type, 0.0, "No insert " + itos(id) + ".");
+    const std::optional<size_t> parameter = FindInsertParameter(*type, name.utf8().get_data());
+    ERR_FAIL_COND_V_MSG(!parameter, 0.0, String(InsertTypeName(*type)) + " inserts have no parameter " + name + ".");
+    return *inserts.GetParameter(id, *parameter);
+}
+
+void AudioStreamWasapiAppCapture::set_insert_bypassed(int id, bool bypassed) {
+    ERR_FAIL_COND_MSG(!inserts.SetBypassed(id, bypassed), "No insert " + itos(id) + ".");
+}
+
+bool AudioStreamWasapiAppCapture::is_insert_bypassed(int id) const {
+    return inserts.IsBypassed(id);
+}
+
+Dictionary AudioStreamWasapiAppCapture::get_insert_stats(int id) const {
+    Dictionary stats;
+    const std::optional<InsertTiming::Snapshot> timing = inserts.Timing(id);
+    ERR_FAIL_COND_V_MSG(!timing, stats, "No insert " + itos(id) + ".");
+
+    stats["blocks"] = timing->blocks;
+    stats["frames"] = timing->frames;
+    stats["nsec_per_frame"] = timing->NanosecondsPerFrame();
+    stats["block_usec_p50"] = timing->blockNanoseconds.Percentile(0.5) / 1000.0;
+    stats["block_usec_p99"] = timing->blockNanoseconds.Percentile(0.99) / 1000.0;
+    stats["block_usec_max"] = timing->blockNanoseconds.max / 1000.0;
+    stats["command_overflows"] = inserts.Overflows();
+    return stats;
+}
+
+void AudioStreamWasapiAppCapture::set_history_seconds(double seconds) {
+    history_seconds = MAX(seconds, 0.0);
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session) attach_history(*session);
+}
 
-    capture = new WASAPICapture(this, pid);
+double AudioStreamWasapiAppCapture::get_history_seconds() const {
+    return history_seconds;
+}
+
+void AudioStreamWasapiAppCapture::set_history_compression(bool compress) {
+    history_compression = compress;
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session && history_seconds > 0.0) attach_history(*session);
+}
+
+bool AudioStreamWasapiAppCapture::get_history_compression() const {
+    return history_compression;
+}
+
+double AudioStreamWasapiAppCapture::get_history_length() const {
+    if(!history) return 0.0;
+    return static_cast<double>(history->End() - history->Begin()) / history->SampleRate();
+}
+
+Dictionary AudioStreamWasapiAppCapture::get_history_stats() const {
+    Dictionary stats;
+    if(!history) return stats;
+
+    const CaptureHistory::Stats kept = history->GetStats();
+    const uint64_t raw = kept.blocks * CaptureHistory::BLOCK_FRAMES * sizeof(StereoFrame);
+    stats["seconds"] = get_history_length();
+    stats["memory_bytes"] = static_cast<int64_t>(history->MemoryBytes());
+    stats["stored_bytes"] = kept.storedBytes;
+    // of what the same blocks take raw
+    stats["ratio"] = raw ? static_cast<double>(kept.storedBytes) / raw : 1.0;
+    stats["blocks"] = kept.blocks;
+    stats["silent_blocks"] = kept.silentBlocks;
+    stats["encoded_blocks"] = kept.encodedBlocks;
+    stats["evicted_early"] = kept.evictedEarly;
+    return stats;
+}
+
+ProcessQuery AudioStreamWasapiAppCapture::get_target_query() const {
+    if(target_process_id != 0) return ProcessQuery::ById(static_cast<uint32_t>(target_process_id));
+    if(!target_window_title.is_empty()) return ProcessQuery::ByWindowTitle(target_window_title.utf8().get_data());
+    return ProcessQuery::ByExeName(target_app_name.utf8().get_data());
+}
+
+String AudioStreamWasapiAppCapture::get_target_description() const {
+    if(target_process_id != 0) return "PID " + itos(target_process_id);
+    if(!target_window_title.is_empty()) return "\"" + target_window_title + "\"";
+    return target_app_name;
+}
+
+int64_t AudioStreamWasapiAppCapture::find_target() const {
+    ERR_FAIL_NULL_V(processes, 0);
+    return processes->Find(get_target_query()).value_or(0);
+}
+
+void AudioStreamWasapiAppCapture::wait_for_target() {
+    ERR_FAIL_NULL(processes);
+
+    if(target_wait != 0) {
+        processes->CancelWait(target_wait);
+    }
+    const uint64_t instance_id = get_instance_id();
+    target_wait = processes->WaitFor(get_target_query(), [instance_id](uint32_t process_id) {
+        // refresh thread (or ours): hop over to the main thread before touching the object
+        callable_mp_static(&AudioStreamWasapiAppCapture::emit_target_appeared).call_deferred(instance_id, static_cast<int64_t>(process_id));
+    });
+}
+
+void AudioStreamWasapiAppCapture::emit_target_appeared(uint64_t instance_id, int64_t process_id) {
+    AudioStreamWasapiAppCapture *stream = Object::cast_to<AudioStreamWasapiAppCapture>(ObjectDB::get_instance(instance_id));
+    if(stream == nullptr) return;
+
+    stream->target_wait = 0;
+    stream->emit_signal("target_appeared", process_id);
+}
+
+CaptureStats::Snapshot AudioStreamWasapiAppCapture::get_capture_totals() {
+    CaptureStats::Snapshot totals;
+    if(sessions) {
+        sessions->ForEachSession([&](CaptureSession &session) {
+            totals.Merge(session.Pipeline().Stats().Read());
+        });
+    }
+    return totals;
+}
+
+double AudioStreamWasapiAppCapture::get_monitor(int monitor) {
+    switch(monitor) {
+    case MONITOR_UNDERRUNS: return static_cast<double>(mix_totals.underruns.load(std::memory_order_relaxed));
+    case MONITOR_OVERRUN_FRAMES: return static_cast<double>(mix_totals.overrunFrames.load(std::memory_order_relaxed));
+    case MONITOR_FILL_P50_MS: return frames_to_msec(mix_totals.fillFrames.Read().Percentile(0.5));
+    case MONITOR_WAKEUP_P99_USEC: return static_cast<double>(get_capture_totals().wakeupMicroseconds.Percentile(0.99));
+    case MONITOR_PACKETS_PER_WAKEUP: return get_capture_totals().packetsPerWakeup.Mean();
+    case MONITOR_FRAMES_PER_PACKET: return get_capture_totals().framesPerPacket.Mean();
+    case MONITOR_CAPTURE_ERRORS: return static_cast<double>(get_capture_totals().errors);
+    case MONITOR_SESSIONS: return sessions ? static_cast<double>(sessions->SessionCount()) : 0.0;
+    case MONITOR_TOTAL_LATENCY_P50_MS:
+        return mix_totals.captureLatencyMicroseconds.Read().Percentile(0.5) / 1000.0 + AudioServer::get_singleton()->get_output_latency() * 1000.0;
+    default: return 0.0;
+    }
+}
+
+int64_t AudioStreamWasapiAppCapture::get_capture_clock_usec() {
+    return static_cast<int64_t>(CaptureClockNow() / 10);
+}
+
+Dictionary AudioStreamWasapiAppCapture::get_stats() {
+    Dictionary stats;
+    add_capture_stats(stats, get_capture_totals());
+    add_mix_stats(stats, mix_totals.Read());
+    stats["sessions"] = sessions ? static_cast<int64_t>(sessions->SessionCount()) : 0;
+    stats["warm_sessions"] = sessions ? static_cast<int64_t>(sessions->WarmSessionCount()) : 0;
+    stats["processes"] = processes ? static_cast<int64_t>(processes->ProcessCount()) : 0;
+    return stats;
 }
 
 Ref<AudioStreamPlayback> AudioStreamWasapiAppCapture::_instantiate_playback() const {
@@ -76,51 +823,232 @@ Ref<AudioStreamPlayback> AudioStreamWasapiAppCapture::_instantiate_playback() co
     return playback;
 }
 
-void AudioStreamWasapiAppCapture::OnPacket(BYTE* frames, UINT32 frameCount) {
-    // frames are 2 floats coz stereo lol
-    audioBuffer.Write(reinterpret_cast<float*>(frames), frameCount * 2);
-}
-
 String AudioStreamWasapiAppCapture::_get_stream_name() const {
-    return "WASAPI App Capture: " + target_app_name;
+    return "WASAPI App Capture: " + get_target_description();
 }
 
 void AudioStreamWasapiAppCapture::set_target_app_name(const String &target_app_name) {
     this->target_app_name = target_app_name;
+    retarget_session();
 }
 
-void AudioStreamWasapiAppCapture::_bind_methods() {
-    ClassDB::bind_method(D_METHOD("set_target_app_name"), &AudioStreamWasapiAppCapture::set_target_app_name);
+String AudioStreamWasapiAppCapture::get_target_app_name() const {
+    return target_app_name;
 }
 
-#define zeromem(to, count) memset(to, 0, count)
+void AudioStreamWasapiAppCapture::set_target_window_title(const String &title) {
+    target_window_title = title;
+    retarget_session();
+}
 
-AudioStreamPlaybackWasapiAppCapture::AudioStreamPlaybackWasapiAppCapture()
-    : active(false) {
-    // TODO Is locking actually required?
-    AudioServer::get_singleton()->lock();
-    pcm_buffer = memalloc(PCM_BUFFER_SIZE);
-    zeromem(pcm_buffer, PCM_BUFFER_SIZE);
+String AudioStreamWasapiAppCapture::get_target_window_title() const {
+    return target_window_title;
+}
+
+void AudioStreamWasapiAppCapture::set_target_process_id(int64_t process_id) {
+    ERR_FAIL_COND(process_id < 0 || process_id > UINT32_MAX);
+    target_process_id = process_id;
+    retarget_session();
+}
+
+int64_t AudioStreamWasapiAppCapture::get_target_process_id() const {
+    return target_process_id;
+}
+
+void AudioStreamWasapiAppCapture::set_include_process_tree(bool include) {
+    include_process_tree = include;
+    retarget_session();
+}
 
-    // get buffer stufff
+bool AudioStreamWasapiAppCapture::get_include_process_tree() const {
+    return include_process_tree;
+}
+
+void AudioStreamWasapiAppCapture::set_channel_matrix(const PackedFloat32Array &matrix) {
+    channel_matrix = matrix;
+    // otherwise it's applied once the capture is running
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    if(session && session->GetState() == CaptureSession::State::Running) apply_channel_matrix(*session);
+}
+
+PackedFloat32Array AudioStreamWasapiAppCapture::get_channel_matrix() const {
+    return channel_matrix;
+}
+
+int AudioStreamWasapiAppCapture::get_source_channels() const {
+    std::shared_ptr<CaptureSession> session = current_session.lock();
+    return session && session->GetState() == CaptureSession::State::Running ? session->Pipeline().GetFormat().channels : 0;
+}
+
+void AudioStreamWasapiAppCapture::set_jitter_buffer_enabled(bool enabled) {
+    // running playbacks pick it up on their next start
+    jitter_buffer_enabled = enabled;
+}
 
-    AudioServer::get_singleton()->unlock();
+bool AudioStreamWasapiAppCapture::is_jitter_buffer_enabled() const {
+    return jitter_buffer_enabled;
+}
+
+void AudioStreamWasapiAppCapture::set_target_latency(double seconds) {
+    target_latency = seconds;
+}
+
+double AudioStreamWasapiAppCapture::get_target_latency() const {
+    return target_latency;
+}
+
+void AudioStreamWasapiAppCapture::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_target_app_name", "target_app_name"), &AudioStreamWasapiAppCapture::set_target_app_name);
+    ClassDB::bind_method(D_METHOD("get_target_app_name"), &AudioStreamWasapiAppCapture::get_target_app_name);
+    ClassDB::bind_method(D_METHOD("set_target_window_title", "title"), &AudioStreamWasapiAppCapture::set_target_window_title);
+    ClassDB::bind_method(D_METHOD("get_target_window_title"), &AudioStreamWasapiAppCapture::get_target_window_title);
+    ClassDB::bind_method(D_METHOD("set_target_process_id", "process_id"), &AudioStreamWasapiAppCapture::set_target_process_id);
+    ClassDB::bind_method(D_METHOD("get_target_process_id"), &AudioStreamWasapiAppCapture::get_target_process_id);
+    ClassDB::bind_method(D_METHOD("find_target"), &AudioStreamWasapiAppCapture::find_target);
+    ClassDB::bind_method(D_METHOD("start_recording", "path"), &AudioStreamWasapiAppCapture::start_recording);
+    ClassDB::bind_method(D_METHOD("stop_recording"), &AudioStreamWasapiAppCapture::stop_recording);
+    ClassDB::bind_method(D_METHOD("is_recording"), &AudioStreamWasapiAppCapture::is_recording);
+    ClassDB::bind_method(D_METHOD("get_recording_stats"), &AudioStreamWasapiAppCapture::get_recording_stats);
+    ClassDB::bind_method(D_METHOD("start_analysis"), &AudioStreamWasapiAppCapture::start_analysis);
+    ClassDB::bind_method(D_METHOD("stop_analysis"), &AudioStreamWasapiAppCapture::stop_analysis);
+    ClassDB::bind_method(D_METHOD("is_analyzing"), &AudioStreamWasapiAppCapture::is_analyzing);
+    ClassDB::bind_method(D_METHOD("get_meter"), &AudioStreamWasapiAppCapture::get_meter);
+    ClassDB::bind_method(D_METHOD("get_spectrum"), &AudioStreamWasapiAppCapture::get_spectrum);
+    ClassDB::bind_method(D_METHOD("get_spectrum_bin_hz"), &AudioStreamWasapiAppCapture::get_spectrum_bin_hz);
+    ClassDB::bind_method(D_METHOD("set_analysis_fft_size", "size"), &AudioStreamWasapiAppCapture::set_analysis_fft_size);
+    ClassDB::bind_method(D_METHOD("get_analysis_fft_size"), &AudioStreamWasapiAppCapture::get_analysis_fft_size);
+    ClassDB::bind_method(D_METHOD("set_analysis_hop", "frames"), &AudioStreamWasapiAppCapture::set_analysis_hop);
+    ClassDB::bind_method(D_METHOD("get_analysis_hop"), &AudioStreamWasapiAppCapture::get_analysis_hop);
+    ClassDB::bind_method(D_METHOD("start_pull"), &AudioStreamWasapiAppCapture::start_pull);
+    ClassDB::bind_method(D_METHOD("stop_pull"), &AudioStreamWasapiAppCapture::stop_pull);
+    ClassDB::bind_method(D_METHOD("is_pulling"), &AudioStreamWasapiAppCapture::is_pulling);
+    ClassDB::bind_method(D_METHOD("get_frames_available"), &AudioStreamWasapiAppCapture::get_frames_available);
+    ClassDB::bind_method(D_METHOD("get_buffer", "frames"), &AudioStreamWasapiAppCapture::get_buffer);
+    ClassDB::bind_method(D_METHOD("read_buffer", "frames"), &AudioStreamWasapiAppCapture::read_buffer);
+    ClassDB::bind_method(D_METHOD("clear_buffer"), &AudioStreamWasapiAppCapture::clear_buffer);
+    ClassDB::bind_method(D_METHOD("get_discarded_frames"), &AudioStreamWasapiAppCapture::get_discarded_frames);
+    ClassDB::bind_method(D_METHOD("add_insert", "type", "position"), &AudioStreamWasapiAppCapture::add_insert, DEFVAL(-1));
+    ClassDB::bind_method(D_METHOD("remove_insert", "id"), &AudioStreamWasapiAppCapture::remove_insert);
+    ClassDB::bind_method(D_METHOD("move_insert", "id", "position"), &AudioStreamWasapiAppCapture::move_insert);
+    ClassDB::bind_method(D_METHOD("clear_inserts"), &AudioStreamWasapiAppCapture::clear_inserts);
+    ClassDB::bind_method(D_METHOD("get_inserts"), &AudioStreamWasapiAppCapture::get_inserts);
+    ClassDB::bind_method(D_METHOD("get_insert_type", "id"), &AudioStreamWasapiAppCapture::get_insert_type);
+    ClassDB::bind_method(D_METHOD("set_insert_parameter", "id", "name", "value"), &AudioStreamWasapiAppCapture::set_insert_parameter);
+    ClassDB::bind_method(D_METHOD("get_insert_parameter", "id", "name"), &AudioStreamWasapiAppCapture::get_insert_parameter);
+    ClassDB::bind_method(D_METHOD("set_insert_bypassed", "id", "bypassed"), &AudioStreamWasapiAppCapture::set_insert_bypassed);
+    ClassDB::bind_method(D_METHOD("is_insert_bypassed", "id"), &AudioStreamWasapiAppCapture::is_insert_bypassed);
+    ClassDB::bind_method(D_METHOD("get_insert_stats", "id"), &AudioStreamWasapiAppCapture::get_insert_stats);
+    ClassDB::bind_method(D_METHOD("set_history_seconds", "seconds"), &AudioStreamWasapiAppCapture::set_history_seconds);
+    ClassDB::bind_method(D_METHOD("get_history_seconds"), &AudioStreamWasapiAppCapture::get_history_seconds);
+    ClassDB::bind_method(D_METHOD("set_history_compression", "compress"), &AudioStreamWasapiAppCapture::set_history_compression);
+    ClassDB::bind_method(D_METHOD("get_history_compression"), &AudioStreamWasapiAppCapture::get_history_compression);
+    ClassDB::bind_method(D_METHOD("get_history_length"), &AudioStreamWasapiAppCapture::get_history_length);
+    ClassDB::bind_method(D_METHOD("get_history_stats"), &AudioStreamWasapiAppCapture::get_history_stats);
+    ClassDB::bind_method(D_METHOD("wait_for_target"), &AudioStreamWasapiAppCapture::wait_for_target);
+    ClassDB::bind_method(D_METHOD("set_include_process_tree", "include"), &AudioStreamWasapiAppCapture::set_include_process_tree);
+    ClassDB::bind_method(D_METHOD("get_include_process_tree"), &AudioStreamWasapiAppCapture::get_include_process_tree);
+    ClassDB::bind_method(D_METHOD("prewarm"), &AudioStreamWasapiAppCapture::prewarm);
+    ClassDB::bind_method(D_METHOD("get_session_state"), &AudioStreamWasapiAppCapture::get_session_state);
+    ClassDB::bind_method(D_METHOD("get_session_error"), &AudioStreamWasapiAppCapture::get_session_error);
+
+    ClassDB::bind_static_method("AudioStreamWasapiAppCapture", D_METHOD("get_stats"), &AudioStreamWasapiAppCapture::get_stats);
+    ClassDB::bind_static_method("AudioStreamWasapiAppCapture", D_METHOD("get_capture_clock_usec"), &AudioStreamWasapiAppCapture::get_capture_clock_usec);
+    ClassDB::bind_method(D_METHOD("set_channel_matrix", "matrix"), &AudioStreamWasapiAppCapture::set_channel_matrix);
+    ClassDB::bind_method(D_METHOD("get_channel_matrix"), &AudioStreamWasapiAppCapture::get_channel_matrix);
+    ClassDB::bind_method(D_METHOD("get_source_channels"), &AudioStreamWasapiAppCapture::get_source_channels);
+    ClassDB::bind_method(D_METHOD("set_jitter_buffer_enabled", "enabled"), &AudioStreamWasapiAppCapture::set_jitter_buffer_enabled);
+    ClassDB::bind_method(D_METHOD("is_jitter_buffer_enabled"), &AudioStreamWasapiAppCapture::is_jitter_buffer_enabled);
+    ClassDB::bind_method(D_METHOD("set_target_latency", "seconds"), &AudioStreamWasapiAppCapture::set_target_latency);
+    ClassDB::bind_method(D_METHOD("get_target_latency"), &AudioStreamWasapiAppCapture::get_target_latency);
+
+    ADD_SIGNAL(MethodInfo("target_appeared", PropertyInfo(Variant::INT, "process_id")));
+    ADD_SIGNAL(MethodInfo("session_state_changed", PropertyInfo(Variant::INT, "state")));
+
+    BIND_ENUM_CONSTANT(SESSION_IDLE);
+    BIND_ENUM_CONSTANT(SESSION_ACTIVATING);
+    BIND_ENUM_CONSTANT(SESSION_RUNNING);
+    BIND_ENUM_CONSTANT(SESSION_FAILED);
+    BIND_ENUM_CONSTANT(SESSION_RETRYING);
+
+    BIND_ENUM_CONSTANT(INSERT_GAIN);
+    BIND_ENUM_CONSTANT(INSERT_HIGH_PASS);
+    BIND_ENUM_CONSTANT(INSERT_COMPRESSOR);
+    BIND_ENUM_CONSTANT(INSERT_LIMITER);
+    BIND_ENUM_CONSTANT(INSERT_LOUDNESS);
+
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "target_app_name"), "set_target_app_name", "get_target_app_name");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "target_window_title"), "set_target_window_title", "get_target_window_title");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "target_process_id"), "set_target_process_id", "get_target_process_id");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "include_process_tree"), "set_include_process_tree", "get_include_process_tree");
+    ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "channel_matrix"), "set_channel_matrix", "get_channel_matrix");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "jitter_buffer_enabled"), "set_jitter_buffer_enabled", "is_jitter_buffer_enabled");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "target_latency", PROPERTY_HINT_RANGE, "0.005,0.15,0.001,suffix:s"), "set_target_latency", "get_target_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "analysis_fft_size", PROPERTY_HINT_ENUM, "64:64,128:128,256:256,512:512,1024:1024,2048:2048,4096:4096,8192:8192,16384:16384"), "set_analysis_fft_size", "get_analysis_fft_size");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "analysis_hop", PROPERTY_HINT_RANGE, "1,16384,1,suffix:frames"), "set_analysis_hop", "get_analysis_hop");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "history_seconds", PROPERTY_HINT_RANGE, "0,600,0.1,or_greater,suffix:s"), "set_history_seconds", "get_history_seconds");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "history_compression"), "set_history_compression", "get_history_compression");
+}
+
+AudioStreamPlaybackWasapiAppCapture::AudioStreamPlaybackWasapiAppCapture()
+    : active(false), last_dropped(0), mix_position(0), capture_latency_usec(-1), replaying(false), time_shifted(false), seek_request(-1) {
 }
 
 AudioStreamPlaybackWasapiAppCapture::~AudioStreamPlaybackWasapiAppCapture() {
-    if(pcm_buffer) {
-        memfree(pcm_buffer);
-        pcm_buffer = NULL;
-    }
 }
 
 void AudioStreamPlaybackWasapiAppCapture::_bind_methods() {
-    // Required by GDCLASS macro
+    ClassDB::bind_method(D_METHOD("get_latency"), &AudioStreamPlaybackWasapiAppCapture::get_latency);
+    ClassDB::bind_method(D_METHOD("get_stats"), &AudioStreamPlaybackWasapiAppCapture::get_stats);
+    ClassDB::bind_method(D_METHOD("get_capture_time_usec"), &AudioStreamPlaybackWasapiAppCapture::get_capture_time_usec);
+    ClassDB::bind_method(D_METHOD("get_capture_latency"), &AudioStreamPlaybackWasapiAppCapture::get_capture_latency);
+    ClassDB::bind_method(D_METHOD("get_total_latency"), &AudioStreamPlaybackWasapiAppCapture::get_total_latency);
+    ClassDB::bind_method(D_METHOD("get_time_shift"), &AudioStreamPlaybackWasapiAppCapture::get_time_shift);
+
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "capture_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_capture_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "total_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_total_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "time_shift", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_time_shift");
 }
 
 void AudioStreamPlaybackWasapiAppCapture::_start(double from_pos) {
+    std::shared_ptr<CaptureSession> current = audioStream->acquire_session();
+    ERR_FAIL_COND(!current);
+
+    // Same session as last time (the registry hands it out again while anyone holds it) keeps our reader,
+    // dropping current just gives back the extra reference
+    if(current != session) {
+        reader.reset();
+        jitter.reset();
+        session = std::move(current);
+    }
+    if(audioStream->history != history) {
+        history_reader.reset();
+        history = audioStream->history;
+        if(history) history_reader = std::make_unique<CaptureHistory::Reader>(*history);
+    }
+
+    CapturePipeline &pipeline = session->Pipeline();
+    if(audioStream->is_jitter_buffer_enabled()) {
+        reader.reset();
+        const uint32_t target = static_cast<uint32_t>(audioStream->get_target_latency() * pipeline.OutputRate());
+        if(!jitter) {
+            jitter = std::make_unique<JitterBuffer>(pipeline.Ring(), pipeline.OutputRate(), target);
+        }
+        jitter->SetTargetLatency(target);
+        // Starts target_latency behind the live edge, whatever the others have or haven't consumed
+        jitter->Start();
+    } else {
+        jitter.reset();
+        if(!reader) {
+            reader = std::make_unique<CapturePipeline::Reader>(pipeline.Ring());
+        }
+        // Every playback starts at the live edge, whatever the others have or haven't consumed
+        reader->SeekToLive();
+    }
+    last_dropped = jitter ? jitter->DroppedCount() : reader->DroppedCount();
+    // the next mix goes back into the history, or to live in case it was replaying
+    _seek(from_pos);
     active = true;
-    audioStream->capture->Start();
 }
 
 void AudioStreamPlaybackWasapiAppCapture::_stop() {
@@ -128,6 +1056,46 @@ void AudioStreamPlaybackWasapiAppCapture::_stop() {
 }
 
 void AudioStreamPlaybackWasapiAppCapture::_seek(double position) {
+    if(!session) return;
+    if(position > 0.0 && !history) {
+        WARN_PRINT("No history to seek back into, set history_seconds on the stream before starting. Playing live.");
+        position = 0.0;
+    }
+    const double frames = MAX(position, 0.0) * session->Pipeline().OutputRate();
+    seek_request.store(static_cast<int64_t>(frames), std::memory_order_relaxed);
+}
+
+void AudioStreamPlaybackWasapiAppCapture::apply_seek(uint64_t frames) {
+    if(frames == 0 || !history_reader) {
+        go_live(std::nullopt);
+        return;
+    }
+
+    // as far back as the history goes. Seeking back less than it holds yet lands in the ring, which go_live on the
+    // next check picks up from right there.
+    const uint64_t live = session->Pipeline().Ring().WriteCursor();
+    const uint64_t target = live > frames ? live - frames : 0;
+    history_reader->SeekTo(MAX(target, history->Begin()));
+    replaying = true;
+    time_shifted.store(true, std::memory_order_relaxed);
+    last_dropped = history_reader->DroppedCount();
+}
+
+void AudioStreamPlaybackWasapiAppCapture::go_live(std::optional<uint64_t> position) {
+    replaying = false;
+    time_shifted.store(false, std::memory_order_relaxed);
+    // the jitter buffer only knows where it wants to be, which skips the little the history hadn't stored yet
+    if(jitter) {
+        jitter->Start();
+        last_dropped = jitter->DroppedCount();
+    } else {
+        if(position) {
+            reader->SeekTo(*position);
+        } else {
+            reader->SeekToLive();
+        }
+        last_dropped = reader->DroppedCount();
+    }
 }
 
 bool AudioStreamPlaybackWasapiAppCapture::_is_playing() const {
@@ -137,22 +1105,114 @@ bool AudioStreamPlaybackWasapiAppCapture::_is_playing() const {
 int32_t AudioStreamPlaybackWasapiAppCapture::_mix_resampled(AudioFrame *buffer, int32_t frames) {
     ERR_FAIL_COND_V(!active, 0);
 
-    // TODO What is the max possible value for "frames"?
-    ERR_FAIL_COND_V(frames > PCM_BUFFER_SIZE, 0);
+    static_assert(sizeof(AudioFrame) == sizeof(StereoFrame), "AudioFrame layout changed");
+    StereoFrame *output = reinterpret_cast<StereoFrame*>(buffer);
+    size_t fill;
+    uint64_t position;
+    size_t mixed;
+    uint64_t dropped;
+    bool gated;
+    CapturePipeline &pipeline = session->Pipeline();
+    const int64_t seek = seek_request.exchange(-1, std::memory_order_relaxed);
+    if(seek >= 0) apply_seek(static_cast<uint64_t>(seek));
+    // Caught up with what the history holds, the ring still has what comes next
+    if(replaying && history_reader->Lag() < static_cast<uint64_t>(frames)) go_live(history_reader->Position());
+
+    // A replay reads the history as it was stored, already at our rate. Live, behind a closed silence gate there's
+    // nothing to read or resample, the Mix calls only run when it's open.
+    if(replaying) {
+        fill = static_cast<size_t>(history_reader->Lag());
+        position = history_reader->Position();
+        mixed = history_reader->Read(output, frames);
+        gated = false;
+        dropped = history_reader->DroppedCount();
+    } else if(jitter) {
+        fill = jitter->Fill();
+        position = jitter->Position();
+        mixed = jitter->MixSilence(output, frames, pipeline.SilentUntil(position));
+        gated = mixed != 0;
+        if(!gated) mixed = jitter->Mix(output, frames);
+        dropped = jitter->DroppedCount();
+    } else {
+        fill = reader->Lag();
+        position = reader->Position();
+        mixed = pipeline.MixSilence(*reader, output, frames);
+        gated = mixed != 0;
+        if(!gated) mixed = pipeline.Mix(*reader, output, frames);
+        dropped = reader->DroppedCount();
+    }
+    mix_position.store(position, std::memory_order_relaxed);
+
+    // Relaxed atomics only, nothing here locks or allocates
+    stats.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    AudioStreamWasapiAppCapture::mix_totals.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    if(gated) {
+        stats.RecordGatedMix();
+        AudioStreamWasapiAppCapture::mix_totals.RecordGatedMix();
+    }
+    last_dropped = dropped;
+
+    // With nothing buffered the position is the live edge, whose capture time lies in the future. A replay's would
+    // only swamp the latency figures.
+    if(fill > 0 && !replaying) {
+        const int64_t latency = AudioStreamWasapiAppCapture::record_capture_latency(stats, pipeline.CaptureTimeAt(position));
+        if(latency >= 0) capture_latency_usec.store(latency, std::memory_order_relaxed);
+    }
+
+    return static_cast<int32_t>(mixed);
+}
+
+Dictionary AudioStreamPlaybackWasapiAppCapture::get_stats() const {
+    Dictionary result;
+    if(session) {
+        AudioStreamWasapiAppCapture::add_capture_stats(result, session->Pipeline().Stats().Read());
+        result["rejected_frames"] = session->Pipeline().RejectedFrames();
+        result["silence_gated"] = session->Pipeline().Gate().IsClosed();
+        result["silence_gate_closes"] = session->Pipeline().Gate().Closes();
+    }
+    AudioStreamWasapiAppCapture::add_mix_stats(result, stats.Read());
+    result["latency"] = get_latency();
+    result["time_shift"] = get_time_shift();
+    if(jitter) {
+        result["rate_correction_ppm"] = jitter->Correction() * 1e6;
+    }
+    return result;
+}
+
+int64_t AudioStreamPlaybackWasapiAppCapture::get_capture_time_usec() const {
+    if(!session) return -1;
+
+    const std::optional<uint64_t> captured = session->Pipeline().CaptureTimeAt(mix_position.load(std::memory_order_relaxed));
+    return captured ? static_cast<int64_t>(*captured / 10) : -1;
+}
+
+double AudioStreamPlaybackWasapiAppCapture::get_capture_latency() const {
+    const int64_t latency = capture_latency_usec.load(std::memory_order_relaxed);
+    return latency < 0 ? -1.0 : latency / 1e6;
+}
+
+double AudioStreamPlaybackWasapiAppCapture::get_total_latency() const {
+    const double capture = get_capture_latency();
+    return capture < 0 ? -1.0 : capture + AudioServer::get_singleton()->get_output_latency();
+}
+
+double AudioStreamPlaybackWasapiAppCapture::get_time_shift() const {
+    if(!session || !time_shifted.load(std::memory_order_relaxed)) return 0.0;
+
+    const uint64_t live = session->Pipeline().Ring().WriteCursor();
+    const uint64_t position = mix_position.load(std::memory_order_relaxed);
+    return live > position ? static_cast<double>(live - position) / session->Pipeline().OutputRate() : 0.0;
+}
 
-    // // Generate 16 bits PCM samples in "buf"
-    // zeromem(pcm_buffer, PCM_BUFFER_SIZE);
-    // int16_t *buf = (int16_t *)pcm_buffer;
+double AudioStreamPlaybackWasapiAppCapture::get_latency() const {
+    if(!session) return 0.0;
 
-    // // Convert samples to Godot format (floats in [-1; 1])
-    // for(int i = 0; i < frames; i++) {
-    //     float sample = float(buf[i]) / 32767.0;
-    //     buffer[i] = { sample, sample };
-    // }
-    size_t read = audioStream->audioBuffer.Read(reinterpret_cast<float*>(buffer), frames * 2);
-    return read / 2;
+    const double rate = session->Pipeline().OutputRate();
+    if(jitter) return jitter->Latency() / rate;
+    if(reader) return reader->Lag() / rate;
+    return 0.0;
 }
 
 double AudioStreamPlaybackWasapiAppCapture::_get_stream_sampling_rate() const {
-    return MIX_RATE;
+    return session ? session->Pipeline().OutputRate() : audioStream->mix_rate;
 }
@@ -13,13 +13,28 @@
 #include <godot_cpp/classes/audio_stream.hpp>
 #include <godot_cpp/classes/audio_stream_playback.hpp>
 #include <godot_cpp/classes/audio_stream_playback_resampled.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
 #include <godot_cpp/variant/string.hpp>
 
 // Required as per https://github.com/godotengine/godot-cpp/issues/1207
 #include <godot_cpp/classes/audio_frame.hpp>
 
+#include "capture_analyzer.hpp"
+#include "capture_history.hpp"
+#include "capture_recorder.hpp"
+#include "capture_session.hpp"
+#include "insert_chain.hpp"
+#include "jitter_buffer.hpp"
+#include "process_registry.hpp"
 #include "wasapi_capture.hpp"
-#include <mutex>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
 
 using namespace godot;
 
@@ -29,96 +44,308 @@ using namespace godot;
  *  AudioStream references its own internal custom AudioStreamPlayback which translates
  *  AudioStream into PCM data."
  */
-class AudioStreamWasapiAppCapture : public AudioStream, public WASAPICaptureReceiver {
+class AudioStreamWasapiAppCapture : public AudioStream {
     GDCLASS(AudioStreamWasapiAppCapture, AudioStream)
     friend class AudioStreamPlaybackWasapiAppCapture;
+    // shares the registries, the totals and the stats helpers
+    friend class AudioStreamWasapiMultiCapture;
+    friend class AudioStreamPlaybackWasapiMultiCapture;
+    // and the bus effect, which acquires sessions like a playback
+    friend class AudioEffectWasapiAppCaptureInstance;
 
 private:
-    // A position / phase of the signal to generate (unit: samples)
-    // TODO Should this state be in Playback instead?
-    uint64_t pos; 
-  
     int mix_rate;
 
 public:
+    // Where the capture for the current target is, see CaptureSession::State
+    enum SessionState {
+        SESSION_IDLE,
+        SESSION_ACTIVATING,
+        SESSION_RUNNING,
+        SESSION_FAILED,
+        SESSION_RETRYING,
+    };
+
+    // See InsertType
+    enum InsertType {
+        INSERT_GAIN,
+        INSERT_HIGH_PASS,
+        INSERT_COMPRESSOR,
+        INSERT_LIMITER,
+        INSERT_LOUDNESS,
+    };
+
     AudioStreamWasapiAppCapture();
+    ~AudioStreamWasapiAppCapture();
     Ref<AudioStreamPlayback> _instantiate_playback() const override;
     String _get_stream_name() const override;
 
+    // What to capture. A non-zero target_process_id wins, then a non-empty target_window_title,
+    // then target_app_name (the exe name, case insensitive).
+    // Changing the target while capturing switches over live: the new target is activated while the old one keeps
+    // playing, then crossfaded in, and playbacks, recordings and readers carry on without a restart. Unless another
+    // stream shares the capture, then running playbacks switch on their next start.
     void set_target_app_name(const String &target_app_name);
+    String get_target_app_name() const;
+
+    void set_target_window_title(const String &title);
+    String get_target_window_title() const;
+
+    void set_target_process_id(int64_t process_id);
+    int64_t get_target_process_id() const;
+
+    // PID the target currently resolves to, 0 when it isn't running
+    int64_t find_target() const;
+    // Emits target_appeared once the target is running, right away (deferred) if it already is.
+    // Calling it again replaces the pending wait.
+    void wait_for_target();
+
+    void set_include_process_tree(bool include);
+    bool get_include_process_tree() const;
+
+    // Starts activating the target's capture now rather than on the first play, and keeps it running until the
+    // stream is freed. Returns right away, session_state_changed reports SESSION_RUNNING (or SESSION_FAILED).
+    Error prewarm();
+    // SESSION_IDLE while nothing of ours uses a capture
+    SessionState get_session_state() const;
+    // Why the capture last failed to activate or stopped, empty if it never did
+    String get_session_error() const;
+
+    void set_jitter_buffer_enabled(bool enabled);
+    bool is_jitter_buffer_enabled() const;
+
+    // Seconds between the capture's live edge and what playbacks mix, held there by the jitter buffer. Also sizes the
+    // buffer of captures activated from then on.
+    void set_target_latency(double seconds);
+    double get_target_latency() const;
+
+    // How the target's channels are mixed down to stereo: a left and a right gain per source channel, in the order the
+    // endpoint delivers them (get_source_channels() of them). Empty for the ITU downmix of the endpoint's layout.
+    // Applies to the whole capture, so to every stream sharing it, from the next packet on.
+    void set_channel_matrix(const PackedFloat32Array &matrix);
+    PackedFloat32Array get_channel_matrix() const;
+    // Channels the capture delivers before the downmix, 0 when not capturing
+    int get_source_channels() const;
+
+    // Records the target's audio to a WAV file (RF64 past 4 GiB) as the capture delivers it, as float stereo at the
+    // capture's own rate, whether or not anything is playing. Paths may be user:// or res://. Waits for a capture that's
+    // still activating, as start_analysis() does.
+    Error start_recording(const String &path);
+    Error stop_recording();
+    bool is_recording() const;
+    Dictionary get_recording_stats() const;
+
+    // Meters and a spectrum of the target's audio, computed on the capture thread before any resampling, every
+    // analysis_hop frames over the last analysis_fft_size. Reading them never copies more than the arrays returned.
+    Error start_analysis();
+    void stop_analysis();
+    bool is_analyzing() const;
+    // [rms_left, rms_right, peak_left, peak_right] over the last hop, linear
+    PackedFloat32Array get_meter();
+    // analysis_fft_size / 2 magnitudes of the mid channel, a full scale sine reads 1
+    PackedFloat32Array get_spectrum();
+    // Width of one spectrum bin, 0 when not analyzing
+    double get_spectrum_bin_hz() const;
+
+    // Take effect on the next start_analysis()
+    void set_analysis_fft_size(int size);
+    int get_analysis_fft_size() const;
+    void set_analysis_hop(int frames);
+    int get_analysis_hop() const;
+
+    // Pulls the target's audio out directly, for consumers that aren't the mixer (speech recognition, encoders...),
+    // like AudioEffectCapture does. Frames are at the mix rate, x left and y right, from a reader of our own that
+    // starts at the live edge and doesn't affect any playback. Call from one thread at a time.
+    Error start_pull();
+    void stop_pull();
+    bool is_pulling() const;
+    // Frames waiting to be pulled, the ring keeps about a third of a second of them
+    int get_frames_available() const;
+    // Up to frames of the oldest unread audio, in a new array
+    PackedVector2Array get_buffer(int frames);
+    // Exactly frames of the oldest unread audio, or an empty array while fewer are available. Reads into an array the
+    // stream keeps and returns that; as long as the caller lets go of the previous result first (a local in
+    // _process does), nothing is allocated.
+    PackedVector2Array read_buffer(int frames);
+    // Jumps to the live edge, dropping everything unread
+    void clear_buffer();
+    // Frames lost to pulling too slowly since start_pull()
+    int64_t get_discarded_frames() const;
+
+    // Effects the capture runs on its own thread before anything reads it, so playbacks, recordings, analysis and
+    // pulls all get the processed audio. One chain per capture: while another stream sharing it has inserts, ours
+    // aren't used. Not saved with the resource, set them up from a script.
+    // Returns the insert's id, -1 when there are already InsertChain::MAX_INSERTS. position -1 is the end.
+    int add_insert(InsertType type, int position = -1);
+    void remove_insert(int id);
+    void move_insert(int id, int position);
+    void clear_inserts();
+    // Ids in processing order
+    PackedInt32Array get_inserts() const;
+    InsertType get_insert_type(int id) const;
+    // Parameter names are in the README, values are clamped to their range. Takes effect at the capture's next packet.
+    void set_insert_parameter(int id, const String &name, double value);
+    double get_insert_parameter(int id, const String &name) const;
+    void set_insert_bypassed(int id, bool bypassed);
+    bool is_insert_bypassed(int id) const;
+    // What the insert has cost the capture thread so far
+    Dictionary get_insert_stats(int id) const;
+
+    // Keeps the last history_seconds of the capture, as playbacks mix it, for them to go back into: play(30) or
+    // seek(30) on a playback replays from 30 seconds ago and carries on from there, 0 goes back to live. 0 seconds
+    // keeps none. With history_compression it takes half the memory, audio that doesn't compress that well (most that
+    // isn't from 16 bit sources) is then kept for less, get_history_length() says how long. One history per capture,
+    // like inserts. Changing either starts over with an empty one, playbacks pick it up on their next start.
+    void set_history_seconds(double seconds);
+    double get_history_seconds() const;
+    void set_history_compression(bool compress);
+    bool get_history_compression() const;
+    // Seconds playbacks can go back right now
+    double get_history_length() const;
+    Dictionary get_history_stats() const;
+
+    // Process-wide session registry and Performance monitors, set up and torn down from register_types
+    static void initialize_sessions();
+    static void uninitialize_sessions();
+
+    // Totals over every session and playback, the same numbers the Performance monitors show
+    static Dictionary get_stats();
 
-    virtual void OnPacket(BYTE* frames, UINT32 frameCount) override;
-
-    class CircularBuffer {
-    public:
-        CircularBuffer(size_t bufferSize) : bufferMutex { }, bufferSize { bufferSize }, readCursor { 0 }, writeCursor { 0 }, samplesReadable { 0 } {
-            buffer = new float[bufferSize];
-        }
-
-        ~CircularBuffer() {
-            delete[] buffer;
-            buffer = nullptr;
-        }
-
-        size_t Read(float* samps, size_t nSamps) {
-            if(nSamps > samplesReadable) nSamps = samplesReadable;
-            if(nSamps == 0) return 0;
-
-            bufferMutex.lock();
-            if(readCursor + nSamps <= bufferSize) {
-                memcpy(samps, buffer + readCursor, nSamps * sizeof(float));
-            } else {
-                size_t copied = bufferSize - readCursor;
-                memcpy(samps, buffer + readCursor, copied * sizeof(float));
-                memcpy(samps + copied, buffer, (nSamps -  copied) * sizeof(float));
-            }
-            readCursor = (readCursor + nSamps) % bufferSize;
-            bufferMutex.unlock();
-
-            return nSamps;
-        }
-
-        void Write(float* samps, size_t nSamps) {
-            bufferMutex.lock();
-            if(writeCursor + nSamps <= bufferSize) {
-                memcpy(buffer + writeCursor, samps, nSamps * sizeof(float));
-            } else {
-                size_t copied = bufferSize - writeCursor;
-                memcpy(buffer + writeCursor, samps, copied * sizeof(float));
-                memcpy(buffer, samps + copied, (nSamps -  copied) * sizeof(float));
-            }
-            writeCursor = (writeCursor + nSamps) % bufferSize;
-            samplesReadable += nSamps;
-            if(samplesReadable > bufferSize) samplesReadable = bufferSize;
-            bufferMutex.unlock();
-        }
-
-    private:
-        std::mutex bufferMutex;
-        float* buffer;
-        size_t bufferSize;
-        size_t readCursor;
-        size_t writeCursor;
-        size_t samplesReadable;
-    } audioBuffer;
+    // Now, on the clock capture timestamps run on (QPC, in microseconds)
+    static int64_t get_capture_clock_usec();
 
 protected:
     static void _bind_methods();
 
 private:
+    // Nothing is activated until a playback starts, so just loading the resource (in the editor, say) is free.
+    // Returns the started session for our target, shared with every other stream capturing the same process,
+    // or null when the target isn't running. It may still be activating.
+    std::shared_ptr<CaptureSession> acquire_session() const;
+    // The same, but waits for it to be running, null (with an error printed) if it fails or takes too long
+    std::shared_ptr<CaptureSession> acquire_running_session() const;
+    static std::chrono::microseconds session_latency(double seconds);
+    std::optional<CaptureSessionKey> find_session_key() const;
+    static std::optional<CaptureSessionKey> find_session_key(const ProcessQuery &query, bool include_process_tree);
+    // Moves the session we're capturing from over to the current target, if there is one
+    void retarget_session();
+    // channel_matrix into the session's pipeline, the default downmix if it's empty
+    void apply_channel_matrix(CaptureSession &session) const;
+    // Hands inserts to the capture's pipeline, or takes them back once there are none
+    void attach_inserts(CaptureSession &session) const;
+    // Takes our history back from the capture's pipeline and, while history_seconds is set, gives it a new one
+    void attach_history(CaptureSession &session) const;
+
+    ProcessQuery get_target_query() const;
+    String get_target_description() const;
+    // Runs on the main thread, deferred from the registry's refresh thread
+    static void emit_target_appeared(uint64_t instance_id, int64_t process_id);
+    // Same for the session's state changes, deferred from whatever thread made them
+    static void emit_session_state(uint64_t instance_id, int state);
+
+    enum Monitor {
+        MONITOR_UNDERRUNS,
+        MONITOR_OVERRUN_FRAMES,
+        MONITOR_FILL_P50_MS,
+        MONITOR_WAKEUP_P99_USEC,
+        MONITOR_PACKETS_PER_WAKEUP,
+        MONITOR_FRAMES_PER_PACKET,
+        MONITOR_CAPTURE_ERRORS,
+        MONITOR_SESSIONS,
+        MONITOR_TOTAL_LATENCY_P50_MS,
+        MONITOR_MAX
+    };
+    static double get_monitor(int monitor);
+    static CaptureStats::Snapshot get_capture_totals();
+    static void add_capture_stats(Dictionary &stats, const CaptureStats::Snapshot &capture);
+    static void add_mix_stats(Dictionary &stats, const MixStats::Snapshot &mix);
+    // Audio thread: records how long ago the frame a mix starts with was captured into stats and mix_totals.
+    // Returns it in microseconds, -1 when the source hasn't timed anything yet.
+    static int64_t record_capture_latency(MixStats &stats, const std::optional<uint64_t> &captured);
+
+    static CaptureSessionRegistry *sessions;
+    static ProcessRegistry *processes;
+    // Every playback records into this as well as its own
+    static MixStats mix_totals;
+    // Sessions capture through HelperCapture rather than WASAPICapture
+    static bool capture_out_of_process;
+
+    // Attached to the pipeline of whatever acquire_session() hands out while it has inserts, the last of our session
+    // handles going detaches it. Declared before them so it outlives them all.
+    mutable InsertChain inserts;
+    // The same for the history, playbacks replaying from one hold on to it after that
+    mutable std::shared_ptr<CaptureHistory> history;
+
+    // What acquire_session() last handed out, while anything of ours still holds it
+    mutable std::weak_ptr<CaptureSession> current_session;
+    // Held from prewarm() on
+    std::shared_ptr<CaptureSession> prewarm_session;
+
+    // Only set while recording, the session keeps the capture running for the recorder
+    std::shared_ptr<CaptureSession> recording_session;
+    std::unique_ptr<CaptureRecorder> recorder;
+
+    // Same for the analyzer. The arrays are handed out as is, they only get reallocated when a script kept a copy.
+    std::shared_ptr<CaptureSession> analysis_session;
+    std::unique_ptr<CaptureAnalyzer> analyzer;
+    PackedFloat32Array meter;
+    PackedFloat32Array spectrum;
+    // Result sequence each array was last filled from, so polling faster than the hop copies nothing
+    uint64_t meter_sequence;
+    uint64_t spectrum_sequence;
+    int analysis_fft_size;
+    int analysis_hop;
+
+    // And for pulling, with the array read_buffer() hands out
+    std::shared_ptr<CaptureSession> pull_session;
+    std::unique_ptr<CapturePipeline::Reader> pull_reader;
+    PackedVector2Array pull_frames;
+
+    PackedFloat32Array channel_matrix;
 
-    WASAPICapture* capture;
     String target_app_name;
+    String target_window_title;
+    int64_t target_process_id;
+    ProcessRegistry::WaitId target_wait; // 0 when not waiting
+    bool include_process_tree;
+    bool jitter_buffer_enabled;
+    double target_latency;
+    double history_seconds;
+    bool history_compression;
 };
 
+VARIANT_ENUM_CAST(AudioStreamWasapiAppCapture::SessionState);
+VARIANT_ENUM_CAST(AudioStreamWasapiAppCapture::InsertType);
+
 class AudioStreamPlaybackWasapiAppCapture : public AudioStreamPlaybackResampled {
     GDCLASS(AudioStreamPlaybackWasapiAppCapture, AudioStreamPlaybackResampled)
     friend class AudioStreamWasapiAppCapture;
 
 private:
     Ref<AudioStreamWasapiAppCapture> audioStream; // Keep track of the AudioStream which instantiated us
+    std::shared_ptr<CaptureSession> session; // Keeps the capture alive for as long as we might read from it
+    // Our own cursor into the session's buffer, one or the other depending on jitter_buffer_enabled.
+    // Declared after session so they go first.
+    std::unique_ptr<CapturePipeline::Reader> reader;
+    std::unique_ptr<JitterBuffer> jitter;
     bool active; // Are we currently playing?
-    void *pcm_buffer;
+
+    MixStats stats; // Recorded by _mix_resampled on the audio thread
+    uint64_t last_dropped; // Reader's dropped count at the last mix, audio thread only
+    std::atomic<uint64_t> mix_position; // Ring position the last mix started at
+    std::atomic<int64_t> capture_latency_usec; // Of the last mix that had captured frames, -1 before
+
+    // The stream's history when we started, and our cursor into it
+    std::shared_ptr<CaptureHistory> history;
+    std::unique_ptr<CaptureHistory::Reader> history_reader;
+    bool replaying; // Mixing from history_reader rather than live, audio thread only
+    std::atomic<bool> time_shifted; // replaying, for the main thread
+    std::atomic<int64_t> seek_request; // Frames behind live _start or _seek asked for, -1 once a mix took it
+
+    // Audio thread, picking a seek request up
+    void apply_seek(uint64_t frames);
+    // Audio thread, back to mixing from the ring: from position if it's given and there's no jitter buffer
+    void go_live(std::optional<uint64_t> position);
 
 public:
     AudioStreamPlaybackWasapiAppCapture();
@@ -134,10 +361,31 @@ public:
     double _get_stream_sampling_rate() const override;
 
     bool _is_playing() const override;
+    // Positions are seconds behind live, see AudioStreamWasapiAppCapture::set_history_seconds. Without a history
+    // there's only live.
     void _start(double from_pos) override;
     void _seek(double position) override;
     void _stop() override;
 
+    // Seconds between the capture's live edge and what we last mixed
+    double get_latency() const;
+
+    // When the audio the last mix started with was captured, on get_capture_clock_usec()'s clock.
+    // -1 until the capture has delivered something.
+    int64_t get_capture_time_usec() const;
+
+    // Seconds from the target rendering a sample to the last mix consuming it: WASAPI's capture period plus
+    // whatever sat in the buffer. -1 until the capture has delivered something.
+    double get_capture_latency() const;
+    // The same plus AudioServer.get_output_latency(), from the target rendering a sample to it leaving the speakers
+    double get_total_latency() const;
+
+    // Seconds behind live the last mix replayed from the history, 0 when it was live
+    double get_time_shift() const;
+
+    // This playback's mixes and its session's capture
+    Dictionary get_stats() const;
+
 protected:
     static void _bind_methods();
 };
@@ -0,0 +1,339 @@
+#include "audiostream_wasapi_multi_capture.h"
+
+#include <godot_cpp/classes/audio_frame.hpp>
+#include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+
+AudioStreamWasapiMultiCapture::AudioStreamWasapiMultiCapture()
+    : include_process_tree(true), jitter_buffer_enabled(true), target_latency(0.03) {
+    mix_rate = static_cast<int>(AudioServer::get_singleton()->get_mix_rate());
+}
+
+AudioStreamWasapiMultiCapture::~AudioStreamWasapiMultiCapture() {
+}
+
+ProcessQuery AudioStreamWasapiMultiCapture::get_target_query(const Dictionary &target) {
+    const int64_t process_id = target.get("process_id", 0);
+    if(process_id > 0 && process_id <= UINT32_MAX) return ProcessQuery::ById(static_cast<uint32_t>(process_id));
+    const String title = target.get("window_title", "");
+    if(!title.is_empty()) return ProcessQuery::ByWindowTitle(title.utf8().get_data());
+    const String app_name = target.get("app_name", "");
+    return ProcessQuery::ByExeName(app_name.utf8().get_data());
+}
+
+String AudioStreamWasapiMultiCapture::get_target_description(const Dictionary &target) {
+    const int64_t process_id = target.get("process_id", 0);
+    if(process_id > 0) return "PID " + itos(process_id);
+    const String title = target.get("window_title", "");
+    if(!title.is_empty()) return "\"" + title + "\"";
+    return target.get("app_name", "");
+}
+
+Dictionary AudioStreamWasapiMultiCapture::get_target(int index) const {
+    // anything but a Dictionary reads as an empty one
+    return targets[index];
+}
+
+std::shared_ptr<CaptureMix> AudioStreamWasapiMultiCapture::acquire_mix() const {
+    CaptureSessionRegistry *sessions = AudioStreamWasapiAppCapture::sessions;
+    ERR_FAIL_NULL_V(sessions, nullptr);
+    ERR_FAIL_NULL_V(AudioStreamWasapiAppCapture::processes, nullptr);
+
+    std::shared_ptr<CaptureMix> mix = current_mix.lock();
+    if(mix) return mix;
+
+    mix = std::make_shared<CaptureMix>(sessions->OutputRate(), sessions->BufferFrames());
+    std::vector<int> sources(targets.size(), -1);
+    for(int index = 0; index < targets.size(); index++) {
+        const Dictionary target = get_target(index);
+        const String description = get_target_description(target);
+        const std::optional<CaptureSessionKey> key = AudioStreamWasapiAppCapture::find_session_key(get_target_query(target), include_process_tree);
+        if(!key) {
+            WARN_PRINT("Capture target " + description + " isn't running, mixing without it.");
+            continue;
+        }
+
+        // activates on the session's thread, until then (or if it fails) the mix treats it as stalled
+        std::shared_ptr<CaptureSession> session = sessions->Acquire(*key, AudioStreamWasapiAppCapture::session_latency(target_latency));
+        session->Start();
+
+        const float gain = static_cast<double>(target.get("gain", 1.0));
+        const bool muted = target.get("muted", false);
+        if(!mix->AddSource(std::move(session), gain, muted)) {
+            WARN_PRINT("More than " + itos(CaptureMix::MAX_SOURCES) + " capture targets, mixing without " + description + ".");
+            continue;
+        }
+        sources[index] = static_cast<int>(mix->SourceCount() - 1);
+    }
+    ERR_FAIL_COND_V_MSG(mix->SourceCount() == 0, nullptr, "None of the capture targets is running.");
+
+    mix->Start();
+    current_mix = mix;
+    mix_sources = std::move(sources);
+    return mix;
+}
+
+Ref<AudioStreamPlayback> AudioStreamWasapiMultiCapture::_instantiate_playback() const {
+    Ref<AudioStreamPlaybackWasapiMultiCapture> playback;
+    playback.instantiate();
+    playback->audioStream = Ref<AudioStreamWasapiMultiCapture>(this);
+    return playback;
+}
+
+String AudioStreamWasapiMultiCapture::_get_stream_name() const {
+    String name = "WASAPI Multi Capture:";
+    for(int index = 0; index < targets.size(); index++) {
+        name += (index == 0 ? " " : " + ") + get_target_description(get_target(index));
+    }
+    return name;
+}
+
+void AudioStreamWasapiMultiCapture::set_targets(const Array &new_targets) {
+    // running playbacks keep mixing the old list until their next start, out of our reach
+    targets = new_targets;
+    current_mix.reset();
+    mix_sources.clear();
+}
+
+Array AudioStreamWasapiMultiCapture::get_targets() const {
+    return targets;
+}
+
+int AudioStreamWasapiMultiCapture::get_target_count() const {
+    return targets.size();
+}
+
+void AudioStreamWasapiMultiCapture::set_target_gain(int index, double gain) {
+    ERR_FAIL_INDEX(index, targets.size());
+    Dictionary target = get_target(index);
+    target["gain"] = gain;
+    targets[index] = target;
+
+    std::shared_ptr<CaptureMix> mix = current_mix.lock();
+    if(mix && index < static_cast<int>(mix_sources.size()) && mix_sources[index] >= 0) {
+        mix->SetGain(mix_sources[index], static_cast<float>(gain));
+    }
+}
+
+double AudioStreamWasapiMultiCapture::get_target_gain(int index) const {
+    ERR_FAIL_INDEX_V(index, targets.size(), 0.0);
+    return get_target(index).get("gain", 1.0);
+}
+
+void AudioStreamWasapiMultiCapture::set_target_muted(int index, bool muted) {
+    ERR_FAIL_INDEX(index, targets.size());
+    Dictionary target = get_target(index);
+    target["muted"] = muted;
+    targets[index] = target;
+
+    std::shared_ptr<CaptureMix> mix = current_mix.lock();
+    if(mix && index < static_cast<int>(mix_sources.size()) && mix_sources[index] >= 0) {
+        mix->SetMuted(mix_sources[index], muted);
+    }
+}
+
+bool AudioStreamWasapiMultiCapture::is_target_muted(int index) const {
+    ERR_FAIL_INDEX_V(index, targets.size(), false);
+    return get_target(index).get("muted", false);
+}
+
+bool AudioStreamWasapiMultiCapture::is_target_live(int index) const {
+    ERR_FAIL_INDEX_V(index, targets.size(), false);
+    std::shared_ptr<CaptureMix> mix = current_mix.lock();
+    if(!mix || index >= static_cast<int>(mix_sources.size()) || mix_sources[index] < 0) return false;
+    return mix->IsLive(mix_sources[index]);
+}
+
+void AudioStreamWasapiMultiCapture::set_include_process_tree(bool include) {
+    // like the target list, from the next mix on
+    include_process_tree = include;
+}
+
+bool AudioStreamWasapiMultiCapture::get_include_process_tree() const {
+    return include_process_tree;
+}
+
+void AudioStreamWasapiMultiCapture::set_jitter_buffer_enabled(bool enabled) {
+    // running playbacks pick it up on their next start
+    jitter_buffer_enabled = enabled;
+}
+
+bool AudioStreamWasapiMultiCapture::is_jitter_buffer_enabled() const {
+    return jitter_buffer_enabled;
+}
+
+void AudioStreamWasapiMultiCapture::set_target_latency(double seconds) {
+    target_latency = seconds;
+}
+
+double AudioStreamWasapiMultiCapture::get_target_latency() const {
+    return target_latency;
+}
+
+void AudioStreamWasapiMultiCapture::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_targets", "targets"), &AudioStreamWasapiMultiCapture::set_targets);
+    ClassDB::bind_method(D_METHOD("get_targets"), &AudioStreamWasapiMultiCapture::get_targets);
+    ClassDB::bind_method(D_METHOD("get_target_count"), &AudioStreamWasapiMultiCapture::get_target_count);
+    ClassDB::bind_method(D_METHOD("set_target_gain", "index", "gain"), &AudioStreamWasapiMultiCapture::set_target_gain);
+    ClassDB::bind_method(D_METHOD("get_target_gain", "index"), &AudioStreamWasapiMultiCapture::get_target_gain);
+    ClassDB::bind_method(D_METHOD("set_target_muted", "index", "muted"), &AudioStreamWasapiMultiCapture::set_target_muted);
+    ClassDB::bind_method(D_METHOD("is_target_muted", "index"), &AudioStreamWasapiMultiCapture::is_target_muted);
+    ClassDB::bind_method(D_METHOD("is_target_live", "index"), &AudioStreamWasapiMultiCapture::is_target_live);
+    ClassDB::bind_method(D_METHOD("set_include_process_tree", "include"), &AudioStreamWasapiMultiCapture::set_include_process_tree);
+    ClassDB::bind_method(D_METHOD("get_include_process_tree"), &AudioStreamWasapiMultiCapture::get_include_process_tree);
+    ClassDB::bind_method(D_METHOD("set_jitter_buffer_enabled", "enabled"), &AudioStreamWasapiMultiCapture::set_jitter_buffer_enabled);
+    ClassDB::bind_method(D_METHOD("is_jitter_buffer_enabled"), &AudioStreamWasapiMultiCapture::is_jitter_buffer_enabled);
+    ClassDB::bind_method(D_METHOD("set_target_latency", "seconds"), &AudioStreamWasapiMultiCapture::set_target_latency);
+    ClassDB::bind_method(D_METHOD("get_target_latency"), &AudioStreamWasapiMultiCapture::get_target_latency);
+
+    ADD_PROPERTY(PropertyInfo(Variant::ARRAY, "targets", PROPERTY_HINT_ARRAY_TYPE, "Dictionary"), "set_targets", "get_targets");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "include_process_tree"), "set_include_process_tree", "get_include_process_tree");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "jitter_buffer_enabled"), "set_jitter_buffer_enabled", "is_jitter_buffer_enabled");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "target_latency", PROPERTY_HINT_RANGE, "0.005,0.15,0.001,suffix:s"), "set_target_latency", "get_target_latency");
+}
+
+AudioStreamPlaybackWasapiMultiCapture::AudioStreamPlaybackWasapiMultiCapture()
+    : active(false), last_dropped(0), mix_position(0), capture_latency_usec(-1) {
+}
+
+AudioStreamPlaybackWasapiMultiCapture::~AudioStreamPlaybackWasapiMultiCapture() {
+}
+
+void AudioStreamPlaybackWasapiMultiCapture::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("get_latency"), &AudioStreamPlaybackWasapiMultiCapture::get_latency);
+    ClassDB::bind_method(D_METHOD("get_stats"), &AudioStreamPlaybackWasapiMultiCapture::get_stats);
+    ClassDB::bind_method(D_METHOD("get_capture_time_usec"), &AudioStreamPlaybackWasapiMultiCapture::get_capture_time_usec);
+    ClassDB::bind_method(D_METHOD("get_capture_latency"), &AudioStreamPlaybackWasapiMultiCapture::get_capture_latency);
+    ClassDB::bind_method(D_METHOD("get_total_latency"), &AudioStreamPlaybackWasapiMultiCapture::get_total_latency);
+
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "capture_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_capture_latency");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "total_latency", PROPERTY_HINT_NONE, "suffix:s", PROPERTY_USAGE_NONE), "", "get_total_latency");
+}
+
+void AudioStreamPlaybackWasapiMultiCapture::_start(double from_pos) {
+    std::shared_ptr<CaptureMix> current = audioStream->acquire_mix();
+    ERR_FAIL_COND(!current);
+
+    // Same mix as last time keeps our reader, a new one (the target list changed) gets a new one
+    if(current != mix) {
+        reader.reset();
+        jitter.reset();
+        mix = std::move(current);
+    }
+
+    if(audioStream->is_jitter_buffer_enabled()) {
+        reader.reset();
+        const uint32_t target = static_cast<uint32_t>(audioStream->get_target_latency() * mix->OutputRate());
+        if(!jitter) {
+            jitter = std::make_unique<JitterBuffer>(mix->Ring(), mix->OutputRate(), target);
+        }
+        jitter->SetTargetLatency(target);
+        jitter->Start();
+    } else {
+        jitter.reset();
+        if(!reader) {
+            reader = std::make_unique<CaptureMix::Reader>(mix->Ring());
+        }
+        reader->SeekToLive();
+    }
+    last_dropped = jitter ? jitter->DroppedCount() : reader->DroppedCount();
+    active = true;
+}
+
+void AudioStreamPlaybackWasapiMultiCapture::_stop() {
+    active = false;
+}
+
+void AudioStreamPlaybackWasapiMultiCapture::_seek(double position) {
+}
+
+bool AudioStreamPlaybackWasapiMultiCapture::_is_playing() const {
+    return active;
+}
+
+int32_t AudioStreamPlaybackWasapiMultiCapture::_mix_resampled(AudioFrame *buffer, int32_t frames) {
+    ERR_FAIL_COND_V(!active, 0);
+
+    // One read however many targets there are, the mixing thread summed them already
+    StereoFrame *output = reinterpret_cast<StereoFrame*>(buffer);
+    size_t fill;
+    uint64_t position;
+    size_t mixed;
+    uint64_t dropped;
+    if(jitter) {
+        fill = jitter->Fill();
+        position = jitter->Position();
+        mixed = jitter->Mix(output, frames);
+        dropped = jitter->DroppedCount();
+    } else {
+        fill = reader->Lag();
+        position = reader->Position();
+        mixed = reader->Read(output, frames);
+        dropped = reader->DroppedCount();
+    }
+    mix_position.store(position, std::memory_order_relaxed);
+
+    stats.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    AudioStreamWasapiAppCapture::mix_totals.RecordMix(frames, mixed, fill, dropped - last_dropped);
+    last_dropped = dropped;
+
+    // The mix's timeline is the captures', so this includes the mixing thread's period
+    if(fill > 0) {
+        const int64_t latency = AudioStreamWasapiAppCapture::record_capture_latency(stats, mix->CaptureTimeAt(position));
+        if(latency >= 0) capture_latency_usec.store(latency, std::memory_order_relaxed);
+    }
+
+    return static_cast<int32_t>(mixed);
+}
+
+Dictionary AudioStreamPlaybackWasapiMultiCapture::get_stats() const {
+    Dictionary result;
+    AudioStreamWasapiAppCapture::add_mix_stats(result, stats.Read());
+    result["latency"] = get_latency();
+    if(jitter) {
+        result["rate_correction_ppm"] = jitter->Correction() * 1e6;
+    }
+    if(mix) {
+        int64_t live = 0;
+        for(size_t source = 0; source < mix->SourceCount(); source++) {
+            if(mix->IsLive(source)) live++;
+        }
+        result["sources"] = static_cast<int64_t>(mix->SourceCount());
+        result["live_sources"] = live;
+        result["realignments"] = mix->Realignments();
+        result["mixed_frames"] = mix->MixedFrames();
+    }
+    return result;
+}
+
+int64_t AudioStreamPlaybackWasapiMultiCapture::get_capture_time_usec() const {
+    if(!mix) return -1;
+
+    const std::optional<uint64_t> captured = mix->CaptureTimeAt(mix_position.load(std::memory_order_relaxed));
+    return captured ? static_cast<int64_t>(*captured / 10) : -1;
+}
+
+double AudioStreamPlaybackWasapiMultiCapture::get_capture_latency() const {
+    const int64_t latency = capture_latency_usec.load(std::memory_order_relaxed);
+    return latency < 0 ? -1.0 : latency / 1e6;
+}
+
+double AudioStreamPlaybackWasapiMultiCapture::get_total_latency() const {
+    const double capture = get_capture_latency();
+    return capture < 0 ? -1.0 : capture + AudioServer::get_singleton()->get_output_latency();
+}
+
+double AudioStreamPlaybackWasapiMultiCapture::get_latency() const {
+    if(!mix) return 0.0;
+
+    const double rate = mix->OutputRate();
+    if(jitter) return jitter->Latency() / rate;
+    if(reader) return reader->Lag() / rate;
+    return 0.0;
+}
+
+double AudioStreamPlaybackWasapiMultiCapture::_get_stream_sampling_rate() const {
+    return mix ? mix->OutputRate() : audioStream->mix_rate;
+}
@@ -0,0 +1,130 @@
+#ifndef AUDIOSTREAM_MULTI_CAPTURE_H
+#define AUDIOSTREAM_MULTI_CAPTURE_H
+
+#include "audiostream_wasapi_app_capture.h"
+
+#include <godot_cpp/variant/array.hpp>
+
+#include "capture_mix.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Several processes captured into one stream, a voice chat and a music player say. Every target gets its own capture
+ * session (shared with any AudioStreamWasapiAppCapture on the same process), a mixing thread lines them up by capture
+ * time and sums them with their gains into one buffer, and playbacks read that like they'd read a single capture.
+ * However many targets there are, godot mixes and resamples one stream.
+ */
+class AudioStreamWasapiMultiCapture : public AudioStream {
+    GDCLASS(AudioStreamWasapiMultiCapture, AudioStream)
+    friend class AudioStreamPlaybackWasapiMultiCapture;
+
+public:
+    AudioStreamWasapiMultiCapture();
+    ~AudioStreamWasapiMultiCapture();
+    Ref<AudioStreamPlayback> _instantiate_playback() const override;
+    String _get_stream_name() const override;
+
+    // One Dictionary per target: "process_id", "window_title" or "app_name", picked in that order like
+    // AudioStreamWasapiAppCapture's target properties, plus "gain" (linear, 1 when missing) and "muted".
+    // A new list applies to playbacks started after it. Targets that aren't running when the mix starts are left out.
+    void set_targets(const Array &targets);
+    Array get_targets() const;
+    int get_target_count() const;
+
+    // Change a running mix right away, ramped over a few milliseconds
+    void set_target_gain(int index, double gain);
+    double get_target_gain(int index) const;
+    void set_target_muted(int index, bool muted);
+    bool is_target_muted(int index) const;
+    // Captured, delivering and lined up with the others
+    bool is_target_live(int index) const;
+
+    void set_include_process_tree(bool include);
+    bool get_include_process_tree() const;
+
+    void set_jitter_buffer_enabled(bool enabled);
+    bool is_jitter_buffer_enabled() const;
+
+    // Seconds between the mix's live edge and what playbacks mix, held there by the jitter buffer
+    void set_target_latency(double seconds);
+    double get_target_latency() const;
+
+protected:
+    static void _bind_methods();
+
+private:
+    // Like AudioStreamWasapiAppCapture::acquire_session(): nothing is activated until a playback starts, and every
+    // playback of this stream shares the one mix. Null when none of the targets is running.
+    std::shared_ptr<CaptureMix> acquire_mix() const;
+    Dictionary get_target(int index) const;
+
+    static ProcessQuery get_target_query(const Dictionary &target);
+    static String get_target_description(const Dictionary &target);
+
+    Array targets;
+
+    // What acquire_mix() last handed out, while any playback still holds it
+    mutable std::weak_ptr<CaptureMix> current_mix;
+    // The mix's source for every target of the list it was built from, -1 for those that weren't running
+    mutable std::vector<int> mix_sources;
+
+    bool include_process_tree;
+    bool jitter_buffer_enabled;
+    double target_latency;
+    int mix_rate;
+};
+
+class AudioStreamPlaybackWasapiMultiCapture : public AudioStreamPlaybackResampled {
+    GDCLASS(AudioStreamPlaybackWasapiMultiCapture, AudioStreamPlaybackResampled)
+    friend class AudioStreamWasapiMultiCapture;
+
+private:
+    Ref<AudioStreamWasapiMultiCapture> audioStream;
+    std::shared_ptr<CaptureMix> mix; // Keeps the mix and its captures alive for as long as we might read from it
+    // Our own cursor into the mix's buffer, one or the other depending on jitter_buffer_enabled.
+    // Declared after mix so they go first.
+    std::unique_ptr<CaptureMix::Reader> reader;
+    std::unique_ptr<JitterBuffer> jitter;
+    bool active;
+
+    MixStats stats;
+    uint64_t last_dropped;
+    std::atomic<uint64_t> mix_position;
+    std::atomic<int64_t> capture_latency_usec;
+
+public:
+    AudioStreamPlaybackWasapiMultiCapture();
+    ~AudioStreamPlaybackWasapiMultiCapture();
+
+    int32_t _mix_resampled(AudioFrame *dst_buffer, int32_t frame_count) override;
+    double _get_stream_sampling_rate() const override;
+
+    bool _is_playing() const override;
+    void _start(double from_pos) override;
+    void _seek(double position) override;
+    void _stop() override;
+
+    // Seconds between the mix's live edge and what we last mixed
+    double get_latency() const;
+
+    // When the audio the last mix started with was captured, on get_capture_clock_usec()'s clock.
+    // -1 until a target has delivered something.
+    int64_t get_capture_time_usec() const;
+
+    // Like AudioStreamPlaybackWasapiAppCapture's, from the targets rendering to the last mix, -1 until one delivered
+    double get_capture_latency() const;
+    double get_total_latency() const;
+
+    // This playback's mixes and the mix's sources
+    Dictionary get_stats() const;
+
+protected:
+    static void _bind_methods();
+};
+
+#endif // AUDIOSTREAM_MULTI_CAPTURE_H
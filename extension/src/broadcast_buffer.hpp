@@ -0,0 +1,194 @@
+#ifndef BROADCAST_BUFFER_HPP
+#define BROADCAST_BUFFER_HPP
+
+#include "ring_buffer.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single producer, many consumer ring: one buffer, any number of Readers, each with its own cursor.
+// The producer never looks at the readers, so a slow or stalled one can't hold it (or the others) up; it just gets
+// lapped, notices on its next read and skips forward, counting what it lost. Same wait-free scheme and torn read
+// detection as CircularBuffer with DropOldest, memory stays at one buffer however many readers are attached.
+template<typename T>
+class BroadcastBuffer {
+	static_assert(std::is_trivially_copyable<T>::value, "BroadcastBuffer elements are memcpy'd");
+
+public:
+	class Reader;
+
+	explicit BroadcastBuffer(size_t minimumCapacity) :
+		buffer { nullptr },
+		bufferSize { RoundUpPowerOfTwo(minimumCapacity) },
+		bufferMask { bufferSize - 1 },
+		writeCursor { 0 },
+		writeReserve { 0 },
+		readerCount { 0 }
+	{
+		buffer = new T[bufferSize];
+		memset(buffer, 0, bufferSize * sizeof(T));
+	}
+
+	~BroadcastBuffer() {
+		delete[] buffer;
+		buffer = nullptr;
+	}
+
+	BroadcastBuffer(const BroadcastBuffer&) = delete;
+	BroadcastBuffer& operator=(const BroadcastBuffer&) = delete;
+
+	// Producer side. Hands out up to count slots (at most the capacity) to fill in place, overwriting the oldest data.
+	RingSpan<T> ReserveWrite(size_t count) {
+		const uint64_t write = writeCursor.load(std::memory_order_relaxed);
+		if(count > bufferSize) count = bufferSize;
+
+		// announce the overwrite before doing it, readers check this after looking (see Reader::ConsumeRead)
+		writeReserve.store(write + count, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return MakeSpan<T>(write, count);
+	}
+
+	// Producer side. Publishes the first count slots of the last reservation to every reader.
+	void CommitWrite(size_t count) {
+		const uint64_t write = writeCursor.load(std::memory_order_relaxed);
+		writeCursor.store(write + count, std::memory_order_release);
+	}
+
+	size_t Write(const T* elements, size_t count) {
+		if(count > bufferSize) {
+			elements += count - bufferSize;
+			count = bufferSize;
+		}
+
+		const RingSpan<T> span = ReserveWrite(count);
+		span.CopyFrom(elements);
+		CommitWrite(span.Size());
+		return span.Size();
+	}
+
+	// Total elements ever written, readers measure their lag against this
+	uint64_t WriteCursor() const { return writeCursor.load(std::memory_order_acquire); }
+
+	size_t Capacity() const { return bufferSize; }
+	uint32_t ReaderCount() const { return readerCount.load(std::memory_order_relaxed); }
+
+	// One consumer's view of the buffer. Every method except the statistics must be called from that one consumer
+	// thread; the statistics are snapshots and safe from anywhere. Must not outlive its buffer.
+	class Reader {
+	public:
+		// Starts at the live edge, only seeing what gets written after it was attached
+		explicit Reader(BroadcastBuffer& owner) :
+			owner { owner },
+			readCursor { owner.WriteCursor() },
+			dropped { 0 }
+		{
+			owner.readerCount.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~Reader() {
+			owner.readerCount.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		RingSpan<const T> PeekRead(size_t count) {
+			uint64_t read = readCursor.load(std::memory_order_relaxed);
+			const uint64_t write = owner.writeCursor.load(std::memory_order_acquire);
+
+			if(write - read > owner.bufferSize) {
+				// lapped, everything older than one buffer is gone
+				dropped.fetch_add(write - read - owner.bufferSize, std::memory_order_relaxed);
+				read = write - owner.bufferSize;
+				readCursor.store(read, std::memory_order_relaxed);
+			}
+
+			const size_t readable = static_cast<size_t>(write - read);
+			if(count > readable) count = readable;
+
+			return owner.template MakeSpan<const T>(read, count);
+		}
+
+		// Returns how many of the first count peeked elements were still intact, the rest at the front was torn by
+		// the producer lapping us in the meantime and must be discarded.
+		size_t ConsumeRead(size_t count) {
+			const uint64_t read = readCursor.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t reserve = owner.writeReserve.load(std::memory_order_relaxed);
+			size_t torn = 0;
+			if(reserve - read > owner.bufferSize) {
+				torn = static_cast<size_t>(reserve - read - owner.bufferSize);
+				if(torn > count) torn = count;
+				dropped.fetch_add(torn, std::memory_order_relaxed);
+			}
+
+			readCursor.store(read + count, std::memory_order_relaxed);
+			return count - torn;
+		}
+
+		size_t Read(T* elements, size_t count) {
+			const RingSpan<const T> span = PeekRead(count);
+			span.CopyTo(elements);
+
+			count = span.Size();
+			const size_t intact = ConsumeRead(count);
+			if(intact < count) {
+				memmove(elements, elements + (count - intact), intact * sizeof(T));
+			}
+			return intact;
+		}
+
+		// Jump to the live edge, leaving at most keep of the newest elements unread
+		void SeekToLive(size_t keep = 0) {
+			const uint64_t write = owner.writeCursor.load(std::memory_order_acquire);
+			if(keep > owner.bufferSize) keep = owner.bufferSize;
+			readCursor.store(write >= keep ? write - keep : 0, std::memory_order_relaxed);
+		}
+
+		// Jump to an absolute position, no further than the live edge. One the producer has lapped already is caught
+		// by the next read like any other.
+		void SeekTo(uint64_t position) {
+			const uint64_t write = owner.writeCursor.load(std::memory_order_acquire);
+			readCursor.store(position < write ? position : write, std::memory_order_relaxed);
+		}
+
+		// Unread elements, how far behind the producer this reader is
+		size_t Lag() const {
+			const uint64_t used = owner.WriteCursor() - readCursor.load(std::memory_order_relaxed);
+			return used > owner.bufferSize ? owner.bufferSize : static_cast<size_t>(used);
+		}
+
+		// Where the next read starts, on the same scale as the producer's WriteCursor()
+		uint64_t Position() const { return readCursor.load(std::memory_order_relaxed); }
+
+		// Elements this reader lost to being lapped
+		uint64_t DroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+	private:
+		BroadcastBuffer& owner;
+		alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint64_t> readCursor;
+		std::atomic<uint64_t> dropped;
+	};
+
+private:
+	template<typename View>
+	RingSpan<View> MakeSpan(uint64_t cursor, size_t count) const {
+		return MakeRingSpan<View>(buffer, bufferMask, cursor, count);
+	}
+
+	T* buffer;
+	const size_t bufferSize;
+	const size_t bufferMask;
+
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint64_t> writeCursor;
+	std::atomic<uint64_t> writeReserve;
+
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint32_t> readerCount;
+};
+
+#endif // BROADCAST_BUFFER_HPP
@@ -0,0 +1,216 @@
+#include "capture_analyzer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+void MeterScalar(const StereoFrame* frames, size_t count, float* sumSquares, float* peak) {
+	for(size_t i = 0; i < count; i++) {
+		sumSquares[0] += frames[i].left * frames[i].left;
+		sumSquares[1] += frames[i].right * frames[i].right;
+		peak[0] = std::max(peak[0], std::fabs(frames[i].left));
+		peak[1] = std::max(peak[1], std::fabs(frames[i].right));
+	}
+}
+
+#if defined(SIMD_X86)
+// lanes hold left, right, left, right: fold the two frames together
+void StoreStereo(__m128 sums, __m128 peaks, float* sumSquares, float* peak) {
+	const __m128 sumPairs = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+	const __m128 peakPairs = _mm_max_ps(peaks, _mm_movehl_ps(peaks, peaks));
+	float folded[4];
+	_mm_storeu_ps(folded, sumPairs);
+	sumSquares[0] += folded[0];
+	sumSquares[1] += folded[1];
+	_mm_storeu_ps(folded, peakPairs);
+	peak[0] = std::max(peak[0], folded[0]);
+	peak[1] = std::max(peak[1], folded[1]);
+}
+
+void MeterSse(const StereoFrame* frames, size_t count, float* sumSquares, float* peak) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 sums = _mm_setzero_ps();
+	__m128 peaks = _mm_setzero_ps();
+
+	size_t i = 0;
+	for(; i + 2 <= count; i += 2) {
+		const __m128 value = _mm_loadu_ps(samples + 2 * i);
+		sums = _mm_add_ps(sums, _mm_mul_ps(value, value));
+		peaks = _mm_max_ps(peaks, _mm_and_ps(value, absMask));
+	}
+
+	StoreStereo(sums, peaks, sumSquares, peak);
+	MeterScalar(frames + i, count - i, sumSquares, peak);
+}
+
+SIMD_TARGET_AVX void MeterAvx(const StereoFrame* frames, size_t count, float* sumSquares, float* peak) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 sums = _mm256_setzero_ps();
+	__m256 peaks = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const __m256 value = _mm256_loadu_ps(samples + 2 * i);
+		sums = _mm256_add_ps(sums, _mm256_mul_ps(value, value));
+		peaks = _mm256_max_ps(peaks, _mm256_and_ps(value, absMask));
+	}
+
+	StoreStereo(_mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)),
+		_mm_max_ps(_mm256_castps256_ps128(peaks), _mm256_extractf128_ps(peaks, 1)), sumSquares, peak);
+	MeterScalar(frames + i, count - i, sumSquares, peak);
+}
+#elif defined(SIMD_NEON)
+void MeterNeon(const StereoFrame* frames, size_t count, float* sumSquares, float* peak) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	float32x4_t sums = vdupq_n_f32(0.0f);
+	float32x4_t peaks = vdupq_n_f32(0.0f);
+
+	size_t i = 0;
+	for(; i + 2 <= count; i += 2) {
+		const float32x4_t value = vld1q_f32(samples + 2 * i);
+		sums = vmlaq_f32(sums, value, value);
+		peaks = vmaxq_f32(peaks, vabsq_f32(value));
+	}
+
+	const float32x2_t sumPairs = vadd_f32(vget_low_f32(sums), vget_high_f32(sums));
+	const float32x2_t peakPairs = vmax_f32(vget_low_f32(peaks), vget_high_f32(peaks));
+	sumSquares[0] += vget_lane_f32(sumPairs, 0);
+	sumSquares[1] += vget_lane_f32(sumPairs, 1);
+	peak[0] = std::max(peak[0], vget_lane_f32(peakPairs, 0));
+	peak[1] = std::max(peak[1], vget_lane_f32(peakPairs, 1));
+	MeterScalar(frames + i, count - i, sumSquares, peak);
+}
+#endif
+
+CaptureAnalyzer::MeterFunction SelectMeter(SimdLevel level) {
+	switch(level) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return MeterAvx;
+	case SimdLevel::Baseline: return MeterSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return MeterNeon;
+#endif
+	default: return MeterScalar;
+	}
+}
+
+size_t CheckedFftSize(size_t fftSize) {
+	if(fftSize < CaptureAnalyzer::MIN_FFT_SIZE || fftSize > CaptureAnalyzer::MAX_FFT_SIZE || (fftSize & (fftSize - 1)) != 0) {
+		throw std::runtime_error("analysis FFT size must be a power of two between 64 and 16384");
+	}
+	return fftSize;
+}
+
+} // namespace
+
+CaptureAnalyzer::CaptureAnalyzer(uint32_t sampleRate, size_t fftSize, size_t hop, SimdLevel simd) :
+	sampleRate { sampleRate },
+	hop { hop },
+	simd { ClampSimdLevel(simd) },
+	meter { SelectMeter(ClampSimdLevel(simd)) },
+	fft { CheckedFftSize(fftSize) },
+	window(fftSize),
+	magnitudeScale { 0.0f },
+	history(fftSize),
+	filled { 0 },
+	skip { 0 },
+	windowed(fftSize),
+	bins(fftSize + 2),
+	sumSquares { 0.0, 0.0 },
+	peak { 0.0f, 0.0f },
+	meterFrames { 0 },
+	sequence { 0 },
+	results { fftSize / 2 }
+{
+	if(hop == 0) throw std::runtime_error("analysis hop must be at least one frame");
+
+	// periodic Hann, overlaps to a constant at hop = fftSize / 2
+	double windowSum = 0.0;
+	for(size_t i = 0; i < fftSize; i++) {
+		window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * PI * i / fftSize));
+		windowSum += window[i];
+	}
+	magnitudeScale = static_cast<float>(2.0 / windowSum);
+}
+
+void CaptureAnalyzer::OnFrames(const uint8_t* frames, uint64_t frameCount) {
+	const StereoFrame* input = reinterpret_cast<const StereoFrame*>(frames);
+	const size_t fftSize = history.size();
+
+	while(frameCount > 0) {
+		// up to the next analysis, or through the part of a long hop the FFT doesn't see
+		const size_t count = static_cast<size_t>(std::min<uint64_t>(frameCount, skip > 0 ? skip : fftSize - filled));
+
+		if(input != nullptr) {
+			float sums[2] = { 0.0f, 0.0f };
+			meter(input, count, sums, peak);
+			sumSquares[0] += sums[0];
+			sumSquares[1] += sums[1];
+		}
+		meterFrames += count;
+
+		if(skip > 0) {
+			skip -= count;
+		} else {
+			float* destination = history.data() + filled;
+			if(input != nullptr) {
+				for(size_t i = 0; i < count; i++) destination[i] = 0.5f * (input[i].left + input[i].right);
+			} else {
+				memset(destination, 0, count * sizeof(float));
+			}
+			filled += count;
+
+			if(filled == fftSize) {
+				Analyze();
+				if(hop < fftSize) {
+					memmove(history.data(), history.data() + hop, (fftSize - hop) * sizeof(float));
+					filled = fftSize - hop;
+				} else {
+					filled = 0;
+					skip = hop - fftSize;
+				}
+			}
+		}
+
+		if(input != nullptr) input += count;
+		frameCount -= count;
+	}
+}
+
+void CaptureAnalyzer::Analyze() {
+	const size_t fftSize = history.size();
+	for(size_t i = 0; i < fftSize; i++) windowed[i] = history[i] * window[i];
+	fft.Forward(windowed.data(), bins.data());
+
+	AnalysisFrame& result = results.Back();
+	for(size_t k = 0; k < result.spectrum.size(); k++) {
+		const float re = bins[2 * k];
+		const float im = bins[2 * k + 1];
+		result.spectrum[k] = std::sqrt(re * re + im * im) * magnitudeScale;
+	}
+
+	const double frames = static_cast<double>(std::max<uint64_t>(meterFrames, 1));
+	for(int channel = 0; channel < 2; channel++) {
+		result.rms[channel] = static_cast<float>(std::sqrt(sumSquares[channel] / frames));
+		result.peak[channel] = peak[channel];
+		sumSquares[channel] = 0.0;
+		peak[channel] = 0.0f;
+	}
+	meterFrames = 0;
+	result.sequence = ++sequence;
+
+	results.Publish();
+}
+
+const AnalysisFrame& CaptureAnalyzer::Latest() {
+	results.Update();
+	return results.Front();
+}
@@ -0,0 +1,85 @@
+#ifndef CAPTURE_ANALYZER_HPP
+#define CAPTURE_ANALYZER_HPP
+
+#include "audio_types.hpp"
+#include "capture_source.hpp"
+#include "fft.hpp"
+#include "simd.hpp"
+#include "triple_buffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One analysis result, published every hop
+struct AnalysisFrame {
+	explicit AnalysisFrame(size_t bins) : spectrum(bins) { }
+
+	// Per channel over the hop, linear
+	float rms[2] = { };
+	float peak[2] = { };
+	// Magnitude of bins 0 .. fftSize / 2 - 1 of the Hann windowed mid channel, a full scale sine reads 1
+	std::vector<float> spectrum;
+	// Counts up with every result, 0 until the first one
+	uint64_t sequence = 0;
+};
+
+// Level meters and a spectrum, computed on the capture thread from float32 stereo packets as they arrive, so it runs
+// whether or not anything is playing and sees the capture before it's resampled or mixed.
+//
+// Every hop frames the meters (RMS and peak, SIMD) are closed and the last fftSize frames are windowed and run through
+// the FFT. Results go out through a triple buffer, one reader thread picks up the newest with Latest() without ever
+// blocking the capture. Everything is allocated in the constructor.
+class CaptureAnalyzer : public CaptureTap {
+public:
+	static constexpr size_t MIN_FFT_SIZE = 64;
+	static constexpr size_t MAX_FFT_SIZE = 16384;
+
+	using MeterFunction = void(*)(const StereoFrame* frames, size_t count, float* sumSquares, float* peak);
+
+	// Throws std::runtime_error unless fftSize is a power of two in [MIN_FFT_SIZE, MAX_FFT_SIZE] and hop is at least 1
+	CaptureAnalyzer(uint32_t sampleRate, size_t fftSize, size_t hop, SimdLevel simd = SimdLevel::Avx);
+
+	// Capture thread, float32 stereo, null for silence
+	void OnFrames(const uint8_t* frames, uint64_t frameCount) override;
+
+	// Reader thread. The newest result, valid until the next call.
+	const AnalysisFrame& Latest();
+
+	uint32_t SampleRate() const { return sampleRate; }
+	size_t FftSize() const { return fft.Size(); }
+	size_t Hop() const { return hop; }
+	size_t Bins() const { return fft.Size() / 2; }
+	double BinHz() const { return static_cast<double>(sampleRate) / fft.Size(); }
+	SimdLevel Kernel() const { return simd; }
+
+private:
+	void Analyze();
+
+	const uint32_t sampleRate;
+	const size_t hop;
+	const SimdLevel simd;
+	const MeterFunction meter;
+
+	RealFft fft;
+	std::vector<float> window;
+	// 2 / sum of the window, so a full scale sine peaks at 1
+	float magnitudeScale;
+
+	// mid channel history, the FFT runs whenever it's full
+	std::vector<float> history;
+	size_t filled;
+	// frames to leave out of the history when the hop is longer than the FFT
+	size_t skip;
+	std::vector<float> windowed;
+	std::vector<float> bins;
+
+	double sumSquares[2];
+	float peak[2];
+	uint64_t meterFrames;
+	uint64_t sequence;
+
+	TripleBuffer<AnalysisFrame> results;
+};
+
+#endif // CAPTURE_ANALYZER_HPP
@@ -0,0 +1,339 @@
+#include "capture_history.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr size_t RAW_BLOCK_BYTES = CaptureHistory::BLOCK_FRAMES * sizeof(StereoFrame);
+
+// 4 bit codes: 0 for a sample equal to the last one, otherwise which zero bytes (leading, trailing) were left out.
+// Only combinations that leave at least one byte are possible.
+struct ByteCode {
+	uint8_t leading;
+	uint8_t trailing;
+};
+
+constexpr ByteCode CODES[11] = {
+	{ 4, 0 },
+	{ 0, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 },
+	{ 1, 0 }, { 1, 1 }, { 1, 2 },
+	{ 2, 0 }, { 2, 1 },
+	{ 3, 0 },
+};
+
+constexpr uint8_t CODE_OF[4][4] = {
+	{ 1, 2, 3, 4 },
+	{ 5, 6, 7, 0 },
+	{ 8, 9, 0, 0 },
+	{ 10, 0, 0, 0 },
+};
+
+uint32_t Bits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+float FromBits(uint32_t bits) {
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Appends the significant bytes of delta, returns its code
+uint8_t Pack(uint32_t delta, uint8_t*& output) {
+	if(delta == 0) return 0;
+
+	const uint32_t leading = (delta < (1u << 24)) + (delta < (1u << 16)) + (delta < (1u << 8));
+	const uint32_t trailing = ((delta & 0xFFu) == 0) + ((delta & 0xFFFFu) == 0) + ((delta & 0xFFFFFFu) == 0);
+	const uint32_t bytes = 4 - leading - trailing;
+	uint32_t shifted = delta >> (trailing * 8);
+	for(uint32_t i = 0; i < bytes; i++) {
+		*output++ = static_cast<uint8_t>(shifted);
+		shifted >>= 8;
+	}
+	return CODE_OF[leading][trailing];
+}
+
+bool Unpack(uint8_t code, const uint8_t*& input, const uint8_t* end, uint32_t& delta) {
+	if(code >= 11) return false;
+	const ByteCode& byteCode = CODES[code];
+	const uint32_t bytes = 4 - byteCode.leading - byteCode.trailing;
+	if(static_cast<size_t>(end - input) < bytes) return false;
+
+	uint32_t value = 0;
+	for(uint32_t i = 0; i < bytes; i++) value |= uint32_t(input[i]) << (i * 8);
+	input += bytes;
+	delta = value << (byteCode.trailing * 8);
+	return true;
+}
+
+// One slot per block the seconds cover
+size_t BlockCount(uint32_t sampleRate, double seconds) {
+	return std::max<size_t>(1, static_cast<size_t>(std::ceil(std::max(seconds, 0.0) * sampleRate / CaptureHistory::BLOCK_FRAMES)));
+}
+
+size_t PageCount(size_t blocks, bool compress) {
+	const size_t rawPages = blocks * (RAW_BLOCK_BYTES / CaptureHistory::PAGE_BYTES);
+	if(!compress) return rawPages;
+	// always room for one raw block, a block that doesn't compress has to fit somewhere
+	return std::max(RAW_BLOCK_BYTES / CaptureHistory::PAGE_BYTES, static_cast<size_t>(std::ceil(rawPages * CaptureHistory::COMPRESSED_POOL_FRACTION)));
+}
+
+} // namespace
+
+size_t EncodeHistoryBlock(const StereoFrame* frames, size_t frameCount, uint8_t* output) {
+	uint8_t* const start = output;
+	uint32_t lastLeft = 0;
+	uint32_t lastRight = 0;
+	for(size_t i = 0; i < frameCount; i++) {
+		const uint32_t left = Bits(frames[i].left);
+		const uint32_t right = Bits(frames[i].right);
+		// the codes go first, their bytes after
+		uint8_t* codes = output++;
+		const uint8_t leftCode = Pack(left ^ lastLeft, output);
+		const uint8_t rightCode = Pack(right ^ lastRight, output);
+		*codes = static_cast<uint8_t>(leftCode | (rightCode << 4));
+		lastLeft = left;
+		lastRight = right;
+	}
+	return static_cast<size_t>(output - start);
+}
+
+bool DecodeHistoryBlock(const uint8_t* input, size_t byteCount, StereoFrame* frames, size_t frameCount) {
+	const uint8_t* const end = input + byteCount;
+	uint32_t left = 0;
+	uint32_t right = 0;
+	for(size_t i = 0; i < frameCount; i++) {
+		if(input == end) return false;
+		const uint8_t codes = *input++;
+		uint32_t delta;
+		if(!Unpack(codes & 0xF, input, end, delta)) return false;
+		left ^= delta;
+		if(!Unpack(codes >> 4, input, end, delta)) return false;
+		right ^= delta;
+		frames[i] = StereoFrame { FromBits(left), FromBits(right) };
+	}
+	return input == end;
+}
+
+CaptureHistory::CaptureHistory(uint32_t sampleRate, double seconds, bool compress) :
+	sampleRate { sampleRate },
+	compress { compress },
+	pageCount { PageCount(BlockCount(sampleRate, seconds), compress) },
+	pages(pageCount * PAGE_BYTES),
+	slots(BlockCount(sampleRate, seconds)),
+	current(BLOCK_FRAMES),
+	scratch(compress ? MaxEncodedHistoryBytes(BLOCK_FRAMES) : 0),
+	currentBlock { 0 },
+	currentFrames { 0 },
+	started { false },
+	nextPage { 0 },
+	beginBlock { 0 },
+	endBlock { 0 },
+	storedBytes { 0 },
+	silentBlocks { 0 },
+	encodedBlocks { 0 },
+	evictedEarly { 0 }
+{ }
+
+void CaptureHistory::Write(uint64_t position, const StereoFrame* frames, size_t frameCount) {
+	if(!started) {
+		started = true;
+		currentBlock = position / BLOCK_FRAMES;
+		currentFrames = static_cast<size_t>(position % BLOCK_FRAMES);
+		std::fill(current.begin(), current.begin() + currentFrames, StereoFrame { 0.0f, 0.0f });
+		beginBlock.store(currentBlock, std::memory_order_relaxed);
+		endBlock.store(currentBlock, std::memory_order_release);
+	}
+
+	while(frameCount > 0) {
+		const size_t count = std::min(frameCount, BLOCK_FRAMES - currentFrames);
+		if(frames != nullptr) {
+			memcpy(current.data() + currentFrames, frames, count * sizeof(StereoFrame));
+			frames += count;
+		} else {
+			memset(current.data() + currentFrames, 0, count * sizeof(StereoFrame));
+		}
+		currentFrames += count;
+		frameCount -= count;
+		if(currentFrames == BLOCK_FRAMES) FinishBlock();
+	}
+}
+
+void CaptureHistory::FinishBlock() {
+	const uint64_t block = currentBlock;
+	Encoding encoding = Encoding::Raw;
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(current.data());
+	size_t bytes = RAW_BLOCK_BYTES;
+	if(IsSilent(current.data(), BLOCK_FRAMES)) {
+		encoding = Encoding::Silent;
+		bytes = 0;
+	} else if(compress) {
+		const size_t encoded = EncodeHistoryBlock(current.data(), BLOCK_FRAMES, scratch.data());
+		if(encoded < RAW_BLOCK_BYTES) {
+			encoding = Encoding::Encoded;
+			data = scratch.data();
+			bytes = encoded;
+		}
+	}
+
+	const uint64_t firstPage = nextPage;
+	const uint64_t endPage = firstPage + (bytes + PAGE_BYTES - 1) / PAGE_BYTES;
+
+	// whatever this block's slot and pages held goes first
+	const uint64_t oldest = beginBlock.load(std::memory_order_relaxed);
+	uint64_t newBegin = std::max(oldest, block + 1 > slots.size() ? block + 1 - slots.size() : 0);
+	while(newBegin < block && slots[newBegin % slots.size()].firstPage.load(std::memory_order_relaxed) + pageCount < endPage) {
+		newBegin++;
+		evictedEarly.fetch_add(1, std::memory_order_relaxed);
+	}
+	Retire(newBegin);
+
+	CopyIn(firstPage, data, bytes);
+	Slot& slot = slots[block % slots.size()];
+	slot.firstPage.store(firstPage, std::memory_order_relaxed);
+	slot.bytes.store(static_cast<uint32_t>(bytes), std::memory_order_relaxed);
+	slot.encoding.store(encoding, std::memory_order_relaxed);
+	nextPage = endPage;
+
+	storedBytes.fetch_add((endPage - firstPage) * PAGE_BYTES, std::memory_order_relaxed);
+	if(encoding == Encoding::Silent) silentBlocks.fetch_add(1, std::memory_order_relaxed);
+	if(encoding == Encoding::Encoded) encodedBlocks.fetch_add(1, std::memory_order_relaxed);
+	endBlock.store(block + 1, std::memory_order_release);
+
+	currentBlock = block + 1;
+	currentFrames = 0;
+}
+
+void CaptureHistory::Retire(uint64_t newBegin) {
+	const uint64_t oldest = beginBlock.load(std::memory_order_relaxed);
+	if(newBegin == oldest) return;
+
+	for(uint64_t block = oldest; block < newBegin && block < endBlock.load(std::memory_order_relaxed); block++) {
+		const Slot& slot = slots[block % slots.size()];
+		const uint64_t bytes = slot.bytes.load(std::memory_order_relaxed);
+		storedBytes.fetch_sub((bytes + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES, std::memory_order_relaxed);
+		if(slot.encoding.load(std::memory_order_relaxed) == Encoding::Silent) silentBlocks.fetch_sub(1, std::memory_order_relaxed);
+		if(slot.encoding.load(std::memory_order_relaxed) == Encoding::Encoded) encodedBlocks.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// announce it before overwriting anything, readers check this after copying (see Reader::Load)
+	beginBlock.store(newBegin, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void CaptureHistory::CopyIn(uint64_t page, const uint8_t* data, size_t byteCount) {
+	const size_t start = static_cast<size_t>(page % pageCount) * PAGE_BYTES;
+	const size_t first = std::min(byteCount, pages.size() - start);
+	memcpy(pages.data() + start, data, first);
+	memcpy(pages.data(), data + first, byteCount - first);
+}
+
+void CaptureHistory::CopyOut(uint64_t page, uint8_t* data, size_t byteCount) const {
+	const size_t start = static_cast<size_t>(page % pageCount) * PAGE_BYTES;
+	const size_t first = std::min(byteCount, pages.size() - start);
+	memcpy(data, pages.data() + start, first);
+	memcpy(data + first, pages.data(), byteCount - first);
+}
+
+bool CaptureHistory::IsSilent(const StereoFrame* frames, size_t frameCount) {
+	// bit for bit, -0.0 has to come back as it went in
+	const uint32_t* words = reinterpret_cast<const uint32_t*>(frames);
+	uint32_t any = 0;
+	for(size_t i = 0; i < frameCount * 2; i++) any |= words[i];
+	return any == 0;
+}
+
+uint64_t CaptureHistory::Begin() const {
+	return beginBlock.load(std::memory_order_acquire) * BLOCK_FRAMES;
+}
+
+uint64_t CaptureHistory::End() const {
+	return endBlock.load(std::memory_order_acquire) * BLOCK_FRAMES;
+}
+
+size_t CaptureHistory::MemoryBytes() const {
+	return pages.size() + slots.size() * sizeof(Slot) + (current.size() * sizeof(StereoFrame)) + scratch.size();
+}
+
+CaptureHistory::Stats CaptureHistory::GetStats() const {
+	Stats stats;
+	stats.blocks = endBlock.load(std::memory_order_relaxed) - beginBlock.load(std::memory_order_relaxed);
+	stats.storedBytes = storedBytes.load(std::memory_order_relaxed);
+	stats.silentBlocks = silentBlocks.load(std::memory_order_relaxed);
+	stats.encodedBlocks = encodedBlocks.load(std::memory_order_relaxed);
+	stats.evictedEarly = evictedEarly.load(std::memory_order_relaxed);
+	return stats;
+}
+
+CaptureHistory::Reader::Reader(const CaptureHistory& history) :
+	history { history },
+	readPosition { history.End() },
+	decodedBlock { UINT64_MAX },
+	decoded(BLOCK_FRAMES),
+	encoded(MaxEncodedHistoryBytes(BLOCK_FRAMES)),
+	dropped { 0 }
+{ }
+
+uint64_t CaptureHistory::Reader::Lag() const {
+	const uint64_t end = history.End();
+	return end > readPosition ? end - readPosition : 0;
+}
+
+size_t CaptureHistory::Reader::Read(StereoFrame* output, size_t frameCount) {
+	size_t done = 0;
+	while(done < frameCount) {
+		const uint64_t begin = history.Begin();
+		if(readPosition < begin) {
+			dropped.fetch_add(begin - readPosition, std::memory_order_relaxed);
+			readPosition = begin;
+		}
+		if(readPosition >= history.End()) break;
+
+		const uint64_t block = readPosition / BLOCK_FRAMES;
+		// torn, the next round skips past it
+		if(block != decodedBlock && !Load(block)) continue;
+
+		const size_t offset = static_cast<size_t>(readPosition % BLOCK_FRAMES);
+		const size_t count = std::min(frameCount - done, BLOCK_FRAMES - offset);
+		memcpy(output + done, decoded.data() + offset, count * sizeof(StereoFrame));
+		done += count;
+		readPosition += count;
+	}
+	return done;
+}
+
+bool CaptureHistory::Reader::Load(uint64_t block) {
+	// End() was loaded with acquire, so the slot of a block before it is filled in
+	const Slot& slot = history.slots[block % history.slots.size()];
+	const uint64_t firstPage = slot.firstPage.load(std::memory_order_relaxed);
+	const size_t bytes = slot.bytes.load(std::memory_order_relaxed);
+	const Encoding encoding = slot.encoding.load(std::memory_order_relaxed);
+
+	// a slot being rewritten can look like anything, only copy what fits
+	switch(encoding) {
+	case Encoding::Silent:
+		break;
+	case Encoding::Raw:
+		history.CopyOut(firstPage, reinterpret_cast<uint8_t*>(decoded.data()), std::min(bytes, RAW_BLOCK_BYTES));
+		break;
+	case Encoding::Encoded:
+		history.CopyOut(firstPage, encoded.data(), std::min(bytes, encoded.size()));
+		break;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(block < history.beginBlock.load(std::memory_order_relaxed)) return false;
+
+	// intact, so this is what was written
+	if(encoding == Encoding::Silent) {
+		memset(decoded.data(), 0, RAW_BLOCK_BYTES);
+	} else if(encoding == Encoding::Encoded) {
+		DecodeHistoryBlock(encoded.data(), bytes, decoded.data(), BLOCK_FRAMES);
+	}
+	decodedBlock = block;
+	return true;
+}
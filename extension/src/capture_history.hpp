@@ -0,0 +1,161 @@
+#ifndef CAPTURE_HISTORY_HPP
+#define CAPTURE_HISTORY_HPP
+
+#include "audio_types.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless block codec for history: every sample's bits XORed with the previous sample of its channel, stored without
+// the zero bytes at either end of that, a 4 bit code per sample saying which. Neighbouring samples share sign, exponent
+// and the top of the mantissa, and audio that started out as 16 bit integers has its low mantissa byte zero, so that's
+// usually about half the bytes; full 24 bit float content saves less. Every block decodes on its own.
+//
+// Worst case, the bytes EncodeHistoryBlock may write for frameCount frames
+constexpr size_t MaxEncodedHistoryBytes(size_t frameCount) { return frameCount * 9; }
+// Returns the bytes written to output
+size_t EncodeHistoryBlock(const StereoFrame* frames, size_t frameCount, uint8_t* output);
+// False if input isn't exactly frameCount encoded frames
+bool DecodeHistoryBlock(const uint8_t* input, size_t byteCount, StereoFrame* frames, size_t frameCount);
+
+// The last seconds of a pipeline's output, long after the ring has moved on, for replaying and seeking back.
+//
+// Positions are the ring's, so whatever says where or when something is in the ring (CaptureTimeAt, a reader's
+// Position) says the same here. Frames are kept in blocks of BLOCK_FRAMES starting at multiples of it, so finding the
+// block for a position is a division. Blocks are stored in fixed size pages of one allocation made up front, taken
+// round robin: a block uses as many pages as it needs, a silent one none, and whichever blocks held the pages it
+// reuses are gone. Only whole blocks are readable, the newest one is still being filled.
+//
+// With compression every block is stored in whichever is smaller, raw or EncodeHistoryBlock's, and the pages only
+// add up to COMPRESSED_POOL_FRACTION of what the seconds take raw. Audio that doesn't compress that well is then kept
+// for less than the seconds asked for (at least that fraction of them), End() - Begin() says how long.
+//
+// One writer (the capture thread, through the pipeline) and any number of Readers, each on a thread of its own. The
+// writer never waits for them: like a BroadcastBuffer, a reader that's too far behind notices, skips ahead to what's
+// still there and counts what it missed.
+class CaptureHistory {
+public:
+	// About 85 ms at 48kHz, 32 KiB raw
+	static constexpr size_t BLOCK_FRAMES = 4096;
+	static constexpr size_t PAGE_BYTES = 4096;
+	static constexpr double COMPRESSED_POOL_FRACTION = 0.5;
+
+	struct Stats {
+		// Blocks readable right now and what they take up in pages, including a partly used last page each
+		uint64_t blocks = 0;
+		uint64_t storedBytes = 0;
+		uint64_t silentBlocks = 0;
+		uint64_t encodedBlocks = 0;
+		// Blocks dropped before the seconds were up because the pages ran out, compressed histories only
+		uint64_t evictedEarly = 0;
+	};
+
+	// Allocates everything it will ever use. sampleRate is the pipeline's output rate.
+	CaptureHistory(uint32_t sampleRate, double seconds, bool compress);
+
+	CaptureHistory(const CaptureHistory&) = delete;
+	CaptureHistory& operator=(const CaptureHistory&) = delete;
+
+	// Writer. frameCount frames (null for silence) that went into the ring at position, which carries on from where
+	// the last write ended. The first write starts wherever it is, the rest of its block before it reads as silence.
+	void Write(uint64_t position, const StereoFrame* frames, size_t frameCount);
+
+	// Any thread. Oldest and one past the newest position that can be read. Both move in whole blocks.
+	uint64_t Begin() const;
+	uint64_t End() const;
+
+	uint32_t SampleRate() const { return sampleRate; }
+	bool Compressed() const { return compress; }
+	// What was allocated, pages and bookkeeping
+	size_t MemoryBytes() const;
+	Stats GetStats() const;
+
+	// One consumer's cursor, decoding the block it's in into a buffer of its own. Everything but the statistics from
+	// that consumer's thread only. Must not outlive its history.
+	class Reader {
+	public:
+		// Starts at the newest readable position
+		explicit Reader(const CaptureHistory& history);
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		// No work until the next read, whatever position is. Past End() reads nothing until the history gets there,
+		// before Begin() skips ahead.
+		void SeekTo(uint64_t position) { readPosition = position; }
+		uint64_t Position() const { return readPosition; }
+		// Readable frames ahead of the cursor
+		uint64_t Lag() const;
+
+		// Up to frameCount frames from the cursor on, fewer once it reaches End()
+		size_t Read(StereoFrame* output, size_t frameCount);
+
+		// Frames skipped because the history dropped them before they were read
+		uint64_t DroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+	private:
+		// Copies block out and decodes it into decoded, false if the writer got to it first
+		bool Load(uint64_t block);
+
+		const CaptureHistory& history;
+		uint64_t readPosition;
+		// block decoded holds, UINT64_MAX for none
+		uint64_t decodedBlock;
+		std::vector<StereoFrame> decoded;
+		std::vector<uint8_t> encoded;
+		std::atomic<uint64_t> dropped;
+	};
+
+private:
+	enum class Encoding : uint8_t {
+		Raw,
+		Encoded,
+		Silent,
+	};
+
+	// Where a block's bytes are. Written by the writer while nobody may read that block (see Begin), atomics only so
+	// a reader racing it reads a stale value instead of undefined behaviour, which its torn check then throws away.
+	struct Slot {
+		std::atomic<uint64_t> firstPage { 0 };
+		std::atomic<uint32_t> bytes { 0 };
+		std::atomic<Encoding> encoding { Encoding::Silent };
+	};
+
+	// Writer: stores the block being filled and starts the next one
+	void FinishBlock();
+	// Writer: blocks before newBegin may be overwritten from now on
+	void Retire(uint64_t newBegin);
+	// Copies bytes starting at page, wrapping around the end of the pool
+	void CopyIn(uint64_t page, const uint8_t* data, size_t byteCount);
+	void CopyOut(uint64_t page, uint8_t* data, size_t byteCount) const;
+	static bool IsSilent(const StereoFrame* frames, size_t frameCount);
+
+	const uint32_t sampleRate;
+	const bool compress;
+	const size_t pageCount;
+	std::vector<uint8_t> pages;
+	// one per block the seconds cover, block n in slots[n % slots.size()]
+	std::vector<Slot> slots;
+
+	// writer: the block being filled and where the next frame goes in it, staged raw until it's full
+	std::vector<StereoFrame> current;
+	std::vector<uint8_t> scratch;
+	uint64_t currentBlock;
+	size_t currentFrames;
+	bool started;
+	// next page to hand out, counting from the first ever
+	uint64_t nextPage;
+
+	// Blocks [beginBlock, endBlock) are readable. beginBlock moves before anything of the blocks it passes is
+	// overwritten, readers look at it again after copying to know whether what they copied was intact.
+	alignas(64) std::atomic<uint64_t> beginBlock;
+	std::atomic<uint64_t> endBlock;
+	std::atomic<uint64_t> storedBytes;
+	std::atomic<uint64_t> silentBlocks;
+	std::atomic<uint64_t> encodedBlocks;
+	std::atomic<uint64_t> evictedEarly;
+};
+
+#endif // CAPTURE_HISTORY_HPP
@@ -0,0 +1,360 @@
+#include "capture_mix.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+void AccumulateScalar(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step, size_t first = 0) {
+	for(size_t i = first; i < frameCount; i++) {
+		const float frameGain = gain + step * static_cast<float>(i);
+		output[i].left += input[i].left * frameGain;
+		output[i].right += input[i].right * frameGain;
+	}
+}
+
+void Accumulate(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step) {
+	AccumulateScalar(input, output, frameCount, gain, step);
+}
+
+// The vector kernels count frame indices in float lanes, exact up to 2^24 and chunks are far shorter, so every frame's
+// gain comes out of the same multiply and add as in the reference
+
+#if defined(SIMD_X86)
+void AccumulateSse(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step) {
+	const float* in = reinterpret_cast<const float*>(input);
+	float* out = reinterpret_cast<float*>(output);
+	const __m128 gains = _mm_set1_ps(gain);
+	const __m128 steps = _mm_set1_ps(step);
+	const __m128 advance = _mm_set1_ps(4.0f);
+	// two frames a vector
+	__m128 first = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 second = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+
+	size_t i = 0;
+	for(; i + 4 <= frameCount; i += 4) {
+		const __m128 firstGains = _mm_add_ps(gains, _mm_mul_ps(steps, first));
+		const __m128 secondGains = _mm_add_ps(gains, _mm_mul_ps(steps, second));
+		_mm_storeu_ps(out + i * 2, _mm_add_ps(_mm_loadu_ps(out + i * 2), _mm_mul_ps(_mm_loadu_ps(in + i * 2), firstGains)));
+		_mm_storeu_ps(out + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(out + i * 2 + 4), _mm_mul_ps(_mm_loadu_ps(in + i * 2 + 4), secondGains)));
+		first = _mm_add_ps(first, advance);
+		second = _mm_add_ps(second, advance);
+	}
+	AccumulateScalar(input, output, frameCount, gain, step, i);
+}
+
+SIMD_TARGET_AVX void AccumulateAvx(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step) {
+	const float* in = reinterpret_cast<const float*>(input);
+	float* out = reinterpret_cast<float*>(output);
+	const __m256 gains = _mm256_set1_ps(gain);
+	const __m256 steps = _mm256_set1_ps(step);
+	const __m256 advance = _mm256_set1_ps(8.0f);
+	// four frames a vector
+	__m256 first = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+	__m256 second = _mm256_setr_ps(4.0f, 4.0f, 5.0f, 5.0f, 6.0f, 6.0f, 7.0f, 7.0f);
+
+	size_t i = 0;
+	for(; i + 8 <= frameCount; i += 8) {
+		const __m256 firstGains = _mm256_add_ps(gains, _mm256_mul_ps(steps, first));
+		const __m256 secondGains = _mm256_add_ps(gains, _mm256_mul_ps(steps, second));
+		_mm256_storeu_ps(out + i * 2, _mm256_add_ps(_mm256_loadu_ps(out + i * 2), _mm256_mul_ps(_mm256_loadu_ps(in + i * 2), firstGains)));
+		_mm256_storeu_ps(out + i * 2 + 8,
+			_mm256_add_ps(_mm256_loadu_ps(out + i * 2 + 8), _mm256_mul_ps(_mm256_loadu_ps(in + i * 2 + 8), secondGains)));
+		first = _mm256_add_ps(first, advance);
+		second = _mm256_add_ps(second, advance);
+	}
+	_mm256_zeroupper();
+	AccumulateScalar(input, output, frameCount, gain, step, i);
+}
+#endif
+
+#if defined(SIMD_NEON)
+void AccumulateNeon(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step) {
+	const float* in = reinterpret_cast<const float*>(input);
+	float* out = reinterpret_cast<float*>(output);
+	const float32x4_t gains = vdupq_n_f32(gain);
+	const float32x4_t steps = vdupq_n_f32(step);
+	const float32x4_t advance = vdupq_n_f32(4.0f);
+	const float firstIndices[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+	const float secondIndices[4] = { 2.0f, 2.0f, 3.0f, 3.0f };
+	float32x4_t first = vld1q_f32(firstIndices);
+	float32x4_t second = vld1q_f32(secondIndices);
+
+	size_t i = 0;
+	for(; i + 4 <= frameCount; i += 4) {
+		// separate multiply and add, vmlaq could be fused and round differently from the reference
+		const float32x4_t firstGains = vaddq_f32(gains, vmulq_f32(steps, first));
+		const float32x4_t secondGains = vaddq_f32(gains, vmulq_f32(steps, second));
+		vst1q_f32(out + i * 2, vaddq_f32(vld1q_f32(out + i * 2), vmulq_f32(vld1q_f32(in + i * 2), firstGains)));
+		vst1q_f32(out + i * 2 + 4, vaddq_f32(vld1q_f32(out + i * 2 + 4), vmulq_f32(vld1q_f32(in + i * 2 + 4), secondGains)));
+		first = vaddq_f32(first, advance);
+		second = vaddq_f32(second, advance);
+	}
+	AccumulateScalar(input, output, frameCount, gain, step, i);
+}
+#endif
+
+} // namespace
+
+FrameAccumulator SelectAccumulator(SimdLevel level) {
+	switch(ClampSimdLevel(level)) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return AccumulateAvx;
+	case SimdLevel::Baseline: return AccumulateSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return AccumulateNeon;
+#endif
+	default: return Accumulate;
+	}
+}
+
+CaptureMix::Source::Source(std::shared_ptr<CaptureSession> session, float gain, bool muted, uint64_t now) :
+	session { std::move(session) },
+	reader { this->session->Pipeline().Ring() },
+	gain { gain },
+	muted { muted },
+	live { false },
+	// fades in from silence the first time it's mixed
+	appliedGain { 0.0f },
+	offset { 0 },
+	drift { 0.0 },
+	aligned { false },
+	lastWrite { reader.Position() },
+	lastAdvance { now }
+{
+	// the mix waits for its slowest source, one idling behind its silence gate would hold all the others up
+	this->session->Pipeline().HoldAwake();
+}
+
+CaptureMix::Source::~Source() {
+	session->Pipeline().ReleaseAwake();
+}
+
+CaptureMix::CaptureMix(uint32_t outputRate, size_t bufferFrames, SimdLevel simd) :
+	outputRate { outputRate },
+	accumulate { SelectAccumulator(simd) },
+	ring { bufferFrames },
+	sources { },
+	mixed(CHUNK_FRAMES),
+	scratch(CHUNK_FRAMES),
+	realignments { 0 },
+	mixedFrames { 0 },
+	anchorSequence { 0 },
+	anchorPosition { 0 },
+	anchorTimestamp { 0 },
+	mutex { },
+	wakeup { },
+	stopping { false },
+	thread { }
+{ }
+
+CaptureMix::~CaptureMix() {
+	Stop();
+}
+
+bool CaptureMix::AddSource(std::shared_ptr<CaptureSession> session, float gain, bool muted) {
+	if(thread.joinable() || sources.size() >= MAX_SOURCES) return false;
+	if(session->Pipeline().OutputRate() != outputRate) return false;
+
+	sources.push_back(std::make_unique<Source>(std::move(session), gain, muted, CaptureClockNow()));
+	return true;
+}
+
+void CaptureMix::SetGain(size_t source, float gain) {
+	if(source < sources.size()) sources[source]->gain.store(gain, std::memory_order_relaxed);
+}
+
+float CaptureMix::GetGain(size_t source) const {
+	return source < sources.size() ? sources[source]->gain.load(std::memory_order_relaxed) : 0.0f;
+}
+
+void CaptureMix::SetMuted(size_t source, bool muted) {
+	if(source < sources.size()) sources[source]->muted.store(muted, std::memory_order_relaxed);
+}
+
+bool CaptureMix::IsMuted(size_t source) const {
+	return source < sources.size() && sources[source]->muted.load(std::memory_order_relaxed);
+}
+
+bool CaptureMix::IsLive(size_t source) const {
+	return source < sources.size() && sources[source]->live.load(std::memory_order_relaxed);
+}
+
+void CaptureMix::Start() {
+	if(thread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		stopping = false;
+	}
+	thread = std::thread(&CaptureMix::Run, this);
+}
+
+void CaptureMix::Stop() {
+	if(!thread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		stopping = true;
+	}
+	wakeup.notify_all();
+	thread.join();
+}
+
+void CaptureMix::Run() {
+	std::unique_lock<std::mutex> lock { mutex };
+	while(!stopping) {
+		lock.unlock();
+		Process(CaptureClockNow());
+		lock.lock();
+		wakeup.wait_for(lock, std::chrono::microseconds(PERIOD_MICROSECONDS), [this] { return stopping; });
+	}
+}
+
+size_t CaptureMix::Process(uint64_t now) {
+	const uint64_t position = ring.WriteCursor();
+	const uint64_t stallTicks = uint64_t(STALL_MILLISECONDS) * 10000;
+
+	// the mix can go as far as the live source with the fewest frames
+	int64_t end = INT64_MAX;
+	bool anchored = false;
+	for(const std::unique_ptr<Source>& source : sources) {
+		CapturePipeline& pipeline = source->session->Pipeline();
+		const uint64_t write = pipeline.Ring().WriteCursor();
+		if(write != source->lastWrite) {
+			source->lastWrite = write;
+			source->lastAdvance = now;
+		}
+
+		const bool delivering = now < source->lastAdvance + stallTicks;
+		if(delivering) Align(*source, position);
+		const bool live = delivering && source->aligned;
+		source->live.store(live, std::memory_order_relaxed);
+		if(!live) continue;
+
+		if(!anchored) {
+			// The first live source carries the timeline on, the others were lined up with it. Whichever that is after
+			// the previous one stalled was lined up with it too, so the timeline doesn't jump.
+			const std::optional<uint64_t> time = pipeline.CaptureTimeAt(static_cast<uint64_t>(static_cast<int64_t>(position) + source->offset));
+			PublishAnchor(position, *time);
+			anchored = true;
+		}
+		end = std::min(end, static_cast<int64_t>(write) - source->offset);
+	}
+	if(!anchored || end <= static_cast<int64_t>(position)) return 0;
+
+	const size_t frameCount = static_cast<size_t>(std::min<int64_t>(end - static_cast<int64_t>(position), static_cast<int64_t>(ring.Capacity())));
+	for(size_t done = 0; done < frameCount;) {
+		const size_t chunk = std::min(CHUNK_FRAMES, frameCount - done);
+		MixChunk(position + done, chunk);
+		done += chunk;
+	}
+	mixedFrames.fetch_add(frameCount, std::memory_order_relaxed);
+	return frameCount;
+}
+
+void CaptureMix::Align(Source& source, uint64_t position) {
+	CapturePipeline& pipeline = source.session->Pipeline();
+	const std::optional<uint64_t> mixTime = CaptureTimeAt(position);
+	if(!mixTime) {
+		// nothing lined up yet, the first source with a timeline founds the mix's at its live edge
+		if(!pipeline.CaptureTimeAt(0)) return;
+		source.offset = static_cast<int64_t>(pipeline.Ring().WriteCursor()) - static_cast<int64_t>(position);
+		source.aligned = true;
+		return;
+	}
+
+	// where the source's ring has the frame the mix captured at position, measured from where we think it is
+	const uint64_t base = source.aligned ? static_cast<uint64_t>(static_cast<int64_t>(position) + source.offset) : pipeline.Ring().WriteCursor();
+	const std::optional<uint64_t> sourceTime = pipeline.CaptureTimeAt(base);
+	if(!sourceTime) return;
+
+	// to the nearest frame, the timestamps are truncated to whole ticks on both sides
+	const int64_t ticks = static_cast<int64_t>(*mixTime - *sourceTime) * static_cast<int64_t>(outputRate);
+	const int64_t frames = (ticks + (ticks < 0 ? -5000000 : 5000000)) / 10000000;
+	const int64_t tolerance = static_cast<int64_t>(ALIGN_TOLERANCE_MICROSECONDS) * outputRate / 1000000;
+	if(source.aligned) {
+		// packet timestamps jitter, only an error that holds up over several passes is real
+		source.drift += (static_cast<double>(frames) - source.drift) * DRIFT_SMOOTHING;
+		if(std::fabs(source.drift) <= static_cast<double>(tolerance)) return;
+		realignments.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	source.offset = static_cast<int64_t>(base) + frames - static_cast<int64_t>(position);
+	source.drift = 0.0;
+	source.aligned = true;
+}
+
+void CaptureMix::ReadSource(Source& source, uint64_t position, StereoFrame* output, size_t frameCount) {
+	const uint64_t start = static_cast<uint64_t>(static_cast<int64_t>(position) + source.offset);
+	Reader& reader = source.reader;
+
+	// Skips what a source that stalled, was muted or got realigned still has from before, or goes back for what it
+	// has already. A source that doesn't have start yet is silent for this chunk.
+	if(reader.Position() != start) reader.SeekTo(start);
+	if(reader.Position() != start) {
+		std::fill(output, output + frameCount, StereoFrame { 0.0f, 0.0f });
+		return;
+	}
+
+	size_t read = reader.Read(output, frameCount);
+	// lapped, what survived belongs further on
+	const size_t lead = static_cast<size_t>(std::min<uint64_t>(reader.Position() - read - start, frameCount));
+	read = std::min(read, frameCount - lead);
+	if(lead != 0) {
+		memmove(output + lead, output, read * sizeof(StereoFrame));
+		std::fill(output, output + lead, StereoFrame { 0.0f, 0.0f });
+	}
+	std::fill(output + lead + read, output + frameCount, StereoFrame { 0.0f, 0.0f });
+}
+
+void CaptureMix::MixChunk(uint64_t position, size_t frameCount) {
+	std::fill(mixed.begin(), mixed.begin() + frameCount, StereoFrame { 0.0f, 0.0f });
+
+	for(const std::unique_ptr<Source>& source : sources) {
+		if(!source->aligned) continue;
+
+		const float target = source->muted.load(std::memory_order_relaxed) ? 0.0f : source->gain.load(std::memory_order_relaxed);
+		const float from = source->appliedGain;
+		source->appliedGain = target;
+		// muted all along, its reader catches up once it isn't
+		if(from == 0.0f && target == 0.0f) continue;
+		// behind its silence gate the whole chunk, the same
+		const uint64_t start = static_cast<uint64_t>(static_cast<int64_t>(position) + source->offset);
+		if(source->session->Pipeline().SilentUntil(start) >= start + frameCount) continue;
+
+		ReadSource(*source, position, scratch.data(), frameCount);
+		accumulate(scratch.data(), mixed.data(), frameCount, from, (target - from) / static_cast<float>(frameCount));
+	}
+
+	ring.Write(mixed.data(), frameCount);
+}
+
+void CaptureMix::PublishAnchor(uint64_t ringPosition, uint64_t timestamp) {
+	const uint32_t sequence = anchorSequence.load(std::memory_order_relaxed);
+	anchorSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	anchorPosition.store(ringPosition, std::memory_order_relaxed);
+	anchorTimestamp.store(timestamp, std::memory_order_relaxed);
+	anchorSequence.store(sequence + 2, std::memory_order_release);
+}
+
+std::optional<uint64_t> CaptureMix::CaptureTimeAt(uint64_t ringPosition) const {
+	uint32_t sequence;
+	uint64_t position;
+	uint64_t timestamp;
+	do {
+		sequence = anchorSequence.load(std::memory_order_acquire);
+		position = anchorPosition.load(std::memory_order_relaxed);
+		timestamp = anchorTimestamp.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while((sequence & 1) != 0 || sequence != anchorSequence.load(std::memory_order_relaxed));
+
+	if(sequence == 0) return std::nullopt;
+
+	const int64_t frames = static_cast<int64_t>(ringPosition - position);
+	return timestamp + frames * 10000000 / static_cast<int64_t>(outputRate);
+}
@@ -0,0 +1,150 @@
+#ifndef CAPTURE_MIX_HPP
+#define CAPTURE_MIX_HPP
+
+#include "audio_types.hpp"
+#include "broadcast_buffer.hpp"
+#include "capture_session.hpp"
+#include "simd.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// output[i] += input[i] * (gain + step * i) on both channels, step ramps the gain from one value to the next.
+// SimdLevel::Scalar is the reference. The vector kernels do the same multiplies and adds in the same order, so as
+// long as the compiler doesn't fuse the reference's into FMAs they match it exactly.
+using FrameAccumulator = void (*)(const StereoFrame* input, StereoFrame* output, size_t frameCount, float gain, float step);
+
+FrameAccumulator SelectAccumulator(SimdLevel level = SimdLevel::Avx);
+
+// Several capture sessions summed into one ring, so a stream capturing a voice chat and a music player together costs
+// the godot mixer one read and one resample instead of one per source.
+//
+// Each source gets a Reader on its session's ring. A mixing thread wakes every PERIOD_MICROSECONDS, works out how far
+// every live source has frames, reads them, and adds them up with their gains into its own ring. Sources are lined up
+// by capture time, not by whatever their rings happened to hold when they were added: ring positions map linearly to
+// capture time (CapturePipeline::CaptureTimeAt), so each source gets a fixed offset from the mix's positions, checked
+// against the timestamps on every pass and corrected if they disagree by more than ALIGN_TOLERANCE_MICROSECONDS.
+//
+// A source that stops delivering (its target exited, or stopped rendering and the loopback went quiet) isn't waited
+// for after STALL_MILLISECONDS, it's mixed as silence until it delivers again. Waiting for the slowest source costs
+// up to one of its capture periods on top of the mixing period.
+class CaptureMix {
+public:
+	using Buffer = BroadcastBuffer<StereoFrame>;
+	using Reader = Buffer::Reader;
+
+	static constexpr size_t MAX_SOURCES = 16;
+	static constexpr uint32_t PERIOD_MICROSECONDS = 2000;
+	static constexpr uint32_t STALL_MILLISECONDS = 50;
+	// Well past how much packet timestamps jitter, well below two sources sounding out of step
+	static constexpr uint32_t ALIGN_TOLERANCE_MICROSECONDS = 5000;
+	// Frames summed at a time, gain changes ramp over one of these
+	static constexpr size_t CHUNK_FRAMES = 256;
+
+	// outputRate has to be what the sessions deliver, every session from one registry does
+	CaptureMix(uint32_t outputRate, size_t bufferFrames, SimdLevel simd = SimdLevel::Avx);
+	~CaptureMix();
+
+	CaptureMix(const CaptureMix&) = delete;
+	CaptureMix& operator=(const CaptureMix&) = delete;
+
+	// Main thread, before Start. Sources are numbered in the order they were added. The same session may be added more
+	// than once. Returns false when MAX_SOURCES are there already or the session runs at another rate.
+	bool AddSource(std::shared_ptr<CaptureSession> session, float gain = 1.0f, bool muted = false);
+	size_t SourceCount() const { return sources.size(); }
+
+	// Any thread, ramped in over the next chunk
+	void SetGain(size_t source, float gain);
+	float GetGain(size_t source) const;
+	void SetMuted(size_t source, bool muted);
+	bool IsMuted(size_t source) const;
+	// Delivered within the last STALL_MILLISECONDS and lined up with the others
+	bool IsLive(size_t source) const;
+
+	// Starts and stops the mixing thread. Without it, Process can be driven by hand.
+	void Start();
+	void Stop();
+
+	// Mixing thread. Sums everything every live source has frames for into the ring, now on CaptureClockNow()'s clock.
+	// Returns how many frames were mixed.
+	size_t Process(uint64_t now);
+
+	uint32_t OutputRate() const { return outputRate; }
+
+	// Attach readers with Reader { mix.Ring() }
+	Buffer& Ring() { return ring; }
+	const Buffer& Ring() const { return ring; }
+
+	// When the frame at a ring position was captured, like CapturePipeline::CaptureTimeAt. Empty until a source has
+	// been lined up. Safe from any thread.
+	std::optional<uint64_t> CaptureTimeAt(uint64_t ringPosition) const;
+
+	// Times a source's offset had to be corrected after it was first lined up
+	uint64_t Realignments() const { return realignments.load(std::memory_order_relaxed); }
+	uint64_t MixedFrames() const { return mixedFrames.load(std::memory_order_relaxed); }
+
+private:
+	struct Source {
+		Source(std::shared_ptr<CaptureSession> session, float gain, bool muted, uint64_t now);
+		~Source();
+
+		std::shared_ptr<CaptureSession> session;
+		// declared after session, it points into the session's ring
+		Reader reader;
+		std::atomic<float> gain;
+		std::atomic<bool> muted;
+		std::atomic<bool> live;
+
+		// mixing thread only
+		float appliedGain;
+		// source ring position minus mix ring position of the frames captured at the same time
+		int64_t offset;
+		// smoothed frames the timestamps say offset is off by
+		double drift;
+		bool aligned;
+		uint64_t lastWrite;
+		uint64_t lastAdvance;
+	};
+
+	// per pass, how much of a new measurement goes into a source's drift: about 100 ms worth of passes
+	static constexpr double DRIFT_SMOOTHING = 0.02;
+
+	// Lines source up with the mix timeline at position, or founds it if there's none yet
+	void Align(Source& source, uint64_t position);
+	// The source's frames for mix positions [position, position + frameCount) into output, silence where it has none
+	void ReadSource(Source& source, uint64_t position, StereoFrame* output, size_t frameCount);
+	void MixChunk(uint64_t position, size_t frameCount);
+	void PublishAnchor(uint64_t ringPosition, uint64_t timestamp);
+	void Run();
+
+	const uint32_t outputRate;
+	const FrameAccumulator accumulate;
+	Buffer ring;
+	std::vector<std::unique_ptr<Source>> sources;
+
+	// mixing thread: the sum, and each source's frames on their way into it
+	std::vector<StereoFrame> mixed;
+	std::vector<StereoFrame> scratch;
+
+	std::atomic<uint64_t> realignments;
+	std::atomic<uint64_t> mixedFrames;
+
+	// ring position <-> capture time, seqlock like the pipeline's
+	std::atomic<uint32_t> anchorSequence;
+	std::atomic<uint64_t> anchorPosition;
+	std::atomic<uint64_t> anchorTimestamp;
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping;
+	std::thread thread;
+};
+
+#endif // CAPTURE_MIX_HPP
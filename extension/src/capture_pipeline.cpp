@@ -0,0 +1,612 @@
+#include "capture_pipeline.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+CapturePipeline::CapturePipeline(size_t bufferFrames, uint32_t outputRate) :
+	ring { bufferFrames },
+	format { 48000, 2, 32, SampleType::Float },
+	outputRate { outputRate },
+	formatSupported { true },
+	convert { },
+	mix { },
+	matrix { },
+	matrices { },
+	samples { },
+	converted { },
+	resampler { },
+	rejectedFrames { 0 },
+	stats { },
+	errorListener { },
+	gate { },
+	awakeHolds { 0 },
+	nextPosition { 0 },
+	timelineStarted { false },
+	taps { },
+	tapUsers { 0 },
+	inserts { nullptr },
+	insertUsers { 0 },
+	history { nullptr },
+	historyUsers { 0 },
+	switchInput { *this },
+	activeInput { 0 },
+	activeUsers { 0 },
+	switchState { SwitchState::Idle },
+	staging { },
+	switchMatrix { },
+	stagingSamples { },
+	fadeMix { },
+	fadeCurve { },
+	fadePosition { 0 },
+	fadedOut { false },
+	switchBegan { 0 },
+	switchFirstPacket { 0 },
+	anchorSequence { 0 },
+	anchorPosition { 0 },
+	anchorTimestamp { 0 }
+{ }
+
+void CapturePipeline::Configure(const CaptureFormat& newFormat, uint32_t newOutputRate) {
+	format = newFormat;
+	// playbacks read it while a lazily started session configures, it only ever gets the rate it was created with
+	if(outputRate != newOutputRate) outputRate = newOutputRate;
+	const std::optional<SampleEncoding> encoding = EncodingOf(format);
+	formatSupported = encoding.has_value() && format.channels >= 1 && format.channels <= MAX_MIX_CHANNELS;
+	convert = formatSupported && *encoding != SampleEncoding::Float32 ? SelectConverter(*encoding) : nullptr;
+	mix = formatSupported ? SelectChannelMixer(format.channels) : nullptr;
+	if(formatSupported) SetChannelMatrix(DownmixMatrix(format.channels, format.channelMask));
+	samples.resize(convert != nullptr ? CONVERT_CHUNK_FRAMES * format.channels : 0);
+	stagingSamples.resize(samples.size());
+	converted.resize(CONVERT_CHUNK_FRAMES);
+
+	timelineStarted = false;
+	// fed converted frames, before any resampling
+	gate.Configure(format.sampleRate);
+
+	if(format.sampleRate != outputRate) {
+		resampler = std::make_unique<PolyphaseResampler>(format.sampleRate, outputRate);
+	} else {
+		resampler.reset();
+	}
+
+	// allocated here so a switch never has to
+	const size_t fadeFrames = std::max<size_t>(size_t(format.sampleRate) * FADE_MILLISECONDS / 1000, 1);
+	fadeCurve.resize(fadeFrames + 1);
+	for(size_t i = 0; i <= fadeFrames; i++) {
+		fadeCurve[i] = static_cast<float>(std::sin(1.57079632679489661923 * i / fadeFrames));
+	}
+	fadeMix.resize(FADE_CHUNK_FRAMES);
+	staging = std::make_unique<CircularBuffer<StereoFrame>>(size_t(format.sampleRate) * TAKEOVER_MILLISECONDS / 1000 * 2, OverrunPolicy::DropNewest);
+	switchState.store(SwitchState::Idle);
+}
+
+void CapturePipeline::OnPacket(const CapturePacket& packet) {
+	Deliver(0, packet);
+}
+
+void CapturePipeline::Deliver(uint32_t input, const CapturePacket& packet) {
+	if(input != activeInput.load(std::memory_order_acquire)) {
+		StagePacket(input, packet);
+		return;
+	}
+
+	// seq_cst pairs with TakeOver: either it waits for us to be out or we see Handoff (or that we aren't active
+	// anymore) and leave the ring alone
+	activeUsers.fetch_add(1);
+	const SwitchState state = switchState.load();
+	if(state != SwitchState::Handoff && input == activeInput.load()) {
+		WritePacket(packet, state != SwitchState::Idle);
+	}
+	activeUsers.fetch_sub(1, std::memory_order_release);
+}
+
+void CapturePipeline::WritePacket(const CapturePacket& packet, bool switching) {
+	stats.RecordPacket(packet.frameCount);
+
+	if(!formatSupported) {
+		rejectedFrames.fetch_add(packet.frameCount, std::memory_order_relaxed);
+		return;
+	}
+
+	uint32_t skip = 0;
+	uint64_t gap = 0;
+	if(packet.timed) {
+		if(timelineStarted) {
+			const int64_t offset = static_cast<int64_t>(packet.position - nextPosition);
+			const uint64_t maxGap = uint64_t(format.sampleRate) * MAX_GAP_SECONDS;
+			if(offset > 0) {
+				// lost frames, silence in their place keeps everything after them on time
+				gap = std::min<uint64_t>(static_cast<uint64_t>(offset), maxGap);
+			} else if(offset < 0 && static_cast<uint64_t>(-offset) <= maxGap) {
+				// repeats frames we already have, keep only what's new
+				skip = static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(-offset), packet.frameCount));
+			}
+			// anything further back means the source restarted its clock, just follow it
+		}
+		nextPosition = packet.position + packet.frameCount;
+		timelineStarted = true;
+	} else {
+		nextPosition += packet.frameCount;
+	}
+
+	if(packet.discontinuity || gap != 0 || skip != 0) stats.RecordDiscontinuity(gap, skip);
+
+	if(gap != 0) Output(nullptr, gap, switching);
+
+	if(packet.timed && skip < packet.frameCount) {
+		const uint64_t skipped = uint64_t(skip) * 10000000 / format.sampleRate;
+		PublishAnchor(NextRingPosition(), packet.timestamp + skipped);
+	}
+
+	const uint32_t frameCount = packet.frameCount - skip;
+	if(packet.silent || packet.frames == nullptr) {
+		stats.RecordSilence(frameCount);
+		Output(nullptr, frameCount, switching);
+	} else {
+		Input(packet.frames + size_t(skip) * format.BytesPerFrame(), frameCount, switching);
+	}
+}
+
+void CapturePipeline::Input(const uint8_t* frames, uint64_t frameCount, bool switching) {
+	matrices.Update();
+	const ChannelMatrix& mixMatrix = matrices.Front();
+	InsertChain* chain = AcquireInserts();
+	if(convert == nullptr && mixMatrix.IsPassthrough() && chain == nullptr) {
+		ReleaseInserts();
+		Output(reinterpret_cast<const StereoFrame*>(frames), frameCount, switching);
+		return;
+	}
+
+	const size_t bytesPerFrame = format.BytesPerFrame();
+	if(!resampler && !switching) {
+		// converted straight into the ring, the taps read it from there before it's committed
+		while(frameCount > 0) {
+			const RingSpan<StereoFrame> span = ring.ReserveWrite(static_cast<size_t>(std::min<uint64_t>(frameCount, ring.Capacity())));
+			ToStereo(frames, span.first, span.firstCount, mixMatrix, samples.data());
+			ToStereo(frames + span.firstCount * bytesPerFrame, span.second, span.secondCount, mixMatrix, samples.data());
+			if(chain != nullptr) {
+				chain->Process(span.first, span.firstCount, format.sampleRate);
+				chain->Process(span.second, span.secondCount, format.sampleRate);
+			}
+			gate.Feed(span.first, span.firstCount, ring.WriteCursor());
+			gate.Feed(span.second, span.secondCount, ring.WriteCursor() + span.firstCount);
+			FeedTaps(reinterpret_cast<const uint8_t*>(span.first), span.firstCount);
+			FeedTaps(reinterpret_cast<const uint8_t*>(span.second), span.secondCount);
+			FeedHistory(span, false);
+			ring.CommitWrite(span.Size());
+
+			frames += span.Size() * bytesPerFrame;
+			frameCount -= span.Size();
+		}
+		ReleaseInserts();
+		return;
+	}
+
+	while(frameCount > 0) {
+		const size_t chunk = static_cast<size_t>(std::min<uint64_t>(frameCount, converted.size()));
+		ToStereo(frames, converted.data(), chunk, mixMatrix, samples.data());
+		// while switching these are the old source's side of the fade, the new source's staged frames go in as they are
+		if(chain != nullptr) chain->Process(converted.data(), chunk, format.sampleRate);
+		Output(converted.data(), chunk, switching);
+
+		frames += chunk * bytesPerFrame;
+		frameCount -= chunk;
+	}
+	ReleaseInserts();
+}
+
+void CapturePipeline::ToStereo(const uint8_t* frames, StereoFrame* output, size_t frameCount, const ChannelMatrix& mixMatrix, float* scratch) {
+	if(mixMatrix.IsPassthrough()) {
+		if(convert != nullptr) {
+			convert(frames, reinterpret_cast<float*>(output), frameCount * 2);
+		} else {
+			memcpy(output, frames, frameCount * sizeof(StereoFrame));
+		}
+		return;
+	}
+
+	const size_t bytesPerFrame = format.BytesPerFrame();
+	while(frameCount > 0) {
+		const size_t chunk = std::min(frameCount, CONVERT_CHUNK_FRAMES);
+		const float* source = reinterpret_cast<const float*>(frames);
+		if(convert != nullptr) {
+			convert(frames, scratch, chunk * format.channels);
+			source = scratch;
+		}
+		mix(source, output, chunk, mixMatrix);
+
+		frames += chunk * bytesPerFrame;
+		output += chunk;
+		frameCount -= chunk;
+	}
+}
+
+void CapturePipeline::Output(const StereoFrame* frames, uint64_t frameCount, bool switching) {
+	if(switching) {
+		FadeOut(frames, frameCount);
+		return;
+	}
+
+	FeedTaps(reinterpret_cast<const uint8_t*>(frames), frameCount);
+	if(frames != nullptr) {
+		WriteFrames(frames, static_cast<size_t>(frameCount));
+	} else {
+		WriteSilence(frameCount);
+	}
+}
+
+// The current source's side of a switch
+void CapturePipeline::FadeOut(const StereoFrame* frames, uint64_t frameCount) {
+	const size_t fadeFrames = fadeCurve.size() - 1;
+
+	while(frameCount > 0) {
+		SwitchState state = switchState.load();
+		// the new source gave up waiting on us, it's waiting for us to leave now
+		if(state == SwitchState::Handoff) return;
+
+		if(state == SwitchState::Staging) {
+			// not far enough ahead yet to fade into without running dry
+			if(staging->Readable() < fadeFrames) {
+				Output(frames, frameCount, false);
+				return;
+			}
+			if(!switchState.compare_exchange_strong(state, SwitchState::Fading)) continue;
+			fadePosition = 0;
+		}
+
+		const size_t chunk = static_cast<size_t>(std::min<uint64_t>(frameCount, std::min(fadeFrames - fadePosition, fadeMix.size())));
+		// where the new source hasn't got that far it fades in from silence
+		const RingSpan<const StereoFrame> incoming = staging->PeekRead(chunk);
+		for(size_t i = 0; i < chunk; i++) {
+			const StereoFrame old = frames != nullptr ? frames[i] : StereoFrame { 0.0f, 0.0f };
+			const StereoFrame next = i < incoming.Size() ? incoming[i] : StereoFrame { 0.0f, 0.0f };
+			const float oldGain = fadeCurve[fadeFrames - fadePosition - i - 1];
+			const float newGain = fadeCurve[fadePosition + i + 1];
+			fadeMix[i] = StereoFrame { old.left * oldGain + next.left * newGain, old.right * oldGain + next.right * newGain };
+		}
+		staging->ConsumeRead(incoming.Size());
+
+		FeedTaps(reinterpret_cast<const uint8_t*>(fadeMix.data()), chunk);
+		WriteFrames(fadeMix.data(), chunk);
+
+		fadePosition += chunk;
+		frameCount -= chunk;
+		if(frames != nullptr) frames += chunk;
+
+		if(fadePosition == fadeFrames) {
+			// the rest of this packet is the new source's from here on
+			fadedOut = true;
+			SwitchState fading = SwitchState::Fading;
+			switchState.compare_exchange_strong(fading, SwitchState::Handoff);
+			return;
+		}
+	}
+}
+
+// The new source's side of a switch
+void CapturePipeline::StagePacket(uint32_t input, const CapturePacket& packet) {
+	SwitchState state = switchState.load(std::memory_order_acquire);
+	// a source that was switched away from, winding down
+	if(state == SwitchState::Idle) return;
+
+	uint64_t unset = 0;
+	switchFirstPacket.compare_exchange_strong(unset, CaptureClockNow(), std::memory_order_relaxed);
+
+	if(state == SwitchState::Handoff) {
+		TakeOver(input);
+		Deliver(input, packet);
+		return;
+	}
+
+	if(packet.silent || packet.frames == nullptr) {
+		const RingSpan<StereoFrame> span = staging->ReserveWrite(packet.frameCount);
+		memset(span.first, 0, span.firstCount * sizeof(StereoFrame));
+		memset(span.second, 0, span.secondCount * sizeof(StereoFrame));
+		staging->CommitWrite(span.Size());
+	} else if(convert != nullptr || !switchMatrix.IsPassthrough()) {
+		const RingSpan<StereoFrame> span = staging->ReserveWrite(packet.frameCount);
+		ToStereo(packet.frames, span.first, span.firstCount, switchMatrix, stagingSamples.data());
+		ToStereo(packet.frames + span.firstCount * format.BytesPerFrame(), span.second, span.secondCount, switchMatrix, stagingSamples.data());
+		staging->CommitWrite(span.Size());
+	} else {
+		staging->Write(reinterpret_cast<const StereoFrame*>(packet.frames), packet.frameCount);
+	}
+
+	// the current source stopped delivering, don't wait for it any longer
+	const size_t takeoverFrames = size_t(format.sampleRate) * TAKEOVER_MILLISECONDS / 1000;
+	if(staging->Readable() >= takeoverFrames && switchState.compare_exchange_strong(state, SwitchState::Handoff)) {
+		TakeOver(input);
+	}
+}
+
+void CapturePipeline::TakeOver(uint32_t input) {
+	// at most the rest of one packet, after that the ring, the resampler and the staged frames are ours
+	while(activeUsers.load() != 0) std::this_thread::yield();
+
+	// whatever is staged carries on right where the fade (or the old source) stopped
+	InsertChain* chain = AcquireInserts();
+	while(staging->Readable() > 0) {
+		if(chain != nullptr) {
+			// the old source is out for good, its chunk buffer is free
+			const size_t chunk = staging->Read(converted.data(), converted.size());
+			chain->Process(converted.data(), chunk, format.sampleRate);
+			FeedTaps(reinterpret_cast<const uint8_t*>(converted.data()), chunk);
+			WriteFrames(converted.data(), chunk);
+			continue;
+		}
+		const RingSpan<const StereoFrame> span = staging->PeekRead(staging->Readable());
+		FeedTaps(reinterpret_cast<const uint8_t*>(span.first), span.firstCount);
+		WriteFrames(span.first, span.firstCount);
+		FeedTaps(reinterpret_cast<const uint8_t*>(span.second), span.secondCount);
+		WriteFrames(span.second, span.secondCount);
+		staging->ConsumeRead(span.Size());
+	}
+	ReleaseInserts();
+
+	// the new source counts its positions from wherever it started
+	timelineStarted = false;
+
+	const uint64_t now = CaptureClockNow();
+	const uint64_t began = switchBegan.load(std::memory_order_relaxed);
+	stats.RecordSwitch((switchFirstPacket.load(std::memory_order_relaxed) - began) / 10, (now - began) / 10, fadedOut);
+
+	activeInput.store(input);
+	switchState.store(SwitchState::Idle);
+}
+
+CaptureReceiver* CapturePipeline::BeginSwitch() {
+	if(!formatSupported || !staging || switchState.load() != SwitchState::Idle) return nullptr;
+
+	const uint32_t input = 1 - activeInput.load();
+	switchMatrix = matrix;
+	fadedOut = false;
+	switchFirstPacket.store(0, std::memory_order_relaxed);
+	switchBegan.store(CaptureClockNow(), std::memory_order_relaxed);
+	switchState.store(SwitchState::Staging);
+
+	return input == 0 ? static_cast<CaptureReceiver*>(this) : &switchInput;
+}
+
+void CapturePipeline::CancelSwitch() {
+	SwitchState staged = SwitchState::Staging;
+	switchState.compare_exchange_strong(staged, SwitchState::Idle);
+}
+
+void CapturePipeline::ForceSwitch() {
+	SwitchState state = switchState.load();
+	while((state == SwitchState::Staging || state == SwitchState::Fading) && !switchState.compare_exchange_weak(state, SwitchState::Handoff)) { }
+}
+
+bool CapturePipeline::SwitchSettled() const {
+	const SwitchState state = switchState.load();
+	return state == SwitchState::Idle || state == SwitchState::Handoff;
+}
+
+CaptureReceiver* CapturePipeline::ActiveInput() {
+	return activeInput.load() == 0 ? static_cast<CaptureReceiver*>(this) : &switchInput;
+}
+
+bool CapturePipeline::SetChannelMatrix(const ChannelMatrix& newMatrix) {
+	if(!formatSupported || newMatrix.channels != format.channels) return false;
+
+	matrix = newMatrix;
+	matrices.Back() = newMatrix;
+	matrices.Publish();
+	return true;
+}
+
+void CapturePipeline::FeedTaps(const uint8_t* frames, uint64_t frameCount) {
+	if(frameCount == 0) return;
+
+	// seq_cst pairs with DetachTap: either it sees us in here or we see the null it stored
+	tapUsers.fetch_add(1);
+	for(std::atomic<CaptureTap*>& slot : taps) {
+		CaptureTap* tap = slot.load();
+		if(tap != nullptr) tap->OnFrames(frames, frameCount);
+	}
+	tapUsers.fetch_sub(1, std::memory_order_release);
+}
+
+void CapturePipeline::FeedHistory(const RingSpan<StereoFrame>& span, bool silent) {
+	if(span.Size() == 0) return;
+
+	// seq_cst pairs with DetachHistory, like FeedTaps with DetachTap
+	historyUsers.fetch_add(1);
+	CaptureHistory* attached = history.load();
+	if(attached != nullptr) {
+		const uint64_t position = ring.WriteCursor();
+		attached->Write(position, silent ? nullptr : span.first, span.firstCount);
+		attached->Write(position + span.firstCount, silent ? nullptr : span.second, span.secondCount);
+	}
+	historyUsers.fetch_sub(1, std::memory_order_release);
+}
+
+void CapturePipeline::WriteFrames(const StereoFrame* input, size_t frameCount) {
+	gate.Feed(input, frameCount, ring.WriteCursor());
+
+	if(!resampler) {
+		// The packet goes directly from the source's buffer into the ring, this is the only copy on the capture side
+		const RingSpan<StereoFrame> span = ring.ReserveWrite(frameCount);
+		span.CopyFrom(input);
+		FeedHistory(span, false);
+		ring.CommitWrite(span.Size());
+		return;
+	}
+
+	// Resample straight into the ring, a chunk of input at a time
+	size_t remaining = frameCount;
+	while(remaining > 0) {
+		const size_t pushed = resampler->Push(input, remaining);
+		input += pushed;
+		remaining -= pushed;
+		DrainResampler();
+	}
+}
+
+void CapturePipeline::WriteSilence(uint64_t frameCount) {
+	gate.Feed(nullptr, static_cast<size_t>(frameCount), ring.WriteCursor());
+
+	if(!resampler) {
+		// After a ring's worth of zeros the rest would only overwrite the same zeros again, but the cursor still has to
+		// move by all of it or every position after the gap maps to the wrong capture time
+		uint64_t remaining = frameCount;
+		uint64_t zeroed = 0;
+		while(remaining > 0) {
+			const RingSpan<StereoFrame> span = ring.ReserveWrite(static_cast<size_t>(std::min<uint64_t>(remaining, ring.Capacity())));
+			if(zeroed < ring.Capacity()) {
+				memset(span.first, 0, span.firstCount * sizeof(StereoFrame));
+				memset(span.second, 0, span.secondCount * sizeof(StereoFrame));
+				zeroed += span.Size();
+			}
+			FeedHistory(span, true);
+			ring.CommitWrite(span.Size());
+			remaining -= span.Size();
+		}
+		return;
+	}
+
+	// through the resampler, so the filter rings out what came before and its phase carries on
+	while(frameCount > 0) {
+		const size_t pushed = resampler->PushSilence(static_cast<size_t>(std::min<uint64_t>(frameCount, PolyphaseResampler::CHUNK_FRAMES)));
+		frameCount -= pushed;
+		DrainResampler();
+	}
+}
+
+void CapturePipeline::DrainResampler() {
+	const RingSpan<StereoFrame> span = ring.ReserveWrite(resampler->Available());
+	const bool silent = resampler->IsSilent();
+	if(silent) {
+		// nothing but zeros left in the filter, don't bother running it
+		resampler->Skip(span.Size());
+		memset(span.first, 0, span.firstCount * sizeof(StereoFrame));
+		memset(span.second, 0, span.secondCount * sizeof(StereoFrame));
+	} else {
+		resampler->Pull(span.first, span.firstCount);
+		resampler->Pull(span.second, span.secondCount);
+	}
+	FeedHistory(span, silent);
+	ring.CommitWrite(span.Size());
+
+	// more than the whole ring at once, what didn't fit would only block the next Push
+	resampler->Skip(resampler->Available());
+}
+
+bool CapturePipeline::AttachTap(CaptureTap* tap) {
+	for(std::atomic<CaptureTap*>& slot : taps) {
+		CaptureTap* empty = nullptr;
+		if(slot.compare_exchange_strong(empty, tap)) return true;
+	}
+	return false;
+}
+
+void CapturePipeline::DetachTap(CaptureTap* tap) {
+	for(std::atomic<CaptureTap*>& slot : taps) {
+		CaptureTap* attached = tap;
+		slot.compare_exchange_strong(attached, nullptr);
+	}
+	// at most one packet's worth of work
+	while(tapUsers.load() != 0) std::this_thread::yield();
+}
+
+bool CapturePipeline::AttachInserts(InsertChain* chain) {
+	InsertChain* empty = nullptr;
+	return inserts.compare_exchange_strong(empty, chain) || empty == chain;
+}
+
+void CapturePipeline::DetachInserts(InsertChain* chain) {
+	InsertChain* attached = chain;
+	if(!inserts.compare_exchange_strong(attached, nullptr)) return;
+	while(insertUsers.load() != 0) std::this_thread::yield();
+}
+
+InsertChain* CapturePipeline::AcquireInserts() {
+	// seq_cst pairs with DetachInserts, the same way FeedTaps does with DetachTap
+	insertUsers.fetch_add(1);
+	InsertChain* chain = inserts.load();
+	return chain != nullptr && !chain->Empty() ? chain : nullptr;
+}
+
+void CapturePipeline::ReleaseInserts() {
+	insertUsers.fetch_sub(1, std::memory_order_release);
+}
+
+bool CapturePipeline::AttachHistory(CaptureHistory* newHistory) {
+	CaptureHistory* empty = nullptr;
+	return history.compare_exchange_strong(empty, newHistory) || empty == newHistory;
+}
+
+void CapturePipeline::DetachHistory(CaptureHistory* oldHistory) {
+	CaptureHistory* attached = oldHistory;
+	if(!history.compare_exchange_strong(attached, nullptr)) return;
+	while(historyUsers.load() != 0) std::this_thread::yield();
+}
+
+uint64_t CapturePipeline::NextRingPosition() const {
+	const uint64_t written = ring.WriteCursor();
+	if(!resampler) return written;
+	// input the resampler holds past its filter center comes out before the next packet does
+	return written + uint64_t(resampler->Pending()) * outputRate / format.sampleRate;
+}
+
+void CapturePipeline::PublishAnchor(uint64_t ringPosition, uint64_t timestamp) {
+	const uint32_t sequence = anchorSequence.load(std::memory_order_relaxed);
+	anchorSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	anchorPosition.store(ringPosition, std::memory_order_relaxed);
+	anchorTimestamp.store(timestamp, std::memory_order_relaxed);
+	anchorSequence.store(sequence + 2, std::memory_order_release);
+}
+
+std::optional<uint64_t> CapturePipeline::CaptureTimeAt(uint64_t ringPosition) const {
+	uint32_t sequence;
+	uint64_t position;
+	uint64_t timestamp;
+	do {
+		sequence = anchorSequence.load(std::memory_order_acquire);
+		position = anchorPosition.load(std::memory_order_relaxed);
+		timestamp = anchorTimestamp.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while((sequence & 1) != 0 || sequence != anchorSequence.load(std::memory_order_relaxed));
+
+	if(sequence == 0) return std::nullopt;
+
+	// gaps are filled, so the ring runs at exactly the output rate on the capture's clock in both directions
+	const int64_t frames = static_cast<int64_t>(ringPosition - position);
+	return timestamp + frames * 10000000 / static_cast<int64_t>(outputRate);
+}
+
+void CapturePipeline::OnWakeup(uint32_t packetCount, uint32_t microseconds) {
+	stats.RecordWakeup(packetCount, microseconds);
+}
+
+void CapturePipeline::OnCaptureError(uint32_t code) {
+	stats.RecordError(code);
+	if(errorListener) errorListener(code);
+}
+
+size_t CapturePipeline::Mix(Reader& reader, StereoFrame* output, size_t frameCount) {
+	// Straight from the ring into the mixer's buffer, no staging
+	return reader.Read(output, frameCount);
+}
+
+size_t CapturePipeline::MixSilence(Reader& reader, StereoFrame* output, size_t frameCount) {
+	const uint64_t position = reader.Position();
+	const uint64_t silentUntil = gate.SilentUntil(position);
+	if(silentUntil == position) return 0;
+
+	// while the gate is closed, what the source hasn't delivered yet will be silent too, it's only idling
+	const size_t consumed = std::min(frameCount, reader.Lag());
+	if(position + consumed > silentUntil || (silentUntil != SilenceGate::NEVER && consumed < frameCount)) return 0;
+
+	reader.SeekTo(position + consumed);
+	memset(output, 0, frameCount * sizeof(StereoFrame));
+	return frameCount;
+}
+
+std::chrono::milliseconds CapturePipeline::IdleWakeupInterval() const {
+	const bool idle = gate.IsClosed() && awakeHolds.load(std::memory_order_relaxed) == 0;
+	return idle ? IDLE_WAKEUP_INTERVAL : std::chrono::milliseconds::zero();
+}
@@ -0,0 +1,273 @@
+#ifndef CAPTURE_PIPELINE_HPP
+#define CAPTURE_PIPELINE_HPP
+
+#include "audio_types.hpp"
+#include "broadcast_buffer.hpp"
+#include "capture_history.hpp"
+#include "capture_source.hpp"
+#include "channel_mix.hpp"
+#include "capture_stats.hpp"
+#include "insert_chain.hpp"
+#include "resampler.hpp"
+#include "ring_buffer.hpp"
+#include "sample_convert.hpp"
+#include "silence_gate.hpp"
+#include "triple_buffer.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Everything between a CaptureSource and the godot mixer that doesn't care which backend or engine it runs in:
+// packets come in through OnPacket on the capture thread, get converted from the source's sample format, mixed down
+// from its channel layout to stereo (and resampled to the output rate, so that happens exactly once) straight into
+// the ring, and any number of Readers pull them out on mixer threads.
+// AudioStreamWasapiAppCapture is a thin godot wrapper around one of these, with one Reader per playback.
+//
+// Timed packets keep the ring on the source's timeline: frames the source lost are filled with silence and frames
+// it repeats are dropped, so ring positions map linearly to capture time (CaptureTimeAt) and nothing after a glitch
+// ends up shifted. Silent packets are written as zeros without reading the source's buffer at all.
+//
+// A SilenceGate watches what goes into the ring. While it's closed mixers can hand out zeros with MixSilence (or
+// JitterBuffer::MixSilence) instead of reading and resampling, and sources wake up every IDLE_WAKEUP_INTERVAL only.
+//
+// An InsertChain can be attached to run effects over the converted frames before the gate, the taps and the ring see
+// them. Silence (flagged by the source or filling a gap) goes in as it is.
+//
+// A CaptureHistory can be attached to keep what goes into the ring for longer than the ring does, at the same
+// positions.
+//
+// A second source can be switched in while the first keeps running (BeginSwitch): the ring, its readers and the taps
+// stay where they are, the new source's audio is crossfaded in and it carries on the ring's timeline from there.
+class CapturePipeline : public CaptureReceiver {
+public:
+	using Buffer = BroadcastBuffer<StereoFrame>;
+	using Reader = Buffer::Reader;
+
+	// outputRate is only a default for OutputRate() until Configure, so readers can be set up before the source is
+	explicit CapturePipeline(size_t bufferFrames, uint32_t outputRate = 48000);
+
+	// Must be called before the source starts delivering, picks the conversion and mixing kernels, allocates the
+	// resampler if the rates differ and everything a switch needs. int16, packed int24, int32 and float32 with 1 to
+	// MAX_MIX_CHANNELS channels are converted and mixed down with DownmixMatrix for their layout, packets in any
+	// other format are dropped. Can be called again once every source that delivered is gone, that abandons a
+	// switch that was under way.
+	void Configure(const CaptureFormat& format, uint32_t outputRate);
+	// Main thread. Replaces the downmix, from the next packet on. Returns false if the matrix isn't for
+	// GetFormat().channels channels.
+	bool SetChannelMatrix(const ChannelMatrix& matrix);
+	const ChannelMatrix& GetChannelMatrix() const { return matrix; }
+	CaptureFormat GetFormat() const { return format; }
+	// What taps get: float stereo at the source's rate
+	CaptureFormat TapFormat() const { return CaptureFormat { format.sampleRate, 2, 32, SampleType::Float }; }
+	uint32_t OutputRate() const { return outputRate; }
+	bool IsResampling() const { return resampler != nullptr; }
+
+	// Capture thread
+	void OnPacket(const CapturePacket& packet) override;
+	void OnWakeup(uint32_t packetCount, uint32_t microseconds) override;
+	void OnCaptureError(uint32_t code) override;
+	std::chrono::milliseconds IdleWakeupInterval() const override;
+
+	// Called on the capture thread after OnCaptureError recorded it, set it before any source starts
+	using ErrorListener = std::function<void(uint32_t code)>;
+	void SetErrorListener(ErrorListener listener) { errorListener = std::move(listener); }
+
+	// Mixer thread of whoever owns reader. Returns how many frames were written to output, the rest is left for
+	// the caller to fill.
+	size_t Mix(Reader& reader, StereoFrame* output, size_t frameCount);
+	// Mix for a reader behind the closed gate: zeros, moving the reader on without reading the ring. Returns 0 if
+	// the gate doesn't cover all of it, Mix has to do it then.
+	size_t MixSilence(Reader& reader, StereoFrame* output, size_t frameCount);
+
+	// Ring position up to which everything from ringPosition on is silent, see SilenceGate. Any thread.
+	uint64_t SilentUntil(uint64_t ringPosition) const { return gate.SilentUntil(ringPosition); }
+	const SilenceGate& Gate() const { return gate; }
+	// On by default. Any thread, from the next packet on.
+	void SetSilenceGateEnabled(bool enabled) { gate.SetEnabled(enabled); }
+	// While anyone holds the pipeline awake its source isn't told to idle behind the gate, for consumers that line
+	// several captures up and would otherwise wait for its bursts (CaptureMix). Any thread.
+	void HoldAwake() { awakeHolds.fetch_add(1, std::memory_order_relaxed); }
+	void ReleaseAwake() { awakeHolds.fetch_sub(1, std::memory_order_relaxed); }
+
+	// Attach readers with Reader { pipeline.Ring() }
+	Buffer& Ring() { return ring; }
+	const Buffer& Ring() const { return ring; }
+
+	// Feeds every packet to tap until DetachTap, from the next packet on. Returns false if MAX_TAPS are attached
+	// already. Taps get frames in TapFormat(). Any thread but the capture thread.
+	bool AttachTap(CaptureTap* tap);
+	// Returns once the capture thread is done with tap, after that it can be destroyed
+	void DetachTap(CaptureTap* tap);
+
+	// Runs chain over every packet from the next one on until DetachInserts, after the downmix and before the taps,
+	// the gate and the ring. One chain per pipeline, returns false if a different one is attached already. Any thread
+	// but the capture thread.
+	bool AttachInserts(InsertChain* chain);
+	// Returns once the capture thread is done with chain, does nothing if it isn't the one attached
+	void DetachInserts(InsertChain* chain);
+
+	// Hands history everything written to the ring from the next packet on, resampled and at the ring's positions,
+	// until DetachHistory. Its rate has to be OutputRate(). One history per pipeline, returns false if a different
+	// one is attached already. A history only ever follows one pipeline, from the first frame it got on.
+	bool AttachHistory(CaptureHistory* history);
+	// Returns once the capture thread is done with history, does nothing if it isn't the one attached
+	void DetachHistory(CaptureHistory* history);
+
+	// Live retargeting, main thread. Start a new source delivering in GetFormat() into the returned receiver while
+	// the current one keeps going: its packets are staged until they're a fade ahead, then the current source
+	// crossfades into them over FADE_MILLISECONDS and the new one takes the ring over where the fade ends. If the
+	// current source stops delivering the new one takes over after TAKEOVER_MILLISECONDS without a fade.
+	// Returns null while the previous switch is under way or the format can't be mixed. The source that was
+	// switched away from must be gone before the next BeginSwitch, it would deliver into the same receiver.
+	CaptureReceiver* BeginSwitch();
+	// The new source couldn't be created after all, nothing was delivered into the receiver
+	void CancelSwitch();
+	// Stop waiting for the current source to fade out, the new one takes over on its next packet
+	void ForceSwitch();
+	// The source switched away from won't write anything anymore and can be destroyed
+	bool SwitchSettled() const;
+	// Where a source that has the ring to itself delivers: the pipeline until the first switch, after that whichever
+	// input the last one went to. Main thread, with no switch under way.
+	CaptureReceiver* ActiveInput();
+
+	// When the frame at a ring position (a Reader's Position()) was captured, on CaptureClockNow()'s clock.
+	// Empty until the source delivered a timed packet. Safe from any thread.
+	std::optional<uint64_t> CaptureTimeAt(uint64_t ringPosition) const;
+
+	// Frames that arrived in a format the pipeline can't convert
+	uint64_t RejectedFrames() const { return rejectedFrames.load(std::memory_order_relaxed); }
+	const CaptureStats& Stats() const { return stats; }
+
+private:
+	// Recorders, analyzers... per session
+	static constexpr size_t MAX_TAPS = 8;
+
+	// Lost frames beyond this many seconds aren't filled in, readers would only get lapped by the silence
+	static constexpr uint32_t MAX_GAP_SECONDS = 1;
+
+	// Switch crossfade length, and how much the new source may get ahead before it stops waiting for the old one
+	static constexpr uint32_t FADE_MILLISECONDS = 10;
+	static constexpr uint32_t TAKEOVER_MILLISECONDS = 100;
+	static constexpr size_t FADE_CHUNK_FRAMES = 256;
+	// converted frames on their way to the resampler or a fade
+	static constexpr size_t CONVERT_CHUNK_FRAMES = 1024;
+	// How long sources may sit on packets while the gate is closed. Jitter buffers ride the bursts out like any
+	// other jitter, a plain reader keeps up to this much extra latency from the one the gate opens in.
+	static constexpr std::chrono::milliseconds IDLE_WAKEUP_INTERVAL { 20 };
+
+	enum class SwitchState : uint32_t {
+		Idle,
+		// the new source's packets are staged
+		Staging,
+		// the current source mixes the staged frames into its own
+		Fading,
+		// the current source is done, the new one takes over from its next packet
+		Handoff,
+	};
+
+	// Input 1, BeginSwitch alternates between it and the pipeline itself
+	class SwitchInput : public CaptureReceiver {
+	public:
+		explicit SwitchInput(CapturePipeline& pipeline) : pipeline { pipeline } { }
+
+		void OnPacket(const CapturePacket& packet) override { pipeline.Deliver(1, packet); }
+		void OnWakeup(uint32_t packetCount, uint32_t microseconds) override { pipeline.OnWakeup(packetCount, microseconds); }
+		void OnCaptureError(uint32_t code) override { pipeline.OnCaptureError(code); }
+		std::chrono::milliseconds IdleWakeupInterval() const override { return pipeline.IdleWakeupInterval(); }
+
+	private:
+		CapturePipeline& pipeline;
+	};
+
+	void Deliver(uint32_t input, const CapturePacket& packet);
+	void WritePacket(const CapturePacket& packet, bool switching);
+	// Source frames to float stereo, then on to Output. frames null for silence.
+	void Input(const uint8_t* frames, uint64_t frameCount, bool switching);
+	// Converts and mixes down. Whichever thread calls it brings the matrix it goes by and scratch space for
+	// CONVERT_CHUNK_FRAMES frames of source samples.
+	void ToStereo(const uint8_t* frames, StereoFrame* output, size_t frameCount, const ChannelMatrix& mixMatrix, float* scratch);
+	// To the taps and the ring, frames null for silence
+	void Output(const StereoFrame* frames, uint64_t frameCount, bool switching);
+	void FadeOut(const StereoFrame* frames, uint64_t frameCount);
+	void StagePacket(uint32_t input, const CapturePacket& packet);
+	void TakeOver(uint32_t input);
+
+	void WriteFrames(const StereoFrame* input, size_t frameCount);
+	void WriteSilence(uint64_t frameCount);
+	// Moves whatever the resampler can produce into the ring
+	void DrainResampler();
+	// Where the next input frame will land in the ring
+	uint64_t NextRingPosition() const;
+	void PublishAnchor(uint64_t ringPosition, uint64_t timestamp);
+
+	Buffer ring;
+	CaptureFormat format;
+	uint32_t outputRate;
+	bool formatSupported;
+	// null when the source delivers float already, stereo frames like that go to the ring as they are
+	SampleConverter convert;
+	ChannelMixer mix;
+	// the main thread's copy of the matrix it published last, the capture thread picks it up from matrices
+	ChannelMatrix matrix;
+	TripleBuffer<ChannelMatrix> matrices;
+	// capture thread: source samples converted to float, and those mixed down
+	std::vector<float> samples;
+	std::vector<StereoFrame> converted;
+	std::unique_ptr<PolyphaseResampler> resampler;
+	std::atomic<uint64_t> rejectedFrames;
+	CaptureStats stats;
+	ErrorListener errorListener;
+	SilenceGate gate;
+	std::atomic<uint32_t> awakeHolds;
+
+	// capture thread only: the source position the next packet should start at
+	uint64_t nextPosition;
+	bool timelineStarted;
+
+	void FeedTaps(const uint8_t* frames, uint64_t frameCount);
+	// Right before span is committed to the ring, silent when it's zeros that needn't be looked at
+	void FeedHistory(const RingSpan<StereoFrame>& span, bool silent);
+	// The attached chain if it has anything in it, null otherwise. Whoever writes the ring holds it until
+	// ReleaseInserts, DetachInserts waits for that like DetachTap does for the taps.
+	InsertChain* AcquireInserts();
+	void ReleaseInserts();
+
+	// the capture thread announces itself in tapUsers before looking at the taps, see DetachTap
+	std::atomic<CaptureTap*> taps[MAX_TAPS];
+	std::atomic<uint32_t> tapUsers;
+	std::atomic<InsertChain*> inserts;
+	std::atomic<uint32_t> insertUsers;
+	std::atomic<CaptureHistory*> history;
+	std::atomic<uint32_t> historyUsers;
+
+	// Switching. The active input announces itself in activeUsers before looking at switchState, so TakeOver can
+	// wait for it to be out the same way DetachTap does.
+	SwitchInput switchInput;
+	std::atomic<uint32_t> activeInput;
+	std::atomic<uint32_t> activeUsers;
+	std::atomic<SwitchState> switchState;
+	// the new source's frames, written by it, read by whoever is writing the ring
+	std::unique_ptr<CircularBuffer<StereoFrame>> staging;
+	// the new source's thread mixes down with the matrix as it was when the switch began
+	ChannelMatrix switchMatrix;
+	std::vector<float> stagingSamples;
+	std::vector<StereoFrame> fadeMix;
+	// equal power gains sin(0..pi/2), the new source's runs up the curve and the old one's down it
+	std::vector<float> fadeCurve;
+	size_t fadePosition;
+	bool fadedOut;
+	std::atomic<uint64_t> switchBegan;
+	std::atomic<uint64_t> switchFirstPacket;
+
+	// ring position <-> capture time of the newest timed packet, seqlock so readers never see half an update
+	std::atomic<uint32_t> anchorSequence;
+	std::atomic<uint64_t> anchorPosition;
+	std::atomic<uint64_t> anchorTimestamp;
+};
+
+#endif // CAPTURE_PIPELINE_HPP
@@ -0,0 +1,226 @@
+#include "capture_recorder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t ALIGNMENT = 4096;
+// The capture thread doesn't lock to notify, so the writer may miss a wakeup; it looks again after this long
+constexpr std::chrono::milliseconds WRITER_POLL_INTERVAL { 50 };
+
+size_t RoundUp(size_t value, size_t multiple) {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+CaptureRecorder::CaptureRecorder(const std::string& path, const CaptureFormat& format, size_t blockBytes, size_t blockCount) :
+	path { path },
+	format { format },
+	bytesPerFrame { format.BytesPerFrame() },
+	blockFrames { bytesPerFrame != 0 ? std::max<size_t>(1, blockBytes / bytesPerFrame) : 0 },
+	blockCount { std::max<size_t>(2, blockCount) },
+	storage { },
+	blocks { },
+	file { nullptr },
+	currentBytes { 0 },
+	queued { 0 },
+	written { 0 },
+	framesWritten { 0 },
+	bytesWritten { 0 },
+	droppedBlocks { 0 },
+	droppedFrames { 0 },
+	failed { false },
+	mutex { },
+	wakeup { },
+	finishing { false },
+	finished { false },
+	writer { }
+{
+	if(bytesPerFrame == 0) throw std::runtime_error("recording format has no frame size");
+
+	const size_t stride = RoundUp(blockFrames * bytesPerFrame, ALIGNMENT);
+	storage.resize(stride * this->blockCount + ALIGNMENT);
+	uint8_t* base = storage.data() + (ALIGNMENT - reinterpret_cast<uintptr_t>(storage.data()) % ALIGNMENT) % ALIGNMENT;
+	for(size_t i = 0; i < this->blockCount; i++) {
+		blocks.push_back(Block { base + i * stride, 0 });
+	}
+
+	file = std::fopen(path.c_str(), "wb");
+	if(file == nullptr) throw std::runtime_error("failed to create recording file");
+	// blocks are big already, stdio's buffer would only add a copy
+	std::setvbuf(file, nullptr, _IONBF, 0);
+
+	// placeholder sizes, patched by Finish
+	WriteHeader(0);
+	if(failed) {
+		std::fclose(file);
+		throw std::runtime_error("failed to write recording header");
+	}
+
+	writer = std::thread(&CaptureRecorder::WriterLoop, this);
+}
+
+CaptureRecorder::~CaptureRecorder() {
+	Finish();
+}
+
+void CaptureRecorder::OnFrames(const uint8_t* frames, uint64_t frameCount) {
+	const size_t blockBytes = blockFrames * bytesPerFrame;
+
+	while(frameCount > 0) {
+		const Block& block = blocks[queued.load(std::memory_order_relaxed) % blockCount];
+		const size_t count = static_cast<size_t>(std::min<uint64_t>(frameCount, (blockBytes - currentBytes) / bytesPerFrame));
+		const size_t bytes = count * bytesPerFrame;
+
+		if(frames != nullptr) {
+			memcpy(block.data + currentBytes, frames, bytes);
+			frames += bytes;
+		} else {
+			memset(block.data + currentBytes, 0, bytes);
+		}
+		currentBytes += bytes;
+		frameCount -= count;
+
+		if(currentBytes == blockBytes) QueueCurrent();
+	}
+}
+
+void CaptureRecorder::QueueCurrent() {
+	if(!TryQueueCurrent()) {
+		droppedBlocks.fetch_add(1, std::memory_order_relaxed);
+		droppedFrames.fetch_add(currentBytes / bytesPerFrame, std::memory_order_relaxed);
+		currentBytes = 0;
+	}
+}
+
+bool CaptureRecorder::TryQueueCurrent() {
+	const uint64_t next = queued.load(std::memory_order_relaxed);
+	const uint64_t done = written.load(std::memory_order_acquire);
+
+	// one block always stays with the capture thread, so at most blockCount - 1 can be queued
+	if(next + 1 - done >= blockCount) return false;
+
+	blocks[next % blockCount].bytes = currentBytes;
+	queued.store(next + 1, std::memory_order_release);
+	currentBytes = 0;
+	wakeup.notify_one();
+	return true;
+}
+
+void CaptureRecorder::WriterLoop() {
+	std::unique_lock<std::mutex> lock { mutex };
+	while(true) {
+		const uint64_t next = written.load(std::memory_order_relaxed);
+		if(next == queued.load(std::memory_order_acquire)) {
+			if(finishing) break;
+			wakeup.wait_for(lock, WRITER_POLL_INTERVAL);
+			continue;
+		}
+
+		lock.unlock();
+		const Block& block = blocks[next % blockCount];
+		if(!failed.load(std::memory_order_relaxed)) {
+			if(std::fwrite(block.data, 1, block.bytes, file) == block.bytes) {
+				bytesWritten.fetch_add(block.bytes, std::memory_order_relaxed);
+				framesWritten.fetch_add(block.bytes / bytesPerFrame, std::memory_order_relaxed);
+			} else {
+				// disk full or gone, keep draining so the capture side doesn't count it as falling behind
+				failed = true;
+			}
+		}
+		written.store(next + 1, std::memory_order_release);
+		lock.lock();
+	}
+}
+
+bool CaptureRecorder::Finish() {
+	if(finished) return !failed;
+
+	// the partial last block, waiting for room if the writer is still busy (we're not the capture thread anymore)
+	if(currentBytes > 0) {
+		while(!TryQueueCurrent()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		finishing = true;
+	}
+	wakeup.notify_one();
+	writer.join();
+
+	const uint64_t dataBytes = bytesWritten.load(std::memory_order_relaxed);
+	// chunks are padded to an even size
+	if(dataBytes & 1) {
+		const uint8_t pad = 0;
+		if(std::fwrite(&pad, 1, 1, file) != 1) failed = true;
+	}
+	if(std::fseek(file, 0, SEEK_SET) != 0) failed = true;
+	else WriteHeader(dataBytes);
+	if(std::fclose(file) != 0) failed = true;
+
+	file = nullptr;
+	finished = true;
+	return !failed;
+}
+
+CaptureRecorder::Stats CaptureRecorder::GetStats() const {
+	Stats stats;
+	stats.framesWritten = framesWritten.load(std::memory_order_relaxed);
+	stats.bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+	stats.droppedBlocks = droppedBlocks.load(std::memory_order_relaxed);
+	stats.droppedFrames = droppedFrames.load(std::memory_order_relaxed);
+	stats.failed = failed.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void CaptureRecorder::WriteHeader(uint64_t dataBytes) {
+	uint8_t header[HEADER_BYTES] { };
+	size_t offset = 0;
+
+	auto putTag = [&](const char* tag) {
+		memcpy(header + offset, tag, 4);
+		offset += 4;
+	};
+	auto putInteger = [&](uint64_t value, size_t bytes) {
+		for(size_t i = 0; i < bytes; i++) header[offset++] = static_cast<uint8_t>(value >> (8 * i));
+	};
+
+	const uint64_t riffBytes = HEADER_BYTES - 8 + dataBytes + (dataBytes & 1);
+	const bool rf64 = riffBytes > 0xFFFFFFFFu;
+
+	putTag(rf64 ? "RF64" : "RIFF");
+	putInteger(rf64 ? 0xFFFFFFFFu : riffBytes, 4);
+	putTag("WAVE");
+
+	// the real sizes when it's RF64, otherwise a JUNK chunk keeping the room for them
+	putTag(rf64 ? "ds64" : "JUNK");
+	putInteger(28, 4);
+	putInteger(rf64 ? riffBytes : 0, 8);
+	putInteger(rf64 ? dataBytes : 0, 8);
+	putInteger(rf64 ? dataBytes / bytesPerFrame : 0, 8);
+	putInteger(0, 4); // no table
+
+	// pads the header out so the data starts at HEADER_BYTES
+	const size_t padding = HEADER_BYTES - offset - 8 - (8 + 16) - 8;
+	putTag("JUNK");
+	putInteger(padding, 4);
+	offset += padding;
+
+	putTag("fmt ");
+	putInteger(16, 4);
+	putInteger(format.sampleType == SampleType::Float ? 3 : 1, 2);
+	putInteger(format.channels, 2);
+	putInteger(format.sampleRate, 4);
+	putInteger(uint64_t(format.sampleRate) * bytesPerFrame, 4);
+	putInteger(bytesPerFrame, 2);
+	putInteger(format.bitsPerSample, 2);
+
+	putTag("data");
+	putInteger(rf64 ? 0xFFFFFFFFu : dataBytes, 4);
+
+	if(std::fwrite(header, 1, HEADER_BYTES, file) != HEADER_BYTES) failed = true;
+}
@@ -0,0 +1,103 @@
+#ifndef CAPTURE_RECORDER_HPP
+#define CAPTURE_RECORDER_HPP
+
+#include "capture_source.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams captured packets to a WAV file from its own writer thread.
+//
+// The capture thread copies packets into one of blockCount preallocated blocks and hands each full block to the
+// writer, it never waits for the disk, allocates or takes a lock. If the disk falls so far behind that no block is
+// free, the block being filled is thrown away and counted in droppedBlocks instead. The writer writes whole blocks
+// with unbuffered writes, starting on a 4 KiB boundary in the file (and in memory).
+//
+// The header reserves room for a ds64 chunk, so Finish() can turn the file into RF64 when the data outgrows what
+// plain RIFF can describe (4 GiB, about 3 hours of 48kHz float stereo). Until then the sizes in the header are
+// zero; readers that check them see an empty file.
+class CaptureRecorder : public CaptureTap {
+public:
+	// 1 MiB is about 2.7s of 48kHz float stereo, three of them ride out a disk stall of twice that
+	static constexpr size_t DEFAULT_BLOCK_BYTES = 1 << 20;
+	static constexpr size_t DEFAULT_BLOCK_COUNT = 3;
+	// Header plus padding, the data starts right after it
+	static constexpr size_t HEADER_BYTES = 4096;
+
+	struct Stats {
+		uint64_t framesWritten = 0;
+		uint64_t bytesWritten = 0;
+		uint64_t droppedBlocks = 0;
+		uint64_t droppedFrames = 0;
+		bool failed = false;
+	};
+
+	// Creates the file and starts the writer thread. Throws std::runtime_error if the file can't be created.
+	CaptureRecorder(const std::string& path, const CaptureFormat& format, size_t blockBytes = DEFAULT_BLOCK_BYTES, size_t blockCount = DEFAULT_BLOCK_COUNT);
+	// Finishes the file if Finish() wasn't called
+	~CaptureRecorder();
+
+	CaptureRecorder(const CaptureRecorder&) = delete;
+	CaptureRecorder& operator=(const CaptureRecorder&) = delete;
+
+	// Capture thread. frames is in the format the recorder was created with, null for silence.
+	void OnFrames(const uint8_t* frames, uint64_t frameCount) override;
+
+	// Once nothing calls Write anymore: writes what's left, patches the header and closes the file.
+	// Blocks until the writer is done. Returns false if anything couldn't be written.
+	bool Finish();
+
+	Stats GetStats() const;
+	const std::string& Path() const { return path; }
+	const CaptureFormat& Format() const { return format; }
+	size_t BlockFrames() const { return blockFrames; }
+
+private:
+	struct Block {
+		uint8_t* data;
+		size_t bytes;
+	};
+
+	// Hands the block being filled to the writer, or drops it if the writer still has all the others
+	void QueueCurrent();
+	bool TryQueueCurrent();
+	void WriterLoop();
+	void WriteHeader(uint64_t dataBytes);
+
+	const std::string path;
+	const CaptureFormat format;
+	const size_t bytesPerFrame;
+	const size_t blockFrames;
+	const size_t blockCount;
+
+	// blockCount blocks carved out of one allocation, each starting on a 4 KiB boundary
+	std::vector<uint8_t> storage;
+	std::vector<Block> blocks;
+
+	std::FILE* file;
+
+	// capture thread fills blocks[queued % blockCount], the writer owns [written, queued)
+	size_t currentBytes;
+	alignas(64) std::atomic<uint64_t> queued;
+	alignas(64) std::atomic<uint64_t> written;
+
+	std::atomic<uint64_t> framesWritten;
+	std::atomic<uint64_t> bytesWritten;
+	std::atomic<uint64_t> droppedBlocks;
+	std::atomic<uint64_t> droppedFrames;
+	std::atomic<bool> failed;
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool finishing;
+	bool finished;
+	std::thread writer;
+};
+
+#endif // CAPTURE_RECORDER_HPP
@@ -0,0 +1,406 @@
+#include "capture_session.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+CaptureSession::CaptureSession(CaptureSessionRegistry& registry, const CaptureSessionKey& key, std::chrono::microseconds clientBuffer) :
+	registry { registry },
+	key { key },
+	clientBuffer { clientBuffer },
+	pipeline { registry.BufferFrames(), registry.OutputRate() },
+	source { },
+	retiring { },
+	retireDeadline { },
+	state { State::Idle },
+	lastError { },
+	watchers { },
+	nextWatch { 1 },
+	signal { },
+	activate { false },
+	startFailed { false },
+	stopping { false },
+	thread { }
+{
+	pipeline.SetErrorListener([this](uint32_t code) { OnCaptureError(code); });
+}
+
+CaptureSession::~CaptureSession() {
+	{
+		std::lock_guard<std::mutex> lock { registry.mutex };
+		stopping = true;
+	}
+	signal.notify_all();
+	// an activation under way finishes first, the sources time out on their own
+	if(thread.joinable()) thread.join();
+
+	retiring.reset();
+	source.reset();
+}
+
+void CaptureSession::Start() {
+	{
+		std::lock_guard<std::mutex> lock { registry.mutex };
+		const State current = state.load(std::memory_order_relaxed);
+		if(current != State::Idle && current != State::Failed) return;
+
+		// Activating right away, so nobody reads GetFormat() off the pipeline while the session's thread configures it
+		SetState(State::Activating);
+		activate = true;
+		if(!thread.joinable()) thread = std::thread(&CaptureSession::Run, this);
+	}
+	signal.notify_all();
+}
+
+std::string CaptureSession::LastError() const {
+	std::lock_guard<std::mutex> lock { registry.mutex };
+	return lastError;
+}
+
+CaptureSession::State CaptureSession::WaitUntilSettled(std::chrono::milliseconds timeout) const {
+	std::unique_lock<std::mutex> lock { registry.mutex };
+	signal.wait_for(lock, timeout, [this]() {
+		const State current = state.load(std::memory_order_relaxed);
+		return current == State::Running || current == State::Failed;
+	});
+	return state.load(std::memory_order_relaxed);
+}
+
+CaptureSession::WatchId CaptureSession::WatchState(StateListener listener) {
+	std::lock_guard<std::mutex> lock { registry.mutex };
+	const WatchId id = nextWatch++;
+	watchers.emplace_back(id, std::move(listener));
+	return id;
+}
+
+void CaptureSession::CancelWatch(WatchId id) {
+	std::lock_guard<std::mutex> lock { registry.mutex };
+	watchers.erase(std::remove_if(watchers.begin(), watchers.end(), [id](const auto& watcher) { return watcher.first == id; }), watchers.end());
+}
+
+void CaptureSession::SetState(State next) {
+	if(state.load(std::memory_order_relaxed) == next) return;
+	state.store(next, std::memory_order_release);
+	for(const auto& [id, listener] : watchers) listener(next);
+	signal.notify_all();
+}
+
+void CaptureSession::OnCaptureError(uint32_t code) {
+	// capture thread, the source has stopped itself; tearing it down is left to the next Start
+	std::lock_guard<std::mutex> lock { registry.mutex };
+	const State current = state.load(std::memory_order_relaxed);
+	if(current != State::Running && current != State::Activating) return;
+
+	char message[64];
+	snprintf(message, sizeof(message), "capture stopped with error 0x%08x", static_cast<unsigned>(code));
+	lastError = message;
+	// a source failing to start can beat Activate to Running, it counts the attempt as failed once Start() returns
+	if(current == State::Activating) {
+		startFailed = true;
+		return;
+	}
+	SetState(State::Failed);
+}
+
+void CaptureSession::Run() {
+	std::unique_lock<std::mutex> lock { registry.mutex };
+	while(!stopping) {
+		signal.wait(lock, [this]() { return activate || stopping; });
+		if(stopping) break;
+		activate = false;
+		Activate(lock);
+	}
+}
+
+void CaptureSession::Activate(std::unique_lock<std::mutex>& lock) {
+	// whatever a failed capture left behind delivers into the pipeline until it's gone
+	std::unique_ptr<CaptureSource> failed = std::move(source);
+	std::unique_ptr<CaptureSource> failedRetiring = std::move(retiring);
+	if(failed || failedRetiring) {
+		lock.unlock();
+		failedRetiring.reset();
+		failed.reset();
+		lock.lock();
+	}
+
+	std::chrono::milliseconds delay = CaptureSessionRegistry::RETRY_DELAY;
+	for(uint32_t attempt = 1; !stopping; attempt++) {
+		SetState(State::Activating);
+		startFailed = false;
+		// Retarget refuses to touch a session that isn't Running or Idle, the key holds still
+		const CaptureSessionKey target = key;
+		lock.unlock();
+
+		std::unique_ptr<CaptureSource> activated;
+		std::string error;
+		try {
+			activated = registry.factory(target, clientBuffer, pipeline.ActiveInput());
+			pipeline.Configure(activated->GetFormat(), registry.OutputRate());
+			activated->Start();
+		} catch(const std::exception& ex) {
+			activated.reset();
+			error = ex.what();
+		}
+
+		lock.lock();
+		if(activated && startFailed) {
+			// stopped itself already, it has to be gone before the next attempt delivers into the pipeline
+			error = lastError;
+			lock.unlock();
+			activated.reset();
+			lock.lock();
+		}
+		if(activated) {
+			source = std::move(activated);
+			SetState(State::Running);
+			return;
+		}
+
+		lastError = error;
+		if(attempt >= CaptureSessionRegistry::MAX_ACTIVATION_ATTEMPTS) {
+			SetState(State::Failed);
+			return;
+		}
+		SetState(State::Retrying);
+		signal.wait_for(lock, delay, [this]() { return stopping; });
+		delay *= 2;
+	}
+}
+
+std::chrono::microseconds CaptureSessionRegistry::ClientBufferFor(std::chrono::microseconds latency) {
+	return std::max<std::chrono::microseconds>(latency * 2, MIN_CLIENT_BUFFER);
+}
+
+CaptureSessionRegistry::CaptureSessionRegistry(SourceFactory factory, uint32_t outputRate, size_t bufferFrames) :
+	factory { std::move(factory) },
+	outputRate { outputRate },
+	bufferFrames { bufferFrames },
+	mutex { },
+	reaperSignal { },
+	sessions { },
+	released { },
+	gracePeriod { std::chrono::seconds(5) },
+	stopping { false },
+	reaper { }
+{
+	reaper = std::thread(&CaptureSessionRegistry::ReaperLoop, this);
+}
+
+CaptureSessionRegistry::~CaptureSessionRegistry() {
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		stopping = true;
+	}
+	reaperSignal.notify_all();
+	reaper.join();
+
+	// anything still held past this point would dangle, but at least don't leak the sources
+	std::map<CaptureSessionKey, Entry> remaining;
+	std::vector<std::unique_ptr<CaptureSession>> unreaped;
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		remaining.swap(sessions);
+		unreaped.swap(released);
+	}
+	unreaped.clear();
+	remaining.clear();
+}
+
+std::shared_ptr<CaptureSession> CaptureSessionRegistry::Acquire(const CaptureSessionKey& key, std::chrono::microseconds latency) {
+	std::lock_guard<std::mutex> lock { mutex };
+
+	// creating one only allocates its pipeline, nothing is activated until it's started
+	auto existing = sessions.find(key);
+	if(existing == sessions.end()) {
+		existing = sessions.emplace(key, Entry { std::make_unique<CaptureSession>(*this, key, ClientBufferFor(latency)), 0, { } }).first;
+	}
+
+	Entry& entry = existing->second;
+	entry.users++;
+
+	// Each user gets its own control block that releases instead of deleting. By session rather than key, which
+	// may have changed by the time it's dropped.
+	return std::shared_ptr<CaptureSession>(entry.session.get(), [this](CaptureSession* session) { Release(session); });
+}
+
+CaptureSessionRegistry::RetargetResult CaptureSessionRegistry::Retarget(CaptureSession& session, const CaptureSessionKey& key) {
+	std::unique_ptr<CaptureSource> retired;
+	std::unique_lock<std::mutex> lock { mutex };
+
+	auto check = [&]() {
+		if(session.key == key) return RetargetResult::Unchanged;
+		auto found = sessions.find(session.key);
+		if(found == sessions.end() || found->second.users > 1) return RetargetResult::Shared;
+		if(sessions.count(key) != 0) return RetargetResult::TargetInUse;
+		return RetargetResult::Switching;
+	};
+
+	const RetargetResult result = check();
+	if(result != RetargetResult::Switching) return result;
+
+	const CaptureSession::State state = session.state.load(std::memory_order_relaxed);
+	if(state == CaptureSession::State::Activating || state == CaptureSession::State::Retrying) return RetargetResult::Busy;
+	if(state != CaptureSession::State::Running) {
+		// nothing's capturing, the next Start activates the new key; a failed source goes with the old one
+		auto node = sessions.extract(session.key);
+		node.key() = key;
+		sessions.insert(std::move(node));
+		session.key = key;
+		std::unique_ptr<CaptureSource> failed = std::move(session.source);
+		retired = std::move(session.retiring);
+		lock.unlock();
+		retired.reset();
+		failed.reset();
+		return RetargetResult::Rekeyed;
+	}
+
+	// the source from the last switch has to be gone before the next one delivers into the same input
+	if(session.retiring) {
+		if(!session.pipeline.SwitchSettled()) return RetargetResult::Busy;
+		retired = std::move(session.retiring);
+	}
+	lock.unlock();
+	retired.reset();
+
+	CaptureReceiver* receiver = session.pipeline.BeginSwitch();
+	if(receiver == nullptr) return RetargetResult::Busy;
+
+	// activating can take a while, the old source keeps playing meanwhile
+	std::unique_ptr<CaptureSource> source;
+	try {
+		source = factory(key, session.clientBuffer, receiver);
+	} catch(...) {
+		session.pipeline.CancelSwitch();
+		throw;
+	}
+	if(source->GetFormat() != session.pipeline.GetFormat()) {
+		source.reset();
+		session.pipeline.CancelSwitch();
+		throw std::runtime_error("the new target captures in a different format");
+	}
+
+	lock.lock();
+	RetargetResult raced = check();
+	// the capture may have failed meanwhile, the session's thread owns it again once it's restarted
+	if(raced == RetargetResult::Switching && session.state.load(std::memory_order_relaxed) != CaptureSession::State::Running) {
+		raced = RetargetResult::Busy;
+	}
+	if(raced != RetargetResult::Switching) {
+		lock.unlock();
+		source.reset();
+		session.pipeline.CancelSwitch();
+		return raced;
+	}
+
+	auto node = sessions.extract(session.key);
+	node.key() = key;
+	sessions.insert(std::move(node));
+	session.key = key;
+	session.retiring = std::move(session.source);
+	session.source = std::move(source);
+	session.retireDeadline = Clock::now() + SWITCH_TIMEOUT;
+	CaptureSource& started = *session.source;
+	lock.unlock();
+
+	started.Start();
+	reaperSignal.notify_all();
+	return RetargetResult::Switching;
+}
+
+void CaptureSessionRegistry::Release(CaptureSession* session) {
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		auto found = sessions.find(session->key);
+		if(found == sessions.end()) return;
+
+		Entry& entry = found->second;
+		if(--entry.users > 0) return;
+
+		if(gracePeriod <= Clock::duration::zero()) {
+			// gone for Acquire right away, but tearing it down waits for an activation under way and stops its
+			// source, that's the reaper's
+			released.push_back(std::move(entry.session));
+			sessions.erase(found);
+		} else {
+			entry.expiry = Clock::now() + gracePeriod;
+		}
+	}
+
+	reaperSignal.notify_all();
+}
+
+void CaptureSessionRegistry::SetGracePeriod(Clock::duration newGracePeriod) {
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		gracePeriod = newGracePeriod;
+	}
+	reaperSignal.notify_all();
+}
+
+CaptureSessionRegistry::Clock::duration CaptureSessionRegistry::GracePeriod() const {
+	std::lock_guard<std::mutex> lock { mutex };
+	return gracePeriod;
+}
+
+size_t CaptureSessionRegistry::SessionCount() const {
+	std::lock_guard<std::mutex> lock { mutex };
+	return sessions.size();
+}
+
+size_t CaptureSessionRegistry::WarmSessionCount() const {
+	std::lock_guard<std::mutex> lock { mutex };
+	size_t count = 0;
+	for(const auto& [key, entry] : sessions) {
+		if(entry.users == 0) count++;
+	}
+	return count;
+}
+
+void CaptureSessionRegistry::ReaperLoop() {
+	std::unique_lock<std::mutex> lock { mutex };
+
+	while(!stopping) {
+		const Clock::time_point now = Clock::now();
+		Clock::time_point nextExpiry = Clock::time_point::max();
+		std::vector<std::unique_ptr<CaptureSession>> expired = std::move(released);
+		released.clear();
+		std::vector<std::unique_ptr<CaptureSource>> retired;
+
+		for(auto it = sessions.begin(); it != sessions.end();) {
+			Entry& entry = it->second;
+			CaptureSession& session = *entry.session;
+			if(session.retiring) {
+				// a source that never fades out would hold the switch up forever
+				if(!session.pipeline.SwitchSettled() && session.retireDeadline <= now) session.pipeline.ForceSwitch();
+				if(session.pipeline.SwitchSettled()) {
+					retired.push_back(std::move(session.retiring));
+				} else {
+					nextExpiry = std::min(nextExpiry, now + RETIRE_POLL);
+				}
+			}
+
+			if(entry.users == 0 && entry.expiry <= now) {
+				expired.push_back(std::move(entry.session));
+				it = sessions.erase(it);
+				continue;
+			}
+			if(entry.users == 0 && entry.expiry < nextExpiry) nextExpiry = entry.expiry;
+			++it;
+		}
+
+		if(!expired.empty() || !retired.empty()) {
+			lock.unlock();
+			retired.clear();
+			expired.clear();
+			lock.lock();
+			continue;
+		}
+
+		if(nextExpiry == Clock::time_point::max()) {
+			reaperSignal.wait(lock);
+		} else {
+			reaperSignal.wait_until(lock, nextExpiry);
+		}
+	}
+}
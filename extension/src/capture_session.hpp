@@ -0,0 +1,233 @@
+#ifndef CAPTURE_SESSION_HPP
+#define CAPTURE_SESSION_HPP
+
+#include "capture_pipeline.hpp"
+#include "capture_source.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+struct CaptureSessionKey {
+	uint32_t processId;
+	LoopbackMode mode;
+
+	bool operator<(const CaptureSessionKey& other) const {
+		return std::tie(processId, mode) < std::tie(other.processId, other.mode);
+	}
+	bool operator==(const CaptureSessionKey& other) const {
+		return processId == other.processId && mode == other.mode;
+	}
+};
+
+class CaptureSessionRegistry;
+
+// One capture source and the pipeline it feeds, shared by every stream that targets the same process. Streams attach
+// their own CapturePipeline::Readers to it. The registry can retarget it to another process, the pipeline and every
+// reader stay; only the source and the key change.
+//
+// Nothing is activated until Start, and then on the session's own thread, so neither acquiring nor starting blocks.
+// Readers can be attached right away, the ring fills once the session is Running. It goes Idle -> Activating ->
+// Running; an activation that fails waits in Retrying and tries again, MAX_ACTIVATION_ATTEMPTS times in all before
+// the session is Failed. A capture error while Running fails it as well. The next Start activates a Failed session
+// from scratch. The source's constructor is the activation: both backends give up on it after a timeout of their own,
+// the session couldn't interrupt one that doesn't.
+class CaptureSession {
+public:
+	enum class State : uint8_t {
+		// acquired, nothing started yet
+		Idle,
+		// the source is being created on the session's thread
+		Activating,
+		// the source is delivering into the pipeline
+		Running,
+		// activation or the capture failed, LastError() says why; the next Start tries again
+		Failed,
+		// an activation failed, the next attempt is RETRY_DELAY (doubling each time) away
+		Retrying,
+	};
+
+	// Called on whichever thread made the transition, with the registry locked: hand it on, don't call back in
+	using StateListener = std::function<void(State state)>;
+	using WatchId = uint64_t;
+
+	CaptureSession(CaptureSessionRegistry& registry, const CaptureSessionKey& key, std::chrono::microseconds clientBuffer);
+	~CaptureSession();
+
+	CaptureSession(const CaptureSession&) = delete;
+	CaptureSession& operator=(const CaptureSession&) = delete;
+
+	// Activates and starts the source in the background when Idle or Failed, does nothing otherwise. Never blocks.
+	void Start();
+	State GetState() const { return state.load(std::memory_order_acquire); }
+	// Why it last failed, empty if it never did
+	std::string LastError() const;
+	// Blocks until the session is Running or Failed, or timeout went by. Returns the state it ended up in.
+	State WaitUntilSettled(std::chrono::milliseconds timeout) const;
+
+	// listener is called on every transition from now on until CancelWatch
+	WatchId WatchState(StateListener listener);
+	void CancelWatch(WatchId id);
+
+	// Changes on Retarget, read it on the thread that retargets
+	const CaptureSessionKey& Key() const { return key; }
+	// What the source's own buffer was sized for, see CaptureSessionRegistry::ClientBufferFor
+	std::chrono::microseconds ClientBuffer() const { return clientBuffer; }
+	// GetFormat() and everything derived from it are only the source's once Running
+	CapturePipeline& Pipeline() { return pipeline; }
+	// Null until Running
+	CaptureSource* Source() { return source.get(); }
+
+private:
+	friend class CaptureSessionRegistry;
+
+	// With the registry locked
+	void SetState(State next);
+	void Run();
+	// Session thread, returns with the source Running or the session Failed (or stopping)
+	void Activate(std::unique_lock<std::mutex>& lock);
+	void OnCaptureError(uint32_t code);
+
+	CaptureSessionRegistry& registry;
+	CaptureSessionKey key;
+	const std::chrono::microseconds clientBuffer;
+	// declared before the sources, which deliver into it until they're destroyed
+	CapturePipeline pipeline;
+	std::unique_ptr<CaptureSource> source;
+	// the source a retarget switched away from, until the pipeline is done with it
+	std::unique_ptr<CaptureSource> retiring;
+	std::chrono::steady_clock::time_point retireDeadline;
+
+	// Everything from here on is guarded by the registry's mutex, state is also read without it
+	std::atomic<State> state;
+	std::string lastError;
+	std::vector<std::pair<WatchId, StateListener>> watchers;
+	WatchId nextWatch;
+	// wakes the session's thread, and whoever waits for it to settle
+	mutable std::condition_variable signal;
+	bool activate;
+	// the source being started by Activate reported an error before it was Running
+	bool startFailed;
+	bool stopping;
+	std::thread thread;
+};
+
+// Hands out refcounted CaptureSessions keyed by target process and loopback mode, so resources capturing the same
+// process share one activated client and one buffer. When the last user lets go, the session stays warm for the
+// grace period before the reaper thread tears it down, so reloading a scene doesn't pay for activation again.
+//
+// Acquire, Start and release happen on the main thread (resource load, _start, destructors) and don't block,
+// activation runs on the session's thread. Retarget blocks on activating the new target. None of it is touched
+// from the capture or mix threads.
+class CaptureSessionRegistry {
+public:
+	using Clock = std::chrono::steady_clock;
+	// Creates (activates) the backend for a key, with its own buffer sized to clientBuffer. May throw, the session
+	// retries and eventually fails with the message. Called on the session's thread.
+	using SourceFactory = std::function<std::unique_ptr<CaptureSource>(const CaptureSessionKey& key, std::chrono::microseconds clientBuffer,
+		CaptureReceiver* receiver)>;
+
+	// Activation attempts before a session is Failed, and the wait before the second, doubling after that
+	static constexpr uint32_t MAX_ACTIVATION_ATTEMPTS = 3;
+	static constexpr std::chrono::milliseconds RETRY_DELAY { 500 };
+
+	// Never less than this, the capture thread has to get through idle wakeups and the odd late one
+	static constexpr std::chrono::milliseconds MIN_CLIENT_BUFFER { 50 };
+
+	// How much a source should buffer for consumers running latency behind it: anything the capture thread is later
+	// than that is an underrun for them anyway, twice that keeps recordings and taps whole through it
+	static std::chrono::microseconds ClientBufferFor(std::chrono::microseconds latency);
+
+	CaptureSessionRegistry(SourceFactory factory, uint32_t outputRate, size_t bufferFrames);
+	~CaptureSessionRegistry();
+
+	CaptureSessionRegistry(const CaptureSessionRegistry&) = delete;
+	CaptureSessionRegistry& operator=(const CaptureSessionRegistry&) = delete;
+
+	// The returned pointer keeps the session alive, dropping it releases this user. A new session is Idle and sizes
+	// its source for latency (ClientBufferFor), one that exists already keeps what it was created with.
+	std::shared_ptr<CaptureSession> Acquire(const CaptureSessionKey& key, std::chrono::microseconds latency);
+
+	enum class RetargetResult {
+		// the new source is activated and switching in, the old one keeps playing until the crossfade
+		Switching,
+		// the session wasn't capturing (Idle or Failed), it activates the new key when it's started
+		Rekeyed,
+		// the session already captures that key
+		Unchanged,
+		// somebody else uses the session too, retargeting it would pull their audio away
+		Shared,
+		// there's a session for the new key already, acquire that one instead
+		TargetInUse,
+		// the previous retarget hasn't finished switching yet, or the session is still activating
+		Busy,
+	};
+
+	// Moves a session nobody else uses to another key without stopping it: the new source is activated (blocking,
+	// and it may throw like the factory does) while the old one keeps delivering, then the pipeline crossfades
+	// from one to the other. Readers and everything else attached to the pipeline carry on across the switch.
+	// The new source has to come up in the same format, otherwise this throws and nothing changes.
+	RetargetResult Retarget(CaptureSession& session, const CaptureSessionKey& key);
+
+	// How long a retired source gets to fade out before the new one takes over anyway
+	static constexpr std::chrono::milliseconds SWITCH_TIMEOUT { 2000 };
+
+	// What every session's pipeline delivers
+	uint32_t OutputRate() const { return outputRate; }
+	size_t BufferFrames() const { return bufferFrames; }
+
+	void SetGracePeriod(Clock::duration gracePeriod);
+	Clock::duration GracePeriod() const;
+
+	// Sessions currently alive, in use or warm
+	size_t SessionCount() const;
+	// Sessions nobody uses that are waiting out their grace period
+	size_t WarmSessionCount() const;
+
+	// Calls function for every live session with the registry locked, so don't acquire from it
+	template<typename Function>
+	void ForEachSession(Function&& function) const {
+		std::lock_guard<std::mutex> lock { mutex };
+		for(const auto& [key, entry] : sessions) function(*entry.session);
+	}
+
+private:
+	friend class CaptureSession;
+
+	struct Entry {
+		std::unique_ptr<CaptureSession> session;
+		uint32_t users;
+		Clock::time_point expiry;
+	};
+
+	// how often the reaper looks at a switch in progress
+	static constexpr std::chrono::milliseconds RETIRE_POLL { 20 };
+
+	void Release(CaptureSession* session);
+	void ReaperLoop();
+
+	const SourceFactory factory;
+	const uint32_t outputRate;
+	const size_t bufferFrames;
+
+	mutable std::mutex mutex;
+	std::condition_variable reaperSignal;
+	std::map<CaptureSessionKey, Entry> sessions;
+	// let go of with no grace period, for the reaper to tear down
+	std::vector<std::unique_ptr<CaptureSession>> released;
+	Clock::duration gracePeriod;
+	bool stopping;
+	std::thread reaper;
+};
+
+#endif // CAPTURE_SESSION_HPP
@@ -0,0 +1,104 @@
+#ifndef CAPTURE_SOURCE_HPP
+#define CAPTURE_SOURCE_HPP
+
+#include <chrono>
+#include <cstdint>
+
+// Backend-neutral capture interface. WASAPICapture is the real implementation, SyntheticCapture and ReplayCapture
+// (synthetic_capture.hpp) push reproducible packets on a plain thread so the rest can be run and profiled anywhere.
+
+enum class SampleType : uint16_t {
+	Float,
+	Int,
+};
+
+// Which audio a process loopback capture picks up
+enum class LoopbackMode : uint8_t {
+	// the target process and everything it spawned (browsers, launchers...)
+	IncludeProcessTree,
+	// everything except the target and its children
+	ExcludeProcessTree,
+};
+
+// Format of the packets a source hands to its receiver, always interleaved
+struct CaptureFormat {
+	uint32_t sampleRate;
+	uint16_t channels;
+	uint16_t bitsPerSample;
+	SampleType sampleType;
+	// Speaker positions of the channels, in WAVEFORMATEXTENSIBLE's dwChannelMask bits (see channel_mix.hpp).
+	// 0 for the usual layout of that many channels.
+	uint32_t channelMask = 0;
+
+	uint32_t BytesPerFrame() const { return channels * (bitsPerSample / 8u); }
+
+	bool operator==(const CaptureFormat& other) const {
+		return sampleRate == other.sampleRate && channels == other.channels && bitsPerSample == other.bitsPerSample &&
+			sampleType == other.sampleType && channelMask == other.channelMask;
+	}
+	bool operator!=(const CaptureFormat& other) const { return !(*this == other); }
+};
+
+// The clock packet timestamps run on, in 100ns ticks. WASAPI stamps packets with QPC time, which is also what
+// steady_clock reads on MSVC, so this lines up with it on Windows and is simply steady_clock everywhere else.
+inline uint64_t CaptureClockNow() {
+	using Ticks = std::chrono::duration<uint64_t, std::ratio<1, 10000000>>;
+	return std::chrono::duration_cast<Ticks>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One packet as the source got it. position and timestamp put it on the source's timeline, so the receiver can
+// tell frames the source lost from ones that were only delivered late.
+struct CapturePacket {
+	// frameCount interleaved frames in the source's format, only valid for the duration of OnPacket.
+	// Null for silent packets.
+	const uint8_t* frames = nullptr;
+	uint32_t frameCount = 0;
+	// Device position of the first frame, in frames since the source started
+	uint64_t position = 0;
+	// When the first frame was captured, on CaptureClockNow()'s clock
+	uint64_t timestamp = 0;
+	// The packet is frameCount frames of silence, don't look at frames
+	bool silent = false;
+	// The source lost data before this packet
+	bool discontinuity = false;
+	// position and timestamp are valid
+	bool timed = false;
+};
+
+class CaptureReceiver {
+public:
+	virtual ~CaptureReceiver() = default;
+
+	// Called on the source's capture thread for every packet
+	virtual void OnPacket(const CapturePacket& packet) = 0;
+
+	// Called on the capture thread after every wakeup, with how many packets it delivered and how long that took
+	virtual void OnWakeup(uint32_t packetCount, uint32_t microseconds) { }
+	// Capture stopped because of an error, code is backend specific (an HRESULT for WASAPI)
+	virtual void OnCaptureError(uint32_t code) { }
+	// Asked on the capture thread after every wakeup: how long the source may let packets pile up before the next
+	// one, because the receiver has no use for them right away (its silence gate is closed). Zero for as they come.
+	virtual std::chrono::milliseconds IdleWakeupInterval() const { return std::chrono::milliseconds::zero(); }
+};
+
+// Sees every packet a CapturePipeline accepts, on the capture thread, converted but before any resampling: float
+// stereo at the source's rate (the pipeline's TapFormat()) and on its timeline, with lost frames already filled in.
+// frames is null for silence.
+class CaptureTap {
+public:
+	virtual ~CaptureTap() = default;
+
+	virtual void OnFrames(const uint8_t* frames, uint64_t frameCount) = 0;
+};
+
+class CaptureSource {
+public:
+	virtual ~CaptureSource() = default;
+
+	virtual void Start() = 0;
+	virtual void Stop() = 0;
+
+	virtual CaptureFormat GetFormat() const = 0;
+};
+
+#endif // CAPTURE_SOURCE_HPP
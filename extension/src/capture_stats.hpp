@@ -0,0 +1,285 @@
+#ifndef CAPTURE_STATS_HPP
+#define CAPTURE_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Instrumentation the real-time threads record into: relaxed atomics in fixed size arrays, no locks, no allocation.
+// Anyone can take a Snapshot at any time; it isn't a consistent cut across counters, which is fine for statistics.
+
+// Log-linear histogram, 4 buckets per power of two so any value is within 25% of its bucket's bounds.
+// Values past the last bucket land in it.
+template<size_t BUCKETS>
+class AtomicHistogram {
+	static_assert(BUCKETS >= 8, "needs at least the linear buckets and one octave");
+
+public:
+	struct Snapshot {
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+		std::array<uint64_t, BUCKETS> buckets { };
+
+		double Mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+		// Upper bound of the bucket the p-th fraction of the samples falls in, clamped to the largest sample seen
+		uint64_t Percentile(double p) const {
+			if(count == 0) return 0;
+			const uint64_t rank = static_cast<uint64_t>(p * (count - 1));
+			uint64_t seen = 0;
+			for(size_t i = 0; i < BUCKETS; i++) {
+				seen += buckets[i];
+				if(seen > rank) return BucketUpperBound(i) < max ? BucketUpperBound(i) : max;
+			}
+			return max;
+		}
+
+		void Merge(const Snapshot& other) {
+			count += other.count;
+			sum += other.sum;
+			if(other.max > max) max = other.max;
+			for(size_t i = 0; i < BUCKETS; i++) buckets[i] += other.buckets[i];
+		}
+	};
+
+	AtomicHistogram() :
+		count { 0 },
+		sum { 0 },
+		max { 0 }
+	{
+		for(auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+	}
+
+	void Record(uint64_t value) {
+		buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(value, std::memory_order_relaxed);
+
+		uint64_t previous = max.load(std::memory_order_relaxed);
+		while(value > previous && !max.compare_exchange_weak(previous, value, std::memory_order_relaxed)) { }
+	}
+
+	Snapshot Read() const {
+		Snapshot snapshot;
+		snapshot.count = count.load(std::memory_order_relaxed);
+		snapshot.sum = sum.load(std::memory_order_relaxed);
+		snapshot.max = max.load(std::memory_order_relaxed);
+		for(size_t i = 0; i < BUCKETS; i++) snapshot.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		return snapshot;
+	}
+
+	static size_t BucketOf(uint64_t value) {
+		if(value < 4) return static_cast<size_t>(value);
+
+		unsigned exponent = 63;
+		while(!(value >> exponent)) exponent--;
+		const size_t index = 4 + (exponent - 2) * 4 + ((value >> (exponent - 2)) & 3);
+		return index < BUCKETS ? index : BUCKETS - 1;
+	}
+
+	// Largest value that lands in bucket index
+	static uint64_t BucketUpperBound(size_t index) {
+		if(index < 4) return index;
+		const size_t exponent = (index - 4) / 4 + 2;
+		const uint64_t sub = (index - 4) % 4;
+		return ((4 + sub + 1) << (exponent - 2)) - 1;
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, BUCKETS> buckets;
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+};
+
+// Recorded by the capture thread, one per CapturePipeline
+struct CaptureStats {
+	struct Snapshot {
+		uint64_t wakeups = 0;
+		uint64_t packets = 0;
+		uint64_t frames = 0;
+		uint64_t errors = 0;
+		uint32_t lastError = 0;
+		uint64_t silentFrames = 0;
+		uint64_t discontinuities = 0;
+		uint64_t gapFrames = 0;
+		uint64_t overlapFrames = 0;
+		AtomicHistogram<32>::Snapshot packetsPerWakeup;
+		AtomicHistogram<64>::Snapshot framesPerPacket;
+		AtomicHistogram<64>::Snapshot wakeupMicroseconds;
+		uint64_t switches = 0;
+		uint64_t abruptSwitches = 0;
+		AtomicHistogram<96>::Snapshot switchActivationMicroseconds;
+		AtomicHistogram<96>::Snapshot switchMicroseconds;
+
+		void Merge(const Snapshot& other) {
+			wakeups += other.wakeups;
+			packets += other.packets;
+			frames += other.frames;
+			errors += other.errors;
+			if(other.lastError != 0) lastError = other.lastError;
+			silentFrames += other.silentFrames;
+			discontinuities += other.discontinuities;
+			gapFrames += other.gapFrames;
+			overlapFrames += other.overlapFrames;
+			packetsPerWakeup.Merge(other.packetsPerWakeup);
+			framesPerPacket.Merge(other.framesPerPacket);
+			wakeupMicroseconds.Merge(other.wakeupMicroseconds);
+			switches += other.switches;
+			abruptSwitches += other.abruptSwitches;
+			switchActivationMicroseconds.Merge(other.switchActivationMicroseconds);
+			switchMicroseconds.Merge(other.switchMicroseconds);
+		}
+	};
+
+	void RecordPacket(uint32_t frameCount) {
+		packets.fetch_add(1, std::memory_order_relaxed);
+		frames.fetch_add(frameCount, std::memory_order_relaxed);
+		framesPerPacket.Record(frameCount);
+	}
+
+	void RecordSilence(uint32_t frameCount) {
+		silentFrames.fetch_add(frameCount, std::memory_order_relaxed);
+	}
+
+	// The source flagged lost data; gap is what got filled with silence for it, overlap what was dropped because
+	// it repeated frames we already had
+	void RecordDiscontinuity(uint64_t gap, uint64_t overlap) {
+		discontinuities.fetch_add(1, std::memory_order_relaxed);
+		gapFrames.fetch_add(gap, std::memory_order_relaxed);
+		overlapFrames.fetch_add(overlap, std::memory_order_relaxed);
+	}
+
+	void RecordWakeup(uint32_t packetCount, uint32_t microseconds) {
+		wakeups.fetch_add(1, std::memory_order_relaxed);
+		packetsPerWakeup.Record(packetCount);
+		wakeupMicroseconds.Record(microseconds);
+	}
+
+	void RecordError(uint32_t code) {
+		errors.fetch_add(1, std::memory_order_relaxed);
+		lastError.store(code, std::memory_order_relaxed);
+	}
+
+	// A new source took the pipeline over: activation is from the start of the switch to its first packet, total
+	// until it owned the ring. Abrupt ones skipped the crossfade because the old source had stopped delivering.
+	void RecordSwitch(uint64_t activation, uint64_t total, bool faded) {
+		switches.fetch_add(1, std::memory_order_relaxed);
+		if(!faded) abruptSwitches.fetch_add(1, std::memory_order_relaxed);
+		switchActivationMicroseconds.Record(activation);
+		switchMicroseconds.Record(total);
+	}
+
+	Snapshot Read() const {
+		Snapshot snapshot;
+		snapshot.wakeups = wakeups.load(std::memory_order_relaxed);
+		snapshot.packets = packets.load(std::memory_order_relaxed);
+		snapshot.frames = frames.load(std::memory_order_relaxed);
+		snapshot.errors = errors.load(std::memory_order_relaxed);
+		snapshot.lastError = lastError.load(std::memory_order_relaxed);
+		snapshot.silentFrames = silentFrames.load(std::memory_order_relaxed);
+		snapshot.discontinuities = discontinuities.load(std::memory_order_relaxed);
+		snapshot.gapFrames = gapFrames.load(std::memory_order_relaxed);
+		snapshot.overlapFrames = overlapFrames.load(std::memory_order_relaxed);
+		snapshot.packetsPerWakeup = packetsPerWakeup.Read();
+		snapshot.framesPerPacket = framesPerPacket.Read();
+		snapshot.wakeupMicroseconds = wakeupMicroseconds.Read();
+		snapshot.switches = switches.load(std::memory_order_relaxed);
+		snapshot.abruptSwitches = abruptSwitches.load(std::memory_order_relaxed);
+		snapshot.switchActivationMicroseconds = switchActivationMicroseconds.Read();
+		snapshot.switchMicroseconds = switchMicroseconds.Read();
+		return snapshot;
+	}
+
+	std::atomic<uint64_t> wakeups { 0 };
+	std::atomic<uint64_t> packets { 0 };
+	std::atomic<uint64_t> frames { 0 };
+	std::atomic<uint64_t> errors { 0 };
+	std::atomic<uint32_t> lastError { 0 };
+	std::atomic<uint64_t> silentFrames { 0 };
+	std::atomic<uint64_t> discontinuities { 0 };
+	std::atomic<uint64_t> gapFrames { 0 };
+	std::atomic<uint64_t> overlapFrames { 0 };
+	AtomicHistogram<32> packetsPerWakeup;
+	AtomicHistogram<64> framesPerPacket;
+	AtomicHistogram<64> wakeupMicroseconds;
+	std::atomic<uint64_t> switches { 0 };
+	std::atomic<uint64_t> abruptSwitches { 0 };
+	AtomicHistogram<96> switchActivationMicroseconds;
+	AtomicHistogram<96> switchMicroseconds;
+};
+
+// Recorded by a mixer thread, one per playback (plus whatever totals it also records into)
+struct MixStats {
+	struct Snapshot {
+		uint64_t mixes = 0;
+		uint64_t underruns = 0;
+		uint64_t underrunFrames = 0;
+		uint64_t overruns = 0;
+		uint64_t overrunFrames = 0;
+		uint64_t gatedMixes = 0;
+		AtomicHistogram<64>::Snapshot fillFrames;
+		AtomicHistogram<96>::Snapshot captureLatencyMicroseconds;
+
+		void Merge(const Snapshot& other) {
+			mixes += other.mixes;
+			underruns += other.underruns;
+			underrunFrames += other.underrunFrames;
+			overruns += other.overruns;
+			overrunFrames += other.overrunFrames;
+			gatedMixes += other.gatedMixes;
+			fillFrames.Merge(other.fillFrames);
+			captureLatencyMicroseconds.Merge(other.captureLatencyMicroseconds);
+		}
+	};
+
+	// fill is what was buffered before the mix, dropped what the reader lost to being lapped since the last one
+	void RecordMix(size_t requested, size_t delivered, size_t fill, uint64_t dropped) {
+		mixes.fetch_add(1, std::memory_order_relaxed);
+		fillFrames.Record(fill);
+		if(delivered < requested) {
+			underruns.fetch_add(1, std::memory_order_relaxed);
+			underrunFrames.fetch_add(requested - delivered, std::memory_order_relaxed);
+		}
+		if(dropped > 0) {
+			overruns.fetch_add(1, std::memory_order_relaxed);
+			overrunFrames.fetch_add(dropped, std::memory_order_relaxed);
+		}
+	}
+
+	// The mix was behind the silence gate, it wrote zeros without reading anything
+	void RecordGatedMix() {
+		gatedMixes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// From when the first frame a mix consumed was captured to the mix, on the capture clock
+	void RecordCaptureLatency(uint64_t microseconds) {
+		captureLatencyMicroseconds.Record(microseconds);
+	}
+
+	Snapshot Read() const {
+		Snapshot snapshot;
+		snapshot.mixes = mixes.load(std::memory_order_relaxed);
+		snapshot.underruns = underruns.load(std::memory_order_relaxed);
+		snapshot.underrunFrames = underrunFrames.load(std::memory_order_relaxed);
+		snapshot.overruns = overruns.load(std::memory_order_relaxed);
+		snapshot.overrunFrames = overrunFrames.load(std::memory_order_relaxed);
+		snapshot.gatedMixes = gatedMixes.load(std::memory_order_relaxed);
+		snapshot.fillFrames = fillFrames.Read();
+		snapshot.captureLatencyMicroseconds = captureLatencyMicroseconds.Read();
+		return snapshot;
+	}
+
+	std::atomic<uint64_t> mixes { 0 };
+	std::atomic<uint64_t> underruns { 0 };
+	std::atomic<uint64_t> underrunFrames { 0 };
+	std::atomic<uint64_t> overruns { 0 };
+	std::atomic<uint64_t> overrunFrames { 0 };
+	std::atomic<uint64_t> gatedMixes { 0 };
+	AtomicHistogram<64> fillFrames;
+	AtomicHistogram<96> captureLatencyMicroseconds;
+};
+
+#endif // CAPTURE_STATS_HPP
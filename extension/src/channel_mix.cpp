@@ -0,0 +1,296 @@
+#include "channel_mix.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+constexpr uint32_t Mask(Speaker speaker) {
+	return static_cast<uint32_t>(speaker);
+}
+
+// -3 dB
+constexpr float HALF_POWER = 0.70710678f;
+
+template<uint16_t CHANNELS>
+void MixScalar(const float* input, StereoFrame* output, size_t frameCount, const ChannelMatrix& matrix) {
+	// 0 is the generic kernel, it goes by the matrix
+	const uint16_t channels = CHANNELS != 0 ? CHANNELS : matrix.channels;
+	for(size_t i = 0; i < frameCount; i++) {
+		const float* frame = input + i * channels;
+		float left = 0.0f;
+		float right = 0.0f;
+		for(uint16_t channel = 0; channel < channels; channel++) {
+			left += frame[channel] * matrix.left[channel];
+			right += frame[channel] * matrix.right[channel];
+		}
+		output[i] = StereoFrame { left, right };
+	}
+}
+
+// The vector kernels multiply each frame by both rows a vector of channels at a time, then add up across lanes for
+// several frames at once so the sums land interleaved, ready to store
+
+#if defined(SIMD_X86)
+// Up to four of a frame's channels, zeros past count
+inline __m128 LoadChannels(const float* samples, uint16_t count) {
+	switch(count) {
+	case 1: return _mm_load_ss(samples);
+	case 2: return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(samples)));
+	case 3: return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(samples))), _mm_load_ss(samples + 2));
+	default: return _mm_loadu_ps(samples);
+	}
+}
+
+inline void MultiplyFrame(const float* frame, uint16_t channels, const ChannelMatrix& matrix, __m128& left, __m128& right) {
+	left = _mm_setzero_ps();
+	right = _mm_setzero_ps();
+	for(uint16_t block = 0; block < channels; block += 4) {
+		const __m128 samples = LoadChannels(frame + block, static_cast<uint16_t>(std::min(channels - block, 4)));
+		left = _mm_add_ps(left, _mm_mul_ps(samples, _mm_loadu_ps(matrix.left + block)));
+		right = _mm_add_ps(right, _mm_mul_ps(samples, _mm_loadu_ps(matrix.right + block)));
+	}
+}
+
+// Specialized channel counts load two frames of samples as whole vectors, and one shuffle per channel makes
+// (first frame's sample, twice, second frame's, twice) to multiply with that channel's (left, right, left, right).
+// Added up in channel order like the reference, so they round the same.
+template<uint16_t CHANNELS>
+constexpr size_t PAIR_VECTORS = (CHANNELS * 2 + 3) / 4;
+
+// Where a channel's sample of the first frame is and where the second frame's, as vector index and shuffle
+template<uint16_t CHANNELS, uint16_t CHANNEL>
+struct PairLanes {
+	static constexpr int FIRST = CHANNEL / 4;
+	static constexpr int SECOND = (CHANNELS + CHANNEL) / 4;
+	static constexpr int SHUFFLE = _MM_SHUFFLE((CHANNELS + CHANNEL) % 4, (CHANNELS + CHANNEL) % 4, CHANNEL % 4, CHANNEL % 4);
+};
+
+template<uint16_t CHANNELS, uint16_t CHANNEL>
+inline __m128 SamplePair(const __m128* vectors) {
+	using Lanes = PairLanes<CHANNELS, CHANNEL>;
+	return _mm_shuffle_ps(vectors[Lanes::FIRST], vectors[Lanes::SECOND], Lanes::SHUFFLE);
+}
+
+template<uint16_t CHANNELS, uint16_t... CHANNEL>
+inline __m128 MixPair(const __m128* vectors, const __m128* gains, std::integer_sequence<uint16_t, CHANNEL...>) {
+	__m128 sum = _mm_setzero_ps();
+	((sum = _mm_add_ps(sum, _mm_mul_ps(SamplePair<CHANNELS, CHANNEL>(vectors), gains[CHANNEL]))), ...);
+	return sum;
+}
+
+// Two frames at once
+template<uint16_t CHANNELS>
+void MixSse(const float* input, StereoFrame* output, size_t frameCount, const ChannelMatrix& matrix) {
+	size_t i = 0;
+	if constexpr(CHANNELS != 0) {
+		__m128 gains[CHANNELS];
+		for(uint16_t channel = 0; channel < CHANNELS; channel++) {
+			gains[channel] = _mm_unpacklo_ps(_mm_set1_ps(matrix.left[channel]), _mm_set1_ps(matrix.right[channel]));
+		}
+		// whole vectors read past the second frame with odd counts, stop before that runs off the end
+		for(; (i + 2) * CHANNELS + (PAIR_VECTORS<CHANNELS> * 4 - CHANNELS * 2) <= frameCount * CHANNELS; i += 2) {
+			const float* frames = input + i * CHANNELS;
+			__m128 vectors[PAIR_VECTORS<CHANNELS>];
+			for(size_t vector = 0; vector < PAIR_VECTORS<CHANNELS>; vector++) vectors[vector] = _mm_loadu_ps(frames + vector * 4);
+			_mm_storeu_ps(reinterpret_cast<float*>(output + i), MixPair<CHANNELS>(vectors, gains, std::make_integer_sequence<uint16_t, CHANNELS>()));
+		}
+	} else {
+		// SSE2 has no horizontal add, a transpose turns each frame's lanes into rows to add up
+		const uint16_t channels = matrix.channels;
+		for(; i + 2 <= frameCount; i += 2) {
+			__m128 left0, right0, left1, right1;
+			MultiplyFrame(input + i * channels, channels, matrix, left0, right0);
+			MultiplyFrame(input + (i + 1) * channels, channels, matrix, left1, right1);
+			_MM_TRANSPOSE4_PS(left0, right0, left1, right1);
+			_mm_storeu_ps(reinterpret_cast<float*>(output + i), _mm_add_ps(_mm_add_ps(left0, right0), _mm_add_ps(left1, right1)));
+		}
+	}
+	MixScalar<CHANNELS>(input + i * (CHANNELS != 0 ? CHANNELS : matrix.channels), output + i, frameCount - i, matrix);
+}
+
+// Eight ones then eight zeros, a load from the middle masks off all but the first count lanes
+alignas(32) const int32_t LANE_MASKS[16] = { -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+SIMD_TARGET_AVX inline void MultiplyFrameAvx(const float* frame, uint16_t channels, const ChannelMatrix& matrix, __m256& left, __m256& right) {
+	left = _mm256_setzero_ps();
+	right = _mm256_setzero_ps();
+	for(uint16_t block = 0; block < channels; block += 8) {
+		const uint16_t count = static_cast<uint16_t>(std::min(channels - block, 8));
+		const __m256 samples = count == 8 ? _mm256_loadu_ps(frame + block) :
+			_mm256_maskload_ps(frame + block, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(LANE_MASKS + 8 - count)));
+		left = _mm256_add_ps(left, _mm256_mul_ps(samples, _mm256_loadu_ps(matrix.left + block)));
+		right = _mm256_add_ps(right, _mm256_mul_ps(samples, _mm256_loadu_ps(matrix.right + block)));
+	}
+}
+
+template<uint16_t CHANNELS, uint16_t... CHANNEL>
+SIMD_TARGET_AVX inline __m256 MixPairs(const __m256* vectors, const __m256* gains, std::integer_sequence<uint16_t, CHANNEL...>) {
+	__m256 sum = _mm256_setzero_ps();
+	((sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(vectors[PairLanes<CHANNELS, CHANNEL>::FIRST],
+		vectors[PairLanes<CHANNELS, CHANNEL>::SECOND], PairLanes<CHANNELS, CHANNEL>::SHUFFLE), gains[CHANNEL]))), ...);
+	return sum;
+}
+
+// Four frames at once. The specialized counts put frames 0 and 1 in the low halves and 2 and 3 in the high ones,
+// in lane shuffles then pair them up the same way the SSE kernel does.
+template<uint16_t CHANNELS>
+SIMD_TARGET_AVX void MixAvx(const float* input, StereoFrame* output, size_t frameCount, const ChannelMatrix& matrix) {
+	size_t i = 0;
+	if constexpr(CHANNELS != 0) {
+		__m256 gains[CHANNELS];
+		for(uint16_t channel = 0; channel < CHANNELS; channel++) {
+			const __m128 pair = _mm_unpacklo_ps(_mm_set1_ps(matrix.left[channel]), _mm_set1_ps(matrix.right[channel]));
+			gains[channel] = _mm256_insertf128_ps(_mm256_castps128_ps256(pair), pair, 1);
+		}
+		for(; (i + 4) * CHANNELS + (PAIR_VECTORS<CHANNELS> * 4 - CHANNELS * 2) <= frameCount * CHANNELS; i += 4) {
+			const float* frames = input + i * CHANNELS;
+			__m256 vectors[PAIR_VECTORS<CHANNELS>];
+			for(size_t vector = 0; vector < PAIR_VECTORS<CHANNELS>; vector++) {
+				vectors[vector] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(frames + vector * 4)), _mm_loadu_ps(frames + CHANNELS * 2 + vector * 4), 1);
+			}
+			const __m256 sums = MixPairs<CHANNELS>(vectors, gains, std::make_integer_sequence<uint16_t, CHANNELS>());
+			_mm256_storeu_ps(reinterpret_cast<float*>(output + i), sums);
+		}
+	} else {
+		const uint16_t channels = matrix.channels;
+		for(; i + 4 <= frameCount; i += 4) {
+			const float* frame = input + i * channels;
+			__m256 left[4], right[4];
+			for(int f = 0; f < 4; f++) MultiplyFrameAvx(frame + f * channels, channels, matrix, left[f], right[f]);
+			// halves of (left 0, right 0, left 1, right 1) and the same for frames 2 and 3, in each 128 bit lane
+			const __m256 first = _mm256_hadd_ps(_mm256_hadd_ps(left[0], right[0]), _mm256_hadd_ps(left[1], right[1]));
+			const __m256 second = _mm256_hadd_ps(_mm256_hadd_ps(left[2], right[2]), _mm256_hadd_ps(left[3], right[3]));
+			const __m256 sums = _mm256_add_ps(_mm256_permute2f128_ps(first, second, 0x20), _mm256_permute2f128_ps(first, second, 0x31));
+			_mm256_storeu_ps(reinterpret_cast<float*>(output + i), sums);
+		}
+	}
+	MixScalar<CHANNELS>(input + i * (CHANNELS != 0 ? CHANNELS : matrix.channels), output + i, frameCount - i, matrix);
+}
+#elif defined(SIMD_NEON)
+inline float32x4_t LoadChannels(const float* samples, uint16_t count) {
+	switch(count) {
+	case 1: return vsetq_lane_f32(samples[0], vdupq_n_f32(0.0f), 0);
+	case 2: return vcombine_f32(vld1_f32(samples), vdup_n_f32(0.0f));
+	case 3: return vcombine_f32(vld1_f32(samples), vset_lane_f32(samples[2], vdup_n_f32(0.0f), 0));
+	default: return vld1q_f32(samples);
+	}
+}
+
+// Two frames at once
+template<uint16_t CHANNELS>
+void MixNeon(const float* input, StereoFrame* output, size_t frameCount, const ChannelMatrix& matrix) {
+	const uint16_t channels = CHANNELS != 0 ? CHANNELS : matrix.channels;
+	size_t i = 0;
+	for(; i + 2 <= frameCount; i += 2) {
+		float32x4_t sums[4];
+		for(int f = 0; f < 2; f++) {
+			const float* frame = input + (i + f) * channels;
+			float32x4_t left = vdupq_n_f32(0.0f);
+			float32x4_t right = vdupq_n_f32(0.0f);
+			for(uint16_t block = 0; block < channels; block += 4) {
+				const float32x4_t samples = LoadChannels(frame + block, static_cast<uint16_t>(std::min(channels - block, 4)));
+				left = vaddq_f32(left, vmulq_f32(samples, vld1q_f32(matrix.left + block)));
+				right = vaddq_f32(right, vmulq_f32(samples, vld1q_f32(matrix.right + block)));
+			}
+			sums[f * 2] = left;
+			sums[f * 2 + 1] = right;
+		}
+		// pairwise adds twice leave (left 0, right 0, left 1, right 1)
+		const float32x4_t first = vpaddq_f32(sums[0], sums[1]);
+		const float32x4_t second = vpaddq_f32(sums[2], sums[3]);
+		vst1q_f32(reinterpret_cast<float*>(output + i), vpaddq_f32(first, second));
+	}
+	MixScalar<CHANNELS>(input + i * channels, output + i, frameCount - i, matrix);
+}
+#endif
+
+template<uint16_t CHANNELS>
+ChannelMixer SelectFor(SimdLevel level) {
+	switch(level) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return MixAvx<CHANNELS>;
+	case SimdLevel::Baseline: return MixSse<CHANNELS>;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return MixNeon<CHANNELS>;
+#endif
+	default: return MixScalar<CHANNELS>;
+	}
+}
+
+} // namespace
+
+uint32_t DefaultChannelMask(uint16_t channels) {
+	const uint32_t front = Mask(Speaker::FrontLeft) | Mask(Speaker::FrontRight);
+	const uint32_t back = Mask(Speaker::BackLeft) | Mask(Speaker::BackRight);
+	const uint32_t center = Mask(Speaker::FrontCenter);
+	const uint32_t lfe = Mask(Speaker::LowFrequency);
+	switch(channels) {
+	case 1: return center;
+	case 2: return front;
+	case 3: return front | center;
+	case 4: return front | back;
+	case 5: return front | center | back;
+	case 6: return front | center | lfe | back;
+	case 7: return front | center | lfe | back | Mask(Speaker::BackCenter);
+	case 8: return front | center | lfe | back | Mask(Speaker::SideLeft) | Mask(Speaker::SideRight);
+	default: return channels >= 32 ? ~0u : (1u << channels) - 1;
+	}
+}
+
+bool ChannelMatrix::IsPassthrough() const {
+	return channels == 2 && Left(0) == 1.0f && Right(0) == 0.0f && Left(1) == 0.0f && Right(1) == 1.0f;
+}
+
+ChannelMatrix DownmixMatrix(uint16_t channels, uint32_t channelMask) {
+	const uint32_t mask = channelMask != 0 ? channelMask : DefaultChannelMask(channels);
+	// without front left and right, the center is all there is and goes to both at full level
+	const bool centerOnly = (mask & (Mask(Speaker::FrontLeft) | Mask(Speaker::FrontRight))) == 0;
+
+	ChannelMatrix matrix;
+	matrix.channels = channels;
+	uint16_t channel = 0;
+	for(uint32_t bit = 1; bit <= Mask(Speaker::TopBackRight) && channel < channels; bit <<= 1) {
+		if((mask & bit) == 0) continue;
+
+		switch(static_cast<Speaker>(bit)) {
+		case Speaker::FrontLeft:
+		case Speaker::FrontLeftOfCenter: matrix.Set(channel, 1.0f, 0.0f); break;
+		case Speaker::FrontRight:
+		case Speaker::FrontRightOfCenter: matrix.Set(channel, 0.0f, 1.0f); break;
+		case Speaker::FrontCenter: matrix.Set(channel, centerOnly ? 1.0f : HALF_POWER, centerOnly ? 1.0f : HALF_POWER); break;
+		case Speaker::BackLeft:
+		case Speaker::SideLeft:
+		case Speaker::TopFrontLeft:
+		case Speaker::TopBackLeft: matrix.Set(channel, HALF_POWER, 0.0f); break;
+		case Speaker::BackRight:
+		case Speaker::SideRight:
+		case Speaker::TopFrontRight:
+		case Speaker::TopBackRight: matrix.Set(channel, 0.0f, HALF_POWER); break;
+		// split between both surrounds, each of those at -3 dB again
+		case Speaker::BackCenter:
+		case Speaker::TopCenter:
+		case Speaker::TopFrontCenter:
+		case Speaker::TopBackCenter: matrix.Set(channel, 0.5f, 0.5f); break;
+		case Speaker::LowFrequency: break;
+		}
+		channel++;
+	}
+	return matrix;
+}
+
+ChannelMixer SelectChannelMixer(uint16_t channels, SimdLevel level) {
+	level = ClampSimdLevel(level);
+	switch(channels) {
+	case 1: return SelectFor<1>(level);
+	case 2: return SelectFor<2>(level);
+	case 3: return SelectFor<3>(level);
+	case 4: return SelectFor<4>(level);
+	case 5: return SelectFor<5>(level);
+	case 6: return SelectFor<6>(level);
+	case 7: return SelectFor<7>(level);
+	case 8: return SelectFor<8>(level);
+	default: return channels <= MAX_MIX_CHANNELS ? SelectFor<0>(level) : nullptr;
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef CHANNEL_MIX_HPP
+#define CHANNEL_MIX_HPP
+
+#include "audio_types.hpp"
+#include "simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// Source channel layouts to the stereo the ring holds. Sources deliver whatever the endpoint renders (5.1, 7.1, mono...)
+// and a matrix gives each of their channels a gain into left and right. The kernels are specialized per channel count
+// and picked once when the pipeline is configured, like the sample conversion ones.
+
+// Speaker positions as WAVEFORMATEXTENSIBLE's dwChannelMask has them, channels come in the order of their bits
+enum class Speaker : uint32_t {
+	FrontLeft = 0x1,
+	FrontRight = 0x2,
+	FrontCenter = 0x4,
+	LowFrequency = 0x8,
+	BackLeft = 0x10,
+	BackRight = 0x20,
+	FrontLeftOfCenter = 0x40,
+	FrontRightOfCenter = 0x80,
+	BackCenter = 0x100,
+	SideLeft = 0x200,
+	SideRight = 0x400,
+	TopCenter = 0x800,
+	TopFrontLeft = 0x1000,
+	TopFrontCenter = 0x2000,
+	TopFrontRight = 0x4000,
+	TopBackLeft = 0x8000,
+	TopBackCenter = 0x10000,
+	TopBackRight = 0x20000,
+};
+
+// one per speaker position
+constexpr uint16_t MAX_MIX_CHANNELS = 18;
+// rounded up to whole AVX vectors
+constexpr uint16_t MATRIX_ROW_FLOATS = 24;
+
+// Layout for a channel count without a mask: mono, stereo, 3.0, quad, 5.0, 5.1, 6.1, 7.1 (KSAUDIO_SPEAKER_*), beyond
+// that the first that many speaker positions
+uint32_t DefaultChannelMask(uint16_t channels);
+
+// Gains of every source channel into left and right
+struct ChannelMatrix {
+	uint16_t channels = 0;
+	// One row per output. Zero past channels, so the kernels can multiply a frame by them a whole vector at a time.
+	float left[MATRIX_ROW_FLOATS] = { };
+	float right[MATRIX_ROW_FLOATS] = { };
+
+	void Set(uint16_t channel, float leftGain, float rightGain) {
+		left[channel] = leftGain;
+		right[channel] = rightGain;
+	}
+	float Left(uint16_t channel) const { return left[channel]; }
+	float Right(uint16_t channel) const { return right[channel]; }
+
+	// Stereo in, stereo out, nothing to do
+	bool IsPassthrough() const;
+};
+
+// ITU-R BS.775 downmix: center and surrounds at -3 dB into their side, LFE dropped. Mono goes to both sides at full
+// level, channels past the mask's speakers are dropped. Not normalized, a loud 5.1 mix can exceed full scale.
+ChannelMatrix DownmixMatrix(uint16_t channels, uint32_t channelMask);
+
+// frameCount interleaved frames of matrix.channels floats to stereo. Input and output need no alignment.
+using ChannelMixer = void (*)(const float* input, StereoFrame* output, size_t frameCount, const ChannelMatrix& matrix);
+
+// Kernel for a channel count, 1 to MAX_MIX_CHANNELS. Counts up to 8 get one of their own, more share a generic one.
+// SimdLevel::Scalar is the reference, the vector kernels add the products up in a different order and can be off
+// from it by a rounding step or two.
+ChannelMixer SelectChannelMixer(uint16_t channels, SimdLevel level = SimdLevel::Avx);
+
+#endif // CHANNEL_MIX_HPP
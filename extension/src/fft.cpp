@@ -0,0 +1,89 @@
+#include "fft.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+} // namespace
+
+RealFft::RealFft(size_t size) :
+	size { size },
+	half { size / 2 },
+	bitReverse(size / 2),
+	twiddles(size / 2),
+	splitTwiddles(size + 2),
+	work(size)
+{
+	if(size < 4 || (size & (size - 1)) != 0) throw std::runtime_error("FFT size must be a power of two of at least 4");
+
+	size_t bits = 0;
+	while((size_t(1) << bits) < half) bits++;
+	for(size_t i = 0; i < half; i++) {
+		size_t reversed = 0;
+		for(size_t bit = 0; bit < bits; bit++) {
+			if(i & (size_t(1) << bit)) reversed |= size_t(1) << (bits - 1 - bit);
+		}
+		bitReverse[i] = reversed;
+	}
+
+	for(size_t j = 0; j < half / 2; j++) {
+		twiddles[2 * j] = static_cast<float>(std::cos(-2.0 * PI * j / half));
+		twiddles[2 * j + 1] = static_cast<float>(std::sin(-2.0 * PI * j / half));
+	}
+	for(size_t k = 0; k <= half; k++) {
+		splitTwiddles[2 * k] = static_cast<float>(std::cos(-2.0 * PI * k / size));
+		splitTwiddles[2 * k + 1] = static_cast<float>(std::sin(-2.0 * PI * k / size));
+	}
+}
+
+void RealFft::Forward(const float* input, float* output) {
+	// even samples as the real part, odd ones as the imaginary part, in bit reversed order for the in-place stages
+	for(size_t n = 0; n < half; n++) {
+		const size_t target = bitReverse[n];
+		work[2 * target] = input[2 * n];
+		work[2 * target + 1] = input[2 * n + 1];
+	}
+
+	for(size_t length = 2; length <= half; length <<= 1) {
+		const size_t halfLength = length / 2;
+		const size_t stride = half / length;
+		for(size_t start = 0; start < half; start += length) {
+			for(size_t j = 0; j < halfLength; j++) {
+				const float wr = twiddles[2 * j * stride];
+				const float wi = twiddles[2 * j * stride + 1];
+				float* a = work.data() + 2 * (start + j);
+				float* b = work.data() + 2 * (start + j + halfLength);
+				const float tr = b[0] * wr - b[1] * wi;
+				const float ti = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+
+	// Z[k] holds the even samples' spectrum plus i times the odd ones', untangle them with Z[half - k]
+	for(size_t k = 0; k <= half; k++) {
+		const size_t forward = k == half ? 0 : k;
+		const size_t mirrored = k == 0 ? 0 : half - k;
+		const float zr = work[2 * forward];
+		const float zi = work[2 * forward + 1];
+		const float cr = work[2 * mirrored];
+		const float ci = -work[2 * mirrored + 1];
+
+		const float evenR = 0.5f * (zr + cr);
+		const float evenI = 0.5f * (zi + ci);
+		// (Z[k] - conj(Z[half - k])) / 2i
+		const float oddR = 0.5f * (zi - ci);
+		const float oddI = -0.5f * (zr - cr);
+
+		const float wr = splitTwiddles[2 * k];
+		const float wi = splitTwiddles[2 * k + 1];
+		output[2 * k] = evenR + oddR * wr - oddI * wi;
+		output[2 * k + 1] = evenI + oddR * wi + oddI * wr;
+	}
+}
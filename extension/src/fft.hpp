@@ -0,0 +1,34 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <cstddef>
+#include <vector>
+
+// FFT of real input, for a size fixed at construction (a power of two, at least 4).
+// Runs as a complex radix-2 FFT of half the size over the even/odd samples and splits the result, with every table
+// (bit reversal, twiddles) built in the constructor, so Forward() is safe on a real-time thread.
+class RealFft {
+public:
+	explicit RealFft(size_t size);
+
+	RealFft(const RealFft&) = delete;
+	RealFft& operator=(const RealFft&) = delete;
+
+	// input holds Size() samples. output gets the Size() / 2 + 1 non-negative frequency bins, interleaved (re, im),
+	// unnormalized: a full scale cosine on bin k comes out with magnitude Size() / 2.
+	void Forward(const float* input, float* output);
+
+	size_t Size() const { return size; }
+
+private:
+	const size_t size;
+	const size_t half;
+
+	std::vector<size_t> bitReverse;
+	// exp(-2 pi i j / half) for the complex stages, exp(-2 pi i k / size) for the split, interleaved (re, im)
+	std::vector<float> twiddles;
+	std::vector<float> splitTwiddles;
+	std::vector<float> work;
+};
+
+#endif // FFT_HPP
@@ -0,0 +1,93 @@
+#include "helper_capture.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+namespace {
+	std::string UniqueMemoryName() {
+		static std::atomic<uint32_t> counter { 0 };
+		return "WasapiAppCapture." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(counter++);
+	}
+}
+
+HelperCapture::HelperCapture(CaptureReceiver* receiver, DWORD processId, LoopbackMode mode, std::chrono::microseconds clientBuffer,
+	const std::wstring& helperPath, std::chrono::milliseconds activationTimeout) :
+	memory { SharedMemory::Create(UniqueMemoryName(), SharedCaptureRing::MemoryBytes(RING_BYTES)) },
+	process { nullptr },
+	ring { }
+{
+	// the ring and its events have to exist before the helper opens them
+	ring = std::make_unique<SharedRingCapture>(memory, RING_BYTES, receiver, [this]() {
+		return WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	});
+
+	// capture_helper <shared memory> <process id> <loopback mode> <client buffer usec> <parent process id>
+	const std::string name = memory.Name();
+	std::wstring commandLine = L"\"" + helperPath + L"\" " + std::wstring(name.begin(), name.end()) + L" " + std::to_wstring(processId) +
+		L" " + std::to_wstring(static_cast<uint32_t>(mode)) + L" " + std::to_wstring(clientBuffer.count()) + L" " +
+		std::to_wstring(GetCurrentProcessId());
+
+	STARTUPINFOW startup { };
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION information { };
+	// suspended until it's in the job, so there's no moment it could outlive us
+	if(!CreateProcessW(helperPath.c_str(), commandLine.data(), nullptr, nullptr, false, CREATE_SUSPENDED | CREATE_NO_WINDOW, nullptr, nullptr,
+		&startup, &information)) {
+		throw std::runtime_error("failed to start the capture helper, error " + std::to_string(GetLastError()));
+	}
+	process = information.hProcess;
+	// nested jobs need Windows 8, without one the helper still quits once it sees we're gone
+	AssignProcessToJobObject(HelperJob(), process);
+	ResumeThread(information.hThread);
+	CloseHandle(information.hThread);
+
+	try {
+		ring->WaitForProducer(activationTimeout);
+	} catch(...) {
+		TerminateProcess(process, 1);
+		ring.reset();
+		CloseHandle(process);
+		throw;
+	}
+}
+
+HelperCapture::~HelperCapture() {
+	Stop();
+	if(WaitForSingleObject(process, static_cast<DWORD>(QUIT_TIMEOUT.count())) != WAIT_OBJECT_0) {
+		TerminateProcess(process, 1);
+	}
+	ring.reset();
+	CloseHandle(process);
+}
+
+void HelperCapture::Start() {
+	ring->Start();
+}
+
+void HelperCapture::Stop() {
+	ring->Stop();
+}
+
+std::wstring HelperCapture::DefaultHelperPath() {
+	HMODULE module = nullptr;
+	GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		reinterpret_cast<LPCWSTR>(&HelperCapture::DefaultHelperPath), &module);
+
+	std::wstring path(MAX_PATH, L'\0');
+	const DWORD length = GetModuleFileNameW(module, path.data(), static_cast<DWORD>(path.size()));
+	path.resize(length);
+	return path.substr(0, path.find_last_of(L"\\/") + 1) + L"capture_helper.exe";
+}
+
+HANDLE HelperCapture::HelperJob() {
+	// never closed, it goes when we do and takes the helpers with it
+	static const HANDLE job = []() {
+		HANDLE created = CreateJobObjectW(nullptr, nullptr);
+		JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits { };
+		limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+		SetInformationJobObject(created, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+		return created;
+	}();
+	return job;
+}
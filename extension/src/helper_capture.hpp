@@ -0,0 +1,54 @@
+#ifndef HELPER_CAPTURE_HPP
+#define HELPER_CAPTURE_HPP
+
+// windows.h before other headers
+#include <Windows.h>
+
+#include "capture_source.hpp"
+#include "shared_capture_ring.hpp"
+#include "shared_memory.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+// WASAPICapture running in capture_helper.exe instead of in the game, delivering through a SharedRingCapture.
+// Everything COM and WASAPI happens in the helper, so a crash in there or an activation that never completes costs
+// the capture, not the game: the constructor gives up on a helper that doesn't come up in time, and one that dies
+// while capturing is reported to the receiver as a capture error. The helper is tied to us by a job object, it
+// can't outlive the game.
+class HelperCapture : public CaptureSource {
+public:
+	// About 1.4 s of 8 channel float at 96 kHz, enough to ride out the game stalling
+	static constexpr size_t RING_BYTES = 1 << 22;
+	// How long the helper gets to exit on its own once stopped
+	static constexpr std::chrono::milliseconds QUIT_TIMEOUT { 1000 };
+
+	// Starts the helper, which activates a client buffering clientBuffer, and waits up to activationTimeout for it to
+	// come up. Throws std::runtime_error if it couldn't be started, failed, or took too long.
+	HelperCapture(CaptureReceiver* receiver, DWORD processId, LoopbackMode mode, std::chrono::microseconds clientBuffer,
+		const std::wstring& helperPath, std::chrono::milliseconds activationTimeout);
+	~HelperCapture();
+
+	HelperCapture(const HelperCapture&) = delete;
+	HelperCapture& operator=(const HelperCapture&) = delete;
+
+	void Start() override;
+	void Stop() override;
+
+	CaptureFormat GetFormat() const override { return ring->GetFormat(); }
+
+	// capture_helper.exe next to the module this code is in
+	static std::wstring DefaultHelperPath();
+
+private:
+	// Every helper goes in here, closing it when we exit (or crash) kills them
+	static HANDLE HelperJob();
+
+	SharedMemory memory;
+	HANDLE process;
+	// declared after process, it asks whether the helper still runs
+	std::unique_ptr<SharedRingCapture> ring;
+};
+
+#endif // HELPER_CAPTURE_HPP
@@ -0,0 +1,903 @@
+#include "insert_chain.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+float DecibelsToGain(float decibels) {
+	return std::pow(10.0f, decibels / 20.0f);
+}
+
+float GainToDecibels(float gain) {
+	return 20.0f * std::log10(gain);
+}
+
+// One pole smoothing coefficient that gets about 63% of the way in milliseconds
+float SmoothingCoefficient(float milliseconds, uint32_t sampleRate) {
+	return 1.0f - static_cast<float>(std::exp(-1000.0 / (static_cast<double>(milliseconds) * sampleRate)));
+}
+
+// from, to: frame indices, so a vector kernel's tail gets the gains it would have given those frames
+void GainRampRange(StereoFrame* frames, size_t from, size_t to, float gain, float step) {
+	for(size_t i = from; i < to; i++) {
+		const float frameGain = gain + step * static_cast<float>(i);
+		frames[i].left *= frameGain;
+		frames[i].right *= frameGain;
+	}
+}
+
+void GainRampScalar(StereoFrame* frames, size_t frameCount, float gain, float step) {
+	GainRampRange(frames, 0, frameCount, gain, step);
+}
+
+void BiquadScalar(StereoFrame* frames, size_t frameCount, const BiquadCoefficients& c, BiquadState& state) {
+	float s1[2] = { state.s1[0], state.s1[1] };
+	float s2[2] = { state.s2[0], state.s2[1] };
+	for(size_t i = 0; i < frameCount; i++) {
+		float* samples = &frames[i].left;
+		for(int channel = 0; channel < 2; channel++) {
+			const float x = samples[channel];
+			const float y = c.b0 * x + s1[channel];
+			s1[channel] = (c.b1 * x + s2[channel]) - c.a1 * y;
+			s2[channel] = c.b2 * x - c.a2 * y;
+			samples[channel] = y;
+		}
+	}
+	memcpy(state.s1, s1, sizeof(s1));
+	memcpy(state.s2, s2, sizeof(s2));
+}
+
+float EnergyScalar(const StereoFrame* frames, size_t frameCount) {
+	float energy = 0.0f;
+	for(size_t i = 0; i < frameCount; i++) energy += frames[i].left * frames[i].left + frames[i].right * frames[i].right;
+	return energy;
+}
+
+#if defined(SIMD_X86)
+// Two frames a vector, two vectors at a time. The lanes' frame indices count up exactly as floats, so every gain comes
+// out as gain + step * i like the scalar kernel's.
+void GainRampSse(StereoFrame* frames, size_t frameCount, float gain, float step) {
+	float* samples = reinterpret_cast<float*>(frames);
+	const __m128 start = _mm_set1_ps(gain);
+	const __m128 slope = _mm_set1_ps(step);
+	const __m128 four = _mm_set1_ps(4.0f);
+	__m128 index0 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 index1 = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+	size_t i = 0;
+	for(; i + 4 <= frameCount; i += 4) {
+		const __m128 gain0 = _mm_add_ps(start, _mm_mul_ps(slope, index0));
+		const __m128 gain1 = _mm_add_ps(start, _mm_mul_ps(slope, index1));
+		_mm_storeu_ps(samples + i * 2, _mm_mul_ps(_mm_loadu_ps(samples + i * 2), gain0));
+		_mm_storeu_ps(samples + i * 2 + 4, _mm_mul_ps(_mm_loadu_ps(samples + i * 2 + 4), gain1));
+		index0 = _mm_add_ps(index0, four);
+		index1 = _mm_add_ps(index1, four);
+	}
+	GainRampRange(frames, i, frameCount, gain, step);
+}
+
+SIMD_TARGET_AVX void GainRampAvx(StereoFrame* frames, size_t frameCount, float gain, float step) {
+	float* samples = reinterpret_cast<float*>(frames);
+	const __m256 start = _mm256_set1_ps(gain);
+	const __m256 slope = _mm256_set1_ps(step);
+	const __m256 eight = _mm256_set1_ps(8.0f);
+	__m256 index0 = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+	__m256 index1 = _mm256_setr_ps(4.0f, 4.0f, 5.0f, 5.0f, 6.0f, 6.0f, 7.0f, 7.0f);
+	size_t i = 0;
+	for(; i + 8 <= frameCount; i += 8) {
+		const __m256 gain0 = _mm256_add_ps(start, _mm256_mul_ps(slope, index0));
+		const __m256 gain1 = _mm256_add_ps(start, _mm256_mul_ps(slope, index1));
+		_mm256_storeu_ps(samples + i * 2, _mm256_mul_ps(_mm256_loadu_ps(samples + i * 2), gain0));
+		_mm256_storeu_ps(samples + i * 2 + 8, _mm256_mul_ps(_mm256_loadu_ps(samples + i * 2 + 8), gain1));
+		index0 = _mm256_add_ps(index0, eight);
+		index1 = _mm256_add_ps(index1, eight);
+	}
+	GainRampRange(frames, i, frameCount, gain, step);
+}
+
+// Left and right in the low two lanes
+void BiquadSse(StereoFrame* frames, size_t frameCount, const BiquadCoefficients& c, BiquadState& state) {
+	const __m128 b0 = _mm_set1_ps(c.b0);
+	const __m128 b1 = _mm_set1_ps(c.b1);
+	const __m128 b2 = _mm_set1_ps(c.b2);
+	const __m128 a1 = _mm_set1_ps(c.a1);
+	const __m128 a2 = _mm_set1_ps(c.a2);
+	__m128 s1 = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(state.s1)));
+	__m128 s2 = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(state.s2)));
+	for(size_t i = 0; i < frameCount; i++) {
+		double* frame = reinterpret_cast<double*>(frames + i);
+		const __m128 x = _mm_castpd_ps(_mm_load_sd(frame));
+		const __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+		s1 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(b1, x), s2), _mm_mul_ps(a1, y));
+		s2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+		_mm_store_sd(frame, _mm_castps_pd(y));
+	}
+	_mm_store_sd(reinterpret_cast<double*>(state.s1), _mm_castps_pd(s1));
+	_mm_store_sd(reinterpret_cast<double*>(state.s2), _mm_castps_pd(s2));
+}
+
+float EnergySse(const StereoFrame* frames, size_t frameCount) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	const size_t count = frameCount * 2;
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		const __m128 first = _mm_loadu_ps(samples + i);
+		const __m128 second = _mm_loadu_ps(samples + i + 4);
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(first, first));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(second, second));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + EnergyScalar(frames + i / 2, frameCount - i / 2);
+}
+
+SIMD_TARGET_AVX float EnergyAvx(const StereoFrame* frames, size_t frameCount) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	const size_t count = frameCount * 2;
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		const __m256 first = _mm256_loadu_ps(samples + i);
+		const __m256 second = _mm256_loadu_ps(samples + i + 8);
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(first, first));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(second, second));
+	}
+	const __m256 sum8 = _mm256_add_ps(sum0, sum1);
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1)));
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + EnergyScalar(frames + i / 2, frameCount - i / 2);
+}
+#elif defined(SIMD_NEON)
+void GainRampNeon(StereoFrame* frames, size_t frameCount, float gain, float step) {
+	float* samples = reinterpret_cast<float*>(frames);
+	const float32x4_t start = vdupq_n_f32(gain);
+	const float32x4_t slope = vdupq_n_f32(step);
+	const float32x4_t four = vdupq_n_f32(4.0f);
+	const float first[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+	const float second[4] = { 2.0f, 2.0f, 3.0f, 3.0f };
+	float32x4_t index0 = vld1q_f32(first);
+	float32x4_t index1 = vld1q_f32(second);
+	size_t i = 0;
+	for(; i + 4 <= frameCount; i += 4) {
+		const float32x4_t gain0 = vaddq_f32(start, vmulq_f32(slope, index0));
+		const float32x4_t gain1 = vaddq_f32(start, vmulq_f32(slope, index1));
+		vst1q_f32(samples + i * 2, vmulq_f32(vld1q_f32(samples + i * 2), gain0));
+		vst1q_f32(samples + i * 2 + 4, vmulq_f32(vld1q_f32(samples + i * 2 + 4), gain1));
+		index0 = vaddq_f32(index0, four);
+		index1 = vaddq_f32(index1, four);
+	}
+	GainRampRange(frames, i, frameCount, gain, step);
+}
+
+void BiquadNeon(StereoFrame* frames, size_t frameCount, const BiquadCoefficients& c, BiquadState& state) {
+	const float32x2_t b0 = vdup_n_f32(c.b0);
+	const float32x2_t b1 = vdup_n_f32(c.b1);
+	const float32x2_t b2 = vdup_n_f32(c.b2);
+	const float32x2_t a1 = vdup_n_f32(c.a1);
+	const float32x2_t a2 = vdup_n_f32(c.a2);
+	float32x2_t s1 = vld1_f32(state.s1);
+	float32x2_t s2 = vld1_f32(state.s2);
+	for(size_t i = 0; i < frameCount; i++) {
+		float* frame = &frames[i].left;
+		const float32x2_t x = vld1_f32(frame);
+		const float32x2_t y = vadd_f32(vmul_f32(b0, x), s1);
+		s1 = vsub_f32(vadd_f32(vmul_f32(b1, x), s2), vmul_f32(a1, y));
+		s2 = vsub_f32(vmul_f32(b2, x), vmul_f32(a2, y));
+		vst1_f32(frame, y);
+	}
+	vst1_f32(state.s1, s1);
+	vst1_f32(state.s2, s2);
+}
+
+float EnergyNeon(const StereoFrame* frames, size_t frameCount) {
+	const float* samples = reinterpret_cast<const float*>(frames);
+	const size_t count = frameCount * 2;
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		const float32x4_t first = vld1q_f32(samples + i);
+		const float32x4_t second = vld1q_f32(samples + i + 4);
+		sum0 = vaddq_f32(sum0, vmulq_f32(first, first));
+		sum1 = vaddq_f32(sum1, vmulq_f32(second, second));
+	}
+	return vaddvq_f32(vaddq_f32(sum0, sum1)) + EnergyScalar(frames + i / 2, frameCount - i / 2);
+}
+#endif
+
+} // namespace
+
+GainRampFunction SelectGainRamp(SimdLevel level) {
+	switch(ClampSimdLevel(level)) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return GainRampAvx;
+	case SimdLevel::Baseline: return GainRampSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return GainRampNeon;
+#endif
+	default: return GainRampScalar;
+	}
+}
+
+BiquadFunction SelectBiquad(SimdLevel level) {
+	switch(ClampSimdLevel(level)) {
+#if defined(SIMD_X86)
+	// two lanes is all a stereo frame fills, wider vectors have nothing to add
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return BiquadSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return BiquadNeon;
+#endif
+	default: return BiquadScalar;
+	}
+}
+
+EnergyFunction SelectEnergy(SimdLevel level) {
+	switch(ClampSimdLevel(level)) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return EnergyAvx;
+	case SimdLevel::Baseline: return EnergySse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return EnergyNeon;
+#endif
+	default: return EnergyScalar;
+	}
+}
+
+const char* InsertTypeName(InsertType type) {
+	switch(type) {
+	case InsertType::Gain: return "gain";
+	case InsertType::HighPass: return "high_pass";
+	case InsertType::Compressor: return "compressor";
+	case InsertType::Limiter: return "limiter";
+	case InsertType::Loudness: return "loudness";
+	}
+	return "unknown";
+}
+
+const std::vector<InsertParameter>& InsertParameters(InsertType type) {
+	static const std::vector<InsertParameter> parameters[INSERT_TYPES] = {
+		{ { "gain_db", -60.0f, 24.0f, 0.0f } },
+		{ { "cutoff_hz", 10.0f, 2000.0f, 80.0f }, { "q", 0.3f, 4.0f, 0.70710678f } },
+		{
+			{ "threshold_db", -60.0f, 0.0f, -18.0f },
+			{ "ratio", 1.0f, 30.0f, 4.0f },
+			{ "attack_ms", 0.1f, 200.0f, 10.0f },
+			{ "release_ms", 5.0f, 3000.0f, 150.0f },
+			{ "makeup_db", 0.0f, 30.0f, 0.0f },
+		},
+		{ { "ceiling_db", -30.0f, 0.0f, -1.0f }, { "release_ms", 1.0f, 1000.0f, 50.0f } },
+		{ { "target_lufs", -40.0f, -6.0f, -16.0f }, { "max_gain_db", 0.0f, 30.0f, 12.0f } },
+	};
+	return parameters[static_cast<size_t>(type)];
+}
+
+std::optional<size_t> FindInsertParameter(InsertType type, const std::string& name) {
+	const std::vector<InsertParameter>& parameters = InsertParameters(type);
+	for(size_t i = 0; i < parameters.size(); i++) {
+		if(name == parameters[i].name) return i;
+	}
+	return std::nullopt;
+}
+
+// One insert's DSP. The main thread sets the initial parameters before the insert is published, after that everything
+// is called on the capture thread. Configure comes before the first Process and again whenever the rate changes.
+class InsertProcessor {
+public:
+	virtual ~InsertProcessor() = default;
+
+	virtual void SetParameter(size_t parameter, float value) = 0;
+	virtual void Configure(uint32_t sampleRate) = 0;
+	virtual void Process(StereoFrame* frames, size_t frameCount) = 0;
+};
+
+namespace {
+
+class GainInsert : public InsertProcessor {
+public:
+	// changes are ramped over this long, so moving a slider doesn't click
+	static constexpr uint32_t RAMP_MILLISECONDS = 20;
+
+	explicit GainInsert(SimdLevel simd) :
+		ramp { SelectGainRamp(simd) },
+		sampleRate { 0 },
+		gain { 1.0f },
+		target { 1.0f },
+		step { 0.0f },
+		rampFrames { 0 }
+	{ }
+
+	void SetParameter(size_t, float value) override {
+		target = DecibelsToGain(value);
+		if(sampleRate == 0) {
+			// nothing went through yet, no need to ramp
+			gain = target;
+			return;
+		}
+		rampFrames = std::max<size_t>(size_t(sampleRate) * RAMP_MILLISECONDS / 1000, 1);
+		step = (target - gain) / static_cast<float>(rampFrames);
+	}
+
+	void Configure(uint32_t rate) override {
+		sampleRate = rate;
+	}
+
+	void Process(StereoFrame* frames, size_t frameCount) override {
+		if(rampFrames > 0) {
+			const size_t ramped = std::min(rampFrames, frameCount);
+			ramp(frames, ramped, gain, step);
+			gain += step * static_cast<float>(ramped);
+			rampFrames -= ramped;
+			if(rampFrames == 0) gain = target;
+			frames += ramped;
+			frameCount -= ramped;
+		}
+		if(frameCount > 0 && gain != 1.0f) ramp(frames, frameCount, gain, 0.0f);
+	}
+
+private:
+	const GainRampFunction ramp;
+	uint32_t sampleRate;
+	float gain;
+	float target;
+	float step;
+	size_t rampFrames;
+};
+
+class HighPassInsert : public InsertProcessor {
+public:
+	enum Parameter { CUTOFF_HZ, Q };
+
+	explicit HighPassInsert(SimdLevel simd) :
+		biquad { SelectBiquad(simd) },
+		sampleRate { 0 },
+		cutoff { 80.0f },
+		q { 0.70710678f },
+		coefficients { },
+		state { }
+	{ }
+
+	void SetParameter(size_t parameter, float value) override {
+		if(parameter == CUTOFF_HZ) cutoff = value;
+		if(parameter == Q) q = value;
+		if(sampleRate != 0) Update();
+	}
+
+	void Configure(uint32_t rate) override {
+		sampleRate = rate;
+		state = BiquadState { };
+		Update();
+	}
+
+	void Process(StereoFrame* frames, size_t frameCount) override {
+		biquad(frames, frameCount, coefficients, state);
+	}
+
+private:
+	// RBJ's cookbook high pass
+	void Update() {
+		const double frequency = std::min<double>(cutoff, sampleRate * 0.45);
+		const double w0 = 2.0 * PI * frequency / sampleRate;
+		const double cosine = std::cos(w0);
+		const double alpha = std::sin(w0) / (2.0 * q);
+		const double a0 = 1.0 + alpha;
+		coefficients.b0 = static_cast<float>((1.0 + cosine) / 2.0 / a0);
+		coefficients.b1 = static_cast<float>(-(1.0 + cosine) / a0);
+		coefficients.b2 = coefficients.b0;
+		coefficients.a1 = static_cast<float>(-2.0 * cosine / a0);
+		coefficients.a2 = static_cast<float>((1.0 - alpha) / a0);
+	}
+
+	const BiquadFunction biquad;
+	uint32_t sampleRate;
+	float cutoff;
+	float q;
+	BiquadCoefficients coefficients;
+	BiquadState state;
+};
+
+// The envelope follows every frame's peak, the gain it calls for is worked out (logs and all) once per CONTROL_FRAMES
+// and ramped to over them
+class CompressorInsert : public InsertProcessor {
+public:
+	enum Parameter { THRESHOLD_DB, RATIO, ATTACK_MS, RELEASE_MS, MAKEUP_DB };
+	static constexpr size_t CONTROL_FRAMES = 32;
+
+	explicit CompressorInsert(SimdLevel simd) :
+		ramp { SelectGainRamp(simd) },
+		sampleRate { 0 },
+		thresholdDecibels { -18.0f },
+		ratio { 4.0f },
+		attackMilliseconds { 10.0f },
+		releaseMilliseconds { 150.0f },
+		makeupDecibels { 0.0f },
+		threshold { 0.0f },
+		attack { 0.0f },
+		release { 0.0f },
+		envelope { 0.0f },
+		gain { 1.0f }
+	{ }
+
+	void SetParameter(size_t parameter, float value) override {
+		switch(parameter) {
+		case THRESHOLD_DB: thresholdDecibels = value; break;
+		case RATIO: ratio = value; break;
+		case ATTACK_MS: attackMilliseconds = value; break;
+		case RELEASE_MS: releaseMilliseconds = value; break;
+		case MAKEUP_DB: makeupDecibels = value; break;
+		}
+		threshold = DecibelsToGain(thresholdDecibels);
+		if(sampleRate != 0) Update();
+	}
+
+	void Configure(uint32_t rate) override {
+		sampleRate = rate;
+		Update();
+	}
+
+	void Process(StereoFrame* frames, size_t frameCount) override {
+		const float slope = 1.0f - 1.0f / ratio;
+		for(size_t done = 0; done < frameCount; done += CONTROL_FRAMES) {
+			StereoFrame* block = frames + done;
+			const size_t count = std::min(CONTROL_FRAMES, frameCount - done);
+
+			float level = envelope;
+			for(size_t i = 0; i < count; i++) {
+				const float peak = std::max(std::fabs(block[i].left), std::fabs(block[i].right));
+				level += (peak - level) * (peak > level ? attack : release);
+			}
+			envelope = level;
+
+			const float reduction = level > threshold ? (GainToDecibels(level) - thresholdDecibels) * slope : 0.0f;
+			const float next = DecibelsToGain(makeupDecibels - reduction);
+			ramp(block, count, gain, (next - gain) / static_cast<float>(count));
+			gain = next;
+		}
+	}
+
+private:
+	void Update() {
+		attack = SmoothingCoefficient(attackMilliseconds, sampleRate);
+		release = SmoothingCoefficient(releaseMilliseconds, sampleRate);
+	}
+
+	const GainRampFunction ramp;
+	uint32_t sampleRate;
+	float thresholdDecibels;
+	float ratio;
+	float attackMilliseconds;
+	float releaseMilliseconds;
+	float makeupDecibels;
+	float threshold;
+	float attack;
+	float release;
+	float envelope;
+	float gain;
+};
+
+// Attacks within the frame that would go over, so the ceiling holds without delaying anything
+class LimiterInsert : public InsertProcessor {
+public:
+	enum Parameter { CEILING_DB, RELEASE_MS };
+
+	LimiterInsert() :
+		sampleRate { 0 },
+		ceiling { DecibelsToGain(-1.0f) },
+		releaseMilliseconds { 50.0f },
+		release { 0.0f },
+		gain { 1.0f }
+	{ }
+
+	void SetParameter(size_t parameter, float value) override {
+		if(parameter == CEILING_DB) ceiling = DecibelsToGain(value);
+		if(parameter == RELEASE_MS) releaseMilliseconds = value;
+		if(sampleRate != 0) release = SmoothingCoefficient(releaseMilliseconds, sampleRate);
+	}
+
+	void Configure(uint32_t rate) override {
+		sampleRate = rate;
+		release = SmoothingCoefficient(releaseMilliseconds, sampleRate);
+	}
+
+	void Process(StereoFrame* frames, size_t frameCount) override {
+		float current = gain;
+		for(size_t i = 0; i < frameCount; i++) {
+			const float peak = std::max(std::fabs(frames[i].left), std::fabs(frames[i].right));
+			current += (1.0f - current) * release;
+			if(peak * current > ceiling) current = ceiling / peak;
+			frames[i].left *= current;
+			frames[i].right *= current;
+		}
+		gain = current;
+	}
+
+private:
+	uint32_t sampleRate;
+	float ceiling;
+	float releaseMilliseconds;
+	float release;
+	float gain;
+};
+
+// Measures K-weighted loudness (ITU-R BS.1770) in 100 ms blocks over the last WINDOW_BLOCKS of them, and moves the
+// gain towards whatever brings that to the target by at most SLEW_DECIBELS a block, ramped across the block.
+// Blocks below the absolute gate don't count, so pauses don't get boosted.
+class LoudnessInsert : public InsertProcessor {
+public:
+	enum Parameter { TARGET_LUFS, MAX_GAIN_DB };
+	static constexpr uint32_t BLOCKS_PER_SECOND = 10;
+	static constexpr size_t WINDOW_BLOCKS = 30;
+	static constexpr float ABSOLUTE_GATE_LUFS = -70.0f;
+	static constexpr float SLEW_DECIBELS = 0.5f;
+	static constexpr float MAX_CUT_DECIBELS = 30.0f;
+
+	explicit LoudnessInsert(SimdLevel simd) :
+		biquad { SelectBiquad(simd) },
+		ramp { SelectGainRamp(simd) },
+		energy { SelectEnergy(simd) },
+		weighted(InsertChain::BLOCK_FRAMES),
+		target { -16.0f },
+		maxGain { 12.0f },
+		shelf { },
+		highPass { },
+		shelfState { },
+		highPassState { },
+		blockFrames { 0 },
+		blockPosition { 0 },
+		blockEnergy { 0.0 },
+		window { },
+		windowCount { 0 },
+		windowNext { 0 },
+		gainDecibels { 0.0f },
+		gain { 1.0f },
+		step { 0.0f }
+	{ }
+
+	void SetParameter(size_t parameter, float value) override {
+		if(parameter == TARGET_LUFS) target = value;
+		if(parameter == MAX_GAIN_DB) maxGain = value;
+	}
+
+	void Configure(uint32_t rate) override {
+		// BS.1770's pre-filter and RLB high pass, for any rate (as libebur128 derives them)
+		double k = std::tan(PI * 1681.974450955533 / rate);
+		const double q = 0.7071752369554196;
+		const double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+		const double vb = std::pow(vh, 0.4996667741545416);
+		double a0 = 1.0 + k / q + k * k;
+		shelf.b0 = static_cast<float>((vh + vb * k / q + k * k) / a0);
+		shelf.b1 = static_cast<float>(2.0 * (k * k - vh) / a0);
+		shelf.b2 = static_cast<float>((vh - vb * k / q + k * k) / a0);
+		shelf.a1 = static_cast<float>(2.0 * (k * k - 1.0) / a0);
+		shelf.a2 = static_cast<float>((1.0 - k / q + k * k) / a0);
+
+		k = std::tan(PI * 38.13547087602444 / rate);
+		const double highPassQ = 0.5003270373238773;
+		a0 = 1.0 + k / highPassQ + k * k;
+		highPass.b0 = 1.0f;
+		highPass.b1 = -2.0f;
+		highPass.b2 = 1.0f;
+		highPass.a1 = static_cast<float>(2.0 * (k * k - 1.0) / a0);
+		highPass.a2 = static_cast<float>((1.0 - k / highPassQ + k * k) / a0);
+
+		shelfState = BiquadState { };
+		highPassState = BiquadState { };
+		blockFrames = std::max<size_t>(rate / BLOCKS_PER_SECOND, 1);
+		blockPosition = 0;
+		blockEnergy = 0.0;
+		step = 0.0f;
+	}
+
+	void Process(StereoFrame* frames, size_t frameCount) override {
+		while(frameCount > 0) {
+			const size_t count = std::min({ frameCount, weighted.size(), blockFrames - blockPosition });
+
+			memcpy(weighted.data(), frames, count * sizeof(StereoFrame));
+			biquad(weighted.data(), count, shelf, shelfState);
+			biquad(weighted.data(), count, highPass, highPassState);
+			blockEnergy += energy(weighted.data(), count);
+
+			ramp(frames, count, gain, step);
+			gain += step * static_cast<float>(count);
+
+			blockPosition += count;
+			frames += count;
+			frameCount -= count;
+			if(blockPosition == blockFrames) EndBlock();
+		}
+	}
+
+private:
+	static float Loudness(double meanSquare) {
+		return -0.691f + 10.0f * static_cast<float>(std::log10(std::max(meanSquare, 1e-20)));
+	}
+
+	void EndBlock() {
+		const double meanSquare = blockEnergy / static_cast<double>(blockFrames);
+		blockEnergy = 0.0;
+		blockPosition = 0;
+
+		if(Loudness(meanSquare) > ABSOLUTE_GATE_LUFS) {
+			window[windowNext] = meanSquare;
+			windowNext = (windowNext + 1) % WINDOW_BLOCKS;
+			windowCount = std::min(windowCount + 1, WINDOW_BLOCKS);
+		}
+
+		if(windowCount > 0) {
+			double sum = 0.0;
+			for(size_t i = 0; i < windowCount; i++) sum += window[i];
+			const float wanted = std::clamp(target - Loudness(sum / windowCount), -MAX_CUT_DECIBELS, maxGain);
+			gainDecibels += std::clamp(wanted - gainDecibels, -SLEW_DECIBELS, SLEW_DECIBELS);
+		}
+
+		// lands on the new gain at the end of the next block
+		const float next = DecibelsToGain(gainDecibels);
+		step = (next - gain) / static_cast<float>(blockFrames);
+	}
+
+	const BiquadFunction biquad;
+	const GainRampFunction ramp;
+	const EnergyFunction energy;
+	// the K-weighted copy that's measured, the audio itself only gets the gain
+	std::vector<StereoFrame> weighted;
+	float target;
+	float maxGain;
+	BiquadCoefficients shelf;
+	BiquadCoefficients highPass;
+	BiquadState shelfState;
+	BiquadState highPassState;
+	size_t blockFrames;
+	size_t blockPosition;
+	double blockEnergy;
+	std::array<double, WINDOW_BLOCKS> window;
+	size_t windowCount;
+	size_t windowNext;
+	float gainDecibels;
+	float gain;
+	float step;
+};
+
+std::unique_ptr<InsertProcessor> CreateProcessor(InsertType type, SimdLevel simd) {
+	switch(type) {
+	case InsertType::Gain: return std::make_unique<GainInsert>(simd);
+	case InsertType::HighPass: return std::make_unique<HighPassInsert>(simd);
+	case InsertType::Compressor: return std::make_unique<CompressorInsert>(simd);
+	case InsertType::Limiter: return std::make_unique<LimiterInsert>();
+	case InsertType::Loudness: return std::make_unique<LoudnessInsert>(simd);
+	}
+	return nullptr;
+}
+
+} // namespace
+
+struct InsertChain::Insert {
+	Insert(InsertId id, InsertType type, std::unique_ptr<InsertProcessor> processor) :
+		id { id },
+		type { type },
+		processor { std::move(processor) },
+		values { },
+		bypassed { false },
+		sampleRate { 0 },
+		timing { }
+	{ }
+
+	const InsertId id;
+	const InsertType type;
+	const std::unique_ptr<InsertProcessor> processor;
+	// The main thread's, the capture thread reads them all after the queue overflowed
+	std::array<std::atomic<float>, MAX_INSERT_PARAMETERS> values;
+	std::atomic<bool> bypassed;
+	// capture thread: what the processor was configured for, 0 before its first block
+	uint32_t sampleRate;
+	InsertTiming timing;
+};
+
+InsertChain::InsertChain(SimdLevel simd) :
+	simd { simd },
+	inserts { },
+	count { 0 },
+	nextId { 1 },
+	layouts { },
+	commands { COMMAND_CAPACITY, OverrunPolicy::DropNewest },
+	resync { false },
+	overflows { 0 },
+	insertCount { 0 },
+	users { 0 }
+{ }
+
+InsertChain::~InsertChain() = default;
+
+InsertChain::InsertId InsertChain::Add(InsertType type, size_t position) {
+	if(count == MAX_INSERTS) return 0;
+
+	auto insert = std::make_unique<Insert>(nextId++, type, CreateProcessor(type, simd));
+	const std::vector<InsertParameter>& parameters = InsertParameters(type);
+	for(size_t parameter = 0; parameter < parameters.size(); parameter++) {
+		insert->values[parameter].store(parameters[parameter].initial, std::memory_order_relaxed);
+		// not published yet, the capture thread can't be looking
+		insert->processor->SetParameter(parameter, parameters[parameter].initial);
+	}
+
+	const InsertId id = insert->id;
+	position = std::min(position, count);
+	for(size_t i = count; i > position; i--) inserts[i] = std::move(inserts[i - 1]);
+	inserts[position] = std::move(insert);
+	count++;
+	Publish();
+	return id;
+}
+
+bool InsertChain::Remove(InsertId id) {
+	const size_t index = IndexOf(id);
+	if(index == count) return false;
+
+	std::unique_ptr<Insert> removed = std::move(inserts[index]);
+	for(size_t i = index; i + 1 < count; i++) inserts[i] = std::move(inserts[i + 1]);
+	count--;
+	Publish();
+	WaitForCapture();
+	return true;
+}
+
+bool InsertChain::Move(InsertId id, size_t position) {
+	const size_t index = IndexOf(id);
+	if(index == count) return false;
+
+	std::unique_ptr<Insert> moved = std::move(inserts[index]);
+	for(size_t i = index; i + 1 < count; i++) inserts[i] = std::move(inserts[i + 1]);
+	position = std::min(position, count - 1);
+	for(size_t i = count - 1; i > position; i--) inserts[i] = std::move(inserts[i - 1]);
+	inserts[position] = std::move(moved);
+	Publish();
+	return true;
+}
+
+void InsertChain::Clear() {
+	std::array<std::unique_ptr<Insert>, MAX_INSERTS> removed;
+	for(size_t i = 0; i < count; i++) removed[i] = std::move(inserts[i]);
+	count = 0;
+	Publish();
+	WaitForCapture();
+}
+
+bool InsertChain::SetParameter(InsertId id, size_t parameter, float value) {
+	Insert* insert = Find(id);
+	if(insert == nullptr) return false;
+	const std::vector<InsertParameter>& parameters = InsertParameters(insert->type);
+	if(parameter >= parameters.size()) return false;
+
+	value = std::clamp(value, parameters[parameter].minimum, parameters[parameter].maximum);
+	insert->values[parameter].store(value, std::memory_order_relaxed);
+	const Command command { id, static_cast<uint32_t>(parameter), value };
+	if(commands.Write(&command, 1) == 0) {
+		overflows.fetch_add(1, std::memory_order_relaxed);
+		resync.store(true, std::memory_order_release);
+	}
+	return true;
+}
+
+std::optional<float> InsertChain::GetParameter(InsertId id, size_t parameter) const {
+	const Insert* insert = Find(id);
+	if(insert == nullptr || parameter >= InsertParameters(insert->type).size()) return std::nullopt;
+	return insert->values[parameter].load(std::memory_order_relaxed);
+}
+
+bool InsertChain::SetBypassed(InsertId id, bool bypassed) {
+	Insert* insert = Find(id);
+	if(insert == nullptr) return false;
+	insert->bypassed.store(bypassed, std::memory_order_relaxed);
+	return true;
+}
+
+bool InsertChain::IsBypassed(InsertId id) const {
+	const Insert* insert = Find(id);
+	return insert != nullptr && insert->bypassed.load(std::memory_order_relaxed);
+}
+
+std::optional<InsertType> InsertChain::TypeOf(InsertId id) const {
+	const Insert* insert = Find(id);
+	if(insert == nullptr) return std::nullopt;
+	return insert->type;
+}
+
+std::optional<InsertTiming::Snapshot> InsertChain::Timing(InsertId id) const {
+	const Insert* insert = Find(id);
+	if(insert == nullptr) return std::nullopt;
+	return insert->timing.Read();
+}
+
+std::vector<InsertChain::InsertId> InsertChain::Order() const {
+	std::vector<InsertId> order;
+	for(size_t i = 0; i < count; i++) order.push_back(inserts[i]->id);
+	return order;
+}
+
+size_t InsertChain::IndexOf(InsertId id) const {
+	for(size_t i = 0; i < count; i++) {
+		if(inserts[i]->id == id) return i;
+	}
+	return count;
+}
+
+InsertChain::Insert* InsertChain::Find(InsertId id) const {
+	const size_t index = IndexOf(id);
+	return index < count ? inserts[index].get() : nullptr;
+}
+
+void InsertChain::Publish() {
+	Layout& next = layouts.Back();
+	next.count = count;
+	for(size_t i = 0; i < MAX_INSERTS; i++) next.inserts[i] = i < count ? inserts[i].get() : nullptr;
+	layouts.Publish();
+	insertCount.store(count, std::memory_order_relaxed);
+}
+
+void InsertChain::WaitForCapture() {
+	// pairs with the fence in Process: either we see the capture thread in there, or the layout it picks up next is
+	// the one just published
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// at most one block's worth of work
+	while(users.load() != 0) std::this_thread::yield();
+}
+
+void InsertChain::Process(StereoFrame* frames, size_t frameCount, uint32_t sampleRate) {
+	users.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// commands before the layout: a command for a just added insert was queued after the layout that has it
+	const RingSpan<const Command> pending = commands.PeekRead(COMMAND_CAPACITY);
+	layouts.Update();
+	const Layout& current = layouts.Front();
+
+	for(size_t i = 0; i < pending.Size(); i++) {
+		const Command& command = pending[i];
+		for(size_t j = 0; j < current.count; j++) {
+			// an insert that was removed since is simply not found
+			if(current.inserts[j]->id == command.id) current.inserts[j]->processor->SetParameter(command.parameter, command.value);
+		}
+	}
+	commands.ConsumeRead(pending.Size());
+
+	// every command already applied was older than the values it reloads
+	if(resync.exchange(false, std::memory_order_acquire)) {
+		for(size_t i = 0; i < current.count; i++) {
+			Insert& insert = *current.inserts[i];
+			const size_t parameters = InsertParameters(insert.type).size();
+			for(size_t parameter = 0; parameter < parameters; parameter++) {
+				insert.processor->SetParameter(parameter, insert.values[parameter].load(std::memory_order_relaxed));
+			}
+		}
+	}
+
+	// after the commands, so whatever was set before an insert's first block applies as is rather than ramping in
+	for(size_t i = 0; i < current.count; i++) {
+		Insert& insert = *current.inserts[i];
+		if(insert.sampleRate != sampleRate) {
+			insert.processor->Configure(sampleRate);
+			insert.sampleRate = sampleRate;
+		}
+	}
+
+	for(size_t i = 0; i < current.count && frameCount > 0; i++) {
+		Insert& insert = *current.inserts[i];
+		if(insert.bypassed.load(std::memory_order_relaxed)) continue;
+
+		const auto start = std::chrono::steady_clock::now();
+		insert.processor->Process(frames, frameCount);
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		insert.timing.Record(frameCount, static_cast<uint64_t>(elapsed.count()));
+	}
+
+	users.fetch_sub(1, std::memory_order_release);
+}
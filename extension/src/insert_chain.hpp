@@ -0,0 +1,215 @@
+#ifndef INSERT_CHAIN_HPP
+#define INSERT_CHAIN_HPP
+
+#include "audio_types.hpp"
+#include "capture_stats.hpp"
+#include "ring_buffer.hpp"
+#include "simd.hpp"
+#include "triple_buffer.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Effects a capture runs through on its own capture thread, in float stereo at the source's rate, before the taps,
+// the gate and the ring see it. Everything reading the capture (playbacks, recorders, analyzers, pulls) gets the
+// processed audio and none of it costs the mixer anything.
+
+// Scales frameCount frames by a gain that starts at gain and moves by step every frame, so gain changes are ramped
+// instead of stepped. Frame i gets gain + step * i whichever kernel runs, so the vector ones match the scalar one.
+using GainRampFunction = void (*)(StereoFrame* frames, size_t frameCount, float gain, float step);
+
+GainRampFunction SelectGainRamp(SimdLevel level = SimdLevel::Avx);
+
+// Second order section, normalized so a0 is 1
+struct BiquadCoefficients {
+	float b0 = 1.0f;
+	float b1 = 0.0f;
+	float b2 = 0.0f;
+	float a1 = 0.0f;
+	float a2 = 0.0f;
+};
+
+// Transposed direct form II state, left in [0] and right in [1]
+struct BiquadState {
+	float s1[2] = { };
+	float s2[2] = { };
+};
+
+// Filters both channels of frameCount frames in place. Each frame depends on the last, so the vector kernels run left
+// and right side by side rather than several frames at once; they compute the same expressions as the scalar one.
+using BiquadFunction = void (*)(StereoFrame* frames, size_t frameCount, const BiquadCoefficients& coefficients, BiquadState& state);
+
+BiquadFunction SelectBiquad(SimdLevel level = SimdLevel::Avx);
+
+// Sum of left * left + right * right over frameCount frames. The vector kernels add up in a different order and can
+// be off from the scalar one by a few rounding steps.
+using EnergyFunction = float (*)(const StereoFrame* frames, size_t frameCount);
+
+EnergyFunction SelectEnergy(SimdLevel level = SimdLevel::Avx);
+
+enum class InsertType : uint8_t {
+	// gain_db
+	Gain,
+	// 12 dB/octave: cutoff_hz, q
+	HighPass,
+	// Stereo linked, hard knee: threshold_db, ratio, attack_ms, release_ms, makeup_db
+	Compressor,
+	// No lookahead, so no latency either: nothing above ceiling_db gets through, release_ms to recover
+	Limiter,
+	// Slowly rides the gain towards target_lufs of short term (3 s) BS.1770 loudness, boosting by max_gain_db at most.
+	// Holds its gain through silence.
+	Loudness,
+};
+
+constexpr size_t INSERT_TYPES = 5;
+// Most any type has
+constexpr size_t MAX_INSERT_PARAMETERS = 5;
+
+const char* InsertTypeName(InsertType type);
+
+struct InsertParameter {
+	const char* name;
+	float minimum;
+	float maximum;
+	float initial;
+};
+
+// A type's parameters, in the order their indices go
+const std::vector<InsertParameter>& InsertParameters(InsertType type);
+std::optional<size_t> FindInsertParameter(InsertType type, const std::string& name);
+
+// How long an insert took, recorded by the capture thread for every block it processed
+struct InsertTiming {
+	struct Snapshot {
+		uint64_t blocks = 0;
+		uint64_t frames = 0;
+		uint64_t nanoseconds = 0;
+		AtomicHistogram<80>::Snapshot blockNanoseconds;
+
+		double NanosecondsPerFrame() const { return frames ? static_cast<double>(nanoseconds) / frames : 0.0; }
+	};
+
+	void Record(size_t frameCount, uint64_t elapsed) {
+		blocks.fetch_add(1, std::memory_order_relaxed);
+		frames.fetch_add(frameCount, std::memory_order_relaxed);
+		nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+		blockNanoseconds.Record(elapsed);
+	}
+
+	Snapshot Read() const {
+		Snapshot snapshot;
+		snapshot.blocks = blocks.load(std::memory_order_relaxed);
+		snapshot.frames = frames.load(std::memory_order_relaxed);
+		snapshot.nanoseconds = nanoseconds.load(std::memory_order_relaxed);
+		snapshot.blockNanoseconds = blockNanoseconds.Read();
+		return snapshot;
+	}
+
+	std::atomic<uint64_t> blocks { 0 };
+	std::atomic<uint64_t> frames { 0 };
+	std::atomic<uint64_t> nanoseconds { 0 };
+	AtomicHistogram<80> blockNanoseconds;
+};
+
+// Defined with the kernels, one per type
+class InsertProcessor;
+
+// An ordered list of inserts the main thread edits while the capture thread runs it, neither ever waiting on a lock
+// and the capture thread never allocating:
+// - Adding, removing and reordering publish a new layout the capture thread picks up at its next block
+//   (TripleBuffer). A removed insert is only destroyed once the capture thread is out, like a detached tap.
+// - Parameter changes go through a single producer / single consumer command queue the capture thread drains at the
+//   start of every block. Each command carries its value, and processors only recompute coefficients when one
+//   arrives. If the capture thread isn't draining it (nothing is capturing) and it fills up, the capture thread
+//   picks every insert's current values up in one go instead once it's back.
+class InsertChain {
+public:
+	using InsertId = uint32_t;
+
+	static constexpr size_t MAX_INSERTS = 8;
+	// Parameter changes on their way to the capture thread
+	static constexpr size_t COMMAND_CAPACITY = 256;
+	// Processors with scratch space (loudness) work through longer blocks this many frames at a time
+	static constexpr size_t BLOCK_FRAMES = 1024;
+
+	explicit InsertChain(SimdLevel simd = SimdLevel::Avx);
+	~InsertChain();
+
+	InsertChain(const InsertChain&) = delete;
+	InsertChain& operator=(const InsertChain&) = delete;
+
+	// Main thread (or any one thread at a time) from here on
+
+	// A new insert at position (the end if it's past that) with its parameters' initial values. Returns 0 when
+	// MAX_INSERTS are in already.
+	InsertId Add(InsertType type, size_t position);
+	// Returns once the capture thread is done with it, false if there's no such insert
+	bool Remove(InsertId id);
+	bool Move(InsertId id, size_t position);
+	void Clear();
+
+	// Clamped to the parameter's range, the capture thread applies it at its next block. False for an unknown insert
+	// or parameter.
+	bool SetParameter(InsertId id, size_t parameter, float value);
+	std::optional<float> GetParameter(InsertId id, size_t parameter) const;
+	// A bypassed insert leaves the audio alone and keeps its state as it was
+	bool SetBypassed(InsertId id, bool bypassed);
+	bool IsBypassed(InsertId id) const;
+	std::optional<InsertType> TypeOf(InsertId id) const;
+	std::optional<InsertTiming::Snapshot> Timing(InsertId id) const;
+	// Processing order
+	std::vector<InsertId> Order() const;
+
+	// Any thread
+	bool Empty() const { return insertCount.load(std::memory_order_relaxed) == 0; }
+	// Commands that didn't fit the queue, each of them made the capture thread reload every parameter
+	uint64_t Overflows() const { return overflows.load(std::memory_order_relaxed); }
+
+	// Capture thread, or whichever thread is writing the pipeline's ring at the time. Runs every insert over frames
+	// in place; coefficients follow sampleRate when it changes, without allocating anything.
+	void Process(StereoFrame* frames, size_t frameCount, uint32_t sampleRate);
+
+private:
+	struct Insert;
+
+	struct Layout {
+		size_t count = 0;
+		Insert* inserts[MAX_INSERTS] = { };
+	};
+
+	struct Command {
+		InsertId id;
+		uint32_t parameter;
+		float value;
+	};
+
+	// Index in inserts, count if there's no such insert
+	size_t IndexOf(InsertId id) const;
+	Insert* Find(InsertId id) const;
+	// Hands the inserts as they are now to the capture thread
+	void Publish();
+	// Returns once the capture thread is out of Process, after that nothing it picked up before Publish is in use
+	void WaitForCapture();
+
+	const SimdLevel simd;
+	// main thread: the inserts in order, owned here until they're removed
+	std::array<std::unique_ptr<Insert>, MAX_INSERTS> inserts;
+	size_t count;
+	InsertId nextId;
+	TripleBuffer<Layout> layouts;
+	CircularBuffer<Command> commands;
+	// set when a command didn't fit, the capture thread reloads everything from the inserts' values
+	std::atomic<bool> resync;
+	std::atomic<uint64_t> overflows;
+	std::atomic<size_t> insertCount;
+	// the capture thread announces itself in here before picking the layout up, see WaitForCapture
+	std::atomic<uint32_t> users;
+};
+
+#endif // INSERT_CHAIN_HPP
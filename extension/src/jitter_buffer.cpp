@@ -0,0 +1,157 @@
+#include "jitter_buffer.hpp"
+
+#include "silence_gate.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Time constant of the fill level smoothing, long enough to flatten the packet and mix block sawtooth
+constexpr double SMOOTHING_SECONDS = 1.0;
+// Ratio change per second of latency error, and per second of that error integrated over a second.
+// Critically damped (ki = kp^2 / 4) and slow on purpose: clock drift changes over minutes, a faster loop only turns
+// packet jitter into pitch wobble. See bench/jitter_buffer_bench.cpp.
+constexpr double PROPORTIONAL_GAIN = 0.1;
+constexpr double INTEGRAL_GAIN = PROPORTIONAL_GAIN * PROPORTIONAL_GAIN / 4.0;
+// How far past twice the target the fill may get before we skip ahead instead of draining it
+constexpr uint32_t RESYNC_MARGIN = 1024;
+
+} // namespace
+
+JitterBuffer::JitterBuffer(Buffer& ring, uint32_t sampleRate, uint32_t targetLatency, SimdLevel simd) :
+	reader { ring },
+	resampler { sampleRate, sampleRate, simd, true },
+	sampleRate { sampleRate },
+	capacity { ring.Capacity() },
+	buffering { true },
+	smoothedFill { 0.0 },
+	integral { 0.0 },
+	targetLatency { 0 },
+	latency { 0.0 },
+	correction { 0.0 },
+	underrunFrames { 0 },
+	resyncs { 0 }
+{
+	SetTargetLatency(targetLatency);
+}
+
+uint32_t JitterBuffer::MaxTargetLatency() const {
+	// leave room to overshoot to twice the target plus the margin before the ring laps us
+	return capacity > RESYNC_MARGIN ? static_cast<uint32_t>((capacity - RESYNC_MARGIN) / 2) : 0;
+}
+
+void JitterBuffer::SetTargetLatency(uint32_t frames) {
+	targetLatency.store(std::min(frames, MaxTargetLatency()), std::memory_order_relaxed);
+}
+
+void JitterBuffer::Start() {
+	const uint32_t target = TargetLatency();
+	Resync(target);
+	smoothedFill = target;
+}
+
+void JitterBuffer::Resync(uint32_t target) {
+	reader.SeekToLive(target);
+	resampler.Reset();
+	resampler.SetRatioScale(1.0 + correction.load(std::memory_order_relaxed));
+	buffering = reader.Lag() < target;
+}
+
+size_t JitterBuffer::Mix(StereoFrame* output, size_t frameCount) {
+	const uint32_t target = TargetLatency();
+	const size_t lag = reader.Lag();
+
+	if(buffering) {
+		// after an underrun (or a start without enough history) wait for the target instead of playing every
+		// packet the moment it arrives
+		if(lag < target) {
+			latency.store(static_cast<double>(lag), std::memory_order_relaxed);
+			return 0;
+		}
+		buffering = false;
+	} else if(lag > size_t(target) * 2 + RESYNC_MARGIN) {
+		// stalled for long enough that draining it at MAX_CORRECTION would take forever
+		resyncs.fetch_add(1, std::memory_order_relaxed);
+		Resync(target);
+		smoothedFill = target;
+	}
+
+	const double scale = 1.0 + correction.load(std::memory_order_relaxed);
+	size_t produced = 0;
+	while(produced < frameCount) {
+		produced += resampler.Pull(output + produced, frameCount - produced);
+		if(produced == frameCount) break;
+
+		// feed only what the rest of this mix needs, the remainder stays in the ring where it's counted as latency
+		const size_t wanted = static_cast<size_t>((frameCount - produced) * scale) + 2;
+		const RingSpan<const StereoFrame> span = reader.PeekRead(wanted);
+		if(span.Empty()) {
+			underrunFrames.fetch_add(frameCount - produced, std::memory_order_relaxed);
+			buffering = true;
+			break;
+		}
+
+		size_t pushed = resampler.Push(span.first, span.firstCount);
+		if(pushed == span.firstCount) pushed += resampler.Push(span.second, span.secondCount);
+		if(reader.ConsumeRead(pushed) < pushed) {
+			// lapped while reading, what went into the resampler is garbage
+			resyncs.fetch_add(1, std::memory_order_relaxed);
+			Resync(target);
+			smoothedFill = target;
+			break;
+		}
+	}
+
+	Control(frameCount, target);
+	return produced;
+}
+
+size_t JitterBuffer::MixSilence(StereoFrame* output, size_t frameCount, uint64_t silentUntil) {
+	if(silentUntil == Position()) return 0;
+
+	const uint32_t target = TargetLatency();
+	const size_t lag = reader.Lag();
+	const size_t wanted = static_cast<size_t>(frameCount * (1.0 + correction.load(std::memory_order_relaxed)) + 0.5);
+	// as much as Mix would take, but an idling source delivers in bursts and running dry between them isn't an underrun
+	const size_t consumed = buffering && lag < target ? 0 : std::min(wanted, lag);
+	const uint64_t next = reader.Position() + consumed;
+	// the gate opened again before the end of this mix, or it's open again and there's less than Mix needs
+	if(next > silentUntil || (silentUntil != SilenceGate::NEVER && consumed < wanted)) return 0;
+
+	if(lag >= target) buffering = false;
+	// what the resampler holds is from behind the gate too, dropping it beats filtering zeros
+	if(resampler.Pending() != 0) resampler.Reset();
+	reader.SeekTo(next);
+	memset(output, 0, frameCount * sizeof(StereoFrame));
+
+	Control(frameCount, target);
+	return frameCount;
+}
+
+size_t JitterBuffer::Fill() const {
+	return reader.Lag() + resampler.Pending();
+}
+
+uint64_t JitterBuffer::Position() const {
+	// what the resampler holds was read from the ring already but hasn't come out yet
+	return reader.Position() - resampler.Pending();
+}
+
+void JitterBuffer::Control(size_t frameCount, uint32_t target) {
+	const double fill = static_cast<double>(Fill());
+	const double seconds = static_cast<double>(frameCount) / sampleRate;
+
+	smoothedFill += (fill - smoothedFill) * (seconds / (SMOOTHING_SECONDS + seconds));
+	const double error = (smoothedFill - target) / sampleRate;
+
+	// clamp the integral to what it could ever ask for so it doesn't wind up during an underrun
+	const double integralLimit = MAX_CORRECTION / INTEGRAL_GAIN;
+	integral = std::clamp(integral + error * seconds, -integralLimit, integralLimit);
+
+	const double newCorrection = std::clamp(PROPORTIONAL_GAIN * error + INTEGRAL_GAIN * integral, -MAX_CORRECTION, MAX_CORRECTION);
+	resampler.SetRatioScale(1.0 + newCorrection);
+
+	correction.store(newCorrection, std::memory_order_relaxed);
+	latency.store(smoothedFill, std::memory_order_relaxed);
+}
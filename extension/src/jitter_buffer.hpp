@@ -0,0 +1,83 @@
+#ifndef JITTER_BUFFER_HPP
+#define JITTER_BUFFER_HPP
+
+#include "audio_types.hpp"
+#include "broadcast_buffer.hpp"
+#include "resampler.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A Reader that holds itself a fixed latency behind the live edge.
+//
+// The capture clock (the target's render endpoint) and the mixer's clock are never quite the same, so a plain reader
+// slowly drifts towards an overrun or an underrun. This one measures how much it has buffered after every mix and
+// runs it through a PI controller that nudges the ratio of its own variable ratio resampler by a few hundred ppm at
+// most, so it drains exactly as fast as the capture fills. Only gross errors (an underrun, or a stall long enough
+// that the buffer is way over target) fall back to prebuffering or skipping ahead.
+//
+// Everything except the statistics and SetTargetLatency is for the one mixer thread that owns it. Allocates in the
+// constructor only.
+class JitterBuffer {
+public:
+	using Buffer = BroadcastBuffer<StereoFrame>;
+
+	// Largest ratio change the controller may apply, 0.2% is about 3.5 cents
+	static constexpr double MAX_CORRECTION = 0.002;
+
+	JitterBuffer(Buffer& ring, uint32_t sampleRate, uint32_t targetLatency, SimdLevel simd = SimdLevel::Avx);
+
+	JitterBuffer(const JitterBuffer&) = delete;
+	JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+	// In frames, clamped to what the ring can hold. Any thread, picked up on the next Mix.
+	void SetTargetLatency(uint32_t frames);
+	uint32_t TargetLatency() const { return targetLatency.load(std::memory_order_relaxed); }
+	uint32_t MaxTargetLatency() const;
+
+	// Jump to the target latency behind the live edge. Keeps the drift estimate, the clocks haven't changed.
+	void Start();
+	// Returns how many frames were written to output, the rest is left for the caller to fill
+	size_t Mix(StereoFrame* output, size_t frameCount);
+	// Mix for while the capture's silence gate is closed, silentUntil being what CapturePipeline::SilentUntil says
+	// for Position(): writes zeros and moves on through the ring as far as Mix would, without resampling anything.
+	// Running dry between an idling source's bursts isn't an underrun here. Returns 0 if the gate doesn't cover what
+	// this mix would read, Mix has to do it then.
+	size_t MixSilence(StereoFrame* output, size_t frameCount, uint64_t silentUntil);
+
+	// Mixer thread. Frames buffered right now, in the ring and in the resampler
+	size_t Fill() const;
+	// Mixer thread. Ring position of the next frame Mix will output
+	uint64_t Position() const;
+
+	// Smoothed frames between the capture's live edge and what was last mixed
+	double Latency() const { return latency.load(std::memory_order_relaxed); }
+	// Ratio change currently applied, positive when draining faster than nominal
+	double Correction() const { return correction.load(std::memory_order_relaxed); }
+	uint64_t UnderrunFrames() const { return underrunFrames.load(std::memory_order_relaxed); }
+	// Times the controller gave up and jumped straight to the target
+	uint64_t Resyncs() const { return resyncs.load(std::memory_order_relaxed); }
+	uint64_t DroppedCount() const { return reader.DroppedCount(); }
+
+private:
+	void Resync(uint32_t target);
+	void Control(size_t frameCount, uint32_t target);
+
+	Buffer::Reader reader;
+	PolyphaseResampler resampler;
+	const uint32_t sampleRate;
+	const size_t capacity;
+
+	bool buffering;
+	double smoothedFill;
+	double integral;
+
+	std::atomic<uint32_t> targetLatency;
+	std::atomic<double> latency;
+	std::atomic<double> correction;
+	std::atomic<uint64_t> underrunFrames;
+	std::atomic<uint64_t> resyncs;
+};
+
+#endif // JITTER_BUFFER_HPP
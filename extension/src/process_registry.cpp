@@ -0,0 +1,271 @@
+#include "process_registry.hpp"
+
+#include <algorithm>
+
+ProcessRegistry::ProcessRegistry(std::unique_ptr<ProcessEnumerator> enumerator, std::chrono::milliseconds pollInterval) :
+	enumerator { std::move(enumerator) },
+	pollInterval { pollInterval },
+	refreshMutex { },
+	processScratch { },
+	windowScratch { },
+	mutex { },
+	processes { },
+	processesByName { },
+	preferredByName { },
+	processByTitle { },
+	titlesByProcess { },
+	waits { },
+	nextWaitId { 1 },
+	pollSignal { },
+	stopping { false },
+	poller { }
+{
+	Refresh();
+	poller = std::thread(&ProcessRegistry::PollLoop, this);
+}
+
+ProcessRegistry::~ProcessRegistry() {
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		stopping = true;
+	}
+	pollSignal.notify_all();
+	poller.join();
+}
+
+std::string ProcessRegistry::Lowercase(const std::string& text) {
+	std::string result = text;
+	for(char& c : result) {
+		if(c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+	}
+	return result;
+}
+
+std::optional<uint32_t> ProcessRegistry::Find(const ProcessQuery& query) const {
+	std::lock_guard<std::mutex> lock { mutex };
+	return FindLocked(query);
+}
+
+std::optional<uint32_t> ProcessRegistry::FindLocked(const ProcessQuery& query) const {
+	switch(query.kind) {
+	case ProcessQuery::Kind::ExeName: {
+		const auto found = preferredByName.find(Lowercase(query.name));
+		if(found != preferredByName.end()) return found->second;
+		break;
+	}
+	case ProcessQuery::Kind::WindowTitle: {
+		const auto found = processByTitle.find(query.name);
+		if(found != processByTitle.end()) return found->second;
+		break;
+	}
+	case ProcessQuery::Kind::ProcessId:
+		if(processes.count(query.processId)) return query.processId;
+		break;
+	}
+	return std::nullopt;
+}
+
+ProcessRegistry::WaitId ProcessRegistry::WaitFor(const ProcessQuery& query, WaitCallback callback) {
+	std::unique_lock<std::mutex> lock { mutex };
+	const WaitId id = nextWaitId++;
+
+	const std::optional<uint32_t> found = FindLocked(query);
+	if(found) {
+		lock.unlock();
+		callback(*found);
+		return id;
+	}
+
+	waits.emplace(id, Wait { query, std::move(callback) });
+	return id;
+}
+
+void ProcessRegistry::CancelWait(WaitId id) {
+	std::lock_guard<std::mutex> lock { mutex };
+	waits.erase(id);
+}
+
+size_t ProcessRegistry::ProcessCount() const {
+	std::lock_guard<std::mutex> lock { mutex };
+	return processes.size();
+}
+
+void ProcessRegistry::AddProcess(const ProcessInfo& info) {
+	Process process { info.parentProcessId, Lowercase(info.exeName), 0 };
+	processesByName[process.exeName].push_back(info.processId);
+	processes.emplace(info.processId, std::move(process));
+}
+
+void ProcessRegistry::RemoveProcess(uint32_t processId) {
+	const auto found = processes.find(processId);
+	if(found == processes.end()) return;
+
+	auto byName = processesByName.find(found->second.exeName);
+	if(byName != processesByName.end()) {
+		std::vector<uint32_t>& ids = byName->second;
+		ids.erase(std::remove(ids.begin(), ids.end(), processId), ids.end());
+		if(ids.empty()) processesByName.erase(byName);
+	}
+
+	const auto titles = titlesByProcess.find(processId);
+	if(titles != titlesByProcess.end()) {
+		for(const std::string& title : titles->second) {
+			const auto owner = processByTitle.find(title);
+			if(owner != processByTitle.end() && owner->second == processId) processByTitle.erase(owner);
+		}
+		titlesByProcess.erase(titles);
+	}
+
+	processes.erase(found);
+}
+
+void ProcessRegistry::UpdatePreferred(const std::string& exeName) {
+	const auto byName = processesByName.find(exeName);
+	if(byName == processesByName.end()) {
+		preferredByName.erase(exeName);
+		return;
+	}
+
+	// lower is better: owns a window, then is the root of its tree, then the lowest PID as a tie break
+	auto rank = [&](uint32_t processId) {
+		const Process& process = processes.at(processId);
+		const auto parent = processes.find(process.parentProcessId);
+		const bool root = parent == processes.end() || parent->second.exeName != exeName;
+		return (process.windowCount > 0 ? 0 : 2) + (root ? 0 : 1);
+	};
+
+	uint32_t best = 0;
+	int bestRank = 4;
+	for(uint32_t processId : byName->second) {
+		const int candidate = rank(processId);
+		if(candidate < bestRank || (candidate == bestRank && processId < best)) {
+			best = processId;
+			bestRank = candidate;
+		}
+	}
+	preferredByName[exeName] = best;
+}
+
+size_t ProcessRegistry::Refresh() {
+	std::lock_guard<std::mutex> refreshLock { refreshMutex };
+
+	// enumerate without holding the index lock, that's the slow part
+	processScratch.clear();
+	windowScratch.clear();
+	enumerator->EnumerateProcesses(processScratch);
+	enumerator->EnumerateWindows(windowScratch);
+
+	std::sort(processScratch.begin(), processScratch.end(), [](const ProcessInfo& a, const ProcessInfo& b) { return a.processId < b.processId; });
+	// stable so each process keeps its windows in enumeration order and an unchanged set compares equal
+	std::stable_sort(windowScratch.begin(), windowScratch.end(), [](const WindowInfo& a, const WindowInfo& b) { return a.processId < b.processId; });
+
+	std::vector<std::string> dirtyNames;
+	std::vector<std::pair<WaitCallback, uint32_t>> satisfied;
+	size_t changes = 0;
+
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+
+		auto inSnapshot = [&](uint32_t processId) {
+			return std::binary_search(processScratch.begin(), processScratch.end(), ProcessInfo { processId, 0, { } },
+				[](const ProcessInfo& a, const ProcessInfo& b) { return a.processId < b.processId; });
+		};
+
+		// exits first, so a reused PID below counts as a new process
+		std::vector<uint32_t> exited;
+		for(const auto& [processId, process] : processes) {
+			if(!inSnapshot(processId)) exited.push_back(processId);
+		}
+		for(uint32_t processId : exited) {
+			dirtyNames.push_back(processes.at(processId).exeName);
+			RemoveProcess(processId);
+			changes++;
+		}
+
+		for(const ProcessInfo& info : processScratch) {
+			const auto found = processes.find(info.processId);
+			if(found != processes.end()) {
+				if(found->second.parentProcessId == info.parentProcessId && found->second.exeName == Lowercase(info.exeName)) continue;
+				// PID reused between two refreshes
+				dirtyNames.push_back(found->second.exeName);
+				RemoveProcess(info.processId);
+			}
+			AddProcess(info);
+			dirtyNames.push_back(processes.at(info.processId).exeName);
+			changes++;
+		}
+
+		// windows, per owning process: only processes whose set of titles changed touch the index
+		std::vector<std::string> titles;
+		std::vector<uint32_t> withWindows;
+		for(size_t i = 0; i < windowScratch.size();) {
+			const uint32_t processId = windowScratch[i].processId;
+			titles.clear();
+			for(; i < windowScratch.size() && windowScratch[i].processId == processId; i++) titles.push_back(windowScratch[i].title);
+
+			const auto process = processes.find(processId);
+			if(process == processes.end()) continue;
+			withWindows.push_back(processId);
+
+			std::vector<std::string>& current = titlesByProcess[processId];
+			if(current == titles) continue;
+
+			for(const std::string& title : current) {
+				const auto owner = processByTitle.find(title);
+				if(owner != processByTitle.end() && owner->second == processId) processByTitle.erase(owner);
+			}
+			for(const std::string& title : titles) processByTitle[title] = processId;
+			current = titles;
+
+			if((process->second.windowCount > 0) != !titles.empty()) dirtyNames.push_back(process->second.exeName);
+			process->second.windowCount = static_cast<uint32_t>(titles.size());
+		}
+
+		// and the processes whose windows all went away (or that exited)
+		for(auto it = titlesByProcess.begin(); it != titlesByProcess.end();) {
+			if(std::binary_search(withWindows.begin(), withWindows.end(), it->first)) {
+				++it;
+				continue;
+			}
+			for(const std::string& title : it->second) {
+				const auto owner = processByTitle.find(title);
+				if(owner != processByTitle.end() && owner->second == it->first) processByTitle.erase(owner);
+			}
+			const auto process = processes.find(it->first);
+			if(process != processes.end()) {
+				process->second.windowCount = 0;
+				dirtyNames.push_back(process->second.exeName);
+			}
+			it = titlesByProcess.erase(it);
+		}
+
+		std::sort(dirtyNames.begin(), dirtyNames.end());
+		dirtyNames.erase(std::unique(dirtyNames.begin(), dirtyNames.end()), dirtyNames.end());
+		for(const std::string& exeName : dirtyNames) UpdatePreferred(exeName);
+
+		for(auto it = waits.begin(); it != waits.end();) {
+			const std::optional<uint32_t> found = FindLocked(it->second.query);
+			if(!found) {
+				++it;
+				continue;
+			}
+			satisfied.emplace_back(std::move(it->second.callback), *found);
+			it = waits.erase(it);
+		}
+	}
+
+	for(auto& [callback, processId] : satisfied) callback(processId);
+	return changes;
+}
+
+void ProcessRegistry::PollLoop() {
+	std::unique_lock<std::mutex> lock { mutex };
+	while(!stopping) {
+		pollSignal.wait_for(lock, pollInterval);
+		if(stopping) break;
+
+		lock.unlock();
+		Refresh();
+		lock.lock();
+	}
+}
@@ -0,0 +1,135 @@
+#ifndef PROCESS_REGISTRY_HPP
+#define PROCESS_REGISTRY_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One row of the OS process table
+struct ProcessInfo {
+	uint32_t processId;
+	uint32_t parentProcessId;
+	// file name only, "Spotify.exe"
+	std::string exeName;
+};
+
+// A visible top-level window
+struct WindowInfo {
+	uint32_t processId;
+	std::string title;
+};
+
+// Where ProcessRegistry gets its snapshots from. Win32ProcessEnumerator reads the real tables, benchmarks and tests
+// hand it a fake one.
+class ProcessEnumerator {
+public:
+	virtual ~ProcessEnumerator() = default;
+
+	virtual void EnumerateProcesses(std::vector<ProcessInfo>& processes) = 0;
+	virtual void EnumerateWindows(std::vector<WindowInfo>& windows) = 0;
+};
+
+struct ProcessQuery {
+	enum class Kind : uint8_t {
+		ExeName, // case insensitive, "spotify.exe" finds "Spotify.exe"
+		WindowTitle, // exact
+		ProcessId,
+	};
+
+	Kind kind;
+	std::string name;
+	uint32_t processId;
+
+	static ProcessQuery ByExeName(std::string exeName) { return ProcessQuery { Kind::ExeName, std::move(exeName), 0 }; }
+	static ProcessQuery ByWindowTitle(std::string title) { return ProcessQuery { Kind::WindowTitle, std::move(title), 0 }; }
+	static ProcessQuery ById(uint32_t processId) { return ProcessQuery { Kind::ProcessId, { }, processId }; }
+};
+
+// Index of running processes and their windows: exe name, window title and PID lookups are hash lookups.
+//
+// Refresh() takes a fresh snapshot from the enumerator and applies only what changed to the index, a background
+// thread does that every poll interval. Apps like browsers and Spotify run a whole tree of processes under one
+// exe name; a lookup by name picks the one that owns a visible window, or failing that the root of the tree, which
+// is the one process loopback capture with its tree included wants.
+//
+// Lookups and waits may come from any thread. Wait callbacks run on the refresh thread (or the caller's, if the
+// process is already there) and must not call back into the registry.
+class ProcessRegistry {
+public:
+	using WaitCallback = std::function<void(uint32_t processId)>;
+	using WaitId = uint64_t;
+
+	// Builds the index before returning, then keeps it up to date every pollInterval
+	ProcessRegistry(std::unique_ptr<ProcessEnumerator> enumerator, std::chrono::milliseconds pollInterval);
+	~ProcessRegistry();
+
+	ProcessRegistry(const ProcessRegistry&) = delete;
+	ProcessRegistry& operator=(const ProcessRegistry&) = delete;
+
+	std::optional<uint32_t> Find(const ProcessQuery& query) const;
+
+	// Calls callback once, as soon as something matches query (right away if something already does).
+	// Returns an id for CancelWait, which is harmless after the callback ran.
+	WaitId WaitFor(const ProcessQuery& query, WaitCallback callback);
+	void CancelWait(WaitId id);
+
+	// Takes a snapshot now instead of waiting for the next poll. Returns how many processes came and went.
+	size_t Refresh();
+
+	size_t ProcessCount() const;
+
+private:
+	struct Process {
+		uint32_t parentProcessId;
+		std::string exeName; // lowercased
+		uint32_t windowCount;
+	};
+
+	struct Wait {
+		ProcessQuery query;
+		WaitCallback callback;
+	};
+
+	static std::string Lowercase(const std::string& text);
+
+	void AddProcess(const ProcessInfo& info);
+	void RemoveProcess(uint32_t processId);
+	// Recomputes the pick for one exe name, only called for names whose processes or windows changed
+	void UpdatePreferred(const std::string& exeName);
+	std::optional<uint32_t> FindLocked(const ProcessQuery& query) const;
+	void PollLoop();
+
+	std::unique_ptr<ProcessEnumerator> enumerator;
+	const std::chrono::milliseconds pollInterval;
+
+	// serializes Refresh, the enumerator and the scratch vectors are only touched under it
+	std::mutex refreshMutex;
+	std::vector<ProcessInfo> processScratch;
+	std::vector<WindowInfo> windowScratch;
+
+	mutable std::mutex mutex;
+	std::unordered_map<uint32_t, Process> processes;
+	// lowercased exe name -> every PID running it, and the one lookups return
+	std::unordered_map<std::string, std::vector<uint32_t>> processesByName;
+	std::unordered_map<std::string, uint32_t> preferredByName;
+	// window title -> owning PID, and PID -> its titles to undo that when the window goes
+	std::unordered_map<std::string, uint32_t> processByTitle;
+	std::unordered_map<uint32_t, std::vector<std::string>> titlesByProcess;
+
+	std::unordered_map<WaitId, Wait> waits;
+	WaitId nextWaitId;
+
+	std::condition_variable pollSignal;
+	bool stopping;
+	std::thread poller;
+};
+
+#endif // PROCESS_REGISTRY_HPP
@@ -6,8 +6,9 @@
 #include <godot_cpp/core/defs.hpp>
 #include <godot_cpp/godot.hpp>
 
+#include "audioeffect_wasapi_app_capture.h"
 #include "audiostream_wasapi_app_capture.h"
-#include <RTWorkQ.h>
+#include "audiostream_wasapi_multi_capture.h"
 
 using namespace godot;
 
@@ -19,12 +20,20 @@ void initialize_types(ModuleInitializationLevel p_level)
 
 	ClassDB::register_class<AudioStreamWasapiAppCapture>();
 	ClassDB::register_class<AudioStreamPlaybackWasapiAppCapture>();
+	ClassDB::register_class<AudioStreamWasapiMultiCapture>();
+	ClassDB::register_class<AudioStreamPlaybackWasapiMultiCapture>();
+	ClassDB::register_class<AudioEffectWasapiAppCapture>();
+	ClassDB::register_class<AudioEffectWasapiAppCaptureInstance>();
+
+	AudioStreamWasapiAppCapture::initialize_sessions();
 }
 
 void uninitialize_types(ModuleInitializationLevel p_level) {
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
+
+	AudioStreamWasapiAppCapture::uninitialize_sessions();
 }
 
 extern "C"
@@ -32,10 +41,9 @@ extern "C"
 	// Initialization.
 
 	GDExtensionBool GDE_EXPORT library_init(GDExtensionInterfaceGetProcAddress p_get_proc_address, GDExtensionClassLibraryPtr p_library, GDExtensionInitialization *r_initialization) {
-		// make sure com and rtwq inited :skull:
+		// make sure com inited :skull: (rtwq only once we know the capture runs in here, see initialize_sessions)
 		CoInitializeEx(0, COINIT_MULTITHREADED);
-		RtwqStartup();
-		
+
 		GDExtensionBinding::InitObject init_obj(p_get_proc_address, p_library, r_initialization);
 
 		init_obj.register_initializer(initialize_types);
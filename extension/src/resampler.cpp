@@ -0,0 +1,308 @@
+#include "resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+// Kaiser beta, about 80dB of stopband with 32 taps
+constexpr double KAISER_BETA = 8.0;
+// Passband edge as a fraction of the lower of the two Nyquist frequencies
+constexpr double ROLLOFF = 0.9;
+
+// Modified Bessel function of the first kind, order 0
+double BesselI0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for(int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if(term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+void DotScalar(const float* coefficients, const float* left, const float* right, float* outLeft, float* outRight) {
+	float sumLeft = 0.0f;
+	float sumRight = 0.0f;
+	for(uint32_t i = 0; i < PolyphaseResampler::TAPS; i++) {
+		sumLeft += coefficients[i] * left[i];
+		sumRight += coefficients[i] * right[i];
+	}
+	*outLeft = sumLeft;
+	*outRight = sumRight;
+}
+
+#if defined(SIMD_X86)
+float HorizontalSum(__m128 value) {
+	__m128 shuffled = _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(value, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+void DotSse(const float* coefficients, const float* left, const float* right, float* outLeft, float* outRight) {
+	__m128 sumLeft = _mm_setzero_ps();
+	__m128 sumRight = _mm_setzero_ps();
+	for(uint32_t i = 0; i < PolyphaseResampler::TAPS; i += 4) {
+		const __m128 c = _mm_loadu_ps(coefficients + i);
+		sumLeft = _mm_add_ps(sumLeft, _mm_mul_ps(c, _mm_loadu_ps(left + i)));
+		sumRight = _mm_add_ps(sumRight, _mm_mul_ps(c, _mm_loadu_ps(right + i)));
+	}
+	*outLeft = HorizontalSum(sumLeft);
+	*outRight = HorizontalSum(sumRight);
+}
+
+SIMD_TARGET_AVX void DotAvx(const float* coefficients, const float* left, const float* right, float* outLeft, float* outRight) {
+	__m256 sumLeft = _mm256_setzero_ps();
+	__m256 sumRight = _mm256_setzero_ps();
+	for(uint32_t i = 0; i < PolyphaseResampler::TAPS; i += 8) {
+		const __m256 c = _mm256_loadu_ps(coefficients + i);
+		sumLeft = _mm256_add_ps(sumLeft, _mm256_mul_ps(c, _mm256_loadu_ps(left + i)));
+		sumRight = _mm256_add_ps(sumRight, _mm256_mul_ps(c, _mm256_loadu_ps(right + i)));
+	}
+	*outLeft = HorizontalSum(_mm_add_ps(_mm256_castps256_ps128(sumLeft), _mm256_extractf128_ps(sumLeft, 1)));
+	*outRight = HorizontalSum(_mm_add_ps(_mm256_castps256_ps128(sumRight), _mm256_extractf128_ps(sumRight, 1)));
+}
+#elif defined(SIMD_NEON)
+void DotNeon(const float* coefficients, const float* left, const float* right, float* outLeft, float* outRight) {
+	float32x4_t sumLeft = vdupq_n_f32(0.0f);
+	float32x4_t sumRight = vdupq_n_f32(0.0f);
+	for(uint32_t i = 0; i < PolyphaseResampler::TAPS; i += 4) {
+		const float32x4_t c = vld1q_f32(coefficients + i);
+		sumLeft = vmlaq_f32(sumLeft, c, vld1q_f32(left + i));
+		sumRight = vmlaq_f32(sumRight, c, vld1q_f32(right + i));
+	}
+	*outLeft = vaddvq_f32(sumLeft);
+	*outRight = vaddvq_f32(sumRight);
+}
+#endif
+
+PolyphaseResampler::DotFunction SelectDot(SimdLevel level) {
+	switch(level) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return DotAvx;
+	case SimdLevel::Baseline: return DotSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return DotNeon;
+#endif
+	default: return DotScalar;
+	}
+}
+
+static_assert(PolyphaseResampler::TAPS % 8 == 0, "the SIMD kernels assume whole AVX vectors of taps");
+
+} // namespace
+
+PolyphaseResampler::PolyphaseResampler(uint32_t inputRate, uint32_t outputRate, SimdLevel simd, bool variableRatio) :
+	inputRate { inputRate },
+	outputRate { outputRate },
+	simd { ClampSimdLevel(simd) },
+	dot { SelectDot(ClampSimdLevel(simd)) },
+	exact { false },
+	phaseCount { 0 },
+	stepPhases { 0 },
+	stepWhole { 0 },
+	nominalStep { 0 },
+	step { 0 },
+	coefficients { },
+	scratch(TAPS),
+	left(2 * TAPS + CHUNK_FRAMES),
+	right(2 * TAPS + CHUNK_FRAMES),
+	filled { 0 },
+	base { 0 },
+	phase { 0 },
+	silentTail { 0 }
+{
+	const uint32_t divisor = std::gcd(inputRate, outputRate);
+	const uint32_t upFactor = outputRate / divisor;
+	const uint32_t downFactor = inputRate / divisor;
+
+	if(upFactor <= MAX_EXACT_PHASES && !variableRatio) {
+		exact = true;
+		phaseCount = upFactor;
+		stepWhole = downFactor / upFactor;
+		stepPhases = downFactor % upFactor;
+	} else {
+		nominalStep = (uint64_t(inputRate) << 32) / outputRate;
+		step = nominalStep;
+	}
+
+	BuildFilters();
+	Reset();
+}
+
+void PolyphaseResampler::BuildFilters() {
+	const uint32_t phases = exact ? phaseCount : INTERPOLATED_PHASES + 1;
+	const uint32_t tableSpacing = exact ? phaseCount : INTERPOLATED_PHASES;
+	coefficients.assign(size_t(phases) * TAPS, 0.0f);
+
+	// cutoff in cycles per input sample, pulled below the output Nyquist when decimating
+	const double ratio = double(outputRate) / inputRate;
+	const double cutoff = 0.5 * ROLLOFF * (ratio < 1.0 ? ratio : 1.0);
+	const double halfWidth = TAPS / 2.0;
+	const double windowNormalization = BesselI0(KAISER_BETA);
+
+	for(uint32_t p = 0; p < phases; p++) {
+		const double fraction = double(p) / tableSpacing;
+		float* phaseCoefficients = coefficients.data() + size_t(p) * TAPS;
+
+		double sum = 0.0;
+		for(uint32_t i = 0; i < TAPS; i++) {
+			// distance from the point this phase interpolates, which sits between taps TAPS/2 - 1 and TAPS/2
+			const double x = double(i) - (halfWidth - 1.0) - fraction;
+			const double sincArgument = 2.0 * cutoff * x;
+			const double sinc = std::abs(sincArgument) < 1e-9 ? 1.0 : std::sin(PI * sincArgument) / (PI * sincArgument);
+
+			const double u = x / halfWidth;
+			const double window = std::abs(u) >= 1.0 ? 0.0 : BesselI0(KAISER_BETA * std::sqrt(1.0 - u * u)) / windowNormalization;
+
+			const double value = 2.0 * cutoff * sinc * window;
+			phaseCoefficients[i] = static_cast<float>(value);
+			sum += value;
+		}
+
+		// unity gain at DC for every phase, otherwise the phases ripple against each other
+		for(uint32_t i = 0; i < TAPS; i++) {
+			phaseCoefficients[i] = static_cast<float>(phaseCoefficients[i] / sum);
+		}
+	}
+}
+
+void PolyphaseResampler::Reset() {
+	// start with half a filter of silence so the first output is centered on the first input frame
+	std::fill(left.begin(), left.end(), 0.0f);
+	std::fill(right.begin(), right.end(), 0.0f);
+	filled = TAPS / 2 - 1;
+	base = 0;
+	phase = 0;
+	step = nominalStep;
+	silentTail = filled;
+}
+
+void PolyphaseResampler::Compact() {
+	if(base == 0) return;
+
+	const size_t remaining = filled - base;
+	memmove(left.data(), left.data() + base, remaining * sizeof(float));
+	memmove(right.data(), right.data() + base, remaining * sizeof(float));
+	filled = remaining;
+	base = 0;
+	if(silentTail > filled) silentTail = filled;
+}
+
+size_t PolyphaseResampler::Push(const StereoFrame* input, size_t count) {
+	if(left.size() - filled < count) Compact();
+
+	const size_t space = left.size() - filled;
+	if(count > space) count = space;
+
+	float* destinationLeft = left.data() + filled;
+	float* destinationRight = right.data() + filled;
+	for(size_t i = 0; i < count; i++) {
+		destinationLeft[i] = input[i].left;
+		destinationRight[i] = input[i].right;
+	}
+
+	filled += count;
+	silentTail = 0;
+	return count;
+}
+
+size_t PolyphaseResampler::PushSilence(size_t count) {
+	if(left.size() - filled < count) Compact();
+
+	const size_t space = left.size() - filled;
+	if(count > space) count = space;
+
+	std::fill(left.begin() + filled, left.begin() + filled + count, 0.0f);
+	std::fill(right.begin() + filled, right.begin() + filled + count, 0.0f);
+
+	filled += count;
+	silentTail += count;
+	return count;
+}
+
+bool PolyphaseResampler::IsSilent() const {
+	// every output from here on reads from base onwards
+	return silentTail >= filled - base;
+}
+
+void PolyphaseResampler::SetRatioScale(double scale) {
+	if(exact) return;
+	step = static_cast<uint64_t>(static_cast<double>(nominalStep) * scale + 0.5);
+}
+
+size_t PolyphaseResampler::Pending() const {
+	// the next output is centered between base + TAPS/2 - 1 and the frame after it
+	const size_t center = base + TAPS / 2 - 1;
+	return filled > center ? filled - center : 0;
+}
+
+size_t PolyphaseResampler::Available() const {
+	if(filled < base + TAPS) return 0;
+	const uint64_t lastBase = filled - TAPS - base;
+
+	if(exact) {
+		const uint64_t stepTotal = uint64_t(stepWhole) * phaseCount + stepPhases;
+		return static_cast<size_t>(((lastBase + 1) * phaseCount - phase + stepTotal - 1) / stepTotal);
+	}
+
+	const uint64_t limit = (lastBase + 1) << 32;
+	return static_cast<size_t>((limit - phase + step - 1) / step);
+}
+
+void PolyphaseResampler::Advance() {
+	if(exact) {
+		base += stepWhole;
+		phase += stepPhases;
+		if(phase >= phaseCount) {
+			phase -= phaseCount;
+			base++;
+		}
+	} else {
+		const uint64_t position = uint64_t(phase) + step;
+		base += static_cast<size_t>(position >> 32);
+		phase = static_cast<uint32_t>(position);
+	}
+}
+
+size_t PolyphaseResampler::Pull(StereoFrame* output, size_t count) {
+	const size_t available = Available();
+	if(count > available) count = available;
+
+	if(exact) {
+		for(size_t i = 0; i < count; i++) {
+			dot(coefficients.data() + size_t(phase) * TAPS, left.data() + base, right.data() + base, &output[i].left, &output[i].right);
+			Advance();
+		}
+	} else {
+		float* interpolated = scratch.data();
+		for(size_t i = 0; i < count; i++) {
+			const uint32_t index = phase >> 24;
+			const float weight = static_cast<float>(phase & 0xFFFFFF) * (1.0f / 16777216.0f);
+			const float* from = coefficients.data() + size_t(index) * TAPS;
+			const float* to = from + TAPS;
+			for(uint32_t tap = 0; tap < TAPS; tap++) {
+				interpolated[tap] = from[tap] + weight * (to[tap] - from[tap]);
+			}
+
+			dot(interpolated, left.data() + base, right.data() + base, &output[i].left, &output[i].right);
+			Advance();
+		}
+	}
+
+	return count;
+}
+
+size_t PolyphaseResampler::Skip(size_t count) {
+	const size_t available = Available();
+	if(count > available) count = available;
+
+	for(size_t i = 0; i < count; i++) Advance();
+	return count;
+}
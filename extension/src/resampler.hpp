@@ -0,0 +1,97 @@
+#ifndef RESAMPLER_HPP
+#define RESAMPLER_HPP
+
+#include "audio_types.hpp"
+#include "simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Band-limited polyphase resampler for interleaved stereo, Kaiser windowed sinc with TAPS taps per phase.
+//
+// When the rate ratio reduces to L/M with L <= MAX_EXACT_PHASES (44.1k <-> 48k, any integer ratio...) every output
+// lands exactly on one of L precomputed phases and no interpolation is needed. Anything else steps a 32.32 fixed
+// point position through INTERPOLATED_PHASES phases and interpolates linearly between the two nearest ones.
+// A variable ratio resampler always takes the interpolated path, so SetRatioScale() can nudge the step by any amount.
+//
+// Streaming: Push() appends input, Available() says how many outputs can be produced from it and Pull() produces
+// them. Memory is allocated in the constructor only, so Push/Pull are safe on a real-time thread.
+class PolyphaseResampler {
+public:
+	static constexpr uint32_t TAPS = 32;
+	static constexpr uint32_t MAX_EXACT_PHASES = 512;
+	static constexpr uint32_t INTERPOLATED_PHASES = 256;
+	// Input frames Push() can take between two Pull()s
+	static constexpr size_t CHUNK_FRAMES = 2048;
+
+	PolyphaseResampler(uint32_t inputRate, uint32_t outputRate, SimdLevel simd = SimdLevel::Avx, bool variableRatio = false);
+
+	PolyphaseResampler(const PolyphaseResampler&) = delete;
+	PolyphaseResampler& operator=(const PolyphaseResampler&) = delete;
+
+	// Forget all history, as if freshly constructed
+	void Reset();
+
+	// Returns how many input frames were taken, less than count once the history is full and needs a Pull()
+	size_t Push(const StereoFrame* input, size_t count);
+	// Push that many frames of silence, without anything to copy them from
+	size_t PushSilence(size_t count);
+	// Only silence left in the history: whatever Available() says can be produced is all zeros, so Skip() plus
+	// zeroing the destination gives the same result as Pull() without running the filter
+	bool IsSilent() const;
+	size_t Available() const;
+	size_t Pull(StereoFrame* output, size_t count);
+	// Like Pull, but throws the outputs away without computing them
+	size_t Skip(size_t count);
+
+	// Variable ratio only: consume scale times as much input per output as the nominal rates say, > 1 drains faster.
+	// Takes effect from the next output on, same thread as Pull.
+	void SetRatioScale(double scale);
+	// Input frames pushed but not yet reached by the filter center, i.e. what this adds on top of a buffer's latency
+	size_t Pending() const;
+
+	uint32_t InputRate() const { return inputRate; }
+	uint32_t OutputRate() const { return outputRate; }
+	bool IsExact() const { return exact; }
+	SimdLevel Kernel() const { return simd; }
+
+	// Delay added by the filter, in input frames: an output can't be produced before this much input after it arrived
+	static constexpr uint32_t Latency() { return TAPS / 2; }
+
+	using DotFunction = void(*)(const float* coefficients, const float* left, const float* right, float* outLeft, float* outRight);
+
+private:
+	void BuildFilters();
+	void Compact();
+	void Advance();
+
+	const uint32_t inputRate;
+	const uint32_t outputRate;
+	const SimdLevel simd;
+	const DotFunction dot;
+
+	bool exact;
+	// exact: phase advances by stepPhases per output and wraps at phaseCount, bumping base
+	uint32_t phaseCount;
+	uint32_t stepPhases;
+	uint32_t stepWhole;
+	// interpolated: 32.32 fixed point step in input frames, nominal and currently scaled
+	uint64_t nominalStep;
+	uint64_t step;
+
+	// phase-major, TAPS coefficients per phase (interpolated mode has one extra phase to interpolate towards)
+	std::vector<float> coefficients;
+	std::vector<float> scratch;
+
+	// deinterleaved input history so the dot products run over contiguous memory
+	std::vector<float> left;
+	std::vector<float> right;
+	size_t filled;
+	size_t base;
+	uint32_t phase;
+	// how many of the newest history frames are known to be zero
+	size_t silentTail;
+};
+
+#endif // RESAMPLER_HPP
@@ -0,0 +1,260 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Keep the producer and consumer cursors on their own cache lines so they don't false-share
+#ifndef RING_BUFFER_CACHE_LINE
+#define RING_BUFFER_CACHE_LINE 64
+#endif
+
+// What the producer does when the consumer falls a full buffer behind
+enum class OverrunPolicy {
+	// Keep writing, the consumer skips forward to the newest data (lowest latency, default)
+	DropOldest,
+	// Refuse whatever doesn't fit, the consumer keeps reading the old data in order
+	DropNewest,
+};
+
+// A view into the ring that may wrap around its end, so it comes in up to two contiguous parts.
+// Lets the capture side convert straight into the ring and the mixer read straight out of it, without staging buffers.
+template<typename T>
+struct RingSpan {
+	T* first;
+	size_t firstCount;
+	T* second;
+	size_t secondCount;
+
+	size_t Size() const { return firstCount + secondCount; }
+	bool Empty() const { return Size() == 0; }
+
+	T& operator[](size_t index) const {
+		return index < firstCount ? first[index] : second[index - firstCount];
+	}
+
+	template<typename Source>
+	void CopyFrom(const Source* elements) const {
+		memcpy(first, elements, firstCount * sizeof(T));
+		memcpy(second, elements + firstCount, secondCount * sizeof(T));
+	}
+
+	template<typename Destination>
+	void CopyTo(Destination* elements) const {
+		memcpy(elements, first, firstCount * sizeof(T));
+		memcpy(elements + firstCount, second, secondCount * sizeof(T));
+	}
+};
+
+// The rings size their buffers to a power of two, so wrapping a free running cursor is a mask
+inline size_t RoundUpPowerOfTwo(size_t value) {
+	size_t result = 1;
+	while(result < value) result <<= 1;
+	return result;
+}
+
+// count elements of a power of two sized buffer starting at cursor, split where they wrap around its end
+template<typename View, typename T>
+RingSpan<View> MakeRingSpan(T* buffer, size_t bufferMask, uint64_t cursor, size_t count) {
+	const size_t start = static_cast<size_t>(cursor) & bufferMask;
+	const size_t firstPart = bufferMask + 1 - start;
+	if(count <= firstPart) {
+		return RingSpan<View> { buffer + start, count, buffer, 0 };
+	}
+	return RingSpan<View> { buffer + start, firstPart, buffer, count - firstPart };
+}
+
+// Wait-free single producer / single consumer ring buffer.
+// Write() must only ever be called from one thread (the capture thread) and Read() from one other thread (the mixer).
+// Neither side locks, allocates or spins. The cursors are free running 64-bit counters, so (write - read) is always
+// the fill level and wrapping only happens when indexing, with a mask since the capacity is a power of two.
+template<typename T>
+class CircularBuffer {
+	static_assert(std::is_trivially_copyable<T>::value, "CircularBuffer elements are memcpy'd");
+
+public:
+	CircularBuffer(size_t minimumCapacity, OverrunPolicy policy = OverrunPolicy::DropOldest) :
+		buffer { nullptr },
+		bufferSize { RoundUpPowerOfTwo(minimumCapacity) },
+		bufferMask { bufferSize - 1 },
+		policy { policy },
+		writeCursor { 0 },
+		writeReserve { 0 },
+		droppedNewest { 0 },
+		droppedOversized { 0 },
+		readCursor { 0 },
+		droppedOldest { 0 }
+	{
+		buffer = new T[bufferSize];
+		memset(buffer, 0, bufferSize * sizeof(T));
+	}
+
+	~CircularBuffer() {
+		delete[] buffer;
+		buffer = nullptr;
+	}
+
+	CircularBuffer(const CircularBuffer&) = delete;
+	CircularBuffer& operator=(const CircularBuffer&) = delete;
+
+	// Producer side. Hands out up to count slots to fill in place, which only become visible to the reader on
+	// CommitWrite. With DropNewest the span is clamped to the free space and the shortfall is counted as dropped,
+	// with DropOldest it's only clamped to the capacity and the oldest unread data gets overwritten.
+	RingSpan<T> ReserveWrite(size_t count) {
+		const uint64_t write = writeCursor.load(std::memory_order_relaxed);
+
+		if(policy.load(std::memory_order_relaxed) == OverrunPolicy::DropNewest) {
+			const uint64_t used = write - readCursor.load(std::memory_order_acquire);
+			const size_t writable = used >= bufferSize ? 0 : bufferSize - static_cast<size_t>(used);
+			if(count > writable) {
+				droppedNewest.fetch_add(count - writable, std::memory_order_relaxed);
+				count = writable;
+			}
+		} else if(count > bufferSize) {
+			droppedOversized.fetch_add(count - bufferSize, std::memory_order_relaxed);
+			count = bufferSize;
+		}
+
+		// Announce which slots are about to be overwritten before touching them, so a reader racing with us can
+		// tell afterwards that part of what it looked at was torn (see ConsumeRead).
+		writeReserve.store(write + count, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return MakeSpan<T>(write, count);
+	}
+
+	// Producer side. Publishes the first count slots of the last reservation.
+	void CommitWrite(size_t count) {
+		const uint64_t write = writeCursor.load(std::memory_order_relaxed);
+		writeCursor.store(write + count, std::memory_order_release);
+	}
+
+	// Producer side. Returns how many elements were actually stored, which is less than count when DropNewest refuses
+	// some or when a single write is larger than the whole buffer.
+	size_t Write(const T* elements, size_t count) {
+		if(count > bufferSize && policy.load(std::memory_order_relaxed) == OverrunPolicy::DropOldest) {
+			// only the tail of an oversized write could ever be read back anyway
+			elements += count - bufferSize;
+			droppedOversized.fetch_add(count - bufferSize, std::memory_order_relaxed);
+			count = bufferSize;
+		}
+
+		const RingSpan<T> span = ReserveWrite(count);
+		span.CopyFrom(elements);
+		CommitWrite(span.Size());
+		return span.Size();
+	}
+
+	// Consumer side. Looks at up to count of the oldest unread elements in place, without consuming them.
+	RingSpan<const T> PeekRead(size_t count) {
+		uint64_t read = readCursor.load(std::memory_order_relaxed);
+		const uint64_t write = writeCursor.load(std::memory_order_acquire);
+
+		if(write - read > bufferSize) {
+			// the producer lapped us, everything older than one buffer is gone
+			droppedOldest.fetch_add(write - read - bufferSize, std::memory_order_relaxed);
+			read = write - bufferSize;
+			readCursor.store(read, std::memory_order_release);
+		}
+
+		const size_t readable = static_cast<size_t>(write - read);
+		if(count > readable) count = readable;
+
+		return MakeSpan<const T>(read, count);
+	}
+
+	// Consumer side. Releases the first count elements of the last peek back to the producer.
+	// Returns how many of them were still intact: with DropOldest the producer may have lapped us while we were
+	// looking, in which case the torn elements at the front are reported as dropped and must be discarded.
+	size_t ConsumeRead(size_t count) {
+		const uint64_t read = readCursor.load(std::memory_order_relaxed);
+
+		// Anything the producer reserved past read + size may have been overwritten in the meantime.
+		// Checked regardless of policy, the producer may have just been switched to DropOldest.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t reserve = writeReserve.load(std::memory_order_relaxed);
+		size_t torn = 0;
+		if(reserve - read > bufferSize) {
+			torn = static_cast<size_t>(reserve - read - bufferSize);
+			if(torn > count) torn = count;
+			droppedOldest.fetch_add(torn, std::memory_order_relaxed);
+		}
+
+		readCursor.store(read + count, std::memory_order_release);
+		return count - torn;
+	}
+
+	// Consumer side. Returns how many elements were copied out, in order, oldest first.
+	size_t Read(T* elements, size_t count) {
+		const RingSpan<const T> span = PeekRead(count);
+		span.CopyTo(elements);
+
+		count = span.Size();
+		const size_t intact = ConsumeRead(count);
+		if(intact < count) {
+			memmove(elements, elements + (count - intact), intact * sizeof(T));
+		}
+		return intact;
+	}
+
+	// Elements the consumer could read right now. Safe to call from any thread, it's only a snapshot.
+	size_t Readable() const {
+		const uint64_t read = readCursor.load(std::memory_order_acquire);
+		const uint64_t write = writeCursor.load(std::memory_order_acquire);
+		const uint64_t used = write - read;
+		return used > bufferSize ? bufferSize : static_cast<size_t>(used);
+	}
+
+	// Elements the producer could write without dropping anything. Also just a snapshot.
+	size_t Writable() const {
+		return bufferSize - Readable();
+	}
+
+	// Consumer side. Throws away everything that has been written so far.
+	void Flush() {
+		readCursor.store(writeCursor.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+	size_t Capacity() const { return bufferSize; }
+
+	// Only the producer acts on the policy, so it can be switched at any time from any thread
+	OverrunPolicy Policy() const { return policy.load(std::memory_order_relaxed); }
+	void SetPolicy(OverrunPolicy newPolicy) { policy.store(newPolicy, std::memory_order_relaxed); }
+
+	// Elements lost to overruns, either refused by the producer (DropNewest) or skipped by the consumer (DropOldest)
+	uint64_t DroppedCount() const {
+		return droppedNewest.load(std::memory_order_relaxed) + droppedOversized.load(std::memory_order_relaxed) +
+			droppedOldest.load(std::memory_order_relaxed);
+	}
+
+private:
+	template<typename View>
+	RingSpan<View> MakeSpan(uint64_t cursor, size_t count) const {
+		return MakeRingSpan<View>(buffer, bufferMask, cursor, count);
+	}
+
+	// shared by both sides, only the policy ever changes after construction
+	T* buffer;
+	const size_t bufferSize;
+	const size_t bufferMask;
+	std::atomic<OverrunPolicy> policy;
+
+	// producer owned
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint64_t> writeCursor;
+	std::atomic<uint64_t> writeReserve;
+	std::atomic<uint64_t> droppedNewest;
+	// DropOldest writes larger than the whole buffer, counted here so the producer never touches the consumer's line
+	std::atomic<uint64_t> droppedOversized;
+
+	// consumer owned
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint64_t> readCursor;
+	std::atomic<uint64_t> droppedOldest;
+
+	// pad out the consumer line so whatever gets allocated after us doesn't share it
+	char padding[RING_BUFFER_CACHE_LINE - 2 * sizeof(std::atomic<uint64_t>)];
+};
+
+#endif // RING_BUFFER_HPP
@@ -0,0 +1,197 @@
+#include "sample_convert.hpp"
+
+#include <cstring>
+
+namespace {
+
+template<SampleEncoding E> struct Encoding;
+
+template<> struct Encoding<SampleEncoding::Int16> {
+	static constexpr size_t BYTES = 2;
+	static constexpr float SCALE = 1.0f / 32768.0f;
+	// samples past the last converted one a vector load touches
+	static constexpr size_t OVERREAD = 0;
+
+	static int32_t Load(const uint8_t* input) {
+		int16_t sample;
+		memcpy(&sample, input, sizeof(sample));
+		return sample;
+	}
+};
+
+template<> struct Encoding<SampleEncoding::Int24> {
+	static constexpr size_t BYTES = 3;
+	static constexpr float SCALE = 1.0f / 8388608.0f;
+	// each sample is read as 4 bytes, the last one of a vector borrows a byte from the next sample
+	static constexpr size_t OVERREAD = 1;
+
+	static int32_t Load(const uint8_t* input) {
+		const uint32_t high = uint32_t(input[0]) << 8 | uint32_t(input[1]) << 16 | uint32_t(input[2]) << 24;
+		return static_cast<int32_t>(high) >> 8;
+	}
+};
+
+template<> struct Encoding<SampleEncoding::Int32> {
+	static constexpr size_t BYTES = 4;
+	static constexpr float SCALE = 1.0f / 2147483648.0f;
+	static constexpr size_t OVERREAD = 0;
+
+	static int32_t Load(const uint8_t* input) {
+		int32_t sample;
+		memcpy(&sample, input, sizeof(sample));
+		return sample;
+	}
+};
+
+// The vector kernels move every encoding's sign bit up to bit 31 and share one scale. Both that and the reference
+// scale by a power of two, so they agree to the bit.
+constexpr float JUSTIFIED_SCALE = 1.0f / 2147483648.0f;
+
+template<SampleEncoding E>
+void ConvertScalar(const uint8_t* input, float* output, size_t sampleCount) {
+	for(size_t i = 0; i < sampleCount; i++) {
+		output[i] = static_cast<float>(Encoding<E>::Load(input + i * Encoding<E>::BYTES)) * Encoding<E>::SCALE;
+	}
+}
+
+// already what we want, whatever the instruction set
+void ConvertFloat(const uint8_t* input, float* output, size_t sampleCount) {
+	memcpy(output, input, sampleCount * sizeof(float));
+}
+
+#if defined(SIMD_X86)
+// Four samples as int32, sign bit at bit 31 (int16 only comes in eights, below)
+template<SampleEncoding E> __m128i LoadJustified(const uint8_t* input);
+
+template<> inline __m128i LoadJustified<SampleEncoding::Int24>(const uint8_t* input) {
+	int32_t words[4];
+	for(int i = 0; i < 4; i++) memcpy(&words[i], input + i * 3, sizeof(int32_t));
+	return _mm_slli_epi32(_mm_setr_epi32(words[0], words[1], words[2], words[3]), 8);
+}
+
+template<> inline __m128i LoadJustified<SampleEncoding::Int32>(const uint8_t* input) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+}
+
+// Eight samples as two halves. int16 gets all of them from one load, the rest load each half on its own.
+template<SampleEncoding E> inline void LoadJustified8(const uint8_t* input, __m128i& low, __m128i& high) {
+	low = LoadJustified<E>(input);
+	high = LoadJustified<E>(input + 4 * Encoding<E>::BYTES);
+}
+
+template<> inline void LoadJustified8<SampleEncoding::Int16>(const uint8_t* input, __m128i& low, __m128i& high) {
+	const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+	low = _mm_unpacklo_epi16(_mm_setzero_si128(), samples);
+	high = _mm_unpackhi_epi16(_mm_setzero_si128(), samples);
+}
+
+template<SampleEncoding E>
+void ConvertSse(const uint8_t* input, float* output, size_t sampleCount) {
+	const __m128 scale = _mm_set1_ps(JUSTIFIED_SCALE);
+	size_t i = 0;
+	for(; i + 8 + Encoding<E>::OVERREAD <= sampleCount; i += 8) {
+		__m128i low, high;
+		LoadJustified8<E>(input + i * Encoding<E>::BYTES, low, high);
+		_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+		_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+	}
+	ConvertScalar<E>(input + i * Encoding<E>::BYTES, output + i, sampleCount - i);
+}
+
+// AVX has no 256 bit integer ops, the loads stay 128 bit and only the conversion and scaling are 8 wide
+template<SampleEncoding E>
+SIMD_TARGET_AVX void ConvertAvx(const uint8_t* input, float* output, size_t sampleCount) {
+	const __m256 scale = _mm256_set1_ps(JUSTIFIED_SCALE);
+	size_t i = 0;
+	for(; i + 8 + Encoding<E>::OVERREAD <= sampleCount; i += 8) {
+		__m128i low, high;
+		LoadJustified8<E>(input + i * Encoding<E>::BYTES, low, high);
+		const __m256i justified = _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(justified), scale));
+	}
+	ConvertScalar<E>(input + i * Encoding<E>::BYTES, output + i, sampleCount - i);
+}
+#elif defined(SIMD_NEON)
+template<SampleEncoding E> int32x4_t LoadJustified(const uint8_t* input);
+
+template<> inline int32x4_t LoadJustified<SampleEncoding::Int16>(const uint8_t* input) {
+	return vshll_n_s16(vreinterpret_s16_u8(vld1_u8(input)), 16);
+}
+
+template<> inline int32x4_t LoadJustified<SampleEncoding::Int24>(const uint8_t* input) {
+	int32_t words[4];
+	for(int i = 0; i < 4; i++) memcpy(&words[i], input + i * 3, sizeof(int32_t));
+	return vshlq_n_s32(vld1q_s32(words), 8);
+}
+
+template<> inline int32x4_t LoadJustified<SampleEncoding::Int32>(const uint8_t* input) {
+	return vreinterpretq_s32_u8(vld1q_u8(input));
+}
+
+template<SampleEncoding E>
+void ConvertNeon(const uint8_t* input, float* output, size_t sampleCount) {
+	size_t i = 0;
+	for(; i + 4 + Encoding<E>::OVERREAD <= sampleCount; i += 4) {
+		vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(LoadJustified<E>(input + i * Encoding<E>::BYTES)), JUSTIFIED_SCALE));
+	}
+	ConvertScalar<E>(input + i * Encoding<E>::BYTES, output + i, sampleCount - i);
+}
+#endif
+
+template<SampleEncoding E>
+SampleConverter SelectFor(SimdLevel level) {
+	switch(level) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return ConvertAvx<E>;
+	case SimdLevel::Baseline: return ConvertSse<E>;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return ConvertNeon<E>;
+#endif
+	default: return ConvertScalar<E>;
+	}
+}
+
+} // namespace
+
+std::optional<SampleEncoding> EncodingOf(const CaptureFormat& format) {
+	if(format.sampleType == SampleType::Float) {
+		if(format.bitsPerSample == 32) return SampleEncoding::Float32;
+		return std::nullopt;
+	}
+	switch(format.bitsPerSample) {
+	case 16: return SampleEncoding::Int16;
+	case 24: return SampleEncoding::Int24;
+	case 32: return SampleEncoding::Int32;
+	default: return std::nullopt;
+	}
+}
+
+size_t BytesPerSample(SampleEncoding encoding) {
+	switch(encoding) {
+	case SampleEncoding::Int16: return 2;
+	case SampleEncoding::Int24: return 3;
+	default: return 4;
+	}
+}
+
+const char* SampleEncodingName(SampleEncoding encoding) {
+	switch(encoding) {
+	case SampleEncoding::Int16: return "int16";
+	case SampleEncoding::Int24: return "int24";
+	case SampleEncoding::Int32: return "int32";
+	case SampleEncoding::Float32: return "float32";
+	}
+	return "unknown";
+}
+
+SampleConverter SelectConverter(SampleEncoding encoding, SimdLevel level) {
+	level = ClampSimdLevel(level);
+	switch(encoding) {
+	case SampleEncoding::Int16: return SelectFor<SampleEncoding::Int16>(level);
+	case SampleEncoding::Int24: return SelectFor<SampleEncoding::Int24>(level);
+	case SampleEncoding::Int32: return SelectFor<SampleEncoding::Int32>(level);
+	case SampleEncoding::Float32: return ConvertFloat;
+	}
+	return nullptr;
+}
@@ -0,0 +1,36 @@
+#ifndef SAMPLE_CONVERT_HPP
+#define SAMPLE_CONVERT_HPP
+
+#include "capture_source.hpp"
+#include "simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Interleaved integer or float samples in whatever a capture client negotiated, to the float the pipeline runs on.
+// One kernel per encoding and instruction set, each a template instantiation with the sample layout baked in, picked
+// once when the pipeline is configured: the loops themselves never look at the format.
+enum class SampleEncoding {
+	Int16,
+	// packed, 3 bytes per sample
+	Int24,
+	// also 24 valid bits in a 32 bit container, the padding is the low byte
+	Int32,
+	Float32,
+};
+
+// Converts sampleCount samples (channels * frames). Integers are scaled so full scale is [-1, 1).
+// The input needs no alignment, the output none either.
+using SampleConverter = void (*)(const uint8_t* input, float* output, size_t sampleCount);
+
+// Empty for formats there is no kernel for
+std::optional<SampleEncoding> EncodingOf(const CaptureFormat& format);
+size_t BytesPerSample(SampleEncoding encoding);
+const char* SampleEncodingName(SampleEncoding encoding);
+
+// SimdLevel::Scalar is the reference implementation the others are checked against. Levels above what the CPU has
+// are clamped, like everywhere else.
+SampleConverter SelectConverter(SampleEncoding encoding, SimdLevel level = SimdLevel::Avx);
+
+#endif // SAMPLE_CONVERT_HPP
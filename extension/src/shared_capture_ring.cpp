@@ -0,0 +1,290 @@
+#include "shared_capture_ring.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+namespace {
+	using Ring = SharedCaptureRing;
+
+	size_t RecordBytes(size_t frameBytes) {
+		return sizeof(Ring::Record) + (frameBytes + Ring::RECORD_ALIGN - 1) / Ring::RECORD_ALIGN * Ring::RECORD_ALIGN;
+	}
+
+	// The block a writer was handed, checked before anything in it is trusted
+	Ring::Header& Attach(SharedMemory& memory) {
+		if(memory.Size() < Ring::HEADER_BYTES) throw std::runtime_error("shared memory too small for a capture ring");
+		Ring::Header& header = *static_cast<Ring::Header*>(memory.Data());
+		if(header.magic != Ring::MAGIC || header.version != Ring::VERSION) {
+			throw std::runtime_error("shared memory isn't a capture ring of this version");
+		}
+		const uint64_t capacity = header.capacity;
+		if(capacity < Ring::RECORD_ALIGN || (capacity & (capacity - 1)) != 0 || Ring::MemoryBytes(capacity) > memory.Size()) {
+			throw std::runtime_error("capture ring doesn't fit its shared memory");
+		}
+		return header;
+	}
+
+	Ring::Header& LayOut(SharedMemory& memory, size_t capacity) {
+		if(capacity < Ring::RECORD_ALIGN || (capacity & (capacity - 1)) != 0) throw std::invalid_argument("capture ring capacity has to be a power of two");
+		if(memory.Size() < Ring::MemoryBytes(capacity)) throw std::invalid_argument("shared memory too small for the capture ring");
+
+		Ring::Header& header = *new(memory.Data()) Ring::Header { };
+		header.magic = Ring::MAGIC;
+		header.version = Ring::VERSION;
+		header.capacity = capacity;
+		header.state.store(Ring::Starting, std::memory_order_relaxed);
+		header.command.store(Ring::Idle, std::memory_order_relaxed);
+		return header;
+	}
+}
+
+SharedRingWriter::SharedRingWriter(SharedMemory& memory) :
+	header { Attach(memory) },
+	data { static_cast<uint8_t*>(memory.Data()) + Ring::HEADER_BYTES },
+	capacity { header.capacity },
+	bytesPerFrame { 0 },
+	write { header.writeCursor.load(std::memory_order_relaxed) },
+	lostPacket { false },
+	stateSignal { header.state, memory.Name() + ".state", false },
+	commandSignal { header.command, memory.Name() + ".command", false },
+	dataSignal { header.writeSequence, memory.Name() + ".data", false }
+{ }
+
+void SharedRingWriter::Publish(const CaptureFormat& format) {
+	bytesPerFrame = format.BytesPerFrame();
+	header.sampleRate = format.sampleRate;
+	header.channels = format.channels;
+	header.bitsPerSample = format.bitsPerSample;
+	header.sampleType = static_cast<uint32_t>(format.sampleType);
+	header.channelMask = format.channelMask;
+	header.state.store(Ring::Ready, std::memory_order_seq_cst);
+	stateSignal.Wake();
+}
+
+void SharedRingWriter::Fail(uint32_t code) {
+	header.error.store(code, std::memory_order_relaxed);
+	header.state.store(Ring::Failed, std::memory_order_seq_cst);
+	stateSignal.Wake();
+}
+
+Ring::Command SharedRingWriter::WaitForCommand(Ring::Command current, std::chrono::microseconds timeout) {
+	commandSignal.Wait(current, timeout);
+	return static_cast<Ring::Command>(header.command.load(std::memory_order_acquire));
+}
+
+Ring::Record* SharedRingWriter::Reserve(size_t bytes) {
+	const uint64_t read = header.readCursor.load(std::memory_order_acquire);
+	const uint64_t offset = write & (capacity - 1);
+	// records never wrap, skip the rest of the ring if this one doesn't fit before its end
+	const uint64_t padding = capacity - offset < bytes ? capacity - offset : 0;
+	if(write + padding + bytes - read > capacity) return nullptr;
+
+	if(padding != 0) {
+		Ring::Record* pad = reinterpret_cast<Ring::Record*>(data + offset);
+		pad->bytes = static_cast<uint32_t>(padding);
+		pad->type = Ring::Padding;
+		write += padding;
+	}
+	return reinterpret_cast<Ring::Record*>(data + (write & (capacity - 1)));
+}
+
+void SharedRingWriter::Commit(Ring::Record* record) {
+	record->published = CaptureClockNow();
+	write += record->bytes;
+	header.writeCursor.store(write, std::memory_order_release);
+}
+
+void SharedRingWriter::Signal() {
+	// pairs with the reader announcing it's about to sleep: either it sees the new sequence or we see it waiting
+	header.writeSequence.fetch_add(1, std::memory_order_seq_cst);
+	if(header.readerWaiting.load(std::memory_order_seq_cst) != 0) dataSignal.Wake();
+}
+
+void SharedRingWriter::OnPacket(const CapturePacket& packet) {
+	const bool silent = packet.silent || packet.frames == nullptr;
+	const size_t frameBytes = silent ? 0 : size_t(packet.frameCount) * bytesPerFrame;
+	Ring::Record* record = Reserve(RecordBytes(frameBytes));
+	if(record == nullptr) {
+		header.droppedPackets.fetch_add(1, std::memory_order_relaxed);
+		lostPacket = true;
+		return;
+	}
+
+	record->bytes = static_cast<uint32_t>(RecordBytes(frameBytes));
+	record->type = Ring::Packet;
+	record->flags = static_cast<uint16_t>((silent ? Ring::Silent : 0) | (packet.discontinuity || lostPacket ? Ring::Discontinuity : 0) |
+		(packet.timed ? Ring::Timed : 0));
+	record->frameCount = packet.frameCount;
+	record->detail = 0;
+	record->position = packet.position;
+	record->timestamp = packet.timestamp;
+	if(!silent) std::memcpy(record + 1, packet.frames, frameBytes);
+	lostPacket = false;
+	Commit(record);
+}
+
+void SharedRingWriter::OnWakeup(uint32_t packetCount, uint32_t microseconds) {
+	// without room for it the reader just doesn't get this wakeup's stats, it's still woken for the packets
+	Ring::Record* record = Reserve(sizeof(Ring::Record));
+	if(record != nullptr) {
+		record->bytes = sizeof(Ring::Record);
+		record->type = Ring::Wakeup;
+		record->flags = 0;
+		record->frameCount = packetCount;
+		record->detail = microseconds;
+		Commit(record);
+	}
+	Signal();
+}
+
+void SharedRingWriter::OnCaptureError(uint32_t code) {
+	Ring::Record* record = Reserve(sizeof(Ring::Record));
+	if(record != nullptr) {
+		record->bytes = sizeof(Ring::Record);
+		record->type = Ring::Error;
+		record->flags = 0;
+		record->frameCount = 0;
+		record->detail = code;
+		Commit(record);
+	}
+	header.error.store(code, std::memory_order_relaxed);
+	Signal();
+}
+
+std::chrono::milliseconds SharedRingWriter::IdleWakeupInterval() const {
+	return std::chrono::milliseconds(header.idleWakeupMilliseconds.load(std::memory_order_relaxed));
+}
+
+SharedRingCapture::SharedRingCapture(SharedMemory& memory, size_t capacity, CaptureReceiver* receiver, std::function<bool()> producerAlive) :
+	header { LayOut(memory, capacity) },
+	data { static_cast<uint8_t*>(memory.Data()) + Ring::HEADER_BYTES },
+	capacity { capacity },
+	receiver { receiver },
+	producerAlive { std::move(producerAlive) },
+	format { },
+	stateSignal { header.state, memory.Name() + ".state", true },
+	commandSignal { header.command, memory.Name() + ".command", true },
+	dataSignal { header.writeSequence, memory.Name() + ".data", true },
+	wakeupMicroseconds { },
+	stopping { false },
+	started { false },
+	thread { }
+{ }
+
+SharedRingCapture::~SharedRingCapture() {
+	Stop();
+}
+
+void SharedRingCapture::WaitForProducer(std::chrono::milliseconds timeout) {
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	for(;;) {
+		const uint32_t state = header.state.load(std::memory_order_seq_cst);
+		if(state == Ring::Ready) break;
+		if(state == Ring::Failed) {
+			throw std::runtime_error("capture helper failed to start its capture, error " + std::to_string(header.error.load(std::memory_order_relaxed)));
+		}
+		if(!producerAlive()) throw std::runtime_error("capture helper exited before its capture started");
+
+		const auto now = std::chrono::steady_clock::now();
+		if(now >= deadline) throw std::runtime_error("capture helper didn't start its capture in time");
+		const auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
+		stateSignal.Wait(state, std::min<std::chrono::microseconds>(left, POLL_INTERVAL));
+	}
+
+	format.sampleRate = header.sampleRate;
+	format.channels = header.channels;
+	format.bitsPerSample = header.bitsPerSample;
+	format.sampleType = static_cast<SampleType>(header.sampleType);
+	format.channelMask = header.channelMask;
+}
+
+void SharedRingCapture::Start() {
+	if(started) return;
+	started = true;
+
+	header.command.store(Ring::Start, std::memory_order_seq_cst);
+	commandSignal.Wake();
+	thread = std::thread(&SharedRingCapture::Run, this);
+}
+
+void SharedRingCapture::Stop() {
+	if(thread.joinable()) {
+		stopping.store(true, std::memory_order_seq_cst);
+		header.writeSequence.fetch_add(1, std::memory_order_seq_cst);
+		dataSignal.Wake();
+		thread.join();
+	}
+
+	header.command.store(Ring::Quit, std::memory_order_seq_cst);
+	commandSignal.Wake();
+}
+
+bool SharedRingCapture::Deliver(uint64_t write) {
+	uint64_t read = header.readCursor.load(std::memory_order_relaxed);
+	if(read == write) return false;
+
+	while(read != write) {
+		const Ring::Record& record = *reinterpret_cast<const Ring::Record*>(data + (read & (capacity - 1)));
+		// the helper is another process, don't let a broken record send us past the end of the ring
+		if(record.bytes < sizeof(Ring::Record) || record.bytes > write - read || (read & (capacity - 1)) + record.bytes > capacity) {
+			receiver->OnCaptureError(ERROR_PRODUCER_LOST);
+			stopping.store(true, std::memory_order_relaxed);
+			return false;
+		}
+		switch(record.type) {
+		case Ring::Packet: {
+			CapturePacket packet;
+			packet.frames = (record.flags & Ring::Silent) ? nullptr : reinterpret_cast<const uint8_t*>(&record + 1);
+			packet.frameCount = record.frameCount;
+			packet.position = record.position;
+			packet.timestamp = record.timestamp;
+			packet.silent = (record.flags & Ring::Silent) != 0;
+			packet.discontinuity = (record.flags & Ring::Discontinuity) != 0;
+			packet.timed = (record.flags & Ring::Timed) != 0;
+			receiver->OnPacket(packet);
+			break;
+		}
+		case Ring::Wakeup: {
+			const uint64_t now = CaptureClockNow();
+			wakeupMicroseconds.Record(now > record.published ? (now - record.published) / 10 : 0);
+			receiver->OnWakeup(record.frameCount, record.detail);
+			break;
+		}
+		case Ring::Error:
+			receiver->OnCaptureError(record.detail);
+			break;
+		default:
+			break;
+		}
+
+		// the frames were used in place, only now may the writer have the space back
+		read += record.bytes;
+		header.readCursor.store(read, std::memory_order_release);
+	}
+	return true;
+}
+
+void SharedRingCapture::Run() {
+	while(!stopping.load(std::memory_order_relaxed)) {
+		const uint32_t sequence = header.writeSequence.load(std::memory_order_seq_cst);
+		if(Deliver(header.writeCursor.load(std::memory_order_acquire))) {
+			header.idleWakeupMilliseconds.store(static_cast<uint32_t>(receiver->IdleWakeupInterval().count()), std::memory_order_relaxed);
+			continue;
+		}
+
+		header.readerWaiting.store(1, std::memory_order_seq_cst);
+		if(header.writeSequence.load(std::memory_order_seq_cst) == sequence) {
+			dataSignal.Wait(sequence, POLL_INTERVAL);
+		}
+		header.readerWaiting.store(0, std::memory_order_relaxed);
+
+		// nothing since the last look, the helper may have crashed or hung
+		if(header.writeSequence.load(std::memory_order_relaxed) == sequence && !producerAlive()) {
+			receiver->OnCaptureError(ERROR_PRODUCER_LOST);
+			break;
+		}
+	}
+}
@@ -0,0 +1,222 @@
+#ifndef SHARED_CAPTURE_RING_HPP
+#define SHARED_CAPTURE_RING_HPP
+
+#include "capture_source.hpp"
+#include "capture_stats.hpp"
+#include "shared_memory.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// A capture source running in another process, handed over through shared memory. The process that runs the source
+// (the capture helper) makes a SharedRingWriter its receiver, which copies every packet into a byte ring in the
+// shared block once. The process that wants the audio reads the same block with a SharedRingCapture, which is a
+// CaptureSource like any other and hands its receiver pointers straight into the mapping, no second copy.
+//
+// One writer and one reader. Cursors only ever grow, each side owns one and only reads the other's, so the ring
+// needs no lock. Every packet is one record with its frames right behind the record's header, contiguous: a record
+// that wouldn't fit before the end of the ring is preceded by a padding record up to the end. When the reader falls
+// so far behind that a packet doesn't fit, the writer drops it and flags the next one as a discontinuity, like
+// WASAPI does when its own buffer overflows; the pipeline fills the gap from the positions as usual.
+//
+// The writer publishes every packet right away but only signals at the end of a wakeup, so the reader is woken once
+// per wakeup like it would be by an in-process source. Waking is a futex on the write sequence number (an event on
+// Windows, see SharedSignal), skipped entirely while the reader isn't asleep.
+struct SharedCaptureRing {
+	// First thing in the block. Plain fields are written once before the atomics that make them visible.
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		// bytes of ring behind the header, a power of two
+		uint64_t capacity;
+
+		// the writer's source format, valid once state is Ready
+		uint32_t sampleRate;
+		uint16_t channels;
+		uint16_t bitsPerSample;
+		uint32_t sampleType;
+		uint32_t channelMask;
+
+		// writer -> reader, the reader sleeps on it until the source came up
+		std::atomic<uint32_t> state;
+		// what the source failed with, once state is Failed
+		std::atomic<uint32_t> error;
+		// reader -> writer, the writer sleeps on it
+		std::atomic<uint32_t> command;
+		std::atomic<uint64_t> droppedPackets;
+
+		alignas(64) std::atomic<uint64_t> writeCursor;
+		// bumped by whoever wants the reader to look at the ring, the reader sleeps on it
+		std::atomic<uint32_t> writeSequence;
+
+		alignas(64) std::atomic<uint64_t> readCursor;
+		std::atomic<uint32_t> readerWaiting;
+		// the reader's receiver's IdleWakeupInterval, passed on to the source
+		std::atomic<uint32_t> idleWakeupMilliseconds;
+	};
+
+	enum State : uint32_t {
+		// the helper is activating its source
+		Starting,
+		Ready,
+		Failed,
+	};
+
+	enum Command : uint32_t {
+		Idle,
+		Start,
+		// stop the source and exit
+		Quit,
+	};
+
+	enum RecordType : uint16_t {
+		Packet,
+		// skip to the start of the ring
+		Padding,
+		// end of a wakeup: frameCount is how many packets it delivered, detail how long that took in microseconds
+		Wakeup,
+		// the source stopped, detail is its error code
+		Error,
+	};
+
+	enum RecordFlags : uint16_t {
+		Silent = 1,
+		Discontinuity = 2,
+		Timed = 4,
+	};
+
+	struct Record {
+		// the whole record, frames and padding included
+		uint32_t bytes;
+		uint16_t type;
+		uint16_t flags;
+		uint32_t frameCount;
+		uint32_t detail;
+		uint64_t position;
+		uint64_t timestamp;
+		// CaptureClockNow() when the writer wrote it
+		uint64_t published;
+		uint8_t reserved[24];
+	};
+
+	static constexpr uint32_t MAGIC = 0x52434157; // "WACR"
+	// bump on any change to Header or Record, the writer refuses memory laid out by another version
+	static constexpr uint32_t VERSION = 2;
+	// records and the frames behind them start on cache lines
+	static constexpr size_t RECORD_ALIGN = 64;
+	static constexpr size_t HEADER_BYTES = (sizeof(Header) + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+
+	static_assert(sizeof(Record) == RECORD_ALIGN, "records are one cache line");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring's atomics live in shared memory");
+
+	// Shared memory for a ring of capacity bytes, which has to be a power of two
+	static size_t MemoryBytes(size_t capacity) { return HEADER_BYTES + capacity; }
+};
+
+// Helper side, the source's receiver. Everything but the constructor, Publish, Fail and WaitForCommand runs on the
+// source's capture thread and never blocks.
+class SharedRingWriter : public CaptureReceiver {
+public:
+	// memory has to be laid out by a SharedRingCapture already. Throws std::runtime_error if it isn't, or was laid
+	// out by another version.
+	explicit SharedRingWriter(SharedMemory& memory);
+
+	SharedRingWriter(const SharedRingWriter&) = delete;
+	SharedRingWriter& operator=(const SharedRingWriter&) = delete;
+
+	// The source is up and delivers in format
+	void Publish(const CaptureFormat& format);
+	// The source couldn't be created
+	void Fail(uint32_t code);
+
+	// Returns the reader's command once it isn't current anymore, or current after timeout
+	SharedCaptureRing::Command WaitForCommand(SharedCaptureRing::Command current, std::chrono::microseconds timeout);
+
+	void OnPacket(const CapturePacket& packet) override;
+	void OnWakeup(uint32_t packetCount, uint32_t microseconds) override;
+	void OnCaptureError(uint32_t code) override;
+	std::chrono::milliseconds IdleWakeupInterval() const override;
+
+	uint64_t DroppedPackets() const { return header.droppedPackets.load(std::memory_order_relaxed); }
+
+private:
+	// Room for a record of bytes at the write cursor, after padding up to the end of the ring if it has to.
+	// Null when the reader hasn't made that much room.
+	SharedCaptureRing::Record* Reserve(size_t bytes);
+	void Commit(SharedCaptureRing::Record* record);
+	void Signal();
+
+	SharedCaptureRing::Header& header;
+	uint8_t* const data;
+	const uint64_t capacity;
+	uint32_t bytesPerFrame;
+	// ours alone, the shared cursor is where the reader sees it
+	uint64_t write;
+	bool lostPacket;
+
+	SharedSignal stateSignal;
+	SharedSignal commandSignal;
+	SharedSignal dataSignal;
+};
+
+// Reader side, a CaptureSource delivering whatever the writer on the other end of memory captures. Its own thread
+// waits for records and hands each packet to receiver in place, frames pointing into the shared block.
+class SharedRingCapture : public CaptureSource {
+public:
+	// How long the reader sleeps before it looks whether the writer is still alive
+	static constexpr std::chrono::milliseconds POLL_INTERVAL { 100 };
+	// OnCaptureError's code when producerAlive says the writer is gone
+	static constexpr uint32_t ERROR_PRODUCER_LOST = 0xFFFF0001;
+
+	// Lays an empty ring of capacity bytes (a power of two) out in memory, which must be fresh from
+	// SharedMemory::Create and at least SharedCaptureRing::MemoryBytes(capacity) big. Start the writer after this.
+	// producerAlive is asked whenever the ring stayed quiet for POLL_INTERVAL.
+	SharedRingCapture(SharedMemory& memory, size_t capacity, CaptureReceiver* receiver, std::function<bool()> producerAlive);
+	~SharedRingCapture();
+
+	SharedRingCapture(const SharedRingCapture&) = delete;
+	SharedRingCapture& operator=(const SharedRingCapture&) = delete;
+
+	// Blocks until the writer published its format. Throws std::runtime_error if it failed, died, or took longer
+	// than timeout.
+	void WaitForProducer(std::chrono::milliseconds timeout);
+
+	// Tells the writer to start its source and starts delivering
+	void Start() override;
+	// Stops delivering and tells the writer to quit. For good, the writer doesn't come back from that.
+	void Stop() override;
+
+	CaptureFormat GetFormat() const override { return format; }
+
+	// Packets the writer had to drop because this side didn't keep up
+	uint64_t DroppedPackets() const { return header.droppedPackets.load(std::memory_order_relaxed); }
+	// From the writer signalling the end of a wakeup to this side delivering it
+	AtomicHistogram<64>::Snapshot WakeupLatency() const { return wakeupMicroseconds.Read(); }
+
+private:
+	void Run();
+	// Hands every record up to write to the receiver, returns whether there was any
+	bool Deliver(uint64_t write);
+
+	SharedCaptureRing::Header& header;
+	uint8_t* const data;
+	const uint64_t capacity;
+	CaptureReceiver* const receiver;
+	const std::function<bool()> producerAlive;
+	CaptureFormat format;
+
+	SharedSignal stateSignal;
+	SharedSignal commandSignal;
+	SharedSignal dataSignal;
+
+	AtomicHistogram<64> wakeupMicroseconds;
+	std::atomic<bool> stopping;
+	bool started;
+	std::thread thread;
+};
+
+#endif // SHARED_CAPTURE_RING_HPP
@@ -0,0 +1,218 @@
+#include "shared_memory.hpp"
+
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#endif
+
+#if defined(_WIN32)
+namespace {
+	// per logon session, like the helper it's shared with
+	std::wstring KernelObjectName(const std::string& name) {
+		return L"Local\\" + std::wstring(name.begin(), name.end());
+	}
+}
+#endif
+
+SharedMemory::SharedMemory(const std::string& name, void* data, size_t size, void* handle, bool owner) :
+	name { name },
+	data { data },
+	size { size },
+	handle { handle },
+	owner { owner }
+{ }
+
+SharedMemory::SharedMemory(SharedMemory&& other) noexcept :
+	name { std::move(other.name) },
+	data { std::exchange(other.data, nullptr) },
+	size { std::exchange(other.size, 0) },
+	handle { std::exchange(other.handle, nullptr) },
+	owner { std::exchange(other.owner, false) }
+{ }
+
+SharedMemory& SharedMemory::operator=(SharedMemory&& other) noexcept {
+	if(this != &other) {
+		Close();
+		name = std::move(other.name);
+		data = std::exchange(other.data, nullptr);
+		size = std::exchange(other.size, 0);
+		handle = std::exchange(other.handle, nullptr);
+		owner = std::exchange(other.owner, false);
+	}
+	return *this;
+}
+
+SharedMemory::~SharedMemory() {
+	Close();
+}
+
+#if defined(_WIN32)
+
+SharedMemory SharedMemory::Create(const std::string& name, size_t bytes) {
+	const uint64_t size = bytes;
+	HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+		static_cast<DWORD>(size), KernelObjectName(name).c_str());
+	if(mapping == nullptr) throw std::runtime_error("failed to create shared memory " + name);
+	if(GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(mapping);
+		throw std::runtime_error("shared memory " + name + " exists already");
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+	if(data == nullptr) {
+		CloseHandle(mapping);
+		throw std::runtime_error("failed to map shared memory " + name);
+	}
+	// pagefile-backed mappings start out zeroed
+	return SharedMemory(name, data, bytes, mapping, true);
+}
+
+SharedMemory SharedMemory::Open(const std::string& name) {
+	HANDLE mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, false, KernelObjectName(name).c_str());
+	if(mapping == nullptr) throw std::runtime_error("no shared memory " + name);
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION region { };
+	if(data == nullptr || VirtualQuery(data, &region, sizeof(region)) == 0) {
+		if(data != nullptr) UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		throw std::runtime_error("failed to map shared memory " + name);
+	}
+	// whole pages, the creator's size rounded up
+	return SharedMemory(name, data, region.RegionSize, mapping, false);
+}
+
+void SharedMemory::Close() {
+	if(data != nullptr) UnmapViewOfFile(data);
+	if(handle != nullptr) CloseHandle(static_cast<HANDLE>(handle));
+	data = nullptr;
+	handle = nullptr;
+}
+
+SharedSignal::SharedSignal(std::atomic<uint32_t>& word, const std::string& name, bool create) :
+	word { word },
+	event { nullptr }
+{
+	const std::wstring objectName = KernelObjectName(name);
+	event = create ? CreateEventW(nullptr, false, false, objectName.c_str())
+		: OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, false, objectName.c_str());
+	if(event == nullptr) throw std::runtime_error("failed to " + std::string(create ? "create" : "open") + " event " + name);
+}
+
+SharedSignal::~SharedSignal() {
+	CloseHandle(static_cast<HANDLE>(event));
+}
+
+void SharedSignal::Wait(uint32_t expected, std::chrono::microseconds timeout) {
+	if(word.load(std::memory_order_seq_cst) != expected) return;
+	// a Wake since the caller read the word left the event set, so this returns right away
+	const DWORD milliseconds = static_cast<DWORD>((timeout.count() + 999) / 1000);
+	WaitForSingleObject(static_cast<HANDLE>(event), milliseconds);
+}
+
+void SharedSignal::Wake() {
+	SetEvent(static_cast<HANDLE>(event));
+}
+
+#else
+
+SharedMemory SharedMemory::Create(const std::string& name, size_t bytes) {
+	const std::string path = "/" + name;
+	const int descriptor = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(descriptor < 0) throw std::runtime_error("failed to create shared memory " + name + ": " + std::strerror(errno));
+
+	if(ftruncate(descriptor, static_cast<off_t>(bytes)) != 0) {
+		close(descriptor);
+		shm_unlink(path.c_str());
+		throw std::runtime_error("failed to size shared memory " + name);
+	}
+
+	void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	if(data == MAP_FAILED) {
+		shm_unlink(path.c_str());
+		throw std::runtime_error("failed to map shared memory " + name);
+	}
+	// ftruncate zero fills
+	return SharedMemory(name, data, bytes, nullptr, true);
+}
+
+SharedMemory SharedMemory::Open(const std::string& name) {
+	const std::string path = "/" + name;
+	const int descriptor = shm_open(path.c_str(), O_RDWR, 0600);
+	if(descriptor < 0) throw std::runtime_error("no shared memory " + name);
+
+	struct stat status { };
+	if(fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+		close(descriptor);
+		throw std::runtime_error("failed to size shared memory " + name);
+	}
+
+	const size_t bytes = static_cast<size_t>(status.st_size);
+	void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	if(data == MAP_FAILED) throw std::runtime_error("failed to map shared memory " + name);
+	return SharedMemory(name, data, bytes, nullptr, false);
+}
+
+void SharedMemory::Close() {
+	if(data != nullptr) {
+		munmap(data, size);
+		if(owner) shm_unlink(("/" + name).c_str());
+	}
+	data = nullptr;
+}
+
+SharedSignal::SharedSignal(std::atomic<uint32_t>& word, const std::string&, bool) :
+	word { word },
+	event { nullptr }
+{
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+		"futexes need a plain 32-bit word");
+}
+
+SharedSignal::~SharedSignal() { }
+
+#if defined(__linux__)
+
+void SharedSignal::Wait(uint32_t expected, std::chrono::microseconds timeout) {
+	const timespec relative { static_cast<time_t>(timeout.count() / 1000000), static_cast<long>(timeout.count() % 1000000) * 1000 };
+	// not FUTEX_PRIVATE_FLAG, the other side is another process
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &relative, nullptr, 0);
+}
+
+void SharedSignal::Wake() {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#else
+
+// no futex we can count on, poll often enough for audio
+void SharedSignal::Wait(uint32_t expected, std::chrono::microseconds timeout) {
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while(word.load(std::memory_order_seq_cst) == expected && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+}
+
+void SharedSignal::Wake() { }
+
+#endif
+
+#endif
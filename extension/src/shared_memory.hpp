@@ -0,0 +1,70 @@
+#ifndef SHARED_MEMORY_HPP
+#define SHARED_MEMORY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A named block of memory mapped into every process that opens it: a file mapping in the session namespace on
+// Windows, POSIX shared memory elsewhere. Whoever creates the block owns the name; once it's destroyed nobody else
+// can open it anymore, but processes that have it mapped keep it until they let go too.
+class SharedMemory {
+public:
+	// Throws std::runtime_error if the name is taken or the block can't be created. The memory starts zeroed.
+	static SharedMemory Create(const std::string& name, size_t bytes);
+	// Throws std::runtime_error if there's no block by that name
+	static SharedMemory Open(const std::string& name);
+
+	SharedMemory(SharedMemory&& other) noexcept;
+	SharedMemory& operator=(SharedMemory&& other) noexcept;
+	~SharedMemory();
+
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	void* Data() const { return data; }
+	size_t Size() const { return size; }
+	const std::string& Name() const { return name; }
+
+private:
+	SharedMemory(const std::string& name, void* data, size_t size, void* handle, bool owner);
+	void Close();
+
+	std::string name;
+	void* data;
+	size_t size;
+	// the file mapping on Windows, unused elsewhere
+	void* handle;
+	bool owner;
+};
+
+// Sleep/wake on a 32-bit word in shared memory, across processes. A futex on Linux, a named auto-reset event per
+// word on Windows (each process opens its own handle to it by name), and plain polling anywhere else.
+//
+// Like a futex, Wait only sleeps while the word still holds expected, and waking someone who isn't asleep yet is
+// never lost, so the usual pattern works: read the word, look for work, Wait(word value) if there's none, and have
+// the other side change the word before it calls Wake.
+class SharedSignal {
+public:
+	// name has to be the same in every process and unique per word, it's ignored where futexes do the job.
+	// The creating side passes create, the others open what it created.
+	SharedSignal(std::atomic<uint32_t>& word, const std::string& name, bool create);
+	~SharedSignal();
+
+	SharedSignal(const SharedSignal&) = delete;
+	SharedSignal& operator=(const SharedSignal&) = delete;
+
+	// Returns once woken, the word no longer holds expected, or timeout passed. May return early for no reason.
+	void Wait(uint32_t expected, std::chrono::microseconds timeout);
+	void Wake();
+
+	std::atomic<uint32_t>& Word() { return word; }
+
+private:
+	std::atomic<uint32_t>& word;
+	void* event;
+};
+
+#endif // SHARED_MEMORY_HPP
@@ -0,0 +1,157 @@
+#include "silence_gate.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+float PeakScalar(const float* samples, size_t count) {
+	float peak = 0.0f;
+	for(size_t i = 0; i < count; i++) peak = std::max(peak, std::fabs(samples[i]));
+	return peak;
+}
+
+#if defined(SIMD_X86)
+float PeakSse(const float* samples, size_t count) {
+	// clearing the sign bit is fabs
+	const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 peak0 = _mm_setzero_ps();
+	__m128 peak1 = _mm_setzero_ps();
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		peak0 = _mm_max_ps(peak0, _mm_and_ps(_mm_loadu_ps(samples + i), magnitude));
+		peak1 = _mm_max_ps(peak1, _mm_and_ps(_mm_loadu_ps(samples + i + 4), magnitude));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_max_ps(peak0, peak1));
+	const float peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	return std::max(peak, PeakScalar(samples + i, count - i));
+}
+
+SIMD_TARGET_AVX float PeakAvx(const float* samples, size_t count) {
+	const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 peak0 = _mm256_setzero_ps();
+	__m256 peak1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		peak0 = _mm256_max_ps(peak0, _mm256_and_ps(_mm256_loadu_ps(samples + i), magnitude));
+		peak1 = _mm256_max_ps(peak1, _mm256_and_ps(_mm256_loadu_ps(samples + i + 8), magnitude));
+	}
+	const __m256 peak8 = _mm256_max_ps(peak0, peak1);
+	const __m128 peak4 = _mm_max_ps(_mm256_castps256_ps128(peak8), _mm256_extractf128_ps(peak8, 1));
+	float lanes[4];
+	_mm_storeu_ps(lanes, peak4);
+	const float peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	return std::max(peak, PeakScalar(samples + i, count - i));
+}
+#elif defined(SIMD_NEON)
+float PeakNeon(const float* samples, size_t count) {
+	float32x4_t peak0 = vdupq_n_f32(0.0f);
+	float32x4_t peak1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		peak0 = vmaxq_f32(peak0, vabsq_f32(vld1q_f32(samples + i)));
+		peak1 = vmaxq_f32(peak1, vabsq_f32(vld1q_f32(samples + i + 4)));
+	}
+	const float peak = vmaxvq_f32(vmaxq_f32(peak0, peak1));
+	return std::max(peak, PeakScalar(samples + i, count - i));
+}
+#endif
+
+} // namespace
+
+PeakFunction SelectPeak(SimdLevel level) {
+	switch(ClampSimdLevel(level)) {
+#if defined(SIMD_X86)
+	case SimdLevel::Avx: return PeakAvx;
+	case SimdLevel::Baseline: return PeakSse;
+#elif defined(SIMD_NEON)
+	case SimdLevel::Avx:
+	case SimdLevel::Baseline: return PeakNeon;
+#endif
+	default: return PeakScalar;
+	}
+}
+
+SilenceGate::SilenceGate(SimdLevel simd) :
+	peak { SelectPeak(simd) },
+	enabled { true },
+	holdFrames { 0 },
+	quietFrames { 0 },
+	closed { false },
+	closes { 0 },
+	sequence { 0 },
+	closedAt { NEVER },
+	openedAt { NEVER }
+{ }
+
+void SilenceGate::Configure(uint32_t sampleRate) {
+	holdFrames = uint64_t(sampleRate) * HOLD_MILLISECONDS / 1000;
+	quietFrames = 0;
+	closed.store(false, std::memory_order_relaxed);
+	Publish(NEVER, NEVER);
+}
+
+void SilenceGate::SetEnabled(bool enable) {
+	enabled.store(enable, std::memory_order_relaxed);
+}
+
+void SilenceGate::Feed(const StereoFrame* frames, size_t frameCount, uint64_t ringPosition) {
+	if(frameCount == 0) return;
+
+	const bool wasClosed = closed.load(std::memory_order_relaxed);
+	if(!enabled.load(std::memory_order_relaxed)) {
+		quietFrames = 0;
+		if(wasClosed) {
+			Publish(closedAt.load(std::memory_order_relaxed), ringPosition);
+			closed.store(false, std::memory_order_relaxed);
+		}
+		return;
+	}
+
+	const float level = frames != nullptr ? peak(reinterpret_cast<const float*>(frames), frameCount * 2) : 0.0f;
+	if(wasClosed) {
+		if(level > OPEN_LEVEL) {
+			quietFrames = 0;
+			Publish(closedAt.load(std::memory_order_relaxed), ringPosition);
+			closed.store(false, std::memory_order_relaxed);
+		}
+		return;
+	}
+
+	if(level > CLOSE_LEVEL) {
+		quietFrames = 0;
+		return;
+	}
+	// held long enough before these, they're the first frames behind the gate
+	if(quietFrames >= holdFrames) {
+		Publish(ringPosition, NEVER);
+		closed.store(true, std::memory_order_relaxed);
+		closes.fetch_add(1, std::memory_order_relaxed);
+	}
+	quietFrames += frameCount;
+}
+
+void SilenceGate::Publish(uint64_t closedPosition, uint64_t openedPosition) {
+	const uint32_t current = sequence.load(std::memory_order_relaxed);
+	sequence.store(current + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	closedAt.store(closedPosition, std::memory_order_relaxed);
+	openedAt.store(openedPosition, std::memory_order_relaxed);
+	sequence.store(current + 2, std::memory_order_release);
+}
+
+uint64_t SilenceGate::SilentUntil(uint64_t ringPosition) const {
+	uint32_t current;
+	uint64_t closedPosition;
+	uint64_t openedPosition;
+	do {
+		current = sequence.load(std::memory_order_acquire);
+		closedPosition = closedAt.load(std::memory_order_relaxed);
+		openedPosition = openedAt.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while((current & 1) != 0 || current != sequence.load(std::memory_order_relaxed));
+
+	if(closedPosition <= ringPosition && ringPosition < openedPosition) return openedPosition;
+	return ringPosition;
+}
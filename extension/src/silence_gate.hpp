@@ -0,0 +1,71 @@
+#ifndef SILENCE_GATE_HPP
+#define SILENCE_GATE_HPP
+
+#include "audio_types.hpp"
+#include "simd.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Largest absolute value among count floats. SimdLevel::Scalar is the reference, max is exact so the vector kernels
+// match it bit for bit.
+using PeakFunction = float (*)(const float* samples, size_t count);
+
+PeakFunction SelectPeak(SimdLevel level = SimdLevel::Avx);
+
+// Decides on the capture thread when a pipeline's audio has gone quiet, so mixers can hand out zeros without reading
+// or resampling anything and the source can wake up less often (CaptureReceiver::IdleWakeupInterval).
+//
+// Hysteresis both ways: the gate closes once nothing above CLOSE_LEVEL came through for HOLD_MILLISECONDS and opens
+// on the first frame above OPEN_LEVEL, so a signal hovering around either threshold doesn't flap it. Packets the
+// source flagged silent aren't looked at. Where it closed and opened is kept as ring positions, readers anywhere in
+// between know what they'd read there is below CLOSE_LEVEL.
+class SilenceGate {
+public:
+	// -60 dBFS opens, -66 dBFS closes
+	static constexpr float OPEN_LEVEL = 0.001f;
+	static constexpr float CLOSE_LEVEL = 0.0005f;
+	// Long past any resampler's filter, so whatever it still holds when the gate closes has died down as well
+	static constexpr uint32_t HOLD_MILLISECONDS = 200;
+	// SilentUntil of a gate that's closed and still is
+	static constexpr uint64_t NEVER = UINT64_MAX;
+
+	explicit SilenceGate(SimdLevel simd = SimdLevel::Avx);
+
+	SilenceGate(const SilenceGate&) = delete;
+	SilenceGate& operator=(const SilenceGate&) = delete;
+
+	// Capture thread, before the first Feed. Opens the gate, frames come at sampleRate from now on.
+	void Configure(uint32_t sampleRate);
+	// Any thread, from the next Feed on. A disabled gate opens and stays open.
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+	// Capture thread: frameCount frames (null for silence) are about to go into the ring at ringPosition
+	void Feed(const StereoFrame* frames, size_t frameCount, uint64_t ringPosition);
+
+	// Any thread. How far the audio from ringPosition on is known to be silent: ringPosition itself if the gate was
+	// open there, NEVER if it closed before and hasn't opened since.
+	uint64_t SilentUntil(uint64_t ringPosition) const;
+	bool IsClosed() const { return closed.load(std::memory_order_relaxed); }
+	uint64_t Closes() const { return closes.load(std::memory_order_relaxed); }
+
+private:
+	void Publish(uint64_t closedPosition, uint64_t openedPosition);
+
+	const PeakFunction peak;
+	std::atomic<bool> enabled;
+	// capture thread: frames below CLOSE_LEVEL in a row
+	uint64_t holdFrames;
+	uint64_t quietFrames;
+
+	std::atomic<bool> closed;
+	std::atomic<uint64_t> closes;
+	// the newest closed stretch of the ring, seqlock so readers never see one end of one and the other of another
+	std::atomic<uint32_t> sequence;
+	std::atomic<uint64_t> closedAt;
+	std::atomic<uint64_t> openedAt;
+};
+
+#endif // SILENCE_GATE_HPP
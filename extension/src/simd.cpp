@@ -0,0 +1,50 @@
+#include "simd.hpp"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static SimdLevel QuerySimdLevel() {
+#if defined(SIMD_X86)
+#if defined(_MSC_VER)
+	int info[4] { };
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	// the OS also has to save the upper halves of the ymm registers on context switches
+	if(osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) return SimdLevel::Avx;
+	return SimdLevel::Baseline;
+#else
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx")) return SimdLevel::Avx;
+	return SimdLevel::Baseline;
+#endif
+#elif defined(SIMD_NEON)
+	return SimdLevel::Baseline;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel DetectSimdLevel() {
+	static const SimdLevel level = QuerySimdLevel();
+	return level;
+}
+
+SimdLevel ClampSimdLevel(SimdLevel requested) {
+	const SimdLevel detected = DetectSimdLevel();
+	return static_cast<int>(requested) < static_cast<int>(detected) ? requested : detected;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+	switch(level) {
+	case SimdLevel::Scalar: return "scalar";
+#if defined(SIMD_NEON)
+	case SimdLevel::Baseline: return "neon";
+#else
+	case SimdLevel::Baseline: return "sse2";
+#endif
+	case SimdLevel::Avx: return "avx";
+	}
+	return "unknown";
+}
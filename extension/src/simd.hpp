@@ -0,0 +1,38 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// Instruction set selection shared by the DSP kernels (resampler, conversion, mixing...).
+// SSE2 is the x86-64 baseline and NEON the arm64 one, so those are used unconditionally. AVX is compiled in per
+// function with SIMD_TARGET_AVX and only picked at runtime if DetectSimdLevel() says the CPU and OS support it.
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX __attribute__((target("avx")))
+#else
+// MSVC lets any function use AVX intrinsics without a flag
+#define SIMD_TARGET_AVX
+#endif
+
+enum class SimdLevel {
+	Scalar,
+	// SSE2 on x86, NEON on arm64
+	Baseline,
+	Avx,
+};
+
+// What this CPU can run, checked once and cached
+SimdLevel DetectSimdLevel();
+
+// min(requested, detected), so benchmarks can force the slower kernels
+SimdLevel ClampSimdLevel(SimdLevel requested);
+
+const char* SimdLevelName(SimdLevel level);
+
+#endif // SIMD_HPP
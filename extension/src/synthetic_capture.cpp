@@ -0,0 +1,229 @@
+#include "synthetic_capture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+PacedCaptureSource::PacedCaptureSource(CaptureReceiver* receiver, const CaptureFormat& format, const CapturePacing& pacing) :
+	format { format },
+	receiver { receiver },
+	pacing { pacing },
+	packetFrames { pacing.packetFrames != 0 ? pacing.packetFrames : static_cast<uint32_t>(uint64_t(format.sampleRate) * pacing.periodMicroseconds / 1000000) },
+	packet { },
+	thread { },
+	running { false },
+	packetsDelivered { 0 },
+	packetsDropped { 0 }
+{
+	if(format.BytesPerFrame() == 0) throw std::runtime_error("capture format has no frame size");
+	if(packetFrames == 0) throw std::runtime_error("capture pacing gives empty packets");
+
+	packet.resize(size_t(packetFrames) * format.BytesPerFrame());
+
+	if(pacing.activationMicroseconds != 0) std::this_thread::sleep_for(std::chrono::microseconds(pacing.activationMicroseconds));
+}
+
+PacedCaptureSource::~PacedCaptureSource() {
+	Stop();
+}
+
+void PacedCaptureSource::Start() {
+	if(running.exchange(true)) return;
+	thread = std::thread(&PacedCaptureSource::Run, this);
+}
+
+void PacedCaptureSource::Stop() {
+	running = false;
+	if(thread.joinable()) thread.join();
+}
+
+void PacedCaptureSource::Run() {
+	using Clock = std::chrono::steady_clock;
+
+	// small LCG so the jitter sequence only depends on the seed, not on the standard library
+	uint32_t rng = pacing.seed;
+	const auto period = std::chrono::microseconds(pacing.periodMicroseconds);
+	auto deadline = Clock::now();
+	// device position in frames, counted from the first packet like WASAPI's
+	uint64_t position = 0;
+	uint64_t packetIndex = 0;
+	bool lostPrevious = false;
+	// periods since the last wakeup, more than one while the receiver lets packets pile up
+	uint32_t periods = 1;
+
+	while(running.load(std::memory_order_relaxed)) {
+		deadline += period * periods;
+
+		auto wakeup = deadline;
+		if(pacing.jitterMicroseconds != 0) {
+			rng = rng * 1664525u + 1013904223u;
+			const int64_t offset = int64_t(rng % (2 * pacing.jitterMicroseconds + 1)) - pacing.jitterMicroseconds;
+			wakeup += std::chrono::microseconds(offset);
+		}
+		std::this_thread::sleep_until(wakeup);
+
+		const auto start = Clock::now();
+		// stamped with when the packet's first frame would have been captured, one period back
+		const uint64_t packetDuration = uint64_t(packetFrames) * 10000000 / format.sampleRate;
+		const uint32_t packetCount = pacing.packetsPerWakeup * periods;
+		uint64_t timestamp = CaptureClockNow() - packetCount * packetDuration;
+		uint32_t delivered = 0;
+		for(uint32_t i = 0; i < packetCount; i++) {
+			packetIndex++;
+			// always produced, so audio after a lost packet carries on where it would have been
+			FillPacket(packet.data(), packetFrames);
+
+			if(pacing.dropEvery != 0 && packetIndex % pacing.dropEvery == 0) {
+				packetsDropped.fetch_add(1, std::memory_order_relaxed);
+				lostPrevious = true;
+			} else {
+				CapturePacket captured { };
+				captured.frameCount = packetFrames;
+				captured.position = position;
+				captured.timestamp = timestamp;
+				captured.silent = pacing.silentEvery != 0 && packetIndex % pacing.silentEvery == 0;
+				captured.frames = captured.silent ? nullptr : packet.data();
+				captured.discontinuity = lostPrevious;
+				captured.timed = true;
+				receiver->OnPacket(captured);
+				packetsDelivered.fetch_add(1, std::memory_order_relaxed);
+				lostPrevious = false;
+				delivered++;
+			}
+
+			position += packetFrames;
+			timestamp += packetDuration;
+		}
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+		receiver->OnWakeup(delivered, static_cast<uint32_t>(elapsed.count()));
+
+		// like a WASAPI client's buffer, the packets wait for us in the meantime
+		const auto idle = std::chrono::duration_cast<std::chrono::microseconds>(receiver->IdleWakeupInterval());
+		periods = std::max<uint32_t>(1, static_cast<uint32_t>(idle / period));
+	}
+}
+
+SyntheticCapture::SyntheticCapture(CaptureReceiver* receiver, const CaptureFormat& format, const CapturePacing& pacing, double frequency, float amplitude) :
+	PacedCaptureSource(receiver, format, pacing),
+	phaseIncrement { 2.0 * 3.14159265358979323846 * frequency / format.sampleRate },
+	amplitude { amplitude },
+	phase { 0.0 }
+{
+	const bool supported = (format.sampleType == SampleType::Float && format.bitsPerSample == 32) ||
+		(format.sampleType == SampleType::Int && format.bitsPerSample == 16);
+	if(!supported) throw std::runtime_error("synthetic capture only generates float32 or int16");
+}
+
+SyntheticCapture::~SyntheticCapture() {
+	Stop();
+}
+
+void SyntheticCapture::FillPacket(uint8_t* frames, uint32_t frameCount) {
+	const uint16_t channels = format.channels;
+
+	for(uint32_t frame = 0; frame < frameCount; frame++) {
+		const float sample = amplitude * static_cast<float>(std::sin(phase));
+		phase += phaseIncrement;
+
+		for(uint16_t channel = 0; channel < channels; channel++) {
+			if(format.sampleType == SampleType::Float) {
+				reinterpret_cast<float*>(frames)[frame * channels + channel] = sample;
+			} else {
+				reinterpret_cast<int16_t*>(frames)[frame * channels + channel] = static_cast<int16_t>(sample * 32767.0f);
+			}
+		}
+	}
+
+	// keep the phase small so precision doesn't drift over long runs
+	if(phase > 2.0 * 3.14159265358979323846) phase = std::fmod(phase, 2.0 * 3.14159265358979323846);
+}
+
+ReplayCapture::ReplayCapture(CaptureReceiver* receiver, const std::string& path, const CapturePacing& pacing) :
+	ReplayCapture(receiver, LoadWav(path), pacing)
+{ }
+
+ReplayCapture::ReplayCapture(CaptureReceiver* receiver, WavData&& wav, const CapturePacing& pacing) :
+	PacedCaptureSource(receiver, wav.format, pacing),
+	data { std::move(wav.frames) },
+	position { 0 }
+{
+	if(data.size() < format.BytesPerFrame()) throw std::runtime_error("replay file has no audio");
+
+	// drop any trailing partial frame so looping stays frame aligned
+	data.resize(data.size() - data.size() % format.BytesPerFrame());
+}
+
+ReplayCapture::~ReplayCapture() {
+	Stop();
+}
+
+void ReplayCapture::FillPacket(uint8_t* frames, uint32_t frameCount) {
+	size_t remaining = size_t(frameCount) * format.BytesPerFrame();
+
+	while(remaining > 0) {
+		const size_t chunk = std::min(remaining, data.size() - position);
+		memcpy(frames, data.data() + position, chunk);
+		frames += chunk;
+		remaining -= chunk;
+		position += chunk;
+		if(position == data.size()) position = 0;
+	}
+}
+
+ReplayCapture::WavData ReplayCapture::LoadWav(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if(!file) throw std::runtime_error("failed to open replay file");
+
+	const std::vector<uint8_t> contents { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	auto readU16 = [&](size_t offset) { return uint16_t(contents[offset] | (contents[offset + 1] << 8)); };
+	auto readU32 = [&](size_t offset) { return uint32_t(readU16(offset) | (uint32_t(readU16(offset + 2)) << 16)); };
+
+	const bool rf64 = contents.size() >= 12 && memcmp(contents.data(), "RF64", 4) == 0;
+	if(contents.size() < 12 || (memcmp(contents.data(), "RIFF", 4) != 0 && !rf64) || memcmp(contents.data() + 8, "WAVE", 4) != 0) {
+		throw std::runtime_error("replay file is not a WAV file");
+	}
+
+	WavData wav { };
+	// RF64 (what CaptureRecorder writes past 4 GiB) keeps the real data size in its ds64 chunk
+	uint64_t dataSize64 = 0;
+	bool haveFormat = false;
+	bool haveData = false;
+
+	size_t offset = 12;
+	while(offset + 8 <= contents.size() && !haveData) {
+		uint64_t chunkSize = readU32(offset + 4);
+		const size_t body = offset + 8;
+		if(rf64 && chunkSize == 0xFFFFFFFFu && memcmp(contents.data() + offset, "data", 4) == 0) chunkSize = dataSize64;
+		const size_t available = static_cast<size_t>(std::min<uint64_t>(chunkSize, contents.size() - body));
+
+		if(rf64 && memcmp(contents.data() + offset, "ds64", 4) == 0 && available >= 16) {
+			dataSize64 = readU32(body + 8) | (uint64_t(readU32(body + 12)) << 32);
+		} else if(memcmp(contents.data() + offset, "fmt ", 4) == 0 && available >= 16) {
+			uint16_t formatTag = readU16(body);
+			// WAVE_FORMAT_EXTENSIBLE keeps the real tag at the start of the SubFormat GUID
+			if(formatTag == 0xFFFE && available >= 26) formatTag = readU16(body + 24);
+
+			wav.format.channels = readU16(body + 2);
+			wav.format.sampleRate = readU32(body + 4);
+			wav.format.bitsPerSample = readU16(body + 14);
+			if(formatTag == 1) wav.format.sampleType = SampleType::Int;
+			else if(formatTag == 3) wav.format.sampleType = SampleType::Float;
+			else throw std::runtime_error("replay file is neither PCM nor IEEE float");
+			haveFormat = true;
+		} else if(memcmp(contents.data() + offset, "data", 4) == 0) {
+			wav.frames.assign(contents.begin() + body, contents.begin() + body + available);
+			haveData = true;
+		}
+
+		// chunks are padded to an even size
+		offset = body + chunkSize + (chunkSize & 1);
+	}
+
+	if(!haveFormat || !haveData) throw std::runtime_error("replay file is missing its fmt or data chunk");
+	return wav;
+}
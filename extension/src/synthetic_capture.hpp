@@ -0,0 +1,109 @@
+#ifndef SYNTHETIC_CAPTURE_HPP
+#define SYNTHETIC_CAPTURE_HPP
+
+#include "capture_source.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How a paced source delivers its packets. Defaults look like a shared mode WASAPI loopback client.
+struct CapturePacing {
+	// Nominal time between wakeups
+	uint32_t periodMicroseconds = 10000;
+	// Each wakeup is moved by a uniformly random amount in [-jitter, +jitter], deadlines don't accumulate it
+	uint32_t jitterMicroseconds = 0;
+	// Frames per packet. Leave at 0 to derive it from the period and sample rate; set it explicitly to simulate
+	// a source clock that runs faster or slower than nominal.
+	uint32_t packetFrames = 0;
+	// Packets pushed per wakeup, per period that went by since the last one if the receiver asked to idle
+	uint32_t packetsPerWakeup = 1;
+	// Same seed, same jitter sequence
+	uint32_t seed = 1;
+	// Every silentEvery-th packet is flagged silent instead of carrying audio, 0 for never
+	uint32_t silentEvery = 0;
+	// Every dropEvery-th packet is lost: produced but never delivered, and the next one is flagged as a
+	// discontinuity, like WASAPI does when the client didn't keep up. 0 for never.
+	uint32_t dropEvery = 0;
+	// How long the constructor blocks, like activating a WASAPI client does. 0 for not at all.
+	uint32_t activationMicroseconds = 0;
+};
+
+// Pushes packets to its receiver from its own thread at a configurable pace.
+// Subclasses only produce the audio, on the pacing thread, into a buffer that is allocated once up front.
+// They have to Stop() in their own destructor, the thread calls back into them until then.
+class PacedCaptureSource : public CaptureSource {
+public:
+	PacedCaptureSource(CaptureReceiver* receiver, const CaptureFormat& format, const CapturePacing& pacing);
+	virtual ~PacedCaptureSource();
+
+	void Start() override;
+	void Stop() override;
+
+	CaptureFormat GetFormat() const override { return format; }
+	uint32_t PacketFrames() const { return packetFrames; }
+	uint64_t PacketsDelivered() const { return packetsDelivered.load(std::memory_order_relaxed); }
+	uint64_t PacketsDropped() const { return packetsDropped.load(std::memory_order_relaxed); }
+
+protected:
+	virtual void FillPacket(uint8_t* frames, uint32_t frameCount) = 0;
+
+	const CaptureFormat format;
+
+private:
+	void Run();
+
+	CaptureReceiver* receiver;
+	const CapturePacing pacing;
+	const uint32_t packetFrames;
+
+	std::vector<uint8_t> packet;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> packetsDelivered;
+	std::atomic<uint64_t> packetsDropped;
+};
+
+// Sine tone in float32 (or int16 if the format says so), the same phase on every channel
+class SyntheticCapture : public PacedCaptureSource {
+public:
+	SyntheticCapture(CaptureReceiver* receiver, const CaptureFormat& format, const CapturePacing& pacing, double frequency = 440.0, float amplitude = 0.5f);
+	~SyntheticCapture();
+
+protected:
+	void FillPacket(uint8_t* frames, uint32_t frameCount) override;
+
+private:
+	const double phaseIncrement;
+	const float amplitude;
+	double phase;
+};
+
+// Loops the contents of a WAV file (PCM int16/int24/int32 or IEEE float). The whole file is loaded in the
+// constructor so the pacing thread never touches the disk.
+class ReplayCapture : public PacedCaptureSource {
+public:
+	struct WavData {
+		CaptureFormat format;
+		std::vector<uint8_t> frames;
+	};
+
+	// Throws std::runtime_error if the file can't be read or isn't a WAV file we understand
+	ReplayCapture(CaptureReceiver* receiver, const std::string& path, const CapturePacing& pacing);
+	~ReplayCapture();
+
+	static WavData LoadWav(const std::string& path);
+
+protected:
+	void FillPacket(uint8_t* frames, uint32_t frameCount) override;
+
+private:
+	ReplayCapture(CaptureReceiver* receiver, WavData&& wav, const CapturePacing& pacing);
+
+	std::vector<uint8_t> data;
+	size_t position;
+};
+
+#endif // SYNTHETIC_CAPTURE_HPP
@@ -0,0 +1,55 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Latest-value handoff between one writer and one reader, neither ever waits for the other.
+// The writer fills Back() and publishes it, the reader picks up whatever was published last with Update() and reads
+// Front() until the next Update(). Of the three slots one belongs to each side and the third is in flight; publishing
+// and picking up swap a slot with the in-flight one, so nothing is copied and nothing is allocated after construction.
+// Values that get published while the reader isn't looking are simply replaced by newer ones.
+template<typename T>
+class TripleBuffer {
+public:
+	// Constructs every slot from the same arguments, so they can all be preallocated the same way
+	template<typename... Arguments>
+	explicit TripleBuffer(const Arguments&... arguments) :
+		slots { T(arguments...), T(arguments...), T(arguments...) },
+		back { 0 },
+		front { 1 },
+		middle { 2 }
+	{ }
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Writer. The slot to fill next, holds whatever was in it two publishes ago.
+	T& Back() { return slots[back]; }
+
+	// Writer
+	void Publish() {
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Reader. Takes the most recently published value if there is one newer than Front(), returns whether it did.
+	bool Update() {
+		if((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	// Reader
+	const T& Front() const { return slots[front]; }
+
+private:
+	static constexpr uint8_t INDEX = 0x3;
+	static constexpr uint8_t FRESH = 0x4;
+
+	T slots[3];
+	uint8_t back;
+	alignas(64) uint8_t front;
+	alignas(64) std::atomic<uint8_t> middle;
+};
+
+#endif // TRIPLE_BUFFER_HPP
@@ -1,5 +1,9 @@
 #include "wasapi_capture.hpp"
 
+#include "channel_mix.hpp"
+#include "sample_convert.hpp"
+
+#include <chrono>
 #include <stdexcept>
 #include <audioclientactivationparams.h>
 #include <mmdeviceapi.h>
@@ -7,7 +11,7 @@
 class WASAPIActivateAudioInterfaceCompletionHandler : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, Microsoft::WRL::FtmBase, IActivateAudioInterfaceCompletionHandler> {
 public:
 	WASAPIActivateAudioInterfaceCompletionHandler() :
-		activatedInteraface { nullptr },
+		activatedInterface { },
 		activationResult { E_NOINTERFACE }
 	{
 		activationSignal = CreateEvent(nullptr, false, false, nullptr);
@@ -19,34 +23,38 @@ public:
 
 	virtual HRESULT STDMETHODCALLTYPE ActivateCompleted(IActivateAudioInterfaceAsyncOperation* activateOperation) override {
 		HRESULT innerActivationResult { };
-		HRESULT innerRetrieveResult = activateOperation->GetActivateResult(&innerActivationResult, &activatedInteraface);
+		HRESULT innerRetrieveResult = activateOperation->GetActivateResult(&innerActivationResult, &activatedInterface);
 		activationResult = SUCCEEDED(innerRetrieveResult) ? innerActivationResult : innerRetrieveResult;
 
 		SetEvent(activationSignal);
 		return activationResult;
 	}
 
-	HRESULT GetActivateResult(IAudioClient** client) {
-		WaitForSingleObject(activationSignal, INFINITE);
-		*client = static_cast<IAudioClient*>(activatedInteraface);
-		return activationResult;
+	// A hung activation may still complete after we gave up on it, we're reference counted so that's harmless
+	HRESULT GetActivateResult(std::chrono::milliseconds timeout, Microsoft::WRL::ComPtr<IAudioClient>& client) {
+		if(WaitForSingleObject(activationSignal, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0) return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+		if(FAILED(activationResult)) return activationResult;
+		return activatedInterface.As(&client);
 	}
 
 private:
-	IUnknown* activatedInteraface;
+	Microsoft::WRL::ComPtr<IUnknown> activatedInterface;
 	HRESULT activationResult;
 	HANDLE activationSignal;
 };
 
-WASAPICapture::WASAPICapture(WASAPICaptureReceiver* receiver, DWORD processId) :
+WASAPICapture::WASAPICapture(CaptureReceiver* receiver, DWORD processId, LoopbackMode mode, std::chrono::microseconds bufferDuration,
+	std::chrono::milliseconds activationTimeout) :
 	receiver { receiver },
 	processId { processId },
+	mode { mode },
+	format { QueryEndpointFormat() },
 	startCaptureCallback { this },
 	sampleReadyCallback { this },
-	restartCallback { this },
 	stopSignal { INVALID_HANDLE_VALUE },
 	receiveSignal { INVALID_HANDLE_VALUE },
-	restartSignal { INVALID_HANDLE_VALUE },
+	idleSignal { INVALID_HANDLE_VALUE },
+	idleWakeupKey { 0 },
 	audioClient { },
 	audioCaptureClient { }
 {
@@ -58,8 +66,8 @@ WASAPICapture::WASAPICapture(WASAPICaptureReceiver* receiver, DWORD processId) :
 	receiveSignal = CreateEvent(nullptr, false, false, nullptr);
 	if(receiveSignal == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to create receiveSignal event");
 
-	restartSignal = CreateEvent(nullptr, true, false, nullptr);
-	if(restartSignal == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to create restartSignal event");
+	idleSignal = CreateEvent(nullptr, true, true, nullptr);
+	if(idleSignal == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to create idleSignal event");
 
 	// old man crackhead compiler yells at nullptr
 	// MSDN says it's optional so i do not care
@@ -69,9 +77,6 @@ WASAPICapture::WASAPICapture(WASAPICaptureReceiver* receiver, DWORD processId) :
 
 	result = RtwqCreateAsyncResult(nullptr, &sampleReadyCallback, nullptr, &sampleReadyAsyncResult);
 	if(FAILED(result)) throw std::runtime_error("failed to create sampleReadyAsyncResult");
-
-	result = RtwqCreateAsyncResult(nullptr, &restartCallback, nullptr, &restartAsyncResult);
-	if(FAILED(result)) throw std::runtime_error("failed to create restartAsyncResult");
 #pragma warning(default:6387)
 
 	DWORD taskId { };
@@ -81,36 +86,107 @@ WASAPICapture::WASAPICapture(WASAPICaptureReceiver* receiver, DWORD processId) :
 
 	startCaptureCallback.SetQueueId(queueId);
 	sampleReadyCallback.SetQueueId(queueId);
-	restartCallback.SetQueueId(queueId);
+
+	try {
+		Activate(bufferDuration, activationTimeout);
+	} catch(...) {
+		// the destructor doesn't run for us
+		RtwqUnlockWorkQueue(queueId);
+		CloseHandle(stopSignal);
+		CloseHandle(receiveSignal);
+		CloseHandle(idleSignal);
+		throw;
+	}
 }
 
 WASAPICapture::~WASAPICapture() {
 	Stop();
+	// a callback that's running or still to run would use us and the receiver after we're gone, once it's seen
+	// stopSignal it doesn't queue another
+	WaitForSingleObject(idleSignal, INFINITE);
+
+	RtwqUnlockWorkQueue(sampleReadyCallback.GetQueueId());
 
 	CloseHandle(stopSignal);
 	CloseHandle(receiveSignal);
-	CloseHandle(restartSignal);
+	CloseHandle(idleSignal);
 }
 
 void WASAPICapture::Start() {
-	RtwqPutWorkItem(startCaptureCallback.GetQueueId(), 0, startCaptureAsyncResult.Get());
+	ResetEvent(idleSignal);
+	if(FAILED(RtwqPutWorkItem(startCaptureCallback.GetQueueId(), 0, startCaptureAsyncResult.Get()))) SetEvent(idleSignal);
 }
 
 void WASAPICapture::Stop() {
 	SetEvent(stopSignal);
+	// wakes OnSampleReady waiting for the client
 	SetEvent(receiveSignal);
 
-	RtwqUnlockWorkQueue(sampleReadyCallback.GetQueueId());
+	// an idle wakeup only comes when it's due, cancelled it doesn't come at all. One that can't be cancelled is being
+	// invoked already and sees stopSignal.
+	const RTWQWORKITEM_KEY key = idleWakeupKey.exchange(0);
+	if(key != 0 && SUCCEEDED(RtwqCancelWorkItem(key))) SetEvent(idleSignal);
 }
 
-void WASAPICapture::Initialize() {
-	HRESULT result;
+CaptureFormat WASAPICapture::GetFormat() const {
+	// what Initialize asks the loopback client for
+	return format;
+}
 
-	ResetEvent(receiveSignal);
+CaptureFormat WASAPICapture::QueryEndpointFormat() {
+	// what we used to hardcode, only used if the endpoint can't be asked
+	const CaptureFormat fallback { 48000, 2, 32, SampleType::Float };
+
+	Microsoft::WRL::ComPtr<IMMDeviceEnumerator> enumerator { };
+	HRESULT result = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, IID_PPV_ARGS(&enumerator));
+	if(FAILED(result)) return fallback;
+
+	Microsoft::WRL::ComPtr<IMMDevice> device { };
+	result = enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device);
+	if(FAILED(result)) return fallback;
+
+	Microsoft::WRL::ComPtr<IAudioClient> client { };
+	result = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, &client);
+	if(FAILED(result)) return fallback;
+
+	WAVEFORMATEX* mixFormat { };
+	result = client->GetMixFormat(&mixFormat);
+	if(FAILED(result) || mixFormat == nullptr) return fallback;
+
+	bool isFloat = mixFormat->wFormatTag == WAVE_FORMAT_IEEE_FLOAT;
+	bool isPcm = mixFormat->wFormatTag == WAVE_FORMAT_PCM;
+	uint32_t channelMask = 0;
+	if(mixFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE && mixFormat->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) {
+		const WAVEFORMATEXTENSIBLE* extensible = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(mixFormat);
+		isFloat = extensible->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+		isPcm = extensible->SubFormat == KSDATAFORMAT_SUBTYPE_PCM;
+		channelMask = extensible->dwChannelMask;
+	}
+
+	// the endpoint's own layout, so the target's surround mix isn't folded down by the loopback client on the way
+	CaptureFormat format { static_cast<uint32_t>(mixFormat->nSamplesPerSec), mixFormat->nChannels, mixFormat->wBitsPerSample,
+		isFloat ? SampleType::Float : SampleType::Int, channelMask };
+	CoTaskMemFree(mixFormat);
 
-	const WORD channelCount = 2;
-	const DWORD samplesPerSecond = 48000; // godot internal
-	constexpr WORD bitsPerSample = 32; // float bits
+	if(!(isFloat || isPcm) || !EncodingOf(format)) {
+		format.bitsPerSample = 32;
+		format.sampleType = SampleType::Float;
+	}
+	if(format.channels == 0 || format.channels > MAX_MIX_CHANNELS) {
+		// more than there are speaker positions for, let the client mix down to stereo
+		format.channels = 2;
+		format.channelMask = 0;
+	}
+	return format;
+}
+
+void WASAPICapture::Activate(std::chrono::microseconds bufferDuration, std::chrono::milliseconds activationTimeout) {
+	HRESULT result;
+
+	// endpoint native, the pipeline converts, mixes down and resamples to what godot mixes
+	const WORD channelCount = format.channels;
+	const DWORD samplesPerSecond = format.sampleRate;
+	const WORD bitsPerSample = format.bitsPerSample;
 	const WORD blockAlign = channelCount * bitsPerSample / 8;
 
 	WAVEFORMATEXTENSIBLE waveFormatExtensible { };
@@ -122,13 +198,14 @@ void WASAPICapture::Initialize() {
 	waveFormatExtensible.Format.wBitsPerSample = bitsPerSample;
 	waveFormatExtensible.Format.cbSize = sizeof(waveFormatExtensible) - sizeof(waveFormatExtensible.Format);
 	waveFormatExtensible.Samples.wValidBitsPerSample = bitsPerSample;
-	waveFormatExtensible.dwChannelMask = KSAUDIO_SPEAKER_STEREO;
-	waveFormatExtensible.SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+	waveFormatExtensible.dwChannelMask = format.channelMask != 0 ? format.channelMask : DefaultChannelMask(channelCount);
+	waveFormatExtensible.SubFormat = format.sampleType == SampleType::Float ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
 
 	AUDIOCLIENT_ACTIVATION_PARAMS audioClientActivationParams { };
 	audioClientActivationParams.ActivationType = AUDIOCLIENT_ACTIVATION_TYPE_PROCESS_LOOPBACK;
 	audioClientActivationParams.ProcessLoopbackParams.TargetProcessId = processId;
-	audioClientActivationParams.ProcessLoopbackParams.ProcessLoopbackMode = PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE;
+	audioClientActivationParams.ProcessLoopbackParams.ProcessLoopbackMode = mode == LoopbackMode::IncludeProcessTree ?
+		PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE : PROCESS_LOOPBACK_MODE_EXCLUDE_TARGET_PROCESS_TREE;
 
 	PROPVARIANT activateParams { };
 	activateParams.vt = VT_BLOB;
@@ -141,13 +218,15 @@ void WASAPICapture::Initialize() {
 	if(FAILED(result)) throw std::runtime_error("failed to activate audio interface");
 
 	Microsoft::WRL::ComPtr<IAudioClient> tempAudioClient { };
-	result = completionHandler->GetActivateResult(&tempAudioClient);
+	result = completionHandler->GetActivateResult(activationTimeout, tempAudioClient);
+	if(result == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) throw std::runtime_error("audio interface activation timed out");
 	if(FAILED(result)) throw std::runtime_error("failed to get activation result");
 
+	// in 100 ns units, sized by whoever knows how late the consumers read
 	result = tempAudioClient->Initialize(
 		AUDCLNT_SHAREMODE_SHARED,
 		AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_LOOPBACK,
-		5 * 10000000,
+		static_cast<REFERENCE_TIME>(bufferDuration.count()) * 10,
 		0,
 		&waveFormatExtensible.Format,
 		nullptr
@@ -161,68 +240,77 @@ void WASAPICapture::Initialize() {
 	result = tempAudioClient->SetEventHandle(receiveSignal);
 	if(FAILED(result)) throw std::runtime_error("failed to set event handle");
 
-	result = tempAudioClient->Start();
-	if(FAILED(result)) throw std::runtime_error("failed to start audio client");
-
 	audioClient = std::move(tempAudioClient);
 	audioCaptureClient = std::move(tempAudioCaptureClient);
-
-	result = RtwqPutWaitingWorkItem(receiveSignal, 0, sampleReadyAsyncResult.Get(), nullptr);
-	if(FAILED(result)) {
-		audioClient.Reset();
-		audioCaptureClient.Reset();
-		throw std::runtime_error("failed to PutWaitingWorkItem sampleReady");
-	}
-
-	result = RtwqPutWaitingWorkItem(restartSignal, 0, restartAsyncResult.Get(), nullptr);
-	if(FAILED(result)) {
-		audioClient.Reset();
-		audioCaptureClient.Reset();
-		throw std::runtime_error("failed to PutWaitingWorkItem restart");
-	}
 }
 
-bool WASAPICapture::ProcessCaptureData() {
+HRESULT WASAPICapture::ProcessCaptureData(uint32_t& packetCount) {
 	HRESULT result;
 
 	while(true) {
 		UINT32 packetSize { };
 		result = audioCaptureClient->GetNextPacketSize(&packetSize);
-		if(FAILED(result)) return false;
+		if(FAILED(result)) return result;
 		if(packetSize == 0) break;
 
 		BYTE* frames { };
 		UINT32 frameCount { };
 		DWORD frameFlags { };
-		result = audioCaptureClient->GetBuffer(&frames, &frameCount, &frameFlags, nullptr, nullptr);
-		if(FAILED(result)) return false;
-
-		receiver->OnPacket(frames, frameCount);
+		UINT64 devicePosition { };
+		UINT64 qpcPosition { };
+		result = audioCaptureClient->GetBuffer(&frames, &frameCount, &frameFlags, &devicePosition, &qpcPosition);
+		if(FAILED(result)) return result;
+
+		CapturePacket packet { };
+		packet.frameCount = frameCount;
+		packet.position = devicePosition;
+		packet.timestamp = qpcPosition;
+		// the buffer of a silent packet isn't guaranteed to hold anything, never read it
+		packet.silent = (frameFlags & AUDCLNT_BUFFERFLAGS_SILENT) != 0;
+		packet.frames = packet.silent ? nullptr : frames;
+		packet.discontinuity = (frameFlags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) != 0;
+		packet.timed = (frameFlags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) == 0;
+		receiver->OnPacket(packet);
+		packetCount++;
 
 		result = audioCaptureClient->ReleaseBuffer(frameCount);
-		if(FAILED(result)) return false;
+		if(FAILED(result)) return result;
 	}
 
-	return true;
+	return S_OK;
 }
 
 void WASAPICapture::OnStartCapture() {
 	const DWORD waitStopSignal = WaitForSingleObject(stopSignal, 0);
 	if(waitStopSignal == WAIT_OBJECT_0) {
+		SetEvent(idleSignal);
 		return;
 	}
 
-	try {
-		Initialize();
-	} catch(const std::exception& ex) {
-		fprintf(stderr, "%s\n", ex.what());
+	// activated already, only what can't fail for reasons of the target's is left
+	ResetEvent(receiveSignal);
+	HRESULT result = audioClient->Start();
+	if(SUCCEEDED(result)) result = RtwqPutWaitingWorkItem(receiveSignal, 0, sampleReadyAsyncResult.Get(), nullptr);
+	if(FAILED(result)) {
+		audioClient->Stop();
+		receiver->OnCaptureError(static_cast<uint32_t>(result));
+		SetEvent(idleSignal);
 	}
 }
 
 void WASAPICapture::OnSampleReady() {
 	bool stop = false;
+	// if this was an idle wakeup it can't be cancelled any more
+	idleWakeupKey.store(0);
 
-	if(!ProcessCaptureData()) {
+	const auto start = std::chrono::steady_clock::now();
+	uint32_t packetCount = 0;
+	const HRESULT result = ProcessCaptureData(packetCount);
+	const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	receiver->OnWakeup(packetCount, static_cast<uint32_t>(elapsed.count()));
+
+	if(FAILED(result)) {
+		receiver->OnCaptureError(static_cast<uint32_t>(result));
 		stop = true;
 	}
 
@@ -231,14 +319,35 @@ void WASAPICapture::OnSampleReady() {
 	}
 
 	if(!stop) {
-		RtwqPutWaitingWorkItem(receiveSignal, 0, sampleReadyAsyncResult.Get(), nullptr);
-	} else {
+		HRESULT queued;
+		const std::chrono::milliseconds idle = receiver->IdleWakeupInterval();
+		if(idle.count() != 0) {
+			// nobody's in a hurry for silence, let it pile up in the client's buffer and take it all at once
+			RTWQWORKITEM_KEY key { };
+			queued = RtwqScheduleWorkItem(sampleReadyAsyncResult.Get(), -static_cast<INT64>(idle.count()), &key);
+			if(SUCCEEDED(queued)) {
+				idleWakeupKey.store(key);
+				// Stop() came between our check and the store, it had nothing to cancel
+				if(WaitForSingleObject(stopSignal, 0) == WAIT_OBJECT_0 && idleWakeupKey.exchange(0) == key &&
+					SUCCEEDED(RtwqCancelWorkItem(key))) {
+					stop = true;
+				}
+			}
+		} else {
+			queued = RtwqPutWaitingWorkItem(receiveSignal, 0, sampleReadyAsyncResult.Get(), nullptr);
+		}
+		// with nothing queued we'd never hear from the client again
+		if(FAILED(queued)) {
+			receiver->OnCaptureError(static_cast<uint32_t>(queued));
+			stop = true;
+		}
+	}
+
+	if(stop) {
 		audioClient->Stop();
 		audioCaptureClient.Reset();
 		audioClient.Reset();
+		// nothing of ours touches the capture after this
+		SetEvent(idleSignal);
 	}
 }
-
-void WASAPICapture::OnRestart() {
-
-}
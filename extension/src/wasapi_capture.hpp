@@ -4,26 +4,36 @@
 // windows.h before other headers
 #include <Windows.h>
 #include <atomic>
+#include <chrono>
 #include <Audioclient.h>
 #include <RTWorkQ.h>
 #include <wrl/implements.h>
 
-class WASAPICaptureReceiver {
-public:
-	virtual void OnPacket(BYTE* frames, UINT32 frameCount) = 0;
-};
+#include "capture_source.hpp"
 
-class WASAPICapture {
+class WASAPICapture : public CaptureSource {
 public:
-	WASAPICapture(WASAPICaptureReceiver* receiver, DWORD processId);
+	// Activates the loopback client right here, blocking, with a buffer of bufferDuration. Throws std::runtime_error if
+	// that fails or takes longer than activationTimeout. Start() then only starts the client, on the work queue.
+	WASAPICapture(CaptureReceiver* receiver, DWORD processId, LoopbackMode mode, std::chrono::microseconds bufferDuration,
+		std::chrono::milliseconds activationTimeout);
 	~WASAPICapture();
 
-	void Start();
-	void Stop();
+	void Start() override;
+	void Stop() override;
+
+	CaptureFormat GetFormat() const override;
 
 private:
-	void Initialize();
-	bool ProcessCaptureData();
+	// Rate, sample format and channel layout the default render endpoint mixes in, which is what the target process'
+	// audio is rendered in. Capturing in that means the OS doesn't resample, convert or downmix anything for us, the
+	// pipeline does that on its own. Stereo float32 at 48kHz where the endpoint can't be asked, float32 where it mixes
+	// in something we can't convert.
+	static CaptureFormat QueryEndpointFormat();
+
+	void Activate(std::chrono::microseconds bufferDuration, std::chrono::milliseconds activationTimeout);
+	// Delivers every pending packet, on failure returns the HRESULT that stopped it
+	HRESULT ProcessCaptureData(uint32_t& packetCount);
 
 	// helper class for Rtwq callbacks
 	template<class Class, typename void(Class::*Member)(void)>
@@ -79,17 +89,18 @@ private:
 	RtwqCallback<WASAPICapture, &OnSampleReady> sampleReadyCallback;
 	Microsoft::WRL::ComPtr<IRtwqAsyncResult> sampleReadyAsyncResult;
 
-	void OnRestart();
-	RtwqCallback<WASAPICapture, &OnRestart> restartCallback;
-	Microsoft::WRL::ComPtr<IRtwqAsyncResult> restartAsyncResult;
-
 private:
-	WASAPICaptureReceiver* receiver;
+	CaptureReceiver* receiver;
 	DWORD processId;
+	LoopbackMode mode;
+	CaptureFormat format;
 
 	HANDLE stopSignal;
 	HANDLE receiveSignal;
-	HANDLE restartSignal;
+	// Set while none of OnStartCapture or OnSampleReady is queued or running, the destructor waits for it
+	HANDLE idleSignal;
+	// The idle wakeup scheduled last, 0 when there's none to cancel. Stop() cancels it, nothing else wakes it early.
+	std::atomic<RTWQWORKITEM_KEY> idleWakeupKey;
 
 	Microsoft::WRL::ComPtr<IAudioClient> audioClient;
 	Microsoft::WRL::ComPtr<IAudioCaptureClient> audioCaptureClient;
@@ -0,0 +1,54 @@
+#include "win32_process_enumerator.hpp"
+
+#include <TlHelp32.h>
+
+std::string Win32ProcessEnumerator::ToUtf8(const wchar_t* text, int length) {
+	const int size = WideCharToMultiByte(CP_UTF8, 0, text, length, nullptr, 0, nullptr, nullptr);
+	if(size <= 0) return { };
+
+	std::string result(size, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, text, length, result.data(), size, nullptr, nullptr);
+	// with length -1 the terminator is counted too
+	if(length < 0 && !result.empty()) result.pop_back();
+	return result;
+}
+
+void Win32ProcessEnumerator::EnumerateProcesses(std::vector<ProcessInfo>& processes) {
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if(snapshot == INVALID_HANDLE_VALUE) return;
+
+	const DWORD self = GetCurrentProcessId();
+	PROCESSENTRY32W entry { };
+	entry.dwSize = sizeof(entry);
+
+	for(BOOL more = Process32FirstW(snapshot, &entry); more; more = Process32NextW(snapshot, &entry)) {
+		if(entry.th32ProcessID == self || entry.th32ProcessID == 0) continue;
+		processes.push_back(ProcessInfo { entry.th32ProcessID, entry.th32ParentProcessID, ToUtf8(entry.szExeFile) });
+	}
+
+	CloseHandle(snapshot);
+}
+
+BOOL CALLBACK Win32ProcessEnumerator::EnumerateWindow(HWND window, LPARAM context) {
+	auto& windows = *reinterpret_cast<std::vector<WindowInfo>*>(context);
+
+	// same filter the old lookup used: visible, top-level, not a tool window
+	if(!IsWindowVisible(window) ||
+		(GetWindowLongPtr(window, GWL_STYLE) & WS_CHILD) ||
+		(GetWindowLongPtr(window, GWL_EXSTYLE) & WS_EX_TOOLWINDOW)) {
+		return TRUE;
+	}
+
+	DWORD processId { };
+	GetWindowThreadProcessId(window, &processId);
+	if(processId == GetCurrentProcessId()) return TRUE;
+
+	wchar_t title[256];
+	const int length = GetWindowTextW(window, title, static_cast<int>(sizeof(title) / sizeof(title[0])));
+	windows.push_back(WindowInfo { processId, length > 0 ? ToUtf8(title, length) : std::string { } });
+	return TRUE;
+}
+
+void Win32ProcessEnumerator::EnumerateWindows(std::vector<WindowInfo>& windows) {
+	EnumWindows(&Win32ProcessEnumerator::EnumerateWindow, reinterpret_cast<LPARAM>(&windows));
+}
@@ -0,0 +1,21 @@
+#ifndef WIN32_PROCESS_ENUMERATOR_HPP
+#define WIN32_PROCESS_ENUMERATOR_HPP
+
+// windows.h before other headers
+#include <Windows.h>
+
+#include "process_registry.hpp"
+
+// Reads the process table with one Toolhelp snapshot (exe names come with it, no OpenProcess per process) and the
+// visible top-level windows with EnumWindows. Our own process is left out of both.
+class Win32ProcessEnumerator : public ProcessEnumerator {
+public:
+	void EnumerateProcesses(std::vector<ProcessInfo>& processes) override;
+	void EnumerateWindows(std::vector<WindowInfo>& windows) override;
+
+private:
+	static std::string ToUtf8(const wchar_t* text, int length = -1);
+	static BOOL CALLBACK EnumerateWindow(HWND window, LPARAM context);
+};
+
+#endif // WIN32_PROCESS_ENUMERATOR_HPP
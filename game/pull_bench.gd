@@ -0,0 +1,68 @@
+extends SceneTree
+
+# Pulling captured audio from GDScript: one read_buffer() call per chunk vs one get_buffer(1) call per frame, both
+# summing the samples so the per-frame work is the same. Needs the target to be running and playing something.
+# godot --headless --path game -s pull_bench.gd -- [target exe] [chunk frames] [rounds]
+
+var stream := AudioStreamWasapiAppCapture.new()
+var chunk := 4096
+var rounds := 20
+var bulk_usec := 0
+var single_usec := 0
+var done := 0
+
+
+func _initialize():
+	var args := OS.get_cmdline_user_args()
+	if args.size() > 0:
+		stream.target_app_name = args[0]
+	if args.size() > 1:
+		chunk = int(args[1])
+	if args.size() > 2:
+		rounds = int(args[2])
+
+	if stream.start_pull() != OK:
+		print("couldn't start capturing ", stream.target_app_name)
+		quit(1)
+
+
+func _process(_delta):
+	if not stream.is_pulling() or stream.get_frames_available() < chunk:
+		return false
+
+	# alternate, so both see the same conditions
+	if done % 2 == 0:
+		bulk_usec += bulk_round()
+	else:
+		single_usec += single_round()
+	done += 1
+
+	if done < rounds * 2:
+		return false
+
+	var bulk := float(bulk_usec) / (rounds * chunk) * 1000.0
+	var single := float(single_usec) / (rounds * chunk) * 1000.0
+	print("%d frames per round, %d rounds each" % [chunk, rounds])
+	print("  read_buffer(%d)   %8.1f ns/frame" % [chunk, bulk])
+	print("  get_buffer(1)      %8.1f ns/frame  (%.1fx)" % [single, single / bulk])
+	print("  discarded %d frames" % stream.get_discarded_frames())
+	stream.stop_pull()
+	return true
+
+
+func bulk_round() -> int:
+	var start := Time.get_ticks_usec()
+	var frames := stream.read_buffer(chunk)
+	var sum := 0.0
+	for frame in frames:
+		sum += frame.x + frame.y
+	return Time.get_ticks_usec() - start
+
+
+func single_round() -> int:
+	var start := Time.get_ticks_usec()
+	var sum := 0.0
+	for i in chunk:
+		var frame: Vector2 = stream.get_buffer(1)[0]
+		sum += frame.x + frame.y
+	return Time.get_ticks_usec() - start
@@ -0,0 +1,72 @@
+// capture_helper.exe, the process HelperCapture runs WASAPI in. Captures one process loopback into the shared memory
+// the extension laid out for it until the extension says quit or goes away.
+// capture_helper <shared memory> <process id> <loopback mode> <client buffer usec> <parent process id>
+
+// windows.h before other headers
+#include <Windows.h>
+#include <RTWorkQ.h>
+
+#include "shared_capture_ring.hpp"
+#include "shared_memory.hpp"
+#include "wasapi_capture.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+
+// How often the helper looks whether the game is still there, in case the job object couldn't be set up
+static const std::chrono::milliseconds PARENT_POLL_INTERVAL { 500 };
+// The extension gives up on us after its own timeout anyway, this just keeps a hung activation from outliving that
+static const std::chrono::milliseconds ACTIVATION_TIMEOUT { 5000 };
+
+int wmain(int argc, wchar_t** argv) {
+	if(argc != 6) {
+		fprintf(stderr, "usage: capture_helper <shared memory> <process id> <loopback mode> <client buffer usec> <parent process id>\n");
+		return 2;
+	}
+
+	const std::wstring wideName = argv[1];
+	const std::string name(wideName.begin(), wideName.end());
+	const DWORD processId = static_cast<DWORD>(std::wcstoul(argv[2], nullptr, 10));
+	const LoopbackMode mode = static_cast<LoopbackMode>(std::wcstoul(argv[3], nullptr, 10));
+	const std::chrono::microseconds clientBuffer { static_cast<int64_t>(std::wcstoull(argv[4], nullptr, 10)) };
+	HANDLE parent = OpenProcess(SYNCHRONIZE, false, static_cast<DWORD>(std::wcstoul(argv[5], nullptr, 10)));
+
+	CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	RtwqStartup();
+
+	int status = 0;
+	try {
+		SharedMemory memory = SharedMemory::Open(name);
+		SharedRingWriter writer { memory };
+
+		std::unique_ptr<WASAPICapture> capture;
+		try {
+			capture = std::make_unique<WASAPICapture>(&writer, processId, mode, clientBuffer, ACTIVATION_TIMEOUT);
+		} catch(const std::exception&) {
+			writer.Fail(static_cast<uint32_t>(E_FAIL));
+			throw;
+		}
+		writer.Publish(capture->GetFormat());
+
+		SharedCaptureRing::Command command = SharedCaptureRing::Idle;
+		while(command != SharedCaptureRing::Quit) {
+			const SharedCaptureRing::Command next = writer.WaitForCommand(command, PARENT_POLL_INTERVAL);
+			if(next == SharedCaptureRing::Start && command != SharedCaptureRing::Start) capture->Start();
+			command = next;
+			if(parent != nullptr && WaitForSingleObject(parent, 0) != WAIT_TIMEOUT) break;
+		}
+		capture->Stop();
+	} catch(const std::exception& error) {
+		fprintf(stderr, "capture_helper: %s\n", error.what());
+		status = 1;
+	}
+
+	RtwqShutdown();
+	CoUninitialize();
+	if(parent != nullptr) CloseHandle(parent);
+	return status;
+}